@@ -24,6 +24,7 @@
 #include "external/x25519.h"
 
 #include <sys/mman.h>
+#include <sys/uio.h>
 #include <sys/types.h>
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -140,6 +141,8 @@ static void send_hello_packet(struct a12_state* S,
 	outb[18] = ASHMIF_VERSION_MAJOR;
 	outb[19] = ASHMIF_VERSION_MINOR;
 	outb[20] = mode;
+	pack_u32(FEATURES_LOCAL |
+		(S->opts->blob_cache ? FEATURE_BLOB_CACHE : 0), &outb[53]);
 
 /* send it back to client */
 	a12int_append_out(S,
@@ -147,43 +150,31 @@ static void send_hello_packet(struct a12_state* S,
 }
 
 /*
- * Used when a full byte buffer for a packet has been prepared, important
- * since it will also encrypt, generate MAC and add to buffer prestate.
- *
- * This is where more advanced and fair queueing should be made in order
- * to not have the bandwidth hungry channels (i.e. video) consume everything.
- * The rough idea is to have bins for a/v/b streams, with a priority on a/v
- * unless it is getting too 'old'. There are some complications:
- *
- * 1. stream cancellation, can only be done on non-delta/non-compressed
- *    so mostly usable for binary then
- * 2. control packets that are tied to an a/v/b frame
+ * Take a built packet and sequence, encrypt and MAC it into the current
+ * output buffer. This must happen in the order the packets are put on the
+ * wire as the MAC is continous and the cipher is a stream.
  *
  * Another issue is that the raw vframes are big and ugly, and here is the
- * place where we perform an unavoidable copy unless we want interleaving (and
- * then it becomes expensive to perform). Practically speaking it is not that
- * bad to encrypt accordingly, it is a stream cipher afterall, BUT having a
- * continous MAC screws with that. Now since we have a few bytes entropy and a
- * counter as part of the message, replay attacks won't work BUT any
- * reordering would then still need to account for rekeying.
+ * place where we perform an unavoidable copy. The cipher is applied as part
+ * of that copy, BUT having a continous MAC screws with reordering. Now since
+ * we have a few bytes entropy and a counter as part of the message, replay
+ * attacks won't work BUT any reordering would then still need to account for
+ * rekeying.
+ *
+ * If [detach] is set, [out] is encrypted in place and left out of the output
+ * buffer, the caller is then responsible for having it follow the header
+ * that was written (see a12_flush_iov).
  */
-void a12int_append_out(struct a12_state* S, uint8_t type,
-	uint8_t* out, size_t out_sz, uint8_t* prepend, size_t prepend_sz)
+static void serialize_packet_ext(struct a12_state* S, uint8_t type,
+	uint8_t* out, size_t out_sz, uint8_t* prepend, size_t prepend_sz, bool detach)
 {
-	if (S->state == STATE_BROKEN)
-		return;
-
-/*
- * QUEUE-slot here,
- * should also have the ability to probe the size of the queue slots
- * so that encoders can react on backpressure
- */
 	a12int_trace(A12_TRACE_CRYPTO,
-		"type=%d:size=%zu:prepend_size=%zu:ofs=%zu", type, out_sz, prepend_sz, S->buf_ofs);
+		"type=%d:size=%zu:prepend_size=%zu:ofs=%zu:detach=%d",
+		type, out_sz, prepend_sz, S->buf_ofs, (int) detach);
 
 /* grow write buffer if the block doesn't fit */
 	size_t required = S->buf_ofs +
-		header_sizes[STATE_NOPACKET] + out_sz + prepend_sz + 1;
+		header_sizes[STATE_NOPACKET] + (detach ? 0 : out_sz) + prepend_sz + 1;
 
 	S->bufs[S->buf_ind] = grow_array(
 		S->bufs[S->buf_ind],
@@ -206,58 +197,65 @@ void a12int_append_out(struct a12_state* S, uint8_t type,
 	S->buf_ofs += MAC_BLOCK_SZ;
 	size_t data_pos = S->buf_ofs;
 
-/* MISSING OPTIMIZATION, extract n bytes of the cipherstream and apply copy
- * operation rather than in-place modification, align with MAC block size and
- * continuously update as we fetch as well */
-
-/* 8 byte sequence number */
-	pack_u64(S->current_seqnr++, &dst[S->buf_ofs]);
-	S->buf_ofs += 8;
-
-/* 1 byte command data */
-	dst[S->buf_ofs++] = type;
-
-/* any possible prepend-to-data block */
-	if (prepend_sz){
-		memcpy(&dst[S->buf_ofs], prepend, prepend_sz);
-		S->buf_ofs += prepend_sz;
-	}
-
-/* and our data block */
-	memcpy(&dst[S->buf_ofs], out, out_sz);
-	S->buf_ofs += out_sz;
-
-	size_t used = S->buf_ofs - data_pos;
-
 /* if we are the client and haven't sent the first authentication request
- * yet, setup the nonce part of the cipher to random and shorten the MAC */
+ * yet, setup the nonce part of the cipher to random and shorten the MAC,
+ * this needs to be done before anything is encrypted */
 	size_t mac_sz = MAC_BLOCK_SZ;
 	if (!S->authentic && !S->server){
 		mac_sz >>= 1;
-		arcan_random(&dst[mac_sz], mac_sz);
+		arcan_random(&dst[mac_pos + mac_sz], mac_sz);
 
 /* depending on flag, we need POLITE, REAL HELLO or full */
 		S->authentic = AUTH_FULL_PK;
 		if (S->dec_state){
-			chacha_set_nonce(S->dec_state, &dst[mac_sz]);
-			chacha_set_nonce(S->enc_state, &dst[mac_sz]);
+			chacha_set_nonce(S->dec_state, &dst[mac_pos + mac_sz]);
+			chacha_set_nonce(S->enc_state, &dst[mac_pos + mac_sz]);
 			a12int_trace(A12_TRACE_CRYPTO, "kind=cipher:status=init_nonce");
 			if (S->opts->pk_lookup){
 				S->authentic = AUTH_REAL_HELLO_SENT;
 			}
 		}
 
-		trace_crypto_key(S->server, "nonce", &dst[mac_sz], mac_sz);
+		trace_crypto_key(S->server, "nonce", &dst[mac_pos + mac_sz], mac_sz);
 /* don't forget to add the nonce to the first message MAC */
-		blake3_hasher_update(&S->out_mac, &dst[mac_sz], mac_sz);
+		blake3_hasher_update(&S->out_mac, &dst[mac_pos + mac_sz], mac_sz);
 	}
 
-/* apply stream-cipher to buffer contents */
+/* 8 byte sequence number */
+	pack_u64(S->current_seqnr++, &dst[S->buf_ofs]);
+	S->buf_ofs += 8;
+
+/* 1 byte command data */
+	dst[S->buf_ofs++] = type;
+
 	if (S->enc_state)
-		chacha_apply(S->enc_state, &dst[data_pos], used);
+		chacha_apply(S->enc_state, &dst[data_pos], S->buf_ofs - data_pos);
+
+/* any possible prepend-to-data block, then our data block */
+	if (prepend_sz){
+		if (S->enc_state)
+			chacha_apply_copy(S->enc_state, prepend, &dst[S->buf_ofs], prepend_sz);
+		else
+			memcpy(&dst[S->buf_ofs], prepend, prepend_sz);
+		S->buf_ofs += prepend_sz;
+	}
 
-/* update MAC */
-	blake3_hasher_update(&S->out_mac, &dst[data_pos], used);
+/* MAC over the part in the buffer first as the detached block follows it */
+	blake3_hasher_update(&S->out_mac, &dst[data_pos], S->buf_ofs - data_pos);
+
+	if (detach){
+		if (S->enc_state)
+			chacha_apply(S->enc_state, out, out_sz);
+		blake3_hasher_update(&S->out_mac, out, out_sz);
+	}
+	else {
+		if (S->enc_state)
+			chacha_apply_copy(S->enc_state, out, &dst[S->buf_ofs], out_sz);
+		else
+			memcpy(&dst[S->buf_ofs], out, out_sz);
+		blake3_hasher_update(&S->out_mac, &dst[S->buf_ofs], out_sz);
+		S->buf_ofs += out_sz;
+	}
 
 /* sample MAC and write to buffer pos, remember it for debugging - no need to
  * chain separately as 'finalize' is not really finalized */
@@ -276,6 +274,543 @@ void a12int_append_out(struct a12_state* S, uint8_t type,
 	}
 }
 
+static void serialize_packet(struct a12_state* S, uint8_t type,
+	uint8_t* out, size_t out_sz, uint8_t* prepend, size_t prepend_sz)
+{
+	serialize_packet_ext(S, type, out, out_sz, prepend, prepend_sz, false);
+}
+
+/*
+ * Sort a packet into the queue it belongs to based on its type, the channel
+ * is extracted from the header so that the packets created in the a/v/b
+ * encoders and the ones from the blob- flush stage are treated the same.
+ * Control commands that define a stream go with the stream so that the
+ * header will always precede the data. CANCELSTREAM stays with control, it is
+ * only sent for streams coming from the other side and any blocks of ours that
+ * it concerns are purged from the queue when it arrives (queue_purge_stream).
+ */
+static int packet_queue(uint8_t type, uint8_t* out,
+	uint8_t* prepend, size_t prepend_sz, uint8_t* chid)
+{
+	uint8_t* hdr = prepend_sz ? prepend : out;
+
+	switch (type){
+	case STATE_CONTROL_PACKET:
+		*chid = out[16];
+		switch (out[17]){
+		case COMMAND_VIDEOFRAME:
+			return A12_QUEUE_VIDEO;
+		case COMMAND_AUDIOFRAME:
+			return A12_QUEUE_AUDIO;
+		case COMMAND_BINARYSTREAM:
+			return A12_QUEUE_BLOB;
+		default:
+			return A12_QUEUE_CONTROL;
+		}
+	case STATE_EVENT_PACKET:
+		*chid = out[SEQUENCE_NUMBER_SIZE];
+		return A12_QUEUE_CONTROL;
+	case STATE_AUDIO_PACKET:
+		*chid = hdr[0];
+		return A12_QUEUE_AUDIO;
+	case STATE_VIDEO_PACKET:
+		*chid = hdr[0];
+		return A12_QUEUE_VIDEO;
+	case STATE_BLOB_PACKET:
+		*chid = hdr[0];
+		return A12_QUEUE_BLOB;
+	default:
+		*chid = 0;
+		return A12_QUEUE_CONTROL;
+	}
+}
+
+static struct out_queue* channel_queue(
+	struct a12_state* S, int kind, uint8_t chid)
+{
+	if (kind == A12_QUEUE_CONTROL)
+		return &S->ctrlq;
+
+	return &S->channels[chid].outq[kind];
+}
+
+static struct out_packet* queue_pop(struct a12_state* S, int kind, uint8_t chid)
+{
+	struct out_queue* q = channel_queue(S, kind, chid);
+	struct out_packet* pkt = q->first;
+	if (!pkt)
+		return NULL;
+
+	q->first = pkt->next;
+	if (!q->first)
+		q->last = NULL;
+
+	q->bytes -= pkt->size;
+	S->queued[kind] -= pkt->size;
+
+/* control is one shared FIFO, the per-channel slot is only for accounting */
+	if (kind == A12_QUEUE_CONTROL)
+		S->channels[pkt->chid].outq[kind].bytes -= pkt->size;
+
+	if (kind == A12_QUEUE_VIDEO &&
+		pkt->type == STATE_CONTROL_PACKET && S->channels[pkt->chid].queued_vframes)
+		S->channels[pkt->chid].queued_vframes--;
+
+	return pkt;
+}
+
+static size_t queue_pending(struct a12_state* S)
+{
+	size_t sum = 0;
+	for (size_t i = 0; i < A12_QUEUE_ALL; i++)
+		sum += S->queued[i];
+	return sum;
+}
+
+/*
+ * Packets are recycled rather than freed as the same handful of sizes come
+ * back for every frame. The pool is first-fit with a cap on the number of
+ * entries, anything beyond that goes back to the allocator.
+ */
+static struct out_packet* packet_alloc(struct a12_state* S, size_t size)
+{
+	struct out_packet** cur = &S->pool;
+	while (*cur){
+		struct out_packet* pkt = *cur;
+		if (pkt->cap >= size){
+			*cur = pkt->next;
+			S->pool_count--;
+			return pkt;
+		}
+		cur = &pkt->next;
+	}
+
+	struct out_packet* pkt = DYNAMIC_MALLOC(sizeof(struct out_packet) + size);
+	if (pkt)
+		pkt->cap = size;
+	return pkt;
+}
+
+static void packet_release(struct a12_state* S, struct out_packet* pkt)
+{
+	if (S->pool_count >= OUTQUEUE_POOL){
+		DYNAMIC_FREE(pkt);
+		return;
+	}
+
+	pkt->next = S->pool;
+	S->pool = pkt;
+	S->pool_count++;
+}
+
+static void pool_drop(struct a12_state* S)
+{
+	while (S->pool){
+		struct out_packet* pkt = S->pool;
+		S->pool = pkt->next;
+		DYNAMIC_FREE(pkt);
+	}
+	S->pool_count = 0;
+}
+
+static void release_sent(struct a12_state* S)
+{
+	while (S->sent){
+		struct out_packet* pkt = S->sent;
+		S->sent = pkt->next;
+		packet_release(S, pkt);
+	}
+}
+
+/*
+ * Serialize a packet popped from a queue. When flushing through a12_flush_iov
+ * the bigger payloads are encrypted where they are and referenced rather than
+ * copied, as long as there are slots left for the header, the payload and a
+ * trailing buffer slice.
+ */
+static void emit_packet(struct a12_state* S, struct out_packet* pkt)
+{
+	if (pkt->size < OUTQUEUE_DETACH || S->n_segs + 3 > S->segs_lim){
+		serialize_packet(S, pkt->type, pkt->data, pkt->size, NULL, 0);
+		packet_release(S, pkt);
+		return;
+	}
+
+	serialize_packet_ext(S, pkt->type, pkt->data, pkt->size, NULL, 0, true);
+
+	S->segs[S->n_segs++] = (struct out_segment){
+		.ofs = S->seg_ofs,
+		.len = S->buf_ofs - S->seg_ofs
+	};
+	S->segs[S->n_segs++] = (struct out_segment){
+		.data = pkt->data,
+		.len = pkt->size
+	};
+	S->seg_ofs = S->buf_ofs;
+	S->detached += pkt->size;
+
+	pkt->next = S->sent;
+	S->sent = pkt;
+}
+
+/*
+ * Remove the blocks of a binary stream that are still waiting in the queue of
+ * a channel. This is used when the other side has cancelled the stream so
+ * there is no point in sending the rest, and it keeps the cancel from being
+ * followed by data for a stream that no longer exists.
+ */
+static void queue_purge_stream(
+	struct a12_state* S, uint8_t chid, uint32_t streamid)
+{
+	struct out_queue* q = &S->channels[chid].outq[A12_QUEUE_BLOB];
+	struct out_packet** cur = &q->first;
+	struct out_packet* last = NULL;
+
+	while (*cur){
+		struct out_packet* pkt = *cur;
+		uint32_t id;
+
+		if (pkt->type == STATE_BLOB_PACKET)
+			unpack_u32(&id, &pkt->data[1]);
+		else
+			unpack_u32(&id, &pkt->data[18]);
+
+		if (id != streamid){
+			last = pkt;
+			cur = &pkt->next;
+			continue;
+		}
+
+		*cur = pkt->next;
+		q->bytes -= pkt->size;
+		S->queued[A12_QUEUE_BLOB] -= pkt->size;
+		packet_release(S, pkt);
+	}
+
+	q->last = last;
+}
+
+static void queue_drop(struct a12_state* S)
+{
+	for (size_t kind = 0; kind < A12_QUEUE_ALL; kind++){
+		for (size_t i = 0; i < 256; i++){
+			struct out_packet* pkt;
+			while ((pkt = queue_pop(S, kind, i)))
+				packet_release(S, pkt);
+			if (kind == A12_QUEUE_CONTROL)
+				break;
+		}
+	}
+}
+
+/*
+ * Used when a full byte buffer for a packet has been prepared. Before the
+ * authentication stage has completed or when the caller has set a sink, the
+ * packet is serialized immediately - the handshake relies on strict order and
+ * nonce setup as part of the very first packet.
+ *
+ * Otherwise the packet goes into a queue bin that the flush stage will pick
+ * from, bandwidth hungry channels (video, blobs) are limited per flush so that
+ * control, events and audio are not stuck behind a big frame. There are some
+ * complications:
+ *
+ * 1. stream cancellation, can only be done on non-delta/non-compressed
+ *    so mostly usable for binary then, see queue_purge_stream
+ * 2. control packets that are tied to an a/v/b frame (see packet_queue)
+ */
+void a12int_append_out(struct a12_state* S, uint8_t type,
+	uint8_t* out, size_t out_sz, uint8_t* prepend, size_t prepend_sz)
+{
+	if (S->state == STATE_BROKEN)
+		return;
+
+	if (S->opts->sink || S->authentic < AUTH_FULL_PK){
+		serialize_packet(S, type, out, out_sz, prepend, prepend_sz);
+		return;
+	}
+
+	struct out_packet* pkt = packet_alloc(S, out_sz + prepend_sz);
+	if (!pkt){
+		a12int_trace(A12_TRACE_SYSTEM,
+			"kind=error:status=ENOMEM:message=couldn't queue packet");
+		fail_state(S);
+		return;
+	}
+
+	pkt->next = NULL;
+	pkt->type = type;
+	pkt->size = out_sz + prepend_sz;
+
+	if (prepend_sz)
+		memcpy(pkt->data, prepend, prepend_sz);
+	memcpy(&pkt->data[prepend_sz], out, out_sz);
+
+	int kind = packet_queue(type, out, prepend, prepend_sz, &pkt->chid);
+	struct out_queue* q = channel_queue(S, kind, pkt->chid);
+
+	if (q->last)
+		q->last->next = pkt;
+	else
+		q->first = pkt;
+	q->last = pkt;
+	q->bytes += pkt->size;
+
+	S->queued[kind] += pkt->size;
+	if (kind == A12_QUEUE_CONTROL)
+		S->channels[pkt->chid].outq[kind].bytes += pkt->size;
+
+	if (kind == A12_QUEUE_VIDEO && type == STATE_CONTROL_PACKET)
+		S->channels[pkt->chid].queued_vframes++;
+
+	a12int_trace(A12_TRACE_TRANSFER,
+		"kind=queue:type=%d:queue=%d:ch=%"PRIu8":size=%zu:queued=%zu",
+		(int) type, kind, pkt->chid, pkt->size, S->queued[kind]);
+}
+
+/*
+ * Move packets from the queue bins into the output buffer. Control and event
+ * packets are always forwarded in full and in order, followed by audio.
+ * Video and binary transfers are round-robin between channels one packet at
+ * a time until the burst budget has been consumed.
+ */
+static void drain_queues(struct a12_state* S)
+{
+	struct out_packet* pkt;
+
+	while ((pkt = queue_pop(S, A12_QUEUE_CONTROL, 0))){
+		emit_packet(S, pkt);
+	}
+
+	for (size_t i = 0; i < 256 && S->queued[A12_QUEUE_AUDIO]; i++){
+		while ((pkt = queue_pop(S, A12_QUEUE_AUDIO, i))){
+			emit_packet(S, pkt);
+		}
+	}
+
+	size_t budget = OUTQUEUE_BURST;
+	int kinds[] = {A12_QUEUE_VIDEO, A12_QUEUE_BLOB};
+
+	for (size_t k = 0; k < COUNT_OF(kinds); k++){
+		int kind = kinds[k];
+
+		while (S->queued[kind] && budget && S->state != STATE_BROKEN){
+			uint8_t ch = S->queue_rr[kind];
+			while (!S->channels[ch].outq[kind].first)
+				ch++;
+
+			pkt = queue_pop(S, kind, ch);
+			budget = pkt->size > budget ? 0 : budget - pkt->size;
+			S->queue_rr[kind] = ch + 1;
+			emit_packet(S, pkt);
+		}
+	}
+}
+
+struct a12_queue_depth
+a12_queue_depth(struct a12_state* S, int chid)
+{
+	struct a12_queue_depth res = {0};
+	if (!S || S->cookie != 0xfeedface)
+		return res;
+
+	for (size_t i = 0; i < 256; i++){
+		if (chid != -1 && chid != i)
+			continue;
+
+		for (size_t kind = 0; kind < A12_QUEUE_ALL; kind++){
+			res.bytes[kind] += S->channels[i].outq[kind].bytes;
+			res.total += S->channels[i].outq[kind].bytes;
+		}
+		res.vframes += S->channels[i].queued_vframes;
+	}
+
+	unsigned long long now = arcan_timemillis();
+	for (struct blob_out* node = S->pending; node; node = node->next){
+		if ((chid != -1 && chid != node->chid) || node->hold_until <= now)
+			continue;
+
+		unsigned left = node->hold_until - now;
+		if (!res.blob_hold || left < res.blob_hold)
+			res.blob_hold = left;
+	}
+
+	return res;
+}
+
+struct a12_link_estimate
+a12_link_estimate(struct a12_state* S)
+{
+	struct a12_link_estimate res = {0};
+	if (!S || S->cookie != 0xfeedface)
+		return res;
+
+	res.rtt_ms = S->link.rtt;
+	res.mbit = S->link.mbit;
+	res.inflight = S->link.bytes_out - S->link.acked_bytes;
+	res.rtt_samples = S->link.rtt_samples;
+	res.rate_samples = S->link.rate_samples;
+
+	return res;
+}
+
+static size_t tile_cache_footprint(struct tile_cache* tc)
+{
+	if (!tc)
+		return 0;
+
+	size_t sum = sizeof(struct tile_cache) + tc->cols * tc->rows * sizeof(uint64_t);
+	for (size_t i = 0; i < TILE_CACHE_SLOTS; i++){
+		if (tc->slot_px[i])
+			sum += TILE_SIZE * TILE_SIZE * 3;
+	}
+
+	return sum;
+}
+
+/* the DEFLATE states are opaque, the compressor dominates with its hash
+ * chains and the inflater keeps a window worth of history */
+static size_t tpack_stream_footprint(struct tpack_stream* ts, bool encoder)
+{
+	if (!ts)
+		return 0;
+
+	return sizeof(struct tpack_stream) + ts->lines_cap + ts->buf_sz +
+		(encoder ? sizeof(tdefl_compressor) :
+		sizeof(tinfl_decompressor) + TINFL_LZ_DICT_SIZE);
+}
+
+size_t a12_footprint(struct a12_state* S)
+{
+	if (!S || S->cookie != 0xfeedface)
+		return 0;
+
+	size_t sum = sizeof(struct a12_state) + S->buf_sz[0] + S->buf_sz[1];
+	if (S->enc_state)
+		sum += sizeof(struct chacha_ctx);
+	if (S->dec_state)
+		sum += sizeof(struct chacha_ctx);
+
+	sum += S->active_blobs * sizeof(struct blob_out);
+
+/* the per-channel queue counters include the control packets from the
+ * shared FIFO, see a12_queue_depth */
+	for (size_t i = 0; i < 256; i++){
+		struct a12_channel* ch = &S->channels[i];
+		for (size_t kind = 0; kind < A12_QUEUE_ALL; kind++)
+			sum += ch->outq[kind].bytes;
+
+/* the accumulation and compression buffers are both packed RGB of the
+ * last frame size, the decode buffers track their own size */
+		if (ch->acc.buffer)
+			sum += ch->acc.w * ch->acc.h * 3;
+		if (ch->compression)
+			sum += ch->acc.w * ch->acc.h * 3;
+		if (ch->unpack_state.vframe.inbuf)
+			sum += ch->unpack_state.vframe.inbuf_sz;
+		if (ch->unpack_state.aframe.inbuf)
+			sum += ch->unpack_state.aframe.inbuf_cap;
+
+		sum += tile_cache_footprint(ch->tiles_out);
+		sum += tile_cache_footprint(ch->tiles_in);
+		sum += tpack_stream_footprint(ch->tpack_out, true);
+		sum += tpack_stream_footprint(ch->tpack_in, false);
+		sum += a12int_jitter_footprint(ch->jitter);
+	}
+
+	return sum;
+}
+
+/*
+ * Remember what went out in a flushed buffer so that the delivery rate can be
+ * sampled when the other side acknowledges the last sequence number in it.
+ */
+static void link_flush(struct a12_state* S, size_t sz, bool app_limited)
+{
+	struct link_state* L = &S->link;
+	unsigned long long now = arcan_timemillis();
+
+/* idle link, don't let the time spent with nothing to send count as transfer */
+	if (L->bytes_out == L->acked_bytes)
+		L->acked_ts = now;
+
+/* the acks are cumulative so losing the oldest record only costs precision */
+	if (L->hist_count == LINK_HISTORY){
+		L->hist_tail = (L->hist_tail + 1) % LINK_HISTORY;
+		L->hist_count--;
+	}
+
+	L->bytes_out += sz;
+	L->hist[(L->hist_tail + L->hist_count) % LINK_HISTORY] = (struct link_record){
+		.seqnr = S->current_seqnr - 1,
+		.bytes = L->bytes_out,
+		.ts = now,
+		.acked_bytes = L->acked_bytes,
+		.acked_ts = L->acked_ts,
+		.app_limited = app_limited
+	};
+	L->hist_count++;
+}
+
+/*
+ * The other side has seen everything up to and including [seqnr], retire the
+ * records covered and sample the delivery rate over the newest of them.
+ */
+static void link_ack(struct a12_state* S, uint64_t seqnr)
+{
+	struct link_state* L = &S->link;
+	if (seqnr <= L->acked_seqnr)
+		return;
+
+	L->acked_seqnr = seqnr;
+
+	bool found = false;
+	struct link_record rec;
+	while (L->hist_count && L->hist[L->hist_tail].seqnr <= seqnr){
+		rec = L->hist[L->hist_tail];
+		L->hist_tail = (L->hist_tail + 1) % LINK_HISTORY;
+		L->hist_count--;
+		found = true;
+	}
+
+	if (!found)
+		return;
+
+	unsigned long long now = arcan_timemillis();
+	L->acked_bytes = rec.bytes;
+	L->acked_ts = now;
+
+/* too short interval to say anything useful given the clock resolution */
+	unsigned long long elapsed = now - rec.acked_ts;
+	if (elapsed < LINK_MIN_SAMPLE_MS)
+		return;
+
+	float mbit = (float)(rec.bytes - rec.acked_bytes) * 8.0 / (elapsed * 1000.0);
+
+/* if we didn't have anything more to send, the sample shows how much we
+ * needed rather than how much the link can take, so it can only raise */
+	if (rec.app_limited && mbit < L->mbit)
+		return;
+
+	L->mbit = L->rate_samples ? 0.75 * L->mbit + 0.25 * mbit : mbit;
+	L->rate_samples++;
+
+	a12int_trace(A12_TRACE_TRANSFER,
+		"kind=link:seqnr=%"PRIu64":sample=%.2f:mbit=%.2f:inflight=%"PRIu64,
+		seqnr, mbit, L->mbit, L->bytes_out - L->acked_bytes);
+}
+
+static void send_ping(struct a12_state* S, bool reply, uint64_t ts)
+{
+	uint8_t outb[CONTROL_PACKET_SIZE] = {0};
+	step_sequence(S, outb);
+
+	outb[17] = COMMAND_PING;
+	pack_u64(ts, &outb[18]);
+	outb[26] = reply;
+
+	a12int_append_out(S, STATE_CONTROL_PACKET, outb, CONTROL_PACKET_SIZE, NULL, 0);
+}
+
 static void reset_state(struct a12_state* S)
 {
 /* the 'reset' from an erroneous state is basically disconnect, just right
@@ -553,6 +1088,34 @@ a12_free(struct a12_state* S)
 	}
 
 	a12int_trace(A12_TRACE_ALLOC, "a12-state machine freed");
+	queue_drop(S);
+	release_sent(S);
+	pool_drop(S);
+
+/* these used to be left for process exit to take care of, but a process that
+ * hosts many sessions over its lifetime can't afford that */
+	while (S->pending){
+		struct blob_out* next = S->pending->next;
+		close(S->pending->fd);
+		free(S->pending);
+		S->pending = next;
+	}
+
+	for (size_t i = 0; i < 256; i++){
+		a12int_tile_cache_free(&S->channels[i].tiles_out);
+		a12int_tile_cache_free(&S->channels[i].tiles_in);
+		a12int_tpack_stream_free(&S->channels[i].tpack_out, true);
+		a12int_tpack_stream_free(&S->channels[i].tpack_in, false);
+		a12int_encode_dpng_reset(S, i);
+		free(S->channels[i].unpack_state.vframe.inbuf);
+		free(S->channels[i].unpack_state.aframe.inbuf);
+		a12int_jitter_free(&S->channels[i].jitter);
+#ifdef WANT_H264_DEC
+		sws_freeContext(S->channels[i].dec_scaler);
+#endif
+	}
+	free(S->enc_state);
+	free(S->dec_state);
 	DYNAMIC_FREE(S->bufs[0]);
 	DYNAMIC_FREE(S->bufs[1]);
 	*S = (struct a12_state){};
@@ -656,7 +1219,7 @@ static void process_srvfirst(struct a12_state* S)
 }
 
 static void command_cancelstream(
-	struct a12_state* S, uint32_t streamid, uint8_t reason)
+	struct a12_state* S, uint8_t channel, uint32_t streamid, uint8_t reason)
 {
 	struct blob_out* node = S->pending;
 
@@ -665,6 +1228,11 @@ static void command_cancelstream(
  * switch the encoder for next frame */
 	if (streamid == 1){
 		if (reason == VSTREAM_CANCEL_DECODE_ERROR){
+			a12int_trace(A12_TRACE_VIDEO,
+				"kind=cancelled:ch=%"PRIu8":stream=video:reason=decode", channel);
+			a12int_encode_dtile_reset(S, channel, true);
+			a12int_encode_dpng_reset(S, channel);
+			a12int_encode_tz_reset(S, channel);
 		}
 
 /* other reasons means that the image contents is already known or too dated,
@@ -679,7 +1247,9 @@ static void command_cancelstream(
 	while (node){
 		if (node->streamid == streamid){
 			a12int_trace(A12_TRACE_BTRANSFER,
-				"kind=cancelled:stream=%"PRIu32":source=remote", streamid);
+				"kind=cancelled:stream=%"PRIu32":source=remote:reason=%s", streamid,
+				reason == VSTREAM_CANCEL_KNOWN ? "cached" : "rejected");
+			queue_purge_stream(S, node->chid, streamid);
 			unlink_node(S, node);
 			return;
 		}
@@ -688,6 +1258,43 @@ static void command_cancelstream(
 
 }
 
+/* [reason] uses the same values as for the video stream, with _KNOWN meaning
+ * that the contents matched a local cache */
+static void stream_cancel(struct a12_state* S, uint8_t channel, int reason)
+{
+	struct binary_frame* bframe = &S->channels[channel].unpack_state.bframe;
+
+/* API misuse, trying to cancel a stream that is not active */
+	if (!bframe->active)
+		return;
+
+	uint8_t outb[CONTROL_PACKET_SIZE] = {0};
+	step_sequence(S, outb);
+	outb[16] = channel;
+	outb[17] = COMMAND_CANCELSTREAM;
+	pack_u32(bframe->streamid, &outb[18]); /* [18 .. 21] stream-id */
+	outb[22] = reason;
+	bframe->active = false;
+	a12int_append_out(S, STATE_CONTROL_PACKET, outb, CONTROL_PACKET_SIZE, NULL, 0);
+
+/* forward the cancellation request to the eventhandler, due to the active tracking
+ * we are protected against bad use (handler -> cancel -> handler) */
+	if (S->binary_handler){
+		struct a12_bhandler_meta bm = {
+			.fd = bframe->tmp_fd,
+			.state = A12_BHANDLER_CANCELLED,
+			.streamid = bframe->streamid,
+			.channel = channel
+		};
+		S->binary_handler(S, bm, S->binary_handler_tag);
+	}
+
+	a12int_trace(A12_TRACE_BTRANSFER,
+		"kind=cancelled:ch=%"PRIu8":stream=%"PRId64, channel, bframe->streamid);
+	bframe->streamid = -1;
+	bframe->tmp_fd = -1;
+}
+
 static void command_binarystream(struct a12_state* S)
 {
 /*
@@ -736,10 +1343,15 @@ static void command_binarystream(struct a12_state* S)
 	int sc = A12_BHANDLER_DONTWANT;
 	struct a12_bhandler_meta bm = {
 		.state = A12_BHANDLER_INITIALIZE,
+		.type = bframe->type,
 		.known_size = bframe->size,
+		.streaming = bframe->size == 0,
+		.channel = channel,
 		.streamid = bframe->streamid,
+		.dcont = S->channels[channel].cont,
 		.fd = -1
 	};
+	memcpy(bm.checksum, bframe->checksum, 16);
 
 	if (S->binary_handler){
 		struct a12_bhandler_res res = S->binary_handler(S, bm, S->binary_handler_tag);
@@ -747,10 +1359,23 @@ static void command_binarystream(struct a12_state* S)
 		sc = res.flag;
 	}
 
+/* the handler had a copy with the same checksum, tell the other side that we
+ * have it and then treat the cached copy as if the transfer just completed */
+	if (sc == A12_BHANDLER_CACHED && bframe->tmp_fd != -1){
+		bm.fd = bframe->tmp_fd;
+		bm.state = A12_BHANDLER_COMPLETED;
+		bframe->tmp_fd = -1;
+		a12int_trace(A12_TRACE_BTRANSFER,
+			"kind=cached:stream=%"PRId64":ch=%d", bframe->streamid, channel);
+		stream_cancel(S, channel, VSTREAM_CANCEL_KNOWN);
+		S->binary_handler(S, bm, S->binary_handler_tag);
+		return;
+	}
+
 	if (sc == A12_BHANDLER_DONTWANT || sc == A12_BHANDLER_CACHED){
-		a12_stream_cancel(S, channel);
 		a12int_trace(A12_TRACE_BTRANSFER,
 			"kind=reject:stream=%"PRId64":ch=%d", bframe->streamid, channel);
+		stream_cancel(S, channel, VSTREAM_CANCEL_DONTWANT);
 	}
 }
 
@@ -763,44 +1388,15 @@ void a12_vstream_cancel(struct a12_state* S, uint8_t channel, int reason)
 
 	outb[16] = channel;
 	outb[17] = COMMAND_CANCELSTREAM;
-	outb[18] = 1;
-	outb[19] = reason;
+	pack_u32(1, &outb[18]); /* [18 .. 21] stream-id, video is always 1 */
+	outb[22] = reason;
 
 	a12int_append_out(S, STATE_CONTROL_PACKET, outb, CONTROL_PACKET_SIZE, NULL, 0);
 }
 
 void a12_stream_cancel(struct a12_state* S, uint8_t channel)
 {
-	uint8_t outb[CONTROL_PACKET_SIZE] = {0};
-	step_sequence(S, outb);
-	struct binary_frame* bframe = &S->channels[channel].unpack_state.bframe;
-
-/* API misuse, trying to cancel a stream that is not active */
-	if (!bframe->active)
-		return;
-
-	outb[16] = channel;
-	outb[17] = COMMAND_CANCELSTREAM;
-	pack_u32(bframe->streamid, &outb[18]); /* [18 .. 21] stream-id */
-	bframe->active = false;
-	bframe->streamid = -1;
-	a12int_append_out(S, STATE_CONTROL_PACKET, outb, CONTROL_PACKET_SIZE, NULL, 0);
-
-/* forward the cancellation request to the eventhandler, due to the active tracking
- * we are protected against bad use (handler -> cancel -> handler) */
-	if (S->binary_handler){
-		struct a12_bhandler_meta bm = {
-			.fd = bframe->tmp_fd,
-			.state = A12_BHANDLER_CANCELLED,
-			.streamid = bframe->streamid,
-			.channel = channel
-		};
-		S->binary_handler(S, bm, S->binary_handler_tag);
-	}
-
-	a12int_trace(A12_TRACE_BTRANSFER,
-		"kind=cancelled:ch=%"PRIu8":stream=%"PRId64, channel, bframe->streamid);
-	bframe->tmp_fd = -1;
+	stream_cancel(S, channel, VSTREAM_CANCEL_DONTWANT);
 }
 
 static void command_audioframe(struct a12_state* S)
@@ -808,11 +1404,13 @@ static void command_audioframe(struct a12_state* S)
 	uint8_t channel = S->decode[16];
 	struct audio_frame* aframe = &S->channels[channel].unpack_state.aframe;
 
-	aframe->format = S->decode[22];
-	aframe->encoding = S->decode[23];
 	aframe->channels = S->decode[22];
+	aframe->encoding = S->decode[23];
+	aframe->format = aframe->encoding;
 	unpack_u16(&aframe->nsamples, &S->decode[24]);
 	unpack_u32(&aframe->rate, &S->decode[26]);
+	aframe->inbuf_pos = 0;
+	aframe->commit = 0;
 	S->in_channel = -1;
 
 /* developer error (or malicious client), set to skip decode/playback */
@@ -823,21 +1421,48 @@ static void command_audioframe(struct a12_state* S)
 		return;
 	}
 
-/* this requires an extended resize (theoretically, practically not),
- * and in those cases we want to copy-out the vbuffer state if set and
-	if (cont->samplerate != aframe->rate){
+/* rate and channel count get converted in the jitter stage, only cap them
+ * to something that can't be abused */
+	if (!aframe->channels || aframe->channels > A12_AUDIO_MAXCH ||
+		aframe->rate < 1000 || aframe->rate > 192000){
+		a12int_trace(A12_TRACE_AUDIO,
+			"kind=error:status=EINVAL:channels=%"PRIu8":rate=%"PRIu32,
+			aframe->channels, aframe->rate
+		);
+		aframe->commit = 255;
+		return;
+	}
+
+	aframe->expanded_sz =
+		(size_t) aframe->nsamples * aframe->channels * sizeof(int16_t);
+
+	switch (aframe->encoding){
+	case POSTPROCESS_AUDIO_S16:
+		aframe->inbuf_sz = aframe->expanded_sz;
+	break;
+	case POSTPROCESS_AUDIO_ADPCM:
+		aframe->inbuf_sz = a12int_adpcm_size(aframe->nsamples, aframe->channels);
+	break;
+	default:
 		a12int_trace(A12_TRACE_MISSING,
-			"rate mismatch: %zu <-> %"PRIu32, cont->samplerate, aframe->rate);
+			"kind=error:status=EINVAL:encoding=%"PRIu8, aframe->encoding);
+		aframe->commit = 255;
+		return;
 	}
- */
 
-/* format should be paired against AUDIO_SAMPLE_TYPE
-	if (aframe->channels != ARCAN_SHMIF_ACHANNELS){
-		a12int_trace(A12_TRACE_MISSING, "channel format repack");
+/* the buffer is kept between frames as they come at a steady pace and
+ * roughly the same size, the decoded samples go after the encoded ones */
+	size_t need = ((aframe->inbuf_sz + 1) & ~(size_t)1) + aframe->expanded_sz;
+	if (need > aframe->inbuf_cap){
+		free(aframe->inbuf);
+		aframe->inbuf = malloc(need);
+		aframe->inbuf_cap = aframe->inbuf ? need : 0;
+		if (!aframe->inbuf){
+			a12int_trace(A12_TRACE_ALLOC,
+				"couldn't allocate %zu bytes for audio", need);
+			aframe->commit = 255;
+		}
 	}
-*/
-/* just plug the samples into the normal abuf- as part of the shmif-cont */
-/* normal dynamic rate adjustment compensating for clock drift etc. go here */
 }
 
 /*
@@ -858,6 +1483,7 @@ static void update_proxy_vcont(
 	cont->pitch = channel->cont->stride / sizeof(shmif_pixel);
 	cont->w = vframe->sw;
 	cont->h = vframe->sh;
+	cont->vbufsize = cont->stride * cont->h;
 
 	if (!cont->vidp)
 		goto fail;
@@ -870,27 +1496,38 @@ static void update_proxy_vcont(
 		vframe->commit = 255;
 }
 
-static bool update_proxy_acont(
-	struct a12_channel* channel, struct audio_frame* aframe)
+/*
+ * Raw destinations get the samples as they arrive, in the source format,
+ * buffering and playback pace is up to them. A new buffer is requested
+ * whenever the format changes or a frame doesn't fit the last one.
+ */
+static void audio_forward_raw(
+	struct a12_channel* ch, struct audio_frame* caf, int16_t* pcm)
 {
-	if (!channel->raw.request_audio_buffer)
-		goto fail;
+	struct arcan_shmif_cont* cont = ch->cont;
+	size_t n = (size_t) caf->nsamples * caf->channels;
+	size_t bytes = n * sizeof(shmif_asample);
 
-	channel->cont->audp =
-		channel->raw.request_audio_buffer(
-			aframe->channels, aframe->rate,
-			sizeof(AUDIO_SAMPLE_TYPE) * aframe->channels,
-			channel->raw.tag
-	);
+	if (!cont->audp || bytes > ch->raw_abuf.bytes ||
+		ch->raw_abuf.rate != caf->rate || ch->raw_abuf.channels != caf->channels){
+		if (!ch->raw.request_audio_buffer)
+			return;
 
-	if (!channel->cont->audp)
-		goto fail;
+		cont->audp = ch->raw.request_audio_buffer(
+			caf->channels, caf->rate, bytes, ch->raw.tag);
+		if (!cont->audp)
+			return;
+
+		ch->raw_abuf.bytes = bytes;
+		ch->raw_abuf.rate = caf->rate;
+		ch->raw_abuf.channels = caf->channels;
+	}
 
-	return true;
+	for (size_t i = 0; i < n; i++)
+		cont->audp[i] = SHMIF_AINT16(pcm[i]);
 
-fail:
-	aframe->commit = 255;
-	return false;
+	if (ch->raw.signal_audio)
+		ch->raw.signal_audio(bytes, ch->raw.tag);
 }
 
 static void command_newchannel(
@@ -921,7 +1558,7 @@ struct a12_state* S, void (*on_event)
 	on_event(S->channels[channel].cont, channel, &ev, tag);
 }
 
-static void command_videoframe(struct a12_state* S)
+static void videoframe_header(struct a12_state* S)
 {
 	uint8_t ch = S->decode[16];
 	int method = S->decode[22];
@@ -959,6 +1596,7 @@ static void command_videoframe(struct a12_state* S)
 	unpack_u16(&vframe->w, &S->decode[31]);
 	unpack_u16(&vframe->h, &S->decode[33]);
 /* [35] : dataflags */
+	vframe->flags = S->decode[35];
 	unpack_u32(&vframe->inbuf_sz, &S->decode[36]);
 /* [41]     : commit: uint8 */
 	unpack_u32(&vframe->expanded_sz, &S->decode[40]);
@@ -980,12 +1618,14 @@ static void command_videoframe(struct a12_state* S)
 /* set the possible consumer presentation / repacking options, or resize
  * if the source / destination dimensions no longer match */
 	bool hints_changed = false;
-	if (vframe->postprocess == POSTPROCESS_VIDEO_TZ && !(cont->hints & SHMIF_RHINT_TPACK)){
+	bool tpack = vframe->postprocess == POSTPROCESS_VIDEO_TZ ||
+		vframe->postprocess == POSTPROCESS_VIDEO_TZS;
+
+	if (tpack && !(cont->hints & SHMIF_RHINT_TPACK)){
 		cont->hints |= SHMIF_RHINT_TPACK;
 		hints_changed = true;
 	}
-	else if ((cont->hints & SHMIF_RHINT_TPACK) &&
-		vframe->postprocess != POSTPROCESS_VIDEO_TZ){
+	else if ((cont->hints & SHMIF_RHINT_TPACK) && !tpack){
 		cont->hints = cont->hints & (~SHMIF_RHINT_TPACK);
 		hints_changed = true;
 	}
@@ -1043,6 +1683,17 @@ static void command_videoframe(struct a12_state* S)
 /* this includes TPACK */
 	else {
 		size_t ulim = vframe->w * vframe->h * sizeof(shmif_pixel);
+
+/* tiles are RGB but each comes with a record header, for tiny surfaces
+ * that can exceed the 1b/px margin */
+		if (vframe->postprocess == POSTPROCESS_VIDEO_DTILE){
+			ulim += ((vframe->w + TILE_SIZE - 1) / TILE_SIZE) *
+				((vframe->h + TILE_SIZE - 1) / TILE_SIZE) * TILE_RECORD_SZ;
+		}
+/* the TZS transform can grow a cell, see TZS_CELL_MAX */
+		else if (vframe->postprocess == POSTPROCESS_VIDEO_TZS)
+			ulim = ulim / TZS_CELL_SZ * TZS_CELL_MAX + TZS_HEADER_SZ;
+
 		if (vframe->expanded_sz > ulim){
 			vframe->commit = 255;
 			a12int_trace(A12_TRACE_SYSTEM,
@@ -1053,8 +1704,11 @@ static void command_videoframe(struct a12_state* S)
 		}
 /* rather arbitrary, but if this condition occurs, the producer should have
  * simply sent the data raw - the odd case is possibly miniz/tpack where the
- * can be a header and a non-compressible buffer. */
-		if (vframe->inbuf_sz > vframe->expanded_sz + 24){
+ * can be a header and a non-compressible buffer. DEFLATE and LZ fall back to
+ * stored blocks / literal runs for those, and they carry a few bytes each,
+ * hence the ratio. */
+		if (vframe->inbuf_sz >
+			vframe->expanded_sz + (vframe->expanded_sz >> 7) + 24){
 			vframe->commit = 255;
 			a12int_trace(A12_TRACE_SYSTEM, "incoming buffer (%"
 				PRIu32") expands to less than target (%"PRIu32")",
@@ -1071,6 +1725,7 @@ static void command_videoframe(struct a12_state* S)
 		if (!vframe->inbuf){
 			a12int_trace(A12_TRACE_ALLOC,
 				"couldn't allocate intermediate buffer store");
+			vframe->commit = 255;
 			return;
 		}
 		vframe->row_left = vframe->w;
@@ -1079,6 +1734,31 @@ static void command_videoframe(struct a12_state* S)
 	}
 }
 
+/*
+ * A dropped tile frame leaves the grid on this side out of step with the one
+ * the source diffs the next frame against, so ask for a full refresh. The
+ * tile cache itself is still valid as only complete tiles go into it.
+ */
+static void vframe_dropped(struct a12_state* S, uint8_t ch)
+{
+	struct video_frame* vframe = &S->channels[ch].unpack_state.vframe;
+	if (vframe->postprocess != POSTPROCESS_VIDEO_DTILE)
+		return;
+
+	a12int_trace(A12_TRACE_VIDEO,
+		"kind=dropped:ch=%"PRIu8":codec=dtile:message=request refresh", ch);
+	a12_vstream_cancel(S, ch, VSTREAM_CANCEL_DECODE_ERROR);
+}
+
+static void command_videoframe(struct a12_state* S)
+{
+	uint8_t ch = S->decode[16];
+	videoframe_header(S);
+
+	if (S->channels[ch].unpack_state.vframe.commit == 255)
+		vframe_dropped(S, ch);
+}
+
 /*
  * Binary transfers comes in different shapes:
  *
@@ -1097,6 +1777,52 @@ static void command_videoframe(struct a12_state* S)
  * asymmetric connection as they won't fight with other transfers.
  *
  */
+static bool blob_hash_key(int fd, off_t size, struct blob_hash* out)
+{
+	struct stat fs;
+	if (-1 == fstat(fd, &fs) || !S_ISREG(fs.st_mode))
+		return false;
+
+	*out = (struct blob_hash){
+		.dev = fs.st_dev,
+		.ino = fs.st_ino,
+		.size = size,
+		.mtime_ns = (uint64_t) fs.st_mtim.tv_sec * 1000000000ULL + fs.st_mtim.tv_nsec
+	};
+	return true;
+}
+
+static bool blob_hash_lookup(
+	struct a12_state* S, int fd, off_t size, uint8_t checksum[static 16])
+{
+	struct blob_hash key;
+	if (!blob_hash_key(fd, size, &key))
+		return false;
+
+	for (size_t i = 0; i < BLOB_HASH_CACHE; i++){
+		struct blob_hash* cur = &S->blob_hashes[i];
+		if (cur->size && cur->dev == key.dev && cur->ino == key.ino &&
+			cur->size == key.size && cur->mtime_ns == key.mtime_ns){
+			memcpy(checksum, cur->checksum, 16);
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static void blob_hash_store(
+	struct a12_state* S, int fd, off_t size, uint8_t checksum[static 16])
+{
+	struct blob_hash key;
+	if (!blob_hash_key(fd, size, &key))
+		return;
+
+	memcpy(key.checksum, checksum, 16);
+	S->blob_hashes[S->blob_hash_ind] = key;
+	S->blob_hash_ind = (S->blob_hash_ind + 1) % BLOB_HASH_CACHE;
+}
+
 void a12_enqueue_bstream(
 	struct a12_state* S, int fd, int type, bool streaming, size_t sz)
 {
@@ -1185,12 +1911,18 @@ void a12_enqueue_bstream(
 		goto fail;
 	}
 
+/* same file as one of the recent transfers and not modified since? */
+	if (blob_hash_lookup(S, next->fd, fend, next->checksum)){
+		a12int_trace(A12_TRACE_BTRANSFER, "kind=checksum:source=memo");
+		goto done;
+	}
+
 /* this has the normal sigbus problem, though we don't care about that much now
  * being in the same sort of privilege domain - we can also defer the entire
  * thing and simply thread- process it, which is probably the better solution */
 	void* map = mmap(NULL, fend, PROT_READ, MAP_FILE | MAP_PRIVATE, fd, 0);
 
-	if (!map){
+	if (map == MAP_FAILED){
 		a12int_trace(A12_TRACE_SYSTEM, "kind=error:status=EMMAP");
 		goto fail;
 	}
@@ -1203,6 +1935,9 @@ void a12_enqueue_bstream(
 	blake3_hasher_update(&hash, map, fend);
 	blake3_hasher_finalize(&hash, next->checksum, 16);
 	munmap(map, fend);
+	blob_hash_store(S, next->fd, fend, next->checksum);
+
+done:
 	next->left = fend;
 	a12int_trace(A12_TRACE_BTRANSFER,
 		"kind=added:type=%d:stream=no:size=%zu", type, next->left);
@@ -1336,7 +2071,12 @@ static void process_hello_auth(struct a12_state* S)
 - [19]      Version minor : uint8 (shmif-version until 1.0)
 - [20]      Flags         : uint8
 - [21+ 32]  x25519 Pk     : blob
+- [53..56]  Features      : uint32
 	 */
+	unpack_u32(&S->remote_features, &S->decode[53]);
+	a12int_trace(A12_TRACE_CRYPTO,
+		"kind=hello:features=%"PRIu32, S->remote_features);
+
 	if (S->authentic == AUTH_SERVER_HBLOCK){
 		hello_auth_server_hello(S);
 		return;
@@ -1378,6 +2118,33 @@ static void process_hello_auth(struct a12_state* S)
 	}
 }
 
+/*
+ * Ping requests are answered right away with the timestamp echoed back, the
+ * replies are matched against our own clock for the round-trip time.
+ */
+static void command_ping(struct a12_state* S)
+{
+	uint64_t ts;
+	unpack_u64(&ts, &S->decode[18]);
+
+	if (!S->decode[26]){
+		send_ping(S, true, ts);
+		return;
+	}
+
+	unsigned long long now = arcan_timemillis();
+	if (ts > now)
+		return;
+
+	struct link_state* L = &S->link;
+	float rtt = now - ts;
+	L->rtt = L->rtt_samples ? 0.875 * L->rtt + 0.125 * rtt : rtt;
+	L->rtt_samples++;
+
+	a12int_trace(A12_TRACE_TRANSFER,
+		"kind=link:rtt_sample=%.0f:rtt=%.2f", rtt, L->rtt);
+}
+
 /*
  * Control command,
  * current MAC calculation in s->mac_dec
@@ -1391,10 +2158,12 @@ static void process_control(struct a12_state* S, void (*on_event)
 	}
 
 /* ignore these for now
-	uint64_t last_seen = S->decode[0];
 	uint8_t entropy[8] = S->decode[8];
 	uint8_t channel = S->decode[16];
  */
+	uint64_t last_seen;
+	unpack_u64(&last_seen, S->decode);
+	link_ack(S, last_seen);
 
 	uint8_t command = S->decode[17];
 	if (S->authentic < AUTH_FULL_PK && command != COMMAND_HELLO){
@@ -1417,11 +2186,11 @@ static void process_control(struct a12_state* S, void (*on_event)
 	case COMMAND_CANCELSTREAM:{
 		uint32_t streamid;
 		unpack_u32(&streamid, &S->decode[18]);
-		command_cancelstream(S, streamid, S->decode[22]);
+		command_cancelstream(S, S->decode[16], streamid, S->decode[22]);
 	}
 	break;
 	case COMMAND_PING:
-		a12int_trace(A12_TRACE_MISSING, "Check ping packet");
+		command_ping(S);
 	break;
 	case COMMAND_VIDEOFRAME:
 		command_videoframe(S);
@@ -1458,7 +2227,9 @@ static void process_event(struct a12_state* S, void* tag,
 	uint8_t channel = S->decode[8];
 
 	struct arcan_event aev;
-	unpack_u64(&S->last_seen_seqnr, S->decode);
+	uint64_t last_seen;
+	unpack_u64(&last_seen, S->decode);
+	link_ack(S, last_seen);
 
 	if (-1 == arcan_shmif_eventunpack(
 		&S->decode[SEQUENCE_NUMBER_SIZE+1],
@@ -1632,9 +2403,12 @@ static void process_video(struct a12_state* S)
 		a12int_trace(A12_TRACE_CRYPTO, "kind=frame_auth");
 	}
 
-/* if we are in discard state, just continue */
+/* if we are in discard state, just continue - a TPACK stream can't continue
+ * past a frame that never reached the inflater */
 	if (cvf->commit == 255){
 		a12int_trace(A12_TRACE_VIDEO, "kind=discard");
+		if (cvf->postprocess == POSTPROCESS_VIDEO_TZS)
+			a12int_tpack_stream_free(&ch->tpack_in, false);
 		reset_state(S);
 		return;
 	}
@@ -1665,7 +2439,10 @@ static void process_video(struct a12_state* S)
 		else if (left != 0){
 			a12int_trace(A12_TRACE_SYSTEM,
 				"kind=error:source=video:channel=%d:type=EOVERFLOW", S->in_channel);
+			cvf->commit = 255;
+			vframe_dropped(S, S->in_channel);
 			reset_state(S);
+			return;
 		}
 
 /* buffer is finished, decode and commit to designated channel context
@@ -1695,7 +2472,7 @@ static void process_video(struct a12_state* S)
 	reset_state(S);
 }
 
-static void drain_audio(struct a12_channel* ch)
+static void drain_audio(struct a12_state* S, struct a12_channel* ch)
 {
 	struct arcan_shmif_cont* cont = ch->cont;
 	if (ch->active == CHANNEL_RAW){
@@ -1705,7 +2482,92 @@ static void drain_audio(struct a12_channel* ch)
 		return;
 	}
 
-	arcan_shmif_signal(cont, SHMIF_SIGAUD);
+	a12int_signal(S, ch, SHMIF_SIGAUD);
+}
+
+/*
+ * Flush out whatever the jitter buffer says is due by [now] into the abuffer,
+ * this runs both when a packet arrives and from a12_tick as the playout has
+ * to keep going on the local clock in between.
+ */
+static size_t audio_playout(
+	struct a12_state* S, struct a12_channel* ch, unsigned long long now)
+{
+	struct arcan_shmif_cont* cont = ch->cont;
+	int16_t out[512];
+	size_t nf;
+	size_t total = 0;
+
+	do {
+		nf = a12int_jitter_pull(ch->jitter, out, 256, now);
+		for (size_t i = 0; i < nf * 2; i++){
+			cont->audp[cont->abufpos++] = SHMIF_AINT16(out[i]);
+			if (cont->abufpos >= cont->abufcount)
+				drain_audio(S, ch);
+		}
+		total += nf;
+	} while (nf == 256);
+
+	if (cont->abufpos)
+		drain_audio(S, ch);
+
+	return total;
+}
+
+/*
+ * Segments get the audio through the jitter buffer, it is the one that
+ * decides when samples are due, converts to the rate of the segment and
+ * compensates for the clocks on both sides not quite agreeing.
+ */
+static void audio_forward_jitter(struct a12_state* S,
+	struct a12_channel* ch, struct audio_frame* caf, int16_t* pcm)
+{
+	struct arcan_shmif_cont* cont = ch->cont;
+
+/* a note with the extended resize here is that we always request a single
+ * video buffer, which means the video part will be locked until we get an
+ * ack from the consumer - this might need to be tunable to increase if we
+ * detect that we stall on signalling video */
+	if (!cont->audp){
+		a12int_trace(A12_TRACE_AUDIO,
+			"frame-resize, rate: %"PRIu32", channels: %"PRIu8,
+			caf->rate, caf->channels
+		);
+
+		if (!arcan_shmif_resize_ext(cont,
+			cont->w, cont->h, (struct shmif_resize_ext){
+				.abuf_sz = 1024, .samplerate = caf->rate,
+				.abuf_cnt = 16, .vbuf_cnt = 1
+			})){
+			a12int_trace(A12_TRACE_ALLOC, "frame-resize failed");
+			return;
+		}
+	}
+
+	uint32_t out_rate = cont->samplerate > 0 ?
+		cont->samplerate : ARCAN_SHMIF_SAMPLERATE;
+
+	if (ch->jitter && a12int_jitter_rate(ch->jitter) != out_rate)
+		a12int_jitter_free(&ch->jitter);
+
+	if (!ch->jitter){
+		ch->jitter = a12int_jitter_alloc(out_rate);
+		if (!ch->jitter){
+			a12int_trace(A12_TRACE_ALLOC, "couldn't allocate jitter buffer");
+			return;
+		}
+	}
+
+	unsigned long long now = arcan_timemillis();
+	if (!a12int_jitter_push(ch->jitter,
+		pcm, caf->nsamples, caf->channels, caf->rate, now))
+		return;
+
+	size_t total = audio_playout(S, ch, now);
+	a12int_trace(A12_TRACE_AUDIO,
+		"kind=jitter:in=%"PRIu16":out=%zu:target=%u",
+		caf->nsamples, total, a12int_jitter_target(ch->jitter)
+	);
 }
 
 static void process_audio(struct a12_state* S)
@@ -1713,20 +2575,19 @@ static void process_audio(struct a12_state* S)
 /* in_channel is used to track if we are waiting for the header or not */
 	if (S->in_channel == -1){
 		uint32_t stream;
+		update_mac_and_decrypt(__func__,
+			&S->in_mac, S->dec_state, S->decode, header_sizes[S->state]);
 		S->in_channel = S->decode[0];
 		unpack_u32(&stream, &S->decode[1]);
 		unpack_u16(&S->left, &S->decode[5]);
 		S->decode_pos = 0;
-		update_mac_and_decrypt(__func__,
-			&S->in_mac, S->dec_state, S->decode, header_sizes[S->state]);
 		a12int_trace(A12_TRACE_AUDIO,
 			"audio[%d:%"PRIx32"], left: %"PRIu16, S->in_channel, stream, S->left);
 		return;
 	}
 
-/* the 'audio_frame' structure for the current channel (segment) only
- * contains the metadata, we use the mapped shmif- segment to actually
- * buffer, assuming we have no compression */
+/* the 'audio_frame' structure for the current channel (segment) tracks the
+ * buffer that the stream is collected in before it is decoded */
 	struct a12_channel* channel = &S->channels[S->in_channel];
 	struct audio_frame* caf = &channel->unpack_state.aframe;
 	struct arcan_shmif_cont* cont = channel->cont;
@@ -1739,6 +2600,12 @@ static void process_audio(struct a12_state* S)
 		a12int_trace(A12_TRACE_CRYPTO, "kind=frame_auth");
 	}
 
+	if (caf->commit == 255){
+		a12int_trace(A12_TRACE_AUDIO, "kind=discard");
+		reset_state(S);
+		return;
+	}
+
 	if (!cont){
 		a12int_trace(A12_TRACE_SYSTEM,
 			"audio data on unmapped channel (%d)", (int) S->in_channel);
@@ -1746,69 +2613,45 @@ static void process_audio(struct a12_state* S)
 		return;
 	}
 
-	if (channel->active == CHANNEL_RAW){
-		if (!update_proxy_acont(channel, caf))
-			return;
+	size_t left = caf->inbuf_sz - caf->inbuf_pos;
+	if (S->decode_pos > left){
+		a12int_trace(A12_TRACE_SYSTEM,
+			"kind=error:source=audio:channel=%d:type=EOVERFLOW", S->in_channel);
+		caf->commit = 255;
+		reset_state(S);
+		return;
 	}
 
-/* passed the header stage, now it's the data block,
- * make sure the segment has registered that it can provide audio */
-	if (!cont->audp){
-		a12int_trace(A12_TRACE_AUDIO,
-			"frame-resize, rate: %"PRIu32", channels: %"PRIu8,
-			caf->rate, caf->channels
-		);
+	memcpy(&caf->inbuf[caf->inbuf_pos], S->decode, S->decode_pos);
+	caf->inbuf_pos += S->decode_pos;
+	if (caf->inbuf_pos < caf->inbuf_sz){
+		reset_state(S);
+		return;
+	}
 
-/* a note with the extended resize here is that we always request a single
- * video buffer, which means the video part will be locked until we get an
- * ack from the consumer - this might need to be tunable to increase if we
- * detect that we stall on signalling video */
-			if (!arcan_shmif_resize_ext(cont,
-			cont->w, cont->h, (struct shmif_resize_ext){
-				.abuf_sz = 1024, .samplerate = caf->rate,
-				.abuf_cnt = 16, .vbuf_cnt = 1
-			})){
-			a12int_trace(A12_TRACE_ALLOC, "frame-resize failed");
-			caf->commit = 255;
+/* complete, the next data needs a new astream header */
+	caf->commit = 255;
+	int16_t* pcm = (int16_t*) &caf->inbuf[(caf->inbuf_sz + 1) & ~(size_t)1];
+	size_t n = (size_t) caf->nsamples * caf->channels;
+
+	if (caf->encoding == POSTPROCESS_AUDIO_ADPCM){
+		if (!a12int_adpcm_decode(
+			caf->inbuf, caf->inbuf_sz, caf->nsamples, caf->channels, pcm)){
+			a12int_trace(A12_TRACE_AUDIO, "kind=error:status=EINVAL:adpcm");
+			reset_state(S);
 			return;
 		}
 	}
-
-/* Flush out into abuffer, assuming that the context has been set to match the
- * defined source format in a previous stage. Resampling might be needed here,
- * both for rate and for drift/buffer */
-	size_t samples_in = S->decode_pos >> 1;
-	size_t pos = 0;
-
-/* assumed s16, stereo for now, if the sender didn't align properly, shame */
-	while (samples_in > 1){
-		int16_t l, r;
-		unpack_s16(&l, &S->decode[pos]);
-		pos += 2;
-		unpack_s16(&r, &S->decode[pos]);
-		pos += 2;
-		cont->audp[cont->abufpos++] = SHMIF_AINT16(l);
-		cont->audp[cont->abufpos++] = SHMIF_AINT16(r);
-		samples_in -= 2;
-
-		if (cont->abufcount - cont->abufpos <= 1){
-			a12int_trace(A12_TRACE_AUDIO,
-				"forward %zu samples", (size_t) cont->abufpos);
-			drain_audio(channel);
-		}
+	else {
+		for (size_t i = 0; i < n; i++)
+			unpack_s16(&pcm[i], &caf->inbuf[i * 2]);
 	}
 
-/* now we can subtract the number of SAMPLES from the audio stream packet, when
- * that reaches zero we reset state, this incorrectly assumes 2 channels. */
-	caf->nsamples -= S->decode_pos >> 1;
-
-/* drain if there is data left in the buffer, but no samples left */
-	if (!caf->nsamples && cont->abufused){
-		drain_audio(channel);
-	}
+	if (channel->active == CHANNEL_RAW)
+		audio_forward_raw(channel, caf, pcm);
+	else
+		audio_forward_jitter(S, channel, caf, pcm);
 
-	a12int_trace(A12_TRACE_TRANSFER,
-		"audio packet over, samples left: %zu", (size_t) caf->nsamples);
 	reset_state(S);
 }
 
@@ -1828,6 +2671,7 @@ void a12_set_destination(
 
 	S->channels[chid].cont = wnd;
 	S->channels[chid].active = wnd ? CHANNEL_SHMIF : CHANNEL_INACTIVE;
+	S->channels[chid].signal_pending = 0;
 }
 
 void a12_set_destination_raw(struct a12_state* S,
@@ -1842,6 +2686,9 @@ void a12_set_destination_raw(struct a12_state* S,
 		return;
 
 	*fake = (struct arcan_shmif_cont){};
+	if (S->channels[chid].active == CHANNEL_RAW)
+		free(S->channels[chid].cont);
+
 	S->channels[chid].cont = fake;
 	S->channels[chid].raw = cfg;
 	S->channels[chid].active = CHANNEL_RAW;
@@ -1978,8 +2825,53 @@ static void unlink_node(struct a12_state* S, struct blob_out* node)
 	free(node);
 }
 
+static void send_blob_header(struct a12_state* S, struct blob_out* node)
+{
+	uint8_t outb[CONTROL_PACKET_SIZE] = {0};
+	step_sequence(S, outb);
+	S->out_stream++;
+	outb[16] = node->chid;
+	outb[17] = COMMAND_BINARYSTREAM;
+	pack_u32(S->out_stream, &outb[18]); /* [18 .. 21] stream-id */
+	pack_u64(node->left, &outb[22]); /* [22 .. 29] total-size */
+	outb[30] = node->type;
+	/* 31..34 : id-token, ignored for now */
+	memcpy(&outb[35], node->checksum, 16);
+	a12int_append_out(S, STATE_CONTROL_PACKET, outb, CONTROL_PACKET_SIZE, NULL, 0);
+	node->active = true;
+	node->streamid = S->out_stream;
+	a12int_trace(A12_TRACE_BTRANSFER,
+		"kind=created:size=%zu:stream:%"PRIu64":ch=%d",
+		node->left, node->streamid, node->chid
+	);
+}
+
+/* long enough for a cancel from the other side to make it back here */
+static unsigned long long blob_hold_time(struct a12_state* S)
+{
+	if (!S->link.rtt_samples)
+		return BLOB_HOLD_DEFAULT;
+
+	unsigned long long rtt = S->link.rtt * 1.5 + 5;
+	return rtt > BLOB_HOLD_MAX ? BLOB_HOLD_MAX : rtt;
+}
+
 static size_t queue_node(struct a12_state* S, struct blob_out* node)
 {
+/* a bigger file-backed transfer that the other side might already have cached,
+ * send the header with the checksum on its own and hold the data back until
+ * there has been time for a cancellation to come back */
+	if (!node->active && !node->streaming && node->left >= BLOB_HOLD_SIZE &&
+		(S->remote_features & FEATURE_BLOB_CACHE)){
+		send_blob_header(S, node);
+		node->hold_until = arcan_timemillis() + blob_hold_time(S);
+		a12int_trace(A12_TRACE_BTRANSFER,
+			"kind=hold:stream=%"PRIu64":ch=%d:until=%llu",
+			node->streamid, (int)node->chid, node->hold_until
+		);
+		return CONTROL_PACKET_SIZE;
+	}
+
 	uint16_t nts;
 	size_t cap = node->left;
 	if (cap == 0 || cap > 64096)
@@ -1996,25 +2888,8 @@ static size_t queue_node(struct a12_state* S, struct blob_out* node)
 	}
 
 /* not activated, so build a header first */
-	if (!node->active){
-		uint8_t outb[CONTROL_PACKET_SIZE] = {0};
-		step_sequence(S, outb);
-		S->out_stream++;
-		outb[16] = node->chid;
-		outb[17] = COMMAND_BINARYSTREAM;
-		pack_u32(S->out_stream, &outb[18]); /* [18 .. 21] stream-id */
-		pack_u64(node->left, &outb[22]); /* [22 .. 29] total-size */
-		outb[30] = node->type;
-		/* 31..34 : id-token, ignored for now */
-		memcpy(&outb[35], node->checksum, 16);
-		a12int_append_out(S, STATE_CONTROL_PACKET, outb, CONTROL_PACKET_SIZE, NULL, 0);
-		node->active = true;
-		node->streamid = S->out_stream;
-		a12int_trace(A12_TRACE_BTRANSFER,
-			"kind=created:size=%zu:stream:%"PRIu64":ch=%d",
-			node->left, node->streamid, node->chid
-		);
-	}
+	if (!node->active)
+		send_blob_header(S, node);
 
 /* prepend the bstream header */
 	uint8_t outb[1 + 4 + 2];
@@ -2053,44 +2928,124 @@ static size_t append_blob(struct a12_state* S, int mode)
 /* find suitable blob */
 	if (mode == A12_FLUSH_NOBLOB || !S->pending)
 		return 0;
-/* only current channel? */
-	else if (mode == A12_FLUSH_CHONLY){
-		struct blob_out* parent = S->pending;
-		while (parent){
-			if (parent->chid == S->out_channel)
-				return queue_node(S, parent);
-			parent = parent->next;
-		}
-		return 0;
+
+/* first one that isn't waiting for a possible cancel, optionally only for the
+ * current channel */
+	unsigned long long now = arcan_timemillis();
+	struct blob_out* node = S->pending;
+	while (node){
+		if ((mode != A12_FLUSH_CHONLY || node->chid == S->out_channel) &&
+			node->hold_until <= now)
+			return queue_node(S, node);
+		node = node->next;
 	}
-	return queue_node(S, S->pending);
+	return 0;
 }
 
-size_t
-a12_flush(struct a12_state* S, uint8_t** buf, int allow_blob)
+/*
+ * Shared by the flush variants, pick packets from the queues and serialize
+ * them into the current output buffer. Returns the number of bytes that go
+ * out with the buffer, including any detached payloads.
+ */
+static size_t flush_queues(struct a12_state* S, int allow_blob)
 {
 	if (S->state == STATE_BROKEN || S->cookie != 0xfeedface)
 		return 0;
 
-/* nothing in the outgoing buffer? then we can pull in whatever data transfer
- * is pending, if there are any queued */
-	if (S->buf_ofs == 0){
+	release_sent(S);
+	S->detached = 0;
+	S->n_segs = 0;
+	S->seg_ofs = 0;
+
+/* keep the link estimate fresh, this also gives the other side something
+ * to acknowledge our sequence numbers with */
+	if (S->authentic == AUTH_FULL_PK){
+		unsigned long long now = arcan_timemillis();
+		if (now - S->link.last_ping >= LINK_PING_INTERVAL){
+			S->link.last_ping = now;
+			send_ping(S, false, now);
+		}
+	}
+
+/* nothing in the outgoing buffer or the queues? then we can pull in whatever
+ * data transfer is pending, if there are any queued */
+	if (S->buf_ofs == 0 && !queue_pending(S)){
 		if (allow_blob > A12_FLUSH_NOBLOB && append_blob(S, allow_blob)){}
 		else
 			return 0;
 	}
 
-	size_t rv = S->buf_ofs;
+	drain_queues(S);
+	if (S->buf_ofs == 0)
+		return 0;
+
+	size_t rv = S->buf_ofs + S->detached;
+	link_flush(S, rv, !queue_pending(S));
+
+	return rv;
+}
+
+/* switch out "output buffer", it is expected that by the next non-0 returning
+ * flush, its contents have been pushed to the other side */
+static uint8_t* step_buffer(struct a12_state* S)
+{
+	uint8_t* buf = S->bufs[S->buf_ind];
 	int old_ind = S->buf_ind;
 
-/* switch out "output buffer" and return how much there is to send, it is
- * expected that by the next non-0 returning channel_flush, its contents have
- * been pushed to the other side */
-	*buf = S->bufs[S->buf_ind];
 	S->buf_ofs = 0;
 	S->buf_ind = (S->buf_ind + 1) % 2;
 	a12int_trace(A12_TRACE_ALLOC, "locked %d, new buffer: %d", old_ind, S->buf_ind);
 
+	return buf;
+}
+
+size_t
+a12_flush(struct a12_state* S, uint8_t** buf, int allow_blob)
+{
+	S->segs_lim = 0;
+	size_t rv = flush_queues(S, allow_blob);
+	if (!rv)
+		return 0;
+
+	*buf = step_buffer(S);
+	return rv;
+}
+
+size_t
+a12_flush_iov(
+	struct a12_state* S, struct iovec* iov, size_t* n_iov, int allow_blob)
+{
+	if (!n_iov || !*n_iov)
+		return 0;
+
+	S->segs_lim = *n_iov > OUTQUEUE_IOV ? OUTQUEUE_IOV : *n_iov;
+	size_t rv = flush_queues(S, allow_blob);
+	S->segs_lim = 0;
+
+	if (!rv){
+		*n_iov = 0;
+		return 0;
+	}
+
+/* the trailing slice that didn't end with a detached payload */
+	if (S->seg_ofs < S->buf_ofs){
+		S->segs[S->n_segs++] = (struct out_segment){
+			.ofs = S->seg_ofs,
+			.len = S->buf_ofs - S->seg_ofs
+		};
+	}
+
+/* the buffer might have moved while growing so resolve the slices only now */
+	uint8_t* buf = step_buffer(S);
+	for (size_t i = 0; i < S->n_segs; i++){
+		iov[i].iov_base = S->segs[i].data ? S->segs[i].data : &buf[S->segs[i].ofs];
+		iov[i].iov_len = S->segs[i].len;
+	}
+
+	a12int_trace(A12_TRACE_TRANSFER,
+		"kind=flush_iov:segments=%zu:size=%zu:detached=%zu", S->n_segs, rv, S->detached);
+
+	*n_iov = S->n_segs;
 	return rv;
 }
 
@@ -2100,7 +3055,79 @@ a12_poll(struct a12_state* S)
 	if (!S || S->state == STATE_BROKEN || S->cookie != 0xfeedface)
 		return -1;
 
-	return S->buf_ofs || S->pending ? 1 : 0;
+	return S->buf_ofs || S->pending || queue_pending(S) ? 1 : 0;
+}
+
+void
+a12int_signal(struct a12_state* S, struct a12_channel* ch, int mask)
+{
+	struct arcan_shmif_cont* cont = ch->cont;
+	if (!S->signal_nonblock){
+		arcan_shmif_signal(cont, mask);
+		return;
+	}
+
+/* vready is only cleared when the consumer is done with the buffer, stepping
+ * before that would have the signal wait (SUBREGION) or tear the frame it is
+ * reading, the region keeps accumulating in cont->dirty meanwhile */
+	if ((mask & SHMIF_SIGVID) && cont->addr && cont->addr->dms &&
+		atomic_load(&cont->addr->vready)){
+		ch->signal_pending |= SHMIF_SIGVID;
+		mask &= ~SHMIF_SIGVID;
+	}
+	else
+		ch->signal_pending &= ~mask;
+
+	if (mask)
+		arcan_shmif_signal(cont, mask | SHMIF_SIGBLK_NONE);
+}
+
+void
+a12_set_nonblock(struct a12_state* S, bool nonblock)
+{
+	if (!S || S->cookie != 0xfeedface)
+		return;
+
+	S->signal_nonblock = nonblock;
+}
+
+/* the consumer releasing a buffer can't be waited on without blocking, so
+ * pending signals are retried at this interval */
+#define SIGNAL_RETRY_MS 4
+
+unsigned
+a12_tick(struct a12_state* S)
+{
+	if (!S || S->cookie != 0xfeedface)
+		return 0;
+
+	unsigned next = 0;
+	unsigned long long now = arcan_timemillis();
+
+	for (size_t i = 0; i < 256; i++){
+		struct a12_channel* ch = &S->channels[i];
+		if (ch->active != CHANNEL_SHMIF){
+			ch->signal_pending = 0;
+			continue;
+		}
+
+/* the jitter buffer plays out on the local clock, not on packet arrival */
+		if (ch->jitter && ch->cont->audp && a12int_jitter_next(ch->jitter)){
+			audio_playout(S, ch, now);
+			unsigned due = a12int_jitter_next(ch->jitter);
+			if (due && (!next || due < next))
+				next = due;
+		}
+
+		if (!ch->signal_pending)
+			continue;
+
+		a12int_signal(S, ch, ch->signal_pending);
+		if (ch->signal_pending && (!next || SIGNAL_RETRY_MS < next))
+			next = SIGNAL_RETRY_MS;
+	}
+
+	return next;
 }
 
 int
@@ -2158,14 +3185,26 @@ a12_channel_aframe(struct a12_state* S,
 	if (!S || S->cookie != 0xfeedface || S->state == STATE_BROKEN)
 		return;
 
-/* use a fix size now as the outb- writer lacks queueing and interleaving */
+/* chunk size sets the granularity for the output queue interleaving, audio
+ * is drained in full on flush so this mostly matters for the MTU */
 	size_t chunk_sz = 16428;
 
+	if (!cfg.channels || !cfg.samplerate)
+		return;
+
 	a12int_trace(A12_TRACE_AUDIO,
 		"encode %zu samples @ %"PRIu32" Hz /%"PRIu8" ch",
 		n_samples, cfg.samplerate, cfg.channels
 	);
-	a12int_encode_araw(S, S->out_channel, buf, n_samples/2, cfg, opts, chunk_sz);
+
+/* the astream header counts samples per channel in 16 bits */
+	size_t n_frames = n_samples / cfg.channels;
+	while (n_frames){
+		size_t nf = n_frames > UINT16_MAX ? UINT16_MAX : n_frames;
+		a12int_encode_araw(S, S->out_channel, buf, nf, cfg, opts, chunk_sz);
+		buf += nf * cfg.channels;
+		n_frames -= nf;
+	}
 }
 
 /*
@@ -2179,7 +3218,8 @@ a12_channel_vframe(struct a12_state* S,
 	if (!S || S->cookie != 0xfeedface || S->state == STATE_BROKEN)
 		return;
 
-/* use a fix size now as the outb- writer lacks queueing and interleaving */
+/* chunk size sets the granularity for the output queue interleaving, smaller
+ * means that control/audio has a shorter wait behind a large frame */
 	size_t chunk_sz = 32768;
 
 /* avoid dumb updates */
@@ -2224,6 +3264,25 @@ a12_channel_vframe(struct a12_state* S,
  */
 	a12int_trace(A12_TRACE_VIDEO,
 		"out vframe: %zu*%zu @%zu,%zu+%zu,%zu", vb->w, vb->h, w, h, x, y);
+
+/* the LZ formats and tiles came after the base format, a peer that hasn't
+ * announced them gets the DEFLATE version instead (adaptive may pick LZ) */
+	if (((opts.method == VFRAME_METHOD_DLZ ||
+		opts.method == VFRAME_METHOD_ADAPTIVE) &&
+		!(S->remote_features & FEATURE_VFRAME_LZ)) ||
+		(opts.method == VFRAME_METHOD_DTILE &&
+		!(S->remote_features & FEATURE_VFRAME_DTILE))){
+		a12int_trace(A12_TRACE_VIDEO, "kind=fallback:method=%d:to=dpng", opts.method);
+		opts.method = VFRAME_METHOD_DPNG;
+	}
+
+/* any other method will update the sink surface behind the back of the delta
+ * encoders, so their view of what is on the other side can't be trusted */
+	if (opts.method != VFRAME_METHOD_DTILE)
+		a12int_encode_dtile_reset(S, S->out_channel, false);
+	if (opts.method != VFRAME_METHOD_DPNG && opts.method != VFRAME_METHOD_DLZ &&
+		opts.method != VFRAME_METHOD_ADAPTIVE && opts.method != VFRAME_METHOD_H264)
+		a12int_encode_dpng_reset(S, S->out_channel);
 #define argstr S, vb, opts, x, y, w, h, chunk_sz, S->out_channel
 
 	switch(opts.method){
@@ -2248,6 +3307,15 @@ a12_channel_vframe(struct a12_state* S,
 	case VFRAME_METHOD_TPACK:
 		a12int_encode_tz(argstr);
 	break;
+	case VFRAME_METHOD_DTILE:
+		a12int_encode_dtile(argstr);
+	break;
+	case VFRAME_METHOD_DLZ:
+		a12int_encode_dlz(argstr);
+	break;
+	case VFRAME_METHOD_ADAPTIVE:
+		a12int_encode_adaptive(argstr);
+	break;
 /*
  * FLIV and dav1d missing
  */
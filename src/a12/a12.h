@@ -86,6 +86,11 @@ struct a12_context_options {
  * marks the state machine as broken. */
 	bool (*sink)(uint8_t* buf, size_t buf_sz, void* tag);
 	void* sink_tag;
+
+/* set if the binary handler checks incoming transfers against a local cache,
+ * the other side will then hold bigger transfers back for about a round-trip
+ * so that there is a chance to cancel them */
+	bool blob_cache;
 };
 
 /*
@@ -220,6 +225,82 @@ enum a12_blob_mode {
 size_t
 a12_flush(struct a12_state*, uint8_t**, int allow_blob);
 
+/*
+ * Scatter/gather version of a12_flush. Rather than everything being copied
+ * into one contiguous buffer, [iov] is filled out with at most [n_iov] entries
+ * (updated to the number used) where the bigger payloads are encrypted in place
+ * and referenced from the queue they were waiting in. Suitable for writev or
+ * sendmsg. The entries remain valid until the next a12_flush or a12_flush_iov.
+ *
+ * Returns the total number of bytes referenced by [iov].
+ */
+struct iovec;
+size_t
+a12_flush_iov(struct a12_state*, struct iovec* iov, size_t* n_iov, int allow_blob);
+
+/*
+ * Outgoing packets are kept in a set of queues until the next a12_flush,
+ * where they are picked in priority order: control and events first, then
+ * audio and finally video and binary transfers, with the latter two being
+ * interleaved between channels and capped in size per flush.
+ *
+ * Retrieve the number of bytes waiting in each queue for a channel (or the
+ * sum for all channels if [chid] is -1) along with the number of video frames
+ * that have not started to transfer. This should be used by encoders to pick
+ * cheaper settings or to drop frames altogether when the link falls behind.
+ *
+ * [blob_hold] is the number of milliseconds until a binary transfer that is
+ * waiting for the other side to cancel it (see a12_set_bhandler) may resume,
+ * or 0 if there is none. An event loop that would otherwise sleep should wake
+ * up and a12_flush again after that.
+ */
+enum a12_queue_kind {
+	A12_QUEUE_CONTROL = 0,
+	A12_QUEUE_AUDIO = 1,
+	A12_QUEUE_VIDEO = 2,
+	A12_QUEUE_BLOB = 3,
+	A12_QUEUE_ALL = 4
+};
+
+struct a12_queue_depth {
+	size_t bytes[A12_QUEUE_ALL];
+	size_t vframes;
+	size_t total;
+	unsigned blob_hold;
+};
+
+struct a12_queue_depth
+a12_queue_depth(struct a12_state*, int chid);
+
+/*
+ * Get the current estimate of the link to the other side. The round-trip time
+ * comes from the periodic pings that a12_flush injects, the throughput from
+ * how fast the sequence numbers the other side acknowledges advance. [inflight]
+ * is the number of flushed bytes that have not been acknowledged yet.
+ *
+ * The respective [_samples] fields are 0 until there is any data to go on, in
+ * which case the corresponding estimate should not be trusted.
+ */
+struct a12_link_estimate {
+	float rtt_ms;
+	float mbit;
+	size_t inflight;
+	size_t rtt_samples;
+	size_t rate_samples;
+};
+
+struct a12_link_estimate
+a12_link_estimate(struct a12_state*);
+
+/*
+ * Estimate of the heap memory held by the state machine: the state itself,
+ * the output buffers, packets waiting in the queues and the per-channel codec
+ * buffers. This is for servers that host many sessions in one process, so
+ * that they can account for, and put a cap on, what each session uses.
+ */
+size_t
+a12_footprint(struct a12_state*);
+
 /*
  * Add a data transfer object to the active outgoing channel. The state machine
  * will duplicate the descriptor in [fd]. These will not necessarily be
@@ -263,6 +344,28 @@ a12_enqueue_bstream(
 int
 a12_poll(struct a12_state*);
 
+/*
+ * Never wait for the consumer of a segment (set_destination) when forwarding
+ * decoded audio and video. This is for hosts that serve many connections from
+ * one thread, where a slow local consumer would otherwise stall all of them.
+ *
+ * A video frame that completes while the segment still holds the previous
+ * one is not handed over, it is left pending (and later frames overwrite it)
+ * until [a12_tick] finds the segment free. Audio is always handed over and
+ * overwrites what the consumer didn't get to in time.
+ */
+void
+a12_set_nonblock(struct a12_state*, bool nonblock);
+
+/*
+ * Run deferred work that isn't triggered by incoming data: audio playout into
+ * segments, which follows the local clock rather than packet arrival, and
+ * retrying held back signals from [a12_set_nonblock]. Returns the number of
+ * milliseconds until it wants to be called again, or 0 if nothing is pending.
+ */
+unsigned
+a12_tick(struct a12_state*);
+
 /*
  * Get the authentication state,
  * 0 = authenticating
@@ -330,7 +433,10 @@ enum a12_vframe_method {
 	VFRAME_METHOD_RAW_RGB565,
 	VFRAME_METHOD_DPNG,
 	VFRAME_METHOD_H264,
-	VFRAME_METHOD_TPACK
+	VFRAME_METHOD_TPACK,
+	VFRAME_METHOD_DTILE,
+	VFRAME_METHOD_DLZ, /* like DPNG, but fast LZ rather than DEFLATE */
+	VFRAME_METHOD_ADAPTIVE /* DPNG / DLZ / uncompressed, see bitrate */
 };
 
 enum a12_vframe_compression_bias {
@@ -351,13 +457,14 @@ struct a12_vframe_opts {
 
 	bool variable;
 	union {
-		float bitrate; /* !variable, Mbit */
+		float bitrate; /* !variable, Mbit, ADAPTIVE uses it as link estimate */
 		int ratefactor; /* variable (ffmpeg scale) */
 	};
 };
 
 enum a12_aframe_method {
 	AFRAME_METHOD_RAW = 0,
+	AFRAME_METHOD_ADPCM = 1 /* 4 bits per sample, for constrained links */
 };
 
 struct a12_aframe_opts {
@@ -381,15 +488,25 @@ struct a12_aframe_cfg {
  * Each channel can only have one transfer in- flight, so it is safe to
  * track the state per-channel and not try to pair multiple transfers.
  *
- * Cancellation will be triggered on DONTWANT / CACHED. Otherwise the
+ * Cancellation will be triggered on DONTWANT / CACHED, DONTWANT is zero so a
+ * handler that returns a cleared response rejects the transfer. Otherwise the
  * new file descriptor will be populated and when the transfer is
  * completed / cancelled, the handler will be invoked again. It is up
  * to the handler to close any descriptor.
+ *
+ * For CACHED, the descriptor should refer to the local copy that matches
+ * the checksum. The other side is told that the contents is already known
+ * and the handler is invoked again as COMPLETED with that descriptor, just
+ * as if the transfer had gone through.
+ *
+ * The checksum is the first 16 bytes of the BLAKE3 hash of the contents,
+ * it is all zeroes for streaming transfers. It comes from the other side,
+ * so it is up to the handler to verify it before adding to a cache.
  */
 enum a12_bhandler_flag {
-	A12_BHANDLER_CACHED = 0,
-	A12_BHANDLER_NEWFD,
-	A12_BHANDLER_DONTWANT
+	A12_BHANDLER_DONTWANT = 0,
+	A12_BHANDLER_NEWFD = 1,
+	A12_BHANDLER_CACHED = 2
 };
 
 enum a12_bhandler_state {
@@ -438,7 +555,8 @@ bool
 a12_channel_enqueue(struct a12_state*, struct arcan_event*);
 
 /* Encode and transfer an audio frame with a number of samples in the native
- * audio sample format and the samplerate etc. configuration that matches */
+ * audio sample format and the samplerate etc. configuration that matches.
+ * [n_samples] counts all channels, i.e. frames * cfg.channels */
 void
 a12_channel_aframe(
 	struct a12_state* S, shmif_asample* buf,
@@ -0,0 +1,522 @@
+/*
+ * Copyright: 2020, Björn Ståhl
+ * Description: A12 protocol state machine, audio compression and jitter buffer
+ * License: 3-Clause BSD, see COPYING file in arcan source repository.
+ * Reference: https://arcan-fe.com
+ */
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "a12_audio.h"
+#include "speex_resampler.h"
+
+#define ADPCM_CH_HEADER 4
+
+static const int16_t adpcm_steps[89] = {
+	7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37, 41, 45,
+	50, 55, 60, 66, 73, 80, 88, 97, 107, 118, 130, 143, 157, 173, 190, 209, 230,
+	253, 279, 307, 337, 371, 408, 449, 494, 544, 598, 658, 724, 796, 876, 963,
+	1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066, 2272, 2499, 2749, 3024, 3327,
+	3660, 4026, 4428, 4871, 5358, 5894, 6484, 7132, 7845, 8630, 9493, 10442,
+	11487, 12635, 13899, 15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794,
+	32767
+};
+
+static const int8_t adpcm_index[16] = {
+	-1, -1, -1, -1, 2, 4, 6, 8,
+	-1, -1, -1, -1, 2, 4, 6, 8
+};
+
+static void adpcm_step(struct a12int_adpcm* st, uint8_t nib)
+{
+	int step = adpcm_steps[st->index];
+	int delta = step >> 3;
+	if (nib & 4)
+		delta += step;
+	if (nib & 2)
+		delta += step >> 1;
+	if (nib & 1)
+		delta += step >> 2;
+
+	int pred = st->pred + ((nib & 8) ? -delta : delta);
+	if (pred > 32767)
+		pred = 32767;
+	else if (pred < -32768)
+		pred = -32768;
+	st->pred = pred;
+
+	int index = st->index + adpcm_index[nib];
+	if (index < 0)
+		index = 0;
+	else if (index > 88)
+		index = 88;
+	st->index = index;
+}
+
+static uint8_t adpcm_quantize(struct a12int_adpcm* st, int16_t sample)
+{
+	int step = adpcm_steps[st->index];
+	int diff = sample - st->pred;
+	uint8_t nib = 0;
+
+	if (diff < 0){
+		nib = 8;
+		diff = -diff;
+	}
+
+	if (diff >= step){
+		nib |= 4;
+		diff -= step;
+	}
+	step >>= 1;
+	if (diff >= step){
+		nib |= 2;
+		diff -= step;
+	}
+	step >>= 1;
+	if (diff >= step)
+		nib |= 1;
+
+/* track the state the same way the decoder will */
+	adpcm_step(st, nib);
+	return nib;
+}
+
+size_t a12int_adpcm_size(size_t frames, size_t channels)
+{
+	return ADPCM_CH_HEADER * channels + ((frames * channels + 1) >> 1);
+}
+
+size_t a12int_adpcm_encode(struct a12int_adpcm* state,
+	const int16_t* in, size_t frames, size_t channels, uint8_t* out)
+{
+/* [pred, index] per channel lets the receiver start on any block, starting
+ * from the exact first sample also keeps rounding errors from accumulating */
+	size_t pos = 0;
+	for (size_t i = 0; i < channels; i++){
+		if (frames)
+			state[i].pred = in[i];
+
+/* a fresh state would need a few dozen samples to ramp the step size up */
+		if (!state[i].index && frames > 1){
+			int d = abs(in[channels + i] - in[i]);
+			while (state[i].index < 88 && adpcm_steps[state[i].index] < d)
+				state[i].index++;
+		}
+
+		uint16_t pred = (uint16_t) state[i].pred;
+		out[pos++] = pred & 0xff;
+		out[pos++] = pred >> 8;
+		out[pos++] = state[i].index;
+		out[pos++] = 0;
+	}
+
+/* interleaved nibbles in sample order, low nibble first */
+	size_t n = frames * channels;
+	for (size_t i = 0; i < n; i++){
+		uint8_t nib = adpcm_quantize(&state[i % channels], in[i]);
+		if (i & 1)
+			out[pos++] |= nib << 4;
+		else
+			out[pos] = nib;
+	}
+
+	if (n & 1)
+		pos++;
+
+	return pos;
+}
+
+bool a12int_adpcm_decode(const uint8_t* in, size_t in_sz,
+	size_t frames, size_t channels, int16_t* out)
+{
+	if (!channels || channels > A12_AUDIO_MAXCH ||
+		in_sz != a12int_adpcm_size(frames, channels))
+		return false;
+
+	struct a12int_adpcm state[A12_AUDIO_MAXCH];
+	size_t pos = 0;
+	for (size_t i = 0; i < channels; i++){
+		state[i].pred = (int16_t)(uint16_t)(in[pos] | (in[pos+1] << 8));
+		state[i].index = in[pos+2] > 88 ? 88 : in[pos+2];
+		pos += ADPCM_CH_HEADER;
+	}
+
+	size_t n = frames * channels;
+	for (size_t i = 0; i < n; i++){
+		uint8_t nib = (i & 1) ? in[pos++] >> 4 : in[pos] & 0x0f;
+		struct a12int_adpcm* st = &state[i % channels];
+		adpcm_step(st, nib);
+		out[i] = st->pred;
+	}
+
+	return true;
+}
+
+/*
+ * The jitter buffer keeps the decoded input (stereo, source rate) in a ring
+ * and plays it out against the local clock. Playback starts when the buffered
+ * level reaches the target latency, which tracks the packet size and the
+ * arrival jitter and is raised after every underrun. The resampling ratio is
+ * nudged in small steps to keep the level at the target, which absorbs the
+ * clock drift between the two sides without audible pitch changes. When the
+ * level still runs away (stalled connection that catches up in a burst) the
+ * excess is dropped.
+ *
+ * Playout follows the local clock rather than packet arrival, so the owner
+ * pulls on a timer as well (see a12int_jitter_next). When the buffer runs dry
+ * the last frame is faded out over what is missing and silence follows on the
+ * same clock while the buffer refills, so the consumer never starves in the
+ * middle of a stream.
+ */
+#define JITTER_MIN_MS 20.0f
+#define JITTER_MAX_MS 300.0f
+#define JITTER_UNDERRUN_MS 20.0f
+#define JITTER_FLOOR_MS 200.0f
+#define JITTER_SKIP_MS 100.0f
+#define JITTER_ADJUST_INTERVAL 250
+#define JITTER_PPM_GAIN 200.0f
+#define JITTER_PPM_MAX 5000
+#define JITTER_PPM_STEP 100
+#define JITTER_TICK_MS 5
+#define JITTER_FADE_MS 5
+#define JITTER_CONCEAL_MS 500
+
+struct a12int_jitter {
+	SpeexResamplerState* resampler;
+	uint32_t out_rate;
+	uint32_t in_rate;
+	size_t in_channels;
+	int ppm;
+
+	int16_t* ring;
+	size_t ring_cap;
+	size_t ring_head;
+	size_t ring_used;
+
+/* playback clock */
+	bool playing;
+	unsigned long long t0;
+	uint64_t emitted;
+	uint64_t lead;
+
+/* underrun concealment, silence is emitted on the clock until conceal_end */
+	bool concealing;
+	unsigned long long conceal_end;
+	int16_t last[2];
+
+/* arrival statistics */
+	unsigned long long first_arrival;
+	unsigned long long last_adjust;
+	uint64_t pushed;
+	double transit;
+	float jitter_ms;
+	float packet_ms;
+	float floor_ms;
+	float level_ms;
+};
+
+static float level_ms(struct a12int_jitter* jb)
+{
+	return (float) jb->ring_used * 1000.0f / (float) jb->in_rate;
+}
+
+static float target_ms(struct a12int_jitter* jb)
+{
+	float target = 1.5f * jb->packet_ms + 3.0f * jb->jitter_ms + jb->floor_ms;
+	if (target < JITTER_MIN_MS)
+		return JITTER_MIN_MS;
+	if (target > JITTER_MAX_MS)
+		return JITTER_MAX_MS;
+	return target;
+}
+
+static void set_ratio(struct a12int_jitter* jb, int ppm)
+{
+	jb->ppm = ppm;
+
+/* consuming more input per output frame drains the buffer faster */
+	uint32_t num = jb->in_rate * 1000 + (int64_t) jb->in_rate * ppm / 1000;
+	uint32_t den = jb->out_rate * 1000;
+	speex_resampler_set_rate_frac(
+		jb->resampler, num, den, jb->in_rate, jb->out_rate);
+}
+
+static bool set_format(struct a12int_jitter* jb, size_t channels, uint32_t rate)
+{
+	if (jb->resampler)
+		speex_resampler_destroy(jb->resampler);
+	free(jb->ring);
+
+	*jb = (struct a12int_jitter){
+		.out_rate = jb->out_rate,
+		.in_rate = rate,
+		.in_channels = channels,
+		.ring_cap = rate
+	};
+
+	int err;
+	jb->resampler = speex_resampler_init(
+		2, rate, jb->out_rate, SPEEX_RESAMPLER_QUALITY_VOIP, &err);
+	jb->ring = malloc(jb->ring_cap * 2 * sizeof(int16_t));
+
+	if (!jb->resampler || !jb->ring){
+		if (jb->resampler)
+			speex_resampler_destroy(jb->resampler);
+		free(jb->ring);
+		jb->resampler = NULL;
+		jb->ring = NULL;
+		jb->in_rate = 0;
+		return false;
+	}
+
+	speex_resampler_skip_zeros(jb->resampler);
+	return true;
+}
+
+static void drop_frames(struct a12int_jitter* jb, size_t n)
+{
+	if (n > jb->ring_used)
+		n = jb->ring_used;
+	jb->ring_head = (jb->ring_head + n) % jb->ring_cap;
+	jb->ring_used -= n;
+}
+
+struct a12int_jitter* a12int_jitter_alloc(uint32_t out_rate)
+{
+	if (!out_rate)
+		return NULL;
+
+	struct a12int_jitter* jb = malloc(sizeof(struct a12int_jitter));
+	if (!jb)
+		return NULL;
+
+	*jb = (struct a12int_jitter){
+		.out_rate = out_rate
+	};
+
+	return jb;
+}
+
+void a12int_jitter_free(struct a12int_jitter** jb)
+{
+	if (!jb || !*jb)
+		return;
+
+	if ((*jb)->resampler)
+		speex_resampler_destroy((*jb)->resampler);
+	free((*jb)->ring);
+	free(*jb);
+	*jb = NULL;
+}
+
+bool a12int_jitter_push(struct a12int_jitter* jb, const int16_t* in,
+	size_t frames, size_t channels, uint32_t rate, unsigned long long now)
+{
+	if (!jb || !channels || !rate)
+		return false;
+
+	if (rate != jb->in_rate || channels != jb->in_channels){
+		if (!set_format(jb, channels, rate))
+			return false;
+	}
+
+	if (!frames)
+		return true;
+
+/* RFC3550 style interarrival jitter, the transit time is relative to when the
+ * first packet arrived so any constant offset cancels out */
+	double media_ms = (double) jb->pushed * 1000.0 / (double) rate;
+	if (!jb->pushed){
+		jb->first_arrival = now;
+		jb->transit = 0;
+	}
+	else {
+		double transit = (double)(now - jb->first_arrival) - media_ms;
+		float d = fabs(transit - jb->transit);
+		jb->transit = transit;
+		jb->jitter_ms += (d - jb->jitter_ms) / 16.0f;
+	}
+
+	float pkt_ms = (float) frames * 1000.0f / (float) rate;
+	if (jb->packet_ms > 0)
+		jb->packet_ms += (pkt_ms - jb->packet_ms) / 8.0f;
+	else
+		jb->packet_ms = pkt_ms;
+	jb->pushed += frames;
+
+/* there is always room for a second of input, past that the oldest goes */
+	if (frames > jb->ring_cap){
+		in += (frames - jb->ring_cap) * channels;
+		frames = jb->ring_cap;
+	}
+	if (jb->ring_used + frames > jb->ring_cap)
+		drop_frames(jb, jb->ring_used + frames - jb->ring_cap);
+
+	size_t tail = (jb->ring_head + jb->ring_used) % jb->ring_cap;
+	for (size_t i = 0; i < frames; i++){
+		int16_t* dst = &jb->ring[tail * 2];
+		dst[0] = in[0];
+		dst[1] = channels > 1 ? in[1] : in[0];
+		in += channels;
+		tail = (tail + 1) % jb->ring_cap;
+	}
+	jb->ring_used += frames;
+
+	return true;
+}
+
+/* number of frames the clock says should have been handed out by [now] */
+static size_t frames_due(
+	struct a12int_jitter* jb, unsigned long long now, size_t frames)
+{
+	uint64_t due = (now - jb->t0) * jb->out_rate / 1000 + jb->lead;
+	due = due > jb->emitted ? due - jb->emitted : 0;
+	return due > frames ? frames : due;
+}
+
+/* fill [out] from frame [ofs] up to [n] with the last frame faded to zero */
+static void conceal(struct a12int_jitter* jb, int16_t* out, size_t ofs, size_t n)
+{
+	size_t fade = jb->out_rate * JITTER_FADE_MS / 1000;
+	for (size_t i = ofs; i < n; i++){
+		size_t step = i - ofs;
+		for (size_t c = 0; c < 2; c++)
+			out[i * 2 + c] = step < fade ?
+				(int16_t)((int32_t) jb->last[c] * (int32_t)(fade - step) / (int32_t) fade) : 0;
+	}
+	jb->last[0] = jb->last[1] = 0;
+}
+
+size_t a12int_jitter_pull(struct a12int_jitter* jb,
+	int16_t* out, size_t frames, unsigned long long now)
+{
+	if (!jb || !jb->resampler)
+		return 0;
+
+	float target = target_ms(jb);
+
+	if (!jb->playing){
+		if (level_ms(jb) < target){
+/* keep the consumer fed on the old clock while refilling, a stream that has
+ * stopped altogether runs out after a while */
+			if (!jb->concealing)
+				return 0;
+
+			if (now >= jb->conceal_end){
+				jb->concealing = false;
+				return 0;
+			}
+
+			size_t due = frames_due(jb, now, frames);
+			conceal(jb, out, 0, due);
+			jb->emitted += due;
+			return due;
+		}
+
+/* hand one packet worth to the consumer up front so it has something
+ * queued when the next one is due */
+		jb->playing = true;
+		jb->concealing = false;
+		jb->t0 = now;
+		jb->emitted = 0;
+		jb->lead = (uint64_t)(jb->packet_ms * (float) jb->out_rate / 1000.0f);
+		jb->level_ms = target;
+		jb->last_adjust = now;
+	}
+
+	size_t due = frames_due(jb, now, frames);
+	size_t produced = 0;
+	while (produced < due && jb->ring_used){
+		size_t contig = jb->ring_cap - jb->ring_head;
+		if (contig > jb->ring_used)
+			contig = jb->ring_used;
+
+		spx_uint32_t in_len = contig;
+		spx_uint32_t out_len = due - produced;
+		speex_resampler_process_interleaved_int(jb->resampler,
+			&jb->ring[jb->ring_head * 2], &in_len, &out[produced * 2], &out_len);
+
+		drop_frames(jb, in_len);
+		produced += out_len;
+		if (!in_len && !out_len)
+			break;
+	}
+
+	if (produced){
+		jb->last[0] = out[(produced - 1) * 2];
+		jb->last[1] = out[(produced - 1) * 2 + 1];
+	}
+
+/* ran dry, conceal the rest and start over from an empty buffer with a
+ * higher floor */
+	if (produced < due){
+		conceal(jb, out, produced, due);
+		jb->emitted += due;
+		jb->playing = false;
+		jb->concealing = true;
+		jb->conceal_end = now + JITTER_CONCEAL_MS;
+		jb->floor_ms += JITTER_UNDERRUN_MS;
+		if (jb->floor_ms > JITTER_FLOOR_MS)
+			jb->floor_ms = JITTER_FLOOR_MS;
+		set_ratio(jb, 0);
+		return due;
+	}
+	jb->emitted += produced;
+
+	float level = level_ms(jb);
+	jb->level_ms += (level - jb->level_ms) / 16.0f;
+
+	if (level > target + fmaxf(JITTER_SKIP_MS, target)){
+		drop_frames(jb,
+			(size_t)((level - target) * (float) jb->in_rate / 1000.0f));
+		jb->level_ms = target;
+	}
+
+	if (now - jb->last_adjust < JITTER_ADJUST_INTERVAL)
+		return produced;
+
+/* let the floor from earlier underruns decay while playback is clean */
+	float dt = (float)(now - jb->last_adjust) / 1000.0f;
+	jb->floor_ms = fmaxf(0.0f, jb->floor_ms - dt);
+	jb->last_adjust = now;
+
+	int ppm = (int)((jb->level_ms - target) * JITTER_PPM_GAIN);
+	ppm = ppm / JITTER_PPM_STEP * JITTER_PPM_STEP;
+	if (ppm > JITTER_PPM_MAX)
+		ppm = JITTER_PPM_MAX;
+	else if (ppm < -JITTER_PPM_MAX)
+		ppm = -JITTER_PPM_MAX;
+
+	if (ppm != jb->ppm)
+		set_ratio(jb, ppm);
+
+	return produced;
+}
+
+unsigned a12int_jitter_next(struct a12int_jitter* jb)
+{
+	return jb && (jb->playing || jb->concealing) ? JITTER_TICK_MS : 0;
+}
+
+uint32_t a12int_jitter_rate(struct a12int_jitter* jb)
+{
+	return jb ? jb->out_rate : 0;
+}
+
+unsigned a12int_jitter_target(struct a12int_jitter* jb)
+{
+	return jb ? (unsigned) target_ms(jb) : 0;
+}
+
+size_t a12int_jitter_footprint(struct a12int_jitter* jb)
+{
+	if (!jb)
+		return 0;
+
+	return sizeof(struct a12int_jitter) + jb->ring_cap * 2 * sizeof(int16_t);
+}
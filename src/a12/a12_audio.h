@@ -0,0 +1,77 @@
+#ifndef HAVE_A12_AUDIO
+#define HAVE_A12_AUDIO
+
+/*
+ * Audio stages for the a12 astream: a 4:1 IMA ADPCM codec for constrained
+ * links and a jitter buffer that paces decoded samples out to the local
+ * segment, resampling to its rate and steering the ratio to compensate for
+ * clock drift between the two sides. See HACKING.md for the block format.
+ */
+
+/* the highest channel count an astream may carry */
+#define A12_AUDIO_MAXCH 8
+
+struct a12int_adpcm {
+	int16_t pred;
+	uint8_t index;
+};
+
+/* size in bytes of an ADPCM block carrying [frames] x [channels] samples */
+size_t a12int_adpcm_size(size_t frames, size_t channels);
+
+/*
+ * Encode [frames] of interleaved [channels] samples from [in] into [out] that
+ * fits at least a12int_adpcm_size bytes. [state] holds one entry per channel
+ * and is carried over between blocks. Returns the number of bytes written.
+ */
+size_t a12int_adpcm_encode(struct a12int_adpcm* state,
+	const int16_t* in, size_t frames, size_t channels, uint8_t* out);
+
+/*
+ * Decode a block of [in_sz] bytes into [frames] of interleaved [channels]
+ * samples in [out]. Each block carries its own predictor state so no state
+ * is kept between calls. Returns false if [in_sz] does not match the block.
+ */
+bool a12int_adpcm_decode(const uint8_t* in, size_t in_sz,
+	size_t frames, size_t channels, int16_t* out);
+
+struct a12int_jitter;
+
+/*
+ * Allocate a jitter buffer that outputs interleaved stereo at [out_rate].
+ */
+struct a12int_jitter* a12int_jitter_alloc(uint32_t out_rate);
+void a12int_jitter_free(struct a12int_jitter**);
+
+/*
+ * Add [frames] of interleaved [channels] samples at [rate] that arrived at
+ * [now] (ms). Mono is duplicated and channels past the first two are dropped.
+ * A change of rate or channel count flushes what is buffered.
+ */
+bool a12int_jitter_push(struct a12int_jitter*, const int16_t* in,
+	size_t frames, size_t channels, uint32_t rate, unsigned long long now);
+
+/*
+ * Take up to [frames] stereo frames that are due for playback at [now] and
+ * write them into [out]. Returns the number of frames written, 0 while the
+ * buffer is filling up to its target latency. After an underrun the frames
+ * are concealment (fade to silence) until the buffer has refilled.
+ */
+size_t a12int_jitter_pull(struct a12int_jitter*,
+	int16_t* out, size_t frames, unsigned long long now);
+
+/*
+ * Milliseconds until the next pull is due when no new input arrives, 0 if
+ * nothing is playing out. Playout is clocked, so the owner has to keep
+ * pulling on this interval rather than only after a push.
+ */
+unsigned a12int_jitter_next(struct a12int_jitter*);
+
+/* the output rate the buffer was allocated for */
+uint32_t a12int_jitter_rate(struct a12int_jitter*);
+
+/* current target latency in ms, for tracing */
+unsigned a12int_jitter_target(struct a12int_jitter*);
+
+size_t a12int_jitter_footprint(struct a12int_jitter*);
+#endif
@@ -13,6 +13,8 @@
 
 #include "a12.h"
 #include "a12_int.h"
+#include "a12_pool.h"
+#include "a12_lz.h"
 
 #ifdef LOG_FRAME_OUTPUT
 #define STB_IMAGE_WRITE_STATIC
@@ -21,21 +23,23 @@
 #include "../../engine/external/stb_image_write.h"
 #endif
 
-static void drain_video(struct a12_channel* ch, struct video_frame* cvf)
+static void drain_video(
+	struct a12_state* S, struct a12_channel* ch, struct video_frame* cvf)
 {
 	cvf->commit = 0;
 	if (ch->active == CHANNEL_RAW){
 	a12int_trace(A12_TRACE_VIDEO,
 		"kind=drain:dest=user:ts=%llu", arcan_timemillis());
 		if (ch->raw.signal_video){
-
+			ch->raw.signal_video(cvf->x, cvf->y,
+				cvf->x + cvf->w, cvf->y + cvf->h, ch->raw.tag);
 		}
 		return;
 	}
 
 	a12int_trace(A12_TRACE_VIDEO,
 		"kind=drain:dest=%"PRIxPTR":ts=%llu", (uintptr_t) ch->cont, arcan_timemillis());
-	arcan_shmif_signal(ch->cont, SHMIF_SIGVID);
+	a12int_signal(S, ch, SHMIF_SIGVID);
 }
 
 bool a12int_buffer_format(int method)
@@ -44,15 +48,106 @@ bool a12int_buffer_format(int method)
 		method == POSTPROCESS_VIDEO_H264 ||
 		method == POSTPROCESS_VIDEO_MINIZ ||
 		method == POSTPROCESS_VIDEO_DMINIZ ||
-		method == POSTPROCESS_VIDEO_TZ;
+		method == POSTPROCESS_VIDEO_DTILE ||
+		method == POSTPROCESS_VIDEO_LZ ||
+		method == POSTPROCESS_VIDEO_DLZ ||
+		method == POSTPROCESS_VIDEO_TZ ||
+		method == POSTPROCESS_VIDEO_TZS;
+}
+
+/*
+ * Unpack [npx] packed RGB pixels straight into the shmif buffer at the current
+ * frame position. The row wrap is handled per span rather than per pixel, and
+ * for the delta formats the XOR is applied in place against what the previous
+ * frame left there.
+ */
+static void unpack_rgb(struct video_frame* cvf,
+	struct arcan_shmif_cont* cont, const uint8_t* in, size_t npx, bool delta)
+{
+	while (npx){
+		size_t run = npx < cvf->row_left ? npx : cvf->row_left;
+		shmif_pixel* dst = &cont->vidp[cvf->out_pos];
+
+		if (delta){
+			for (size_t i = 0; i < run; i++, in += 3)
+				dst[i] = (dst[i] ^ SHMIF_RGBA(in[0], in[1], in[2], 0)) |
+					SHMIF_RGBA(0, 0, 0, 0xff);
+		}
+		else {
+			for (size_t i = 0; i < run; i++, in += 3)
+				dst[i] = SHMIF_RGBA(in[0], in[1], in[2], 0xff);
+		}
+
+		cvf->out_pos += run;
+		cvf->row_left -= run;
+		npx -= run;
+
+		if (cvf->row_left == 0){
+			cvf->out_pos -= cvf->w;
+			cvf->out_pos += cont->pitch;
+			cvf->row_left = cvf->w;
+		}
+	}
+}
+
+static void unpack_rgba(struct video_frame* cvf,
+	struct arcan_shmif_cont* cont, const uint8_t* in, size_t npx)
+{
+	while (npx){
+		size_t run = npx < cvf->row_left ? npx : cvf->row_left;
+		shmif_pixel* dst = &cont->vidp[cvf->out_pos];
+
+		for (size_t i = 0; i < run; i++, in += 4)
+			dst[i] = SHMIF_RGBA(in[0], in[1], in[2], in[3]);
+
+		cvf->out_pos += run;
+		cvf->row_left -= run;
+		npx -= run;
+
+		if (cvf->row_left == 0){
+			cvf->out_pos -= cvf->w;
+			cvf->out_pos += cont->pitch;
+			cvf->row_left = cvf->w;
+		}
+	}
+}
+
+/*
+ * Grow the damaged region of the segment with what the frame covered so that
+ * the consumer only needs to synch that part, the region is reset on signal.
+ * This only applies if whoever set the destination asked for subregion synch,
+ * _dirty would otherwise switch the hint on (and resize to get there) behind
+ * their back. Proxied (raw) channels get the coordinates through signal_video
+ * instead and TPACK is in cells rather than pixels so it covers everything.
+ */
+static void mark_dirty(struct a12_channel* ch,
+	struct video_frame* cvf, struct arcan_shmif_cont* cont)
+{
+	if (ch->active == CHANNEL_RAW || !(cont->hints & SHMIF_RHINT_SUBREGION))
+		return;
+
+	if (cvf->postprocess == POSTPROCESS_VIDEO_TZ ||
+		cvf->postprocess == POSTPROCESS_VIDEO_TZS)
+		arcan_shmif_dirty(cont, 0, 0, cont->w, cont->h, 0);
+	else if (cvf->w && cvf->h)
+		arcan_shmif_dirty(cont, cvf->x, cvf->y, cvf->x + cvf->w, cvf->y + cvf->h, 0);
 }
 
+/* where the inflate callback should write, one per band */
+struct miniz_dst {
+	struct video_frame* cvf;
+	struct arcan_shmif_cont* cont;
+};
+
 static int video_miniz(const void* buf, int len, void* user)
 {
-	struct a12_state* S = user;
-	struct video_frame* cvf = &S->channels[S->in_channel].unpack_state.vframe;
-	struct arcan_shmif_cont* cont = S->channels[S->in_channel].cont;
+	struct miniz_dst* dst = user;
+	struct video_frame* cvf = dst->cvf;
+	struct arcan_shmif_cont* cont = dst->cont;
 	const uint8_t* inbuf = buf;
+	bool delta =
+		cvf->postprocess == POSTPROCESS_VIDEO_DMINIZ ||
+		cvf->postprocess == POSTPROCESS_VIDEO_DLZ;
 
 	if (!cont || len > cvf->expanded_sz){
 		a12int_trace(A12_TRACE_SYSTEM, "decompression resulted in data overcommit");
@@ -72,7 +167,7 @@ static int video_miniz(const void* buf, int len, void* user)
 		}
 
 /* and commit */
-		if (cvf->postprocess == POSTPROCESS_VIDEO_DMINIZ){
+		if (delta){
 			uint8_t r, g, b, a;
 			SHMIF_RGBA_DECOMP(cont->vidp[cvf->out_pos], &r, &g, &b, &a);
 
@@ -108,30 +203,7 @@ static int video_miniz(const void* buf, int len, void* user)
 
 /* pixel-aligned fill/unpack, same as everywhere else */
 	size_t npx = (len / 3) * 3;
-	for (size_t i = 0; i < npx; i += 3){
-		if (cvf->postprocess == POSTPROCESS_VIDEO_DMINIZ){
-			uint8_t r, g, b, a;
-			SHMIF_RGBA_DECOMP(cont->vidp[cvf->out_pos], &r, &g, &b, &a);
-
-			cont->vidp[cvf->out_pos++] = SHMIF_RGBA(
-				inbuf[i+0] ^ r,
-				inbuf[i+1] ^ g,
-				inbuf[i+2] ^ b,
-				0xff
-			);
-		}
-		else{
-			cont->vidp[cvf->out_pos++] =
-				SHMIF_RGBA(inbuf[i], inbuf[i+1], inbuf[i+2], 0xff);
-		}
-
-		cvf->row_left--;
-		if (cvf->row_left == 0){
-			cvf->out_pos -= cvf->w;
-			cvf->out_pos += cont->pitch;
-			cvf->row_left = cvf->w;
-		}
-	}
+	unpack_rgb(cvf, cont, inbuf, npx / 3, delta);
 
 /* we need to account for len bytes not aligning */
 	if (len - npx){
@@ -145,6 +217,508 @@ static int video_miniz(const void* buf, int len, void* user)
 	return 1;
 }
 
+void a12int_tile_cache_free(struct tile_cache** tc)
+{
+	if (!*tc)
+		return;
+
+	free((*tc)->grid);
+	for (size_t i = 0; i < TILE_CACHE_SLOTS; i++)
+		free((*tc)->slot_px[i]);
+
+	free(*tc);
+	*tc = NULL;
+}
+
+void a12int_tpack_stream_free(struct tpack_stream** ts, bool encoder)
+{
+	if (!*ts)
+		return;
+
+	if (encoder)
+		mz_deflateEnd(&(*ts)->zs);
+	else
+		mz_inflateEnd(&(*ts)->zs);
+
+	free((*ts)->lines);
+	free((*ts)->buf);
+	free(*ts);
+	*ts = NULL;
+}
+
+bool a12int_tzs_reserve(uint8_t** buf, size_t* buf_sz, size_t need)
+{
+	if (need <= *buf_sz)
+		return true;
+
+	size_t new_sz = *buf_sz ? *buf_sz : 4096;
+	while (new_sz < need)
+		new_sz <<= 1;
+
+	uint8_t* new = realloc(*buf, new_sz);
+	if (!new)
+		return false;
+
+	*buf = new;
+	*buf_sz = new_sz;
+	return true;
+}
+
+static bool tzs_read_glyph(
+	const uint8_t* in, size_t in_sz, size_t* pos, uint32_t* cp)
+{
+	*cp = 0;
+	for (size_t shift = 0; shift < 35; shift += 7){
+		if (*pos >= in_sz)
+			return false;
+
+		uint8_t ch = in[(*pos)++];
+		*cp |= (uint32_t)(ch & 0x7f) << shift;
+		if (!(ch & 0x80))
+			return true;
+	}
+
+	return false;
+}
+
+/*
+ * Undo the TZS transform (see a12_int.h) from ts->buf straight into the tpack
+ * buffer of the segment, bounded by the size of that buffer. Any failure here
+ * leaves the stream state undefined so the caller has to mark it as broken.
+ */
+static bool tzs_untransform(struct tpack_stream* ts,
+	size_t in_sz, struct arcan_shmif_cont* cont)
+{
+	uint8_t* in = ts->buf;
+	uint8_t* out = cont->vidb;
+
+	if (in_sz < TZS_HEADER_SZ)
+		return false;
+
+	uint32_t data_sz;
+	uint16_t n_lines, n_cells;
+	unpack_u32(&data_sz, in);
+	unpack_u16(&n_lines, &in[4]);
+	unpack_u16(&n_cells, &in[6]);
+
+	size_t out_sz = TZS_HEADER_SZ +
+		(size_t) n_lines * TZS_LINE_SZ + (size_t) n_cells * TZS_CELL_SZ;
+
+	if (data_sz != out_sz || out_sz > cont->vbufsize ||
+		TZS_HEADER_SZ + (size_t) n_lines * TZS_LINE_SZ > in_sz ||
+		!a12int_tzs_reserve(&ts->lines, &ts->lines_cap, (size_t) n_lines * TZS_LINE_SZ))
+		return false;
+
+/* restore the line table first, the cell counts are needed to find where
+ * the styles end and the glyphs begin */
+	size_t pos = TZS_HEADER_SZ;
+	size_t sum = 0;
+	for (size_t i = 0; i < n_lines; i++){
+		uint8_t* line = &ts->lines[i * TZS_LINE_SZ];
+		for (size_t j = 0; j < TZS_LINE_SZ; j++)
+			line[j] = in[pos++] ^ (i < ts->n_lines ? line[j] : 0);
+
+		uint16_t ncells;
+		unpack_u16(&ncells, &line[2]);
+		sum += ncells;
+	}
+	ts->n_lines = n_lines;
+
+	if (sum != n_cells)
+		return false;
+
+/* skip through the style runs without touching the palette */
+	size_t style_pos = pos;
+	for (size_t covered = 0; covered < n_cells;){
+		if (pos + 2 > in_sz)
+			return false;
+		covered += (size_t) in[pos] + 1;
+		pos += in[pos + 1] == TZS_LITERAL ? 10 : 2;
+	}
+	size_t glyph_pos = pos;
+	if (glyph_pos > in_sz)
+		return false;
+
+/* now interleave the line headers, styles and glyphs into the output */
+	memcpy(out, in, TZS_HEADER_SZ);
+	size_t ofs = TZS_HEADER_SZ;
+	uint64_t style = 0;
+	size_t run = 0;
+
+	for (size_t i = 0; i < n_lines; i++){
+		uint16_t ncells;
+		memcpy(&out[ofs], &ts->lines[i * TZS_LINE_SZ], TZS_LINE_SZ);
+		unpack_u16(&ncells, &ts->lines[i * TZS_LINE_SZ + 2]);
+		ofs += TZS_LINE_SZ;
+
+		for (size_t j = 0; j < ncells; j++, ofs += TZS_CELL_SZ){
+			if (!run){
+				run = (size_t) in[style_pos] + 1;
+				uint8_t ref = in[style_pos + 1];
+				style_pos += 2;
+
+				if (ref == TZS_LITERAL){
+					unpack_u64(&style, &in[style_pos]);
+					style_pos += 8;
+					ts->palette[ts->pal_next] = style;
+					ts->pal_next = (ts->pal_next + 1) % TZS_PALETTE;
+				}
+				else
+					style = ts->palette[ref];
+			}
+			run--;
+
+			uint32_t cp;
+			if (!tzs_read_glyph(in, in_sz, &glyph_pos, &cp))
+				return false;
+
+			pack_u64(style, &out[ofs]);
+			pack_u32(cp, &out[ofs + 8]);
+		}
+	}
+
+	return glyph_pos == in_sz;
+}
+
+/*
+ * Returns false if the frame couldn't be decoded and the source should be told
+ * to restart the stream. A stream that is already broken drops everything up
+ * until the next reset without asking again.
+ */
+static bool video_tzs(struct a12_channel* ch,
+	struct video_frame* cvf, struct arcan_shmif_cont* cont, bool* skip)
+{
+	*skip = false;
+	if (cvf->flags & VFRAME_DATAFLAG_RESET){
+		a12int_tpack_stream_free(&ch->tpack_in, false);
+		struct tpack_stream* ts = malloc(sizeof(struct tpack_stream));
+		if (!ts)
+			return false;
+
+		*ts = (struct tpack_stream){0};
+		if (MZ_OK != mz_inflateInit2(&ts->zs, -MZ_DEFAULT_WINDOW_BITS)){
+			free(ts);
+			return false;
+		}
+		ch->tpack_in = ts;
+		a12int_trace(A12_TRACE_VIDEO, "kind=status:codec=tzs:message=reset");
+	}
+
+	struct tpack_stream* ts = ch->tpack_in;
+	if (!ts){
+		ts = malloc(sizeof(struct tpack_stream));
+		if (!ts)
+			return false;
+
+		*ts = (struct tpack_stream){.broken = true};
+		mz_inflateInit2(&ts->zs, -MZ_DEFAULT_WINDOW_BITS);
+		ch->tpack_in = ts;
+		return false;
+	}
+
+	if (ts->broken){
+		a12int_trace(A12_TRACE_VDETAIL, "kind=status:codec=tzs:message=wait_reset");
+		*skip = true;
+		return true;
+	}
+
+/* the expanded size comes from the peer and this is where it turns into an
+ * allocation, so hold it to the same bound as the frame header: a tpack buffer
+ * no larger than the frame with each cell grown to TZS_CELL_MAX */
+	size_t frame_sz = (size_t) cvf->w * cvf->h * sizeof(shmif_pixel);
+	if (cvf->expanded_sz > frame_sz / TZS_CELL_SZ * TZS_CELL_MAX + TZS_HEADER_SZ){
+		a12int_trace(A12_TRACE_SYSTEM,
+			"kind=error:codec=tzs:message=expanded size out of bounds:size=%zu",
+			(size_t) cvf->expanded_sz);
+		ts->broken = true;
+		return false;
+	}
+
+/* one byte of slack so that the inflater gets to consume the empty stored
+ * block from the sync flush even when the frame fills the buffer exactly */
+	if (!a12int_tzs_reserve(&ts->buf, &ts->buf_sz, (size_t) cvf->expanded_sz + 1)){
+		ts->broken = true;
+		return false;
+	}
+
+	ts->zs.next_in = cvf->inbuf;
+	ts->zs.avail_in = cvf->inbuf_pos;
+	ts->zs.next_out = ts->buf;
+	ts->zs.avail_out = cvf->expanded_sz + 1;
+
+	int rv = mz_inflate(&ts->zs, MZ_SYNC_FLUSH);
+	size_t got = cvf->expanded_sz + 1 - ts->zs.avail_out;
+
+	if (rv != MZ_OK || ts->zs.avail_in || got != cvf->expanded_sz ||
+		!tzs_untransform(ts, got, cont)){
+		a12int_trace(A12_TRACE_SYSTEM,
+			"kind=error:codec=tzs:inflate=%d:got=%zu:expected=%zu",
+			rv, got, (size_t) cvf->expanded_sz);
+		ts->broken = true;
+		return false;
+	}
+
+	return true;
+}
+
+static void tile_blit(struct arcan_shmif_cont* cont,
+	size_t x, size_t y, size_t w, size_t h, const uint8_t* src)
+{
+	for (size_t row = y; row < y + h; row++){
+		shmif_pixel* dst = &cont->vidp[row * cont->pitch + x];
+		for (size_t col = 0; col < w; col++, src += 3)
+			dst[col] = SHMIF_RGBA(src[0], src[1], src[2], 0xff);
+	}
+}
+
+/*
+ * Tile updates are small and scattered, so the inflate is done in one go to
+ * a temporary buffer rather than streamed through the callback like miniz.
+ * The buffer is the announced (and already bounded) expanded size, a stream
+ * that would inflate past it is rejected rather than followed.
+ * A reference to a tile we don't have means that we have lost track of what
+ * the source believes is in the cache, so ask for a full refresh.
+ */
+static bool video_dtile(struct a12_state* S,
+	struct a12_channel* ch, struct video_frame* cvf, struct arcan_shmif_cont* cont)
+{
+	uint8_t* buf = malloc(cvf->expanded_sz ? cvf->expanded_sz : 1);
+	if (!buf){
+		a12int_trace(A12_TRACE_ALLOC,
+			"kind=error:codec=dtile:message=couldn't alloc %zu", (size_t) cvf->expanded_sz);
+		return false;
+	}
+
+	size_t out_sz = tinfl_decompress_mem_to_mem(
+		buf, cvf->expanded_sz, cvf->inbuf, cvf->inbuf_pos, 0);
+	if (out_sz == TINFL_DECOMPRESS_MEM_TO_MEM_FAILED){
+		a12int_trace(A12_TRACE_SYSTEM, "kind=error:codec=dtile:message=inflate failed");
+		free(buf);
+		return false;
+	}
+
+	if (!ch->tiles_in){
+		ch->tiles_in = malloc(sizeof(struct tile_cache));
+		if (!ch->tiles_in){
+			free(buf);
+			return false;
+		}
+		*ch->tiles_in = (struct tile_cache){0};
+	}
+	struct tile_cache* tc = ch->tiles_in;
+
+	bool ok = true;
+	size_t pos = 0;
+
+/* bounding box of the tiles actually touched, this is what gets marked */
+	size_t x1 = cont->w, y1 = cont->h, x2 = 0, y2 = 0;
+
+	while (pos + TILE_RECORD_SZ <= out_sz){
+		uint16_t tx, ty;
+		uint64_t hash;
+		unpack_u16(&tx, &buf[pos]);
+		unpack_u16(&ty, &buf[pos+2]);
+		uint8_t op = buf[pos+4];
+		unpack_u64(&hash, &buf[pos+5]);
+		pos += TILE_RECORD_SZ;
+
+		size_t x = (size_t) tx * TILE_SIZE;
+		size_t y = (size_t) ty * TILE_SIZE;
+		if (x >= cont->w || y >= cont->h){
+			a12int_trace(A12_TRACE_SYSTEM,
+				"kind=error:codec=dtile:message=tile out of bounds:x=%zu:y=%zu", x, y);
+			ok = false;
+			break;
+		}
+
+		size_t tw = x + TILE_SIZE > cont->w ? cont->w - x : TILE_SIZE;
+		size_t th = y + TILE_SIZE > cont->h ? cont->h - y : TILE_SIZE;
+		size_t slot = hash % TILE_CACHE_SLOTS;
+
+		x1 = x < x1 ? x : x1;
+		y1 = y < y1 ? y : y1;
+		x2 = x + tw > x2 ? x + tw : x2;
+		y2 = y + th > y2 ? y + th : y2;
+
+		if (op == TILE_OP_CACHED){
+			if (tc->slot_hash[slot] != hash || !tc->slot_px[slot] ||
+				tc->slot_w[slot] != tw || tc->slot_h[slot] != th){
+				a12int_trace(A12_TRACE_VIDEO,
+					"kind=error:codec=dtile:message=cache miss:slot=%zu", slot);
+				ok = false;
+				break;
+			}
+			tile_blit(cont, x, y, tw, th, tc->slot_px[slot]);
+			continue;
+		}
+
+		size_t nb = tw * th * 3;
+		if (op != TILE_OP_NEW || pos + nb > out_sz){
+			a12int_trace(A12_TRACE_SYSTEM, "kind=error:codec=dtile:message=short tile");
+			ok = false;
+			break;
+		}
+
+		if (!tc->slot_px[slot])
+			tc->slot_px[slot] = malloc(TILE_SIZE * TILE_SIZE * 3);
+
+		if (tc->slot_px[slot]){
+			memcpy(tc->slot_px[slot], &buf[pos], nb);
+			tc->slot_hash[slot] = hash;
+			tc->slot_w[slot] = tw;
+			tc->slot_h[slot] = th;
+		}
+		else
+			tc->slot_hash[slot] = 0;
+
+		tile_blit(cont, x, y, tw, th, &buf[pos]);
+		pos += nb;
+	}
+
+	free(buf);
+
+	if (x2 > x1 && y2 > y1){
+		cvf->x = x1;
+		cvf->y = y1;
+		cvf->w = x2 - x1;
+		cvf->h = y2 - y1;
+	}
+	else
+		cvf->w = cvf->h = 0;
+
+	return ok;
+}
+
+struct inflate_band {
+	struct video_frame vf;
+	struct arcan_shmif_cont* cont;
+	uint8_t* in;
+	size_t in_sz;
+};
+
+static void inflate_band(void* tag)
+{
+	struct inflate_band* band = tag;
+	size_t in_sz = band->in_sz;
+	tinfl_decompress_mem_to_callback(band->in, &in_sz, video_miniz,
+		&(struct miniz_dst){.cvf = &band->vf, .cont = band->cont}, 0);
+}
+
+/*
+ * Each band is an independent DEFLATE stream that covers a range of rows,
+ * give each its own copy of the unpack state with the output offset moved
+ * to the first row of the band and let the workers have at it.
+ */
+static void video_miniz_bands(
+	struct video_frame* cvf, struct arcan_shmif_cont* cont)
+{
+	size_t n = cvf->inbuf_pos ? cvf->inbuf[0] : 0;
+	size_t ofs = 1 + n * 4;
+
+	if (!n || n > VFRAME_MAX_BANDS || n > cvf->h ||
+		ofs > cvf->inbuf_pos || (size_t) cvf->w * cvf->h * 3 > cvf->expanded_sz){
+		a12int_trace(A12_TRACE_SYSTEM,
+			"kind=error:codec=deflate:message=bad band header:bands=%zu", n);
+		return;
+	}
+
+	struct inflate_band bands[VFRAME_MAX_BANDS];
+	size_t band_rows = (cvf->h + n - 1) / n;
+
+	for (size_t i = 0; i < n; i++){
+		uint32_t len;
+		unpack_u32(&len, &cvf->inbuf[1 + i * 4]);
+
+		size_t y = i * band_rows;
+		if (len > cvf->inbuf_pos - ofs || y >= cvf->h){
+			a12int_trace(A12_TRACE_SYSTEM,
+				"kind=error:codec=deflate:message=bad band:index=%zu", i);
+			return;
+		}
+
+		size_t rows = y + band_rows > cvf->h ? cvf->h - y : band_rows;
+		bands[i] = (struct inflate_band){
+			.vf = *cvf,
+			.cont = cont,
+			.in = &cvf->inbuf[ofs],
+			.in_sz = len
+		};
+		bands[i].vf.out_pos = cvf->out_pos + y * cont->pitch;
+		bands[i].vf.row_left = cvf->w;
+		bands[i].vf.expanded_sz = rows * cvf->w * 3;
+		bands[i].vf.carry = 0;
+		ofs += len;
+	}
+
+	a12int_trace(A12_TRACE_VDETAIL, "kind=status:codec=deflate:bands=%zu", n);
+	a12int_pool_run(inflate_band, bands, sizeof(struct inflate_band), n);
+}
+
+/*
+ * A full-width frame covers one contiguous range of the shmif buffer, so the
+ * packed RGB can be decompressed into the tail of that range and expanded
+ * towards the front. Pixel n is read from byte npx + n * 3 and written to
+ * bytes n * 4 .. n * 4 + 3, which never passes the next unread one.
+ */
+static bool video_lz_direct(
+	struct video_frame* cvf, struct arcan_shmif_cont* cont, bool* ok)
+{
+	size_t npx = (size_t) cvf->w * cvf->h;
+	if (cvf->x || cvf->w != cont->pitch || cvf->expanded_sz != npx * 3 ||
+		cvf->out_pos + npx > cont->pitch * cont->h)
+		return false;
+
+	shmif_pixel* dst = &cont->vidp[cvf->out_pos];
+	uint8_t* rgb = (uint8_t*) dst + npx;
+	size_t out_sz;
+
+	*ok = a12int_lz_decompress(
+		cvf->inbuf, cvf->inbuf_pos, rgb, npx * 3, &out_sz) && out_sz == npx * 3;
+
+	if (!*ok){
+		a12int_trace(A12_TRACE_SYSTEM, "kind=error:codec=lz:message=corrupt block");
+		return true;
+	}
+
+	for (size_t i = 0; i < npx; i++, rgb += 3)
+		dst[i] = SHMIF_RGBA(rgb[0], rgb[1], rgb[2], 0xff);
+
+	a12int_trace(A12_TRACE_VDETAIL, "kind=status:codec=lz:direct=%zu", npx);
+	return true;
+}
+
+/*
+ * Unlike inflate, the LZ stage has no streaming interface, so unless the
+ * frame can be unpacked in place it goes to a temporary buffer and then
+ * through the same pixel unpacking. Deltas always take that route as the
+ * previous contents is needed until the XOR has been applied.
+ */
+static bool video_lz(struct video_frame* cvf, struct arcan_shmif_cont* cont)
+{
+	bool ok;
+	if (cvf->postprocess == POSTPROCESS_VIDEO_LZ && video_lz_direct(cvf, cont, &ok))
+		return ok;
+
+	uint8_t* buf = malloc(cvf->expanded_sz);
+	if (!buf){
+		a12int_trace(A12_TRACE_ALLOC,
+			"kind=error:codec=lz:message=couldn't alloc %zu", (size_t) cvf->expanded_sz);
+		return false;
+	}
+
+	size_t out_sz;
+	ok = a12int_lz_decompress(
+		cvf->inbuf, cvf->inbuf_pos, buf, cvf->expanded_sz, &out_sz);
+
+	if (ok)
+		video_miniz(buf, out_sz, &(struct miniz_dst){.cvf = cvf, .cont = cont});
+	else
+		a12int_trace(A12_TRACE_SYSTEM, "kind=error:codec=lz:message=corrupt block");
+
+	free(buf);
+	return ok;
+}
+
 #ifdef WANT_H264_DEC
 
 void ffmpeg_decode_pkt(
@@ -173,18 +747,28 @@ void ffmpeg_decode_pkt(
 
 		a12int_trace(A12_TRACE_VIDEO,
 			"ffmpeg:kind=convert:commit=%d:format=yub420p", cvf->commit);
-/* Quite possible that we should actually cache this context as well, but it
- * has different behavior to the rest due to resize. Since this all turns
- * ffmpeg into a dependency, maybe it belongs in the vframe setup on resize. */
-		struct SwsContext* scaler =
-			sws_getContext(cvf->w, cvf->h, AV_PIX_FMT_YUV420P,
-				cvf->w, cvf->h, AV_PIX_FMT_BGRA, SWS_BILINEAR, NULL, NULL, NULL);
-
-		uint8_t* const dst[] = {cont->vidb};
+
+/* The scaler is kept with the channel and only rebuilt when the dimensions
+ * change (getCachedContext compares), the conversion writes directly into the
+ * mapped shmif buffer at the frame offset and segment stride. */
+		struct a12_channel* ch = &S->channels[S->in_channel];
+		ch->dec_scaler = sws_getCachedContext(ch->dec_scaler,
+			cvf->w, cvf->h, AV_PIX_FMT_YUV420P,
+			cvf->w, cvf->h, AV_PIX_FMT_BGRA, SWS_BILINEAR, NULL, NULL, NULL);
+
+		if (!ch->dec_scaler ||
+			cvf->x + cvf->w > cont->w || cvf->y + cvf->h > cont->h){
+			a12int_trace(A12_TRACE_SYSTEM, "ffmpeg:kind=error:message=bad scaler or region");
+			a12_vstream_cancel(S, S->in_channel, VSTREAM_CANCEL_DECODE_ERROR);
+			return;
+		}
+
+		uint8_t* const dst[] = {(uint8_t*) &cont->vidp[cvf->out_pos]};
 		int dst_stride[] = {cont->stride};
 
-		sws_scale(scaler, (const uint8_t* const*) cvf->ffmpeg.frame->data,
+		sws_scale(ch->dec_scaler, (const uint8_t* const*) cvf->ffmpeg.frame->data,
 			cvf->ffmpeg.frame->linesize, 0, cvf->h, dst, dst_stride);
+		mark_dirty(ch, cvf, cont);
 
 /* So if a packet contains multiple frames, we should use the vsignal- to milk
  * more data out of this beforehand or establish a framequeue (start by just
@@ -192,9 +776,7 @@ void ffmpeg_decode_pkt(
  * producer side to get better frame pacing vs. playback - can do this on the
  * first buffer - synch mismatch though */
 		if (cvf->commit && cvf->commit != 255)
-			drain_video(&S->channels[S->in_channel], cvf);
-
-		sws_freeContext(scaler);
+			drain_video(S, ch, cvf);
 	}
 }
 
@@ -271,7 +853,7 @@ bool a12int_vframe_setup(struct a12_channel* ch, struct video_frame* dst, int me
 		dst->ffmpeg.packet = ch->videnc.packet;
 		dst->ffmpeg.frame = ch->videnc.frame;
 		dst->ffmpeg.parser = ch->videnc.parser;
-		dst->ffmpeg.scaler = ch->videnc.scaler;
+		dst->ffmpeg.scaler = ch->dec_scaler;
 
 #else
 		return false;
@@ -287,18 +869,82 @@ void a12int_decode_vbuffer(struct a12_state* S,
 	if (cvf->postprocess == POSTPROCESS_VIDEO_MINIZ ||
 			cvf->postprocess == POSTPROCESS_VIDEO_DMINIZ ||
 			cvf->postprocess == POSTPROCESS_VIDEO_TZ){
-		size_t inbuf_pos = cvf->inbuf_pos;
-		tinfl_decompress_mem_to_callback(cvf->inbuf, &inbuf_pos, video_miniz, S, 0);
+		if (cvf->postprocess != POSTPROCESS_VIDEO_TZ &&
+			(cvf->flags & VFRAME_DATAFLAG_BANDS)){
+			video_miniz_bands(cvf, cont);
+		}
+		else {
+			size_t inbuf_pos = cvf->inbuf_pos;
+			tinfl_decompress_mem_to_callback(cvf->inbuf, &inbuf_pos,
+				video_miniz, &(struct miniz_dst){.cvf = cvf, .cont = cont}, 0);
+		}
 
 		a12int_trace(A12_TRACE_ALLOC, "freeing zlib/png input block");
 		free(cvf->inbuf);
 		cvf->inbuf = NULL;
 		cvf->carry = 0;
+		mark_dirty(ch, cvf, cont);
 
 /* this is a junction where other local transfer strategies should be considered,
  * i.e. no-block and defer process on the next stepframe or spin on the vready */
 		if (cvf->commit && cvf->commit != 255){
-			drain_video(ch, cvf);
+			drain_video(S, ch, cvf);
+		}
+		return;
+	}
+	else if (cvf->postprocess == POSTPROCESS_VIDEO_TZS){
+		bool skip;
+		bool ok = video_tzs(ch, cvf, cont, &skip);
+		free(cvf->inbuf);
+		cvf->inbuf = NULL;
+
+		if (!ok){
+			a12_vstream_cancel(S, S->in_channel, VSTREAM_CANCEL_DECODE_ERROR);
+			return;
+		}
+
+		if (!skip)
+			mark_dirty(ch, cvf, cont);
+
+		if (!skip && cvf->commit && cvf->commit != 255){
+			drain_video(S, ch, cvf);
+		}
+		return;
+	}
+	else if (cvf->postprocess == POSTPROCESS_VIDEO_LZ ||
+		cvf->postprocess == POSTPROCESS_VIDEO_DLZ){
+		bool ok = video_lz(cvf, cont);
+		free(cvf->inbuf);
+		cvf->inbuf = NULL;
+		cvf->carry = 0;
+
+		if (!ok){
+			a12_vstream_cancel(S, S->in_channel, VSTREAM_CANCEL_DECODE_ERROR);
+			return;
+		}
+
+		mark_dirty(ch, cvf, cont);
+		if (cvf->commit && cvf->commit != 255){
+			drain_video(S, ch, cvf);
+		}
+		return;
+	}
+	else if (cvf->postprocess == POSTPROCESS_VIDEO_DTILE){
+		bool ok = video_dtile(S, ch, cvf, cont);
+		free(cvf->inbuf);
+		cvf->inbuf = NULL;
+
+/* the source will reset and send all tiles again on the next frame, our cache
+ * contents is still valid so there is no need to drop that */
+		if (!ok){
+			a12_vstream_cancel(S, S->in_channel, VSTREAM_CANCEL_DECODE_ERROR);
+			return;
+		}
+
+/* the frame region has been narrowed to the tiles that changed */
+		mark_dirty(ch, cvf, cont);
+		if (cvf->commit && cvf->commit != 255){
+			drain_video(S, ch, cvf);
 		}
 		return;
 	}
@@ -367,28 +1013,10 @@ void a12int_unpack_vbuffer(struct a12_state* S,
  * we can just do it here - no need for the more complex stages like for
  * 264, ... */
 	if (cvf->postprocess == POSTPROCESS_VIDEO_RGBA){
-		for (size_t i = 0; i < S->decode_pos; i += 4){
-			cont->vidp[cvf->out_pos++] = SHMIF_RGBA(
-				S->decode[i+0], S->decode[i+1], S->decode[i+2], S->decode[i+3]);
-			cvf->row_left--;
-			if (cvf->row_left == 0){
-				cvf->out_pos -= cvf->w;
-				cvf->out_pos += cont->pitch;
-				cvf->row_left = cvf->w;
-			}
-		}
+		unpack_rgba(cvf, cont, S->decode, S->decode_pos / 4);
 	}
 	else if (cvf->postprocess == POSTPROCESS_VIDEO_RGB){
-		for (size_t i = 0; i < S->decode_pos; i += 3){
-			cont->vidp[cvf->out_pos++] = SHMIF_RGBA(
-				S->decode[i+0], S->decode[i+1], S->decode[i+2], 0xff);
-			cvf->row_left--;
-			if (cvf->row_left == 0){
-				cvf->out_pos -= cvf->w;
-				cvf->out_pos += cont->pitch;
-				cvf->row_left = cvf->w;
-			}
-		}
+		unpack_rgb(cvf, cont, S->decode, S->decode_pos / 3, false);
 	}
 	else if (cvf->postprocess == POSTPROCESS_VIDEO_RGB565){
 		static const uint8_t rgb565_lut5[] = {
@@ -428,8 +1056,9 @@ void a12int_unpack_vbuffer(struct a12_state* S,
 	if (cvf->inbuf_sz == 0){
 		a12int_trace(A12_TRACE_VIDEO,
 			"video frame completed, commit:%"PRIu8, cvf->commit);
+		mark_dirty(&S->channels[S->in_channel], cvf, cont);
 		if (cvf->commit){
-			arcan_shmif_signal(cont, SHMIF_SIGVID);
+			a12int_signal(S, &S->channels[S->in_channel], SHMIF_SIGVID);
 		}
 	}
 	else {
@@ -10,10 +10,13 @@
 #include <inttypes.h>
 #include <string.h>
 #include <math.h>
+#include <time.h>
 
 #include "a12.h"
 #include "a12_int.h"
 #include "a12_encode.h"
+#include "a12_pool.h"
+#include "a12_lz.h"
 
 /*
  * create the control packet
@@ -78,41 +81,87 @@ static void chunk_pack(struct a12_state* S, int type,
 		a12int_append_out(S, type, &buf[n_chunks * chunk_sz], left, outb, sizeof(outb));
 }
 
+static void a12int_aframehdr_build(uint8_t buf[CONTROL_PACKET_SIZE],
+	uint64_t last_seen, uint8_t chid, uint8_t channels,
+	int encoding, uint16_t n_frames, uint32_t rate)
+{
+	a12int_trace(A12_TRACE_AUDIO,
+		"kind=header:ch=%"PRIu8":encoding=%d:channels=%"PRIu8
+		":frames=%"PRIu16":rate=%"PRIu32,
+		chid, encoding, channels, n_frames, rate
+	);
+
+	memset(buf, '\0', CONTROL_PACKET_SIZE);
+	pack_u64(last_seen, &buf[0]);
+	buf[16] = chid; /* [16] : channel-id */
+	buf[17] = COMMAND_AUDIOFRAME; /* [17] : command */
+	pack_u32(0, &buf[18]); /* [18..21] : stream-id */
+	buf[22] = channels; /* [22] : channels */
+	buf[23] = encoding; /* [23] : encoding */
+	pack_u16(n_frames, &buf[24]); /* [24..25] : samples per channel */
+	pack_u32(rate, &buf[26]); /* [26..29] : samplerate */
+}
+
 void a12int_encode_araw(struct a12_state* S,
 	uint8_t chid,
 	shmif_asample* buf,
-	uint16_t n_samples,
+	uint16_t n_frames,
 	struct a12_aframe_cfg cfg,
 	struct a12_aframe_opts opts, size_t chunk_sz)
 {
+	size_t n_samples = (size_t) n_frames * cfg.channels;
+
+/* older peers would take the ADPCM stream as S16 and play it as noise */
+	if (opts.method == AFRAME_METHOD_ADPCM &&
+		!(S->remote_features & FEATURE_AUDIO_ADPCM))
+		opts.method = AFRAME_METHOD_RAW;
+
+	if (opts.method == AFRAME_METHOD_ADPCM && cfg.channels <= A12_AUDIO_MAXCH){
+		size_t out_sz = a12int_adpcm_size(n_frames, cfg.channels);
+		uint8_t* outb = malloc(out_sz);
+		if (!outb){
+			a12int_trace(A12_TRACE_ALLOC,
+				"failed to alloc %zu for adpcm", out_sz);
+			return;
+		}
+
+/* the channel keeps the predictor going between frames, each block still
+ * carries the state it starts from so the decoder doesn't need any */
+		size_t nb = a12int_adpcm_encode(
+			S->channels[chid].adpcm_out, buf, n_frames, cfg.channels, outb);
+
+		uint8_t hdr_buf[CONTROL_PACKET_SIZE];
+		a12int_aframehdr_build(hdr_buf, S->last_seen_seqnr, chid,
+			cfg.channels, POSTPROCESS_AUDIO_ADPCM, n_frames, cfg.samplerate);
+		a12int_append_out(S,
+			STATE_CONTROL_PACKET, hdr_buf, CONTROL_PACKET_SIZE, NULL, 0);
+		chunk_pack(S, STATE_AUDIO_PACKET, chid, outb, nb, chunk_sz);
+		free(outb);
+		return;
+	}
+
 /* repack the audio into a temporary buffer for format reasons */
-	size_t hdr_sz = a12int_header_size(STATE_AUDIO_PACKET);
-	size_t buf_sz = hdr_sz + n_samples * sizeof(uint16_t) * cfg.channels;
-	uint8_t* outb = malloc(hdr_sz + buf_sz);;
+	size_t buf_sz = n_samples * sizeof(int16_t);
+	uint8_t* outb = malloc(buf_sz);
 	if (!outb){
 		a12int_trace(A12_TRACE_ALLOC,
 			"failed to alloc %zu for s16aud", buf_sz);
 		return;
 	}
 
-/* audio control message header */
-	outb[16] = chid;
-	outb[17] = COMMAND_AUDIOFRAME;
-	pack_u32(0, &outb[18]); /* stream-id */
-	outb[22] = cfg.channels; /* channels */
-	outb[23] = 0; /* encoding, u16 */
-	pack_u16(n_samples, &outb[24]);
-
 /* repack into the right format (note, need _Generic on asample) */
-	size_t pos = hdr_sz;
-	for (size_t i = 0; i < n_samples; i++, pos += 2){
-		pack_s16(buf[i], &outb[pos]);
+	for (size_t i = 0; i < n_samples; i++){
+		pack_s16(buf[i], &outb[i * 2]);
 	}
 
+	uint8_t hdr_buf[CONTROL_PACKET_SIZE];
+	a12int_aframehdr_build(hdr_buf, S->last_seen_seqnr, chid,
+		cfg.channels, POSTPROCESS_AUDIO_S16, n_frames, cfg.samplerate);
+
 /* then split it up (though likely we get fed much smaller chunks) */
 	a12int_append_out(S,
-		STATE_CONTROL_PACKET, outb, CONTROL_PACKET_SIZE, NULL, 0);
-	chunk_pack(S, STATE_AUDIO_PACKET, chid, &outb[hdr_sz], pos - hdr_sz, chunk_sz);
+		STATE_CONTROL_PACKET, hdr_buf, CONTROL_PACKET_SIZE, NULL, 0);
+	chunk_pack(S, STATE_AUDIO_PACKET, chid, outb, buf_sz, chunk_sz);
 	free(outb);
 }
 
@@ -326,23 +375,17 @@ void a12int_encode_rgb(PACK_ARGS)
 	size_t left = ((w * h) - (blocks * ppb)) * px_sz;
 	if (left){
 		pack_u16(left, &outb[5]);
-/* sweep the incoming frame, and pack maximum block size */
-		size_t row_len = w;
-		for (size_t i = 0; i < blocks; i++){
-			for (size_t j = 0; j < bpb; j += px_sz){
-				uint8_t ign;
-				uint8_t* dst = &outb[hdr_sz+j];
-				SHMIF_RGBA_DECOMP(inbuf[pos++], &dst[0], &dst[1], &dst[2], &ign);
-				row_len--;
-				if (row_len == 0){
-					pos += vb->pitch - w;
-					row_len = w;
-				}
-/* dispatch to out-queue(s) */
+		for (size_t i = 0; i < left; i += px_sz){
+			uint8_t ign;
+			uint8_t* dst = &outb[hdr_sz+i];
+			SHMIF_RGBA_DECOMP(inbuf[pos++], &dst[0], &dst[1], &dst[2], &ign);
+			row_len--;
+			if (row_len == 0){
+				pos += vb->pitch - w;
+				row_len = w;
 			}
-
-			a12int_append_out(S, STATE_VIDEO_PACKET, outb, hdr_sz + left, NULL, 0);
 		}
+		a12int_append_out(S, STATE_VIDEO_PACKET, outb, hdr_sz + left, NULL, 0);
 	}
 
 	free(outb);
@@ -351,11 +394,256 @@ void a12int_encode_rgb(PACK_ARGS)
 struct compress_res {
 	bool ok;
 	uint8_t type;
+	uint8_t flags;
 	size_t in_sz;
 	size_t out_sz;
 	uint8_t* out_buf;
+	uint64_t ns;
+};
+
+static uint64_t time_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static uint8_t* compress_lz(
+	uint8_t* in, size_t in_sz, size_t* out_sz, bool store)
+{
+	uint8_t* out = malloc(a12int_lz_bound(in_sz));
+	if (!out)
+		return NULL;
+
+	*out_sz = a12int_lz_compress(in, in_sz, out, store);
+	return out;
+}
+
+struct deflate_band {
+	uint8_t* in;
+	size_t in_sz;
+	uint8_t* out;
+	size_t out_sz;
 };
 
+static void deflate_band(void* tag)
+{
+	struct deflate_band* band = tag;
+	band->out = tdefl_compress_mem_to_heap(band->in, band->in_sz, &band->out_sz, 0);
+}
+
+/*
+ * DEFLATE is inherently serial, so for larger inputs split on row boundaries
+ * and compress each band on its own in the worker pool. This loses matches
+ * across band boundaries, but that is a small cost compared to the latency.
+ * See VFRAME_DATAFLAG_BANDS in a12_int.h for the layout, [S] decides if the
+ * other side has announced that it can decode it.
+ */
+static uint8_t* compress_rows(struct a12_state* S, uint8_t* in,
+	size_t row_sz, size_t rows, size_t* out_sz, uint8_t* flags)
+{
+	size_t in_sz = row_sz * rows;
+	size_t n = (S->remote_features & FEATURE_VFRAME_BANDS) ? a12int_pool_size() : 1;
+	if (n > VFRAME_MAX_BANDS)
+		n = VFRAME_MAX_BANDS;
+	if (n > rows)
+		n = rows;
+
+	*flags = 0;
+	if (in_sz < VFRAME_BAND_THRESHOLD || n < 2)
+		return tdefl_compress_mem_to_heap(in, in_sz, out_sz, 0);
+
+/* recalculate so that there are no empty bands at the end */
+	size_t band_rows = (rows + n - 1) / n;
+	n = (rows + band_rows - 1) / band_rows;
+
+	struct deflate_band bands[VFRAME_MAX_BANDS];
+	for (size_t i = 0; i < n; i++){
+		size_t nr = band_rows;
+		if ((i + 1) * band_rows > rows)
+			nr = rows - i * band_rows;
+
+		bands[i] = (struct deflate_band){
+			.in = &in[i * band_rows * row_sz],
+			.in_sz = nr * row_sz
+		};
+	}
+
+	a12int_pool_run(deflate_band, bands, sizeof(struct deflate_band), n);
+
+	size_t total = 1 + n * 4;
+	bool ok = true;
+	for (size_t i = 0; i < n; i++){
+		ok = ok && bands[i].out;
+		total += bands[i].out_sz;
+	}
+
+	uint8_t* out = ok ? malloc(total) : NULL;
+	if (out){
+		out[0] = n;
+		size_t pos = 1 + n * 4;
+		for (size_t i = 0; i < n; i++){
+			pack_u32(bands[i].out_sz, &out[1 + i * 4]);
+			memcpy(&out[pos], bands[i].out, bands[i].out_sz);
+			pos += bands[i].out_sz;
+		}
+		*out_sz = total;
+		*flags = VFRAME_DATAFLAG_BANDS;
+	}
+
+	for (size_t i = 0; i < n; i++)
+		free(bands[i].out);
+
+	a12int_trace(A12_TRACE_VDETAIL,
+		"kind=status:codec=deflate:bands=%zu:b_in=%zu:b_out=%zu", n, in_sz, total);
+
+	return out;
+}
+
+static size_t tzs_style_run(
+	struct tpack_stream* ts, uint8_t* out, uint64_t style, size_t count)
+{
+	size_t pos = 0;
+	out[pos++] = count - 1;
+
+	for (size_t i = 0; i < TZS_PALETTE; i++){
+		if (ts->palette[i] == style){
+			out[pos++] = i;
+			return pos;
+		}
+	}
+
+/* the decoder mirrors the replacement when it sees the literal */
+	out[pos++] = TZS_LITERAL;
+	pack_u64(style, &out[pos]);
+	ts->palette[ts->pal_next] = style;
+	ts->pal_next = (ts->pal_next + 1) % TZS_PALETTE;
+
+	return pos + 8;
+}
+
+/*
+ * Build the transformed frame (see TZS in a12_int.h) into ts->buf, the input
+ * has already been validated to match the header line and cell counts, but
+ * the per-line cell counts still needs to be checked.
+ */
+static size_t tzs_transform(struct tpack_stream* ts,
+	uint8_t* in, size_t in_sz, size_t n_lines, size_t n_cells)
+{
+	size_t bound =
+		TZS_HEADER_SZ + n_lines * TZS_LINE_SZ + n_cells * TZS_CELL_MAX;
+
+	if (!a12int_tzs_reserve(&ts->buf, &ts->buf_sz, bound) ||
+		!a12int_tzs_reserve(&ts->lines, &ts->lines_cap, n_lines * TZS_LINE_SZ))
+		return 0;
+
+	uint8_t* out = ts->buf;
+	memcpy(out, in, TZS_HEADER_SZ);
+	size_t pos = TZS_HEADER_SZ;
+
+/* line headers against the last frame, the typical delta frame is the same
+ * handful of lines as the one before */
+	size_t ofs = TZS_HEADER_SZ;
+	size_t sum = 0;
+	for (size_t i = 0; i < n_lines; i++){
+		uint16_t ncells;
+		unpack_u16(&ncells, &in[ofs + 2]);
+		sum += ncells;
+		if (sum > n_cells)
+			return 0;
+
+		for (size_t j = 0; j < TZS_LINE_SZ; j++)
+			out[pos++] = in[ofs + j] ^ (i < ts->n_lines ? ts->lines[i * TZS_LINE_SZ + j] : 0);
+
+		ofs += TZS_LINE_SZ + ncells * TZS_CELL_SZ;
+	}
+
+	if (sum != n_cells || ofs != in_sz)
+		return 0;
+
+/* styles as runs of palette references */
+	uint64_t cur = 0;
+	size_t run = 0;
+	ofs = TZS_HEADER_SZ;
+	for (size_t i = 0; i < n_lines; i++){
+		uint16_t ncells;
+		unpack_u16(&ncells, &in[ofs + 2]);
+		uint8_t* cell = &in[ofs + TZS_LINE_SZ];
+
+		for (size_t j = 0; j < ncells; j++, cell += TZS_CELL_SZ){
+			uint64_t style;
+			unpack_u64(&style, cell);
+			if (run && style == cur && run < 256){
+				run++;
+				continue;
+			}
+			if (run)
+				pos += tzs_style_run(ts, &out[pos], cur, run);
+			cur = style;
+			run = 1;
+		}
+
+		memcpy(&ts->lines[i * TZS_LINE_SZ], &in[ofs], TZS_LINE_SZ);
+		ofs += TZS_LINE_SZ + ncells * TZS_CELL_SZ;
+	}
+	if (run)
+		pos += tzs_style_run(ts, &out[pos], cur, run);
+	ts->n_lines = n_lines;
+
+/* and the glyphs, mostly ASCII so mostly a byte each */
+	ofs = TZS_HEADER_SZ;
+	for (size_t i = 0; i < n_lines; i++){
+		uint16_t ncells;
+		unpack_u16(&ncells, &in[ofs + 2]);
+		uint8_t* cell = &in[ofs + TZS_LINE_SZ];
+
+		for (size_t j = 0; j < ncells; j++, cell += TZS_CELL_SZ){
+			uint32_t cp;
+			unpack_u32(&cp, &cell[8]);
+			while (cp >= 0x80){
+				out[pos++] = (cp & 0x7f) | 0x80;
+				cp >>= 7;
+			}
+			out[pos++] = cp;
+		}
+
+		ofs += TZS_LINE_SZ + ncells * TZS_CELL_SZ;
+	}
+
+	return pos;
+}
+
+static struct tpack_stream* tpack_stream_out(
+	struct a12_state* S, uint8_t ch, bool* reset)
+{
+	struct tpack_stream* ts = S->channels[ch].tpack_out;
+	*reset = false;
+	if (ts)
+		return ts;
+
+	ts = malloc(sizeof(struct tpack_stream));
+	if (!ts)
+		return NULL;
+	*ts = (struct tpack_stream){0};
+
+/* raw deflate, the frame boundaries come from the vframe header */
+	if (MZ_OK != mz_deflateInit2(&ts->zs, MZ_BEST_SPEED,
+		MZ_DEFLATED, -MZ_DEFAULT_WINDOW_BITS, 9, MZ_DEFAULT_STRATEGY)){
+		free(ts);
+		return NULL;
+	}
+
+	a12int_trace(A12_TRACE_VIDEO, "kind=status:ch=%d:codec=tzs:message=reset", ch);
+	S->channels[ch].tpack_out = ts;
+	*reset = true;
+	return ts;
+}
+
+void a12int_encode_tz_reset(struct a12_state* S, int chid)
+{
+	a12int_tpack_stream_free(&S->channels[chid].tpack_out, true);
+}
+
 static struct compress_res compress_tz(struct a12_state* S,
 	uint8_t ch, struct shmifsrv_vbuffer* vb)
 {
@@ -373,28 +661,78 @@ static struct compress_res compress_tz(struct a12_state* S,
 	unpack_u16(&n_cells, &vb->buffer_bytes[6]);
 
 /* line-header size (2 + 2 + 2 + 3 = 9 bytes), cell size = 12 bytes) */
-	if (compress_in_sz != n_lines * 9 + n_cells * 12 + 16){
+	if (compress_in_sz !=
+		n_lines * TZS_LINE_SZ + n_cells * TZS_CELL_SZ + TZS_HEADER_SZ){
 		a12int_trace(A12_TRACE_SYSTEM, "kind=error:message=corrupt TPACK buffer");
 		return (struct compress_res){};
 	}
 
-/* all the cell attributes and colors etc. lend themselves well to
- * compression, so lets go ahead with miniz */
-	size_t out_sz;
-	uint8_t* buf = tdefl_compress_mem_to_heap(
-		vb->buffer_bytes, compress_in_sz, &out_sz, 0);
+/* a peer that hasn't announced TZS gets each buffer compressed on its own */
+	if (!(S->remote_features & FEATURE_VFRAME_TZS)){
+		size_t out_sz;
+		uint8_t* buf = tdefl_compress_mem_to_heap(
+			vb->buffer_bytes, compress_in_sz, &out_sz, 0);
+
+		if (!buf){
+			a12int_trace(A12_TRACE_ALLOC, "failed to build compressed TPACK output");
+			return (struct compress_res){};
+		}
+
+		return (struct compress_res){
+			.type = POSTPROCESS_VIDEO_TZ,
+			.ok = true,
+			.out_buf = buf,
+			.out_sz = out_sz,
+			.in_sz = compress_in_sz
+		};
+	}
+
+	bool reset;
+	struct tpack_stream* ts = tpack_stream_out(S, ch, &reset);
+	if (!ts){
+		a12int_trace(A12_TRACE_ALLOC, "kind=error:codec=tzs:message=stream alloc");
+		return (struct compress_res){};
+	}
+
+/* the palette and line table have been updated at this stage so a failure
+ * past here means that the stream has to be restarted */
+	size_t tz_sz = tzs_transform(
+		ts, vb->buffer_bytes, compress_in_sz, n_lines, n_cells);
+	if (!tz_sz){
+		a12int_trace(A12_TRACE_SYSTEM, "kind=error:codec=tzs:message=bad line table");
+		a12int_encode_tz_reset(S, ch);
+		return (struct compress_res){};
+	}
 
+/* the sync flush adds an empty stored block (5 bytes) on top of the bound */
+	size_t out_cap = mz_deflateBound(&ts->zs, tz_sz) + 16;
+	uint8_t* buf = malloc(out_cap);
 	if (!buf){
 		a12int_trace(A12_TRACE_ALLOC, "failed to build compressed TPACK output");
+		a12int_encode_tz_reset(S, ch);
+		return (struct compress_res){};
+	}
+
+	ts->zs.next_in = ts->buf;
+	ts->zs.avail_in = tz_sz;
+	ts->zs.next_out = buf;
+	ts->zs.avail_out = out_cap;
+
+	int rv = mz_deflate(&ts->zs, MZ_SYNC_FLUSH);
+	if (rv != MZ_OK || ts->zs.avail_in || !ts->zs.avail_out){
+		a12int_trace(A12_TRACE_SYSTEM, "kind=error:codec=tzs:deflate=%d", rv);
+		free(buf);
+		a12int_encode_tz_reset(S, ch);
 		return (struct compress_res){};
 	}
 
 	return (struct compress_res){
-		.type = POSTPROCESS_VIDEO_TZ,
+		.type = POSTPROCESS_VIDEO_TZS,
+		.flags = reset ? VFRAME_DATAFLAG_RESET : 0,
 		.ok = true,
 		.out_buf = buf,
-		.out_sz = out_sz,
-		.in_sz = compress_in_sz
+		.out_sz = out_cap - ts->zs.avail_out,
+		.in_sz = tz_sz
 	};
 }
 
@@ -409,9 +747,14 @@ void a12int_encode_tz(PACK_ARGS)
 		cres.type, 0, vb->w, vb->h, w, h, 0, 0,
 		cres.out_sz, cres.in_sz, 1
 	);
+	hdr_buf[35] = cres.flags; /* [35] : dataflags */
 
+	uint32_t tpack_sz;
+	unpack_u32(&tpack_sz, vb->buffer_bytes);
 	a12int_trace(A12_TRACE_VDETAIL,
-		"kind=status:codec=tpack:b_in=%zu:b_out=%zu", cres.in_sz, cres.out_sz
+		"kind=status:codec=tpack:b_in=%zu:b_tz=%zu:b_out=%zu:reset=%d",
+		(size_t) tpack_sz, cres.in_sz, cres.out_sz,
+		(cres.flags & VFRAME_DATAFLAG_RESET) ? 1 : 0
 	);
 
 	a12int_append_out(S,
@@ -422,9 +765,10 @@ void a12int_encode_tz(PACK_ARGS)
 }
 
 static struct compress_res compress_deltaz(struct a12_state* S, uint8_t ch,
-	struct shmifsrv_vbuffer* vb, size_t* x, size_t* y, size_t* w, size_t* h)
+	struct shmifsrv_vbuffer* vb, size_t* x, size_t* y, size_t* w, size_t* h,
+	int stage)
 {
-	int type;
+	bool iframe = false;
 	uint8_t* compress_in;
 	size_t compress_in_sz = 0;
 	struct shmifsrv_vbuffer* ab = &S->channels[ch].acc;
@@ -443,7 +787,7 @@ static struct compress_res compress_deltaz(struct a12_state* S, uint8_t ch,
 
 /* first, reset or no-delta mode, build accumulation buffer and copy */
 	if (!ab->buffer){
-		type = POSTPROCESS_VIDEO_MINIZ;
+		iframe = true;
 		*ab = *vb;
 		size_t nb = vb->w * vb->h * 3;
 		ab->buffer = malloc(nb);
@@ -508,37 +852,140 @@ static struct compress_res compress_deltaz(struct a12_state* S, uint8_t ch,
 				rs += 3;
 			}
 		}
-		type = POSTPROCESS_VIDEO_DMINIZ;
 	}
 
 	size_t out_sz;
+	uint8_t flags = 0;
+	uint8_t* buf;
+	int type;
 
-	uint8_t* buf = tdefl_compress_mem_to_heap(
-			compress_in, compress_in_sz, &out_sz, 0);
+	uint64_t start = time_ns();
+	if (stage == COMPRESS_DEFLATE){
+		type = iframe ? POSTPROCESS_VIDEO_MINIZ : POSTPROCESS_VIDEO_DMINIZ;
+		buf = compress_rows(S, compress_in, (*w) * 3, *h, &out_sz, &flags);
+	}
+	else {
+		type = iframe ? POSTPROCESS_VIDEO_LZ : POSTPROCESS_VIDEO_DLZ;
+		buf = compress_lz(compress_in, compress_in_sz, &out_sz, stage == COMPRESS_STORE);
+	}
 
 	return (struct compress_res){
 		.type = type,
+		.flags = flags,
 		.ok = buf != NULL,
 		.out_buf = buf,
 		.out_sz = out_sz,
-		.in_sz = compress_in_sz
+		.in_sz = compress_in_sz,
+		.ns = time_ns() - start
 	};
 }
 
-void a12int_encode_dpng(PACK_ARGS)
+/*
+ * Starting guesstimates, (ns / byte, out / in) for a mid-range core, these
+ * get replaced by measurements as soon as a stage has been used.
+ */
+static const float stage_defaults[COMPRESS_STAGE_COUNT][2] = {
+	[COMPRESS_STORE] = {0.2, 1.0},
+	[COMPRESS_LZ] = {5.0, 0.4},
+	[COMPRESS_DEFLATE] = {30.0, 0.25}
+};
+
+/* how often to try a stage that isn't being picked to refresh its estimate */
+#define COMPRESS_PROBE_INTERVAL 64
+
+/* link estimate when neither the caller nor the link state has one */
+#define COMPRESS_DEFAULT_MBIT 1000.0
+
+/*
+ * Pick the stage that is expected to get the frame across the fastest: the
+ * time spent compressing plus the time it takes to push the result through
+ * a link of the given bitrate. Decompression cost is not accounted for.
+ */
+static int pick_stage(
+	struct a12_state* S, struct a12_channel* ch, struct a12_vframe_opts opts)
+{
+	struct compress_stats* cs = &ch->cstats;
+	if (!cs->frames){
+		for (size_t i = 0; i < COMPRESS_STAGE_COUNT; i++){
+			cs->ns_per_byte[i] = stage_defaults[i][0];
+			cs->ratio[i] = stage_defaults[i][1];
+		}
+	}
+
+	cs->frames++;
+	if (cs->frames % COMPRESS_PROBE_INTERVAL == 0)
+		return (cs->frames / COMPRESS_PROBE_INTERVAL) % 2 ? COMPRESS_LZ : COMPRESS_DEFLATE;
+
+/* caller provided bitrate, then the link estimate, then assume a fast LAN */
+	float mbit = COMPRESS_DEFAULT_MBIT;
+	struct a12_link_estimate link = a12_link_estimate(S);
+	if (!opts.variable && opts.bitrate > 0)
+		mbit = opts.bitrate;
+	else if (link.rate_samples && link.mbit > 0)
+		mbit = link.mbit;
+	float link_ns = 8000.0 / mbit;
+
+	int best = COMPRESS_STORE;
+	float best_cost = 0;
+
+	for (size_t i = 0; i < COMPRESS_STAGE_COUNT; i++){
+		float cost = cs->ns_per_byte[i] + cs->ratio[i] * link_ns;
+		if (i == COMPRESS_STORE || cost < best_cost){
+			best = i;
+			best_cost = cost;
+		}
+	}
+
+	return best;
+}
+
+static void update_stage(
+	struct a12_channel* ch, int stage, struct compress_res* cres)
 {
-	struct compress_res cres = compress_deltaz(S, chid, vb, &x, &y, &w, &h);
+	if (!cres->in_sz)
+		return;
+
+	struct compress_stats* cs = &ch->cstats;
+	float nspb = (float) cres->ns / cres->in_sz;
+	float ratio = (float) cres->out_sz / cres->in_sz;
+
+/* weighted so that a single odd frame doesn't flip the decision */
+	cs->ns_per_byte[stage] = 0.75 * cs->ns_per_byte[stage] + 0.25 * nspb;
+	cs->ratio[stage] = 0.75 * cs->ratio[stage] + 0.25 * ratio;
+}
+
+void a12int_encode_dpng_reset(struct a12_state* S, int chid)
+{
+	struct shmifsrv_vbuffer* ab = &S->channels[chid].acc;
+	if (!ab->buffer)
+		return;
+
+	a12int_trace(A12_TRACE_VIDEO, "kind=status:ch=%d:codec=dpng:message=reset", chid);
+	free(ab->buffer);
+	free(S->channels[chid].compression);
+	ab->buffer = NULL;
+	S->channels[chid].compression = NULL;
+}
+
+static void encode_delta(PACK_ARGS, int stage)
+{
+	struct compress_res cres = compress_deltaz(S, chid, vb, &x, &y, &w, &h, stage);
 	if (!cres.ok)
 		return;
 
+	if (opts.method == VFRAME_METHOD_ADAPTIVE)
+		update_stage(&S->channels[chid], stage, &cres);
+
 	uint8_t hdr_buf[CONTROL_PACKET_SIZE];
 	a12int_vframehdr_build(hdr_buf, S->last_seen_seqnr, chid,
 		cres.type, 0, vb->w, vb->h, w, h, x, y,
 		cres.out_sz, cres.in_sz, 1
 	);
+	hdr_buf[35] = cres.flags; /* [35] : dataflags */
 
 	a12int_trace(A12_TRACE_VDETAIL,
-		"kind=status:codec=dpng:b_in=%zu:b_out=%zu", w * h * 3, cres.out_sz
+		"kind=status:codec=delta:stage=%d:b_in=%zu:b_out=%zu:ns=%"PRIu64,
+		stage, w * h * 3, cres.out_sz, cres.ns
 	);
 
 	a12int_append_out(S,
@@ -548,6 +995,211 @@ void a12int_encode_dpng(PACK_ARGS)
 	free(cres.out_buf);
 }
 
+void a12int_encode_dpng(PACK_ARGS)
+{
+	encode_delta(FWD_ARGS, COMPRESS_DEFLATE);
+}
+
+void a12int_encode_dlz(PACK_ARGS)
+{
+	encode_delta(FWD_ARGS, COMPRESS_LZ);
+}
+
+void a12int_encode_adaptive(PACK_ARGS)
+{
+	encode_delta(FWD_ARGS, pick_stage(S, &S->channels[chid], opts));
+}
+
+/*
+ * Alpha is ignored as the sink side always unpacks to opaque RGB, the tile
+ * dimensions are part of the seed so edge tiles never match inner ones.
+ */
+static uint64_t tile_hash(struct shmifsrv_vbuffer* vb,
+	size_t x, size_t y, size_t w, size_t h)
+{
+	uint64_t hash = 0x9e3779b97f4a7c15ull ^ ((w << 16) | h);
+	shmif_pixel mask = SHMIF_RGBA(0xff, 0xff, 0xff, 0x00);
+
+	for (size_t cy = y; cy < y + h; cy++){
+		shmif_pixel* row = &vb->buffer[cy * vb->pitch + x];
+		for (size_t cx = 0; cx < w; cx++){
+			hash ^= row[cx] & mask;
+			hash *= 0xff51afd7ed558ccdull;
+			hash ^= hash >> 32;
+		}
+	}
+
+	return hash;
+}
+
+static struct tile_cache* tile_cache_out(
+	struct a12_state* S, int chid, size_t w, size_t h)
+{
+	struct tile_cache* tc = S->channels[chid].tiles_out;
+	if (!tc){
+		tc = malloc(sizeof(struct tile_cache));
+		if (!tc)
+			return NULL;
+		*tc = (struct tile_cache){0};
+		S->channels[chid].tiles_out = tc;
+	}
+
+/* the grid represents what is on the sink surface, if that has been resized
+ * the contents is undefined and everything needs to be sent, the tile cache
+ * itself is independent of the surface and can be kept */
+	if (tc->w != w || tc->h != h || !tc->grid){
+		free(tc->grid);
+		tc->cols = (w + TILE_SIZE - 1) / TILE_SIZE;
+		tc->rows = (h + TILE_SIZE - 1) / TILE_SIZE;
+		tc->grid = calloc(tc->cols * tc->rows, sizeof(uint64_t));
+		tc->w = w;
+		tc->h = h;
+
+		a12int_trace(A12_TRACE_VIDEO,
+			"kind=status:ch=%d:codec=dtile:message=grid:cols=%zu:rows=%zu",
+			chid, tc->cols, tc->rows
+		);
+
+		if (!tc->grid){
+			tc->w = tc->h = 0;
+			return NULL;
+		}
+	}
+
+	return tc;
+}
+
+void a12int_encode_dtile_reset(struct a12_state* S, int chid, bool cache)
+{
+	struct tile_cache* tc = S->channels[chid].tiles_out;
+	if (!tc || (!tc->grid && !cache))
+		return;
+
+	a12int_trace(A12_TRACE_VIDEO,
+		"kind=status:ch=%d:codec=dtile:message=reset:cache=%d", chid, (int) cache);
+	free(tc->grid);
+	tc->grid = NULL;
+	tc->w = tc->h = 0;
+
+	if (cache)
+		memset(tc->slot_hash, '\0', sizeof(tc->slot_hash));
+}
+
+void a12int_encode_dtile(PACK_ARGS)
+{
+	struct tile_cache* old = S->channels[chid].tiles_out;
+	bool refresh = !old || !old->grid || old->w != vb->w || old->h != vb->h;
+
+	struct tile_cache* tc = tile_cache_out(S, chid, vb->w, vb->h);
+	if (!tc){
+		a12int_trace(A12_TRACE_ALLOC, "kind=error:codec=dtile:message=grid alloc");
+		return;
+	}
+
+/* only the tiles the dirty region touches need to be considered, unless the
+ * grid is new - then the sink contents is unknown (resize, dropped frame) and
+ * the whole surface has to be sent */
+	if (refresh){
+		x = y = 0;
+		w = vb->w;
+		h = vb->h;
+	}
+
+	size_t tx1 = x / TILE_SIZE;
+	size_t ty1 = y / TILE_SIZE;
+	size_t tx2 = (x + w + TILE_SIZE - 1) / TILE_SIZE;
+	size_t ty2 = (y + h + TILE_SIZE - 1) / TILE_SIZE;
+	if (tx2 > tc->cols)
+		tx2 = tc->cols;
+	if (ty2 > tc->rows)
+		ty2 = tc->rows;
+
+/* worst case is every tile touched being new */
+	size_t px_w = tx2 * TILE_SIZE > vb->w ? vb->w - tx1 * TILE_SIZE : (tx2 - tx1) * TILE_SIZE;
+	size_t px_h = ty2 * TILE_SIZE > vb->h ? vb->h - ty1 * TILE_SIZE : (ty2 - ty1) * TILE_SIZE;
+	size_t buf_sz = (tx2 - tx1) * (ty2 - ty1) * TILE_RECORD_SZ + px_w * px_h * 3;
+
+	uint8_t* buf = malloc(buf_sz);
+	if (!buf){
+		a12int_trace(A12_TRACE_ALLOC,
+			"kind=error:codec=dtile:message=couldn't alloc %zu", buf_sz);
+		return;
+	}
+
+	size_t pos = 0;
+	size_t n_new = 0, n_cached = 0;
+
+	for (size_t ty = ty1; ty < ty2; ty++){
+		size_t cy = ty * TILE_SIZE;
+		size_t th = cy + TILE_SIZE > vb->h ? vb->h - cy : TILE_SIZE;
+
+		for (size_t tx = tx1; tx < tx2; tx++){
+			size_t cx = tx * TILE_SIZE;
+			size_t tw = cx + TILE_SIZE > vb->w ? vb->w - cx : TILE_SIZE;
+
+			uint64_t hash = tile_hash(vb, cx, cy, tw, th);
+			uint64_t* cur = &tc->grid[ty * tc->cols + tx];
+			if (*cur == hash)
+				continue;
+			*cur = hash;
+
+			size_t slot = hash % TILE_CACHE_SLOTS;
+			bool cached = tc->slot_hash[slot] == hash;
+
+			pack_u16(tx, &buf[pos]);
+			pack_u16(ty, &buf[pos+2]);
+			buf[pos+4] = cached ? TILE_OP_CACHED : TILE_OP_NEW;
+			pack_u64(hash, &buf[pos+5]);
+			pos += TILE_RECORD_SZ;
+
+			if (cached){
+				n_cached++;
+				continue;
+			}
+
+			tc->slot_hash[slot] = hash;
+			for (size_t row = cy; row < cy + th; row++){
+				shmif_pixel* src = &vb->buffer[row * vb->pitch + cx];
+				for (size_t col = 0; col < tw; col++){
+					uint8_t ign;
+					SHMIF_RGBA_DECOMP(src[col], &buf[pos], &buf[pos+1], &buf[pos+2], &ign);
+					pos += 3;
+				}
+			}
+			n_new++;
+		}
+	}
+
+/* even if nothing changed the frame is still sent, otherwise the sink would
+ * miss the commit and the frame pacing on that end */
+	size_t out_sz;
+	uint8_t* out = tdefl_compress_mem_to_heap(buf, pos, &out_sz, 0);
+	free(buf);
+
+	if (!out){
+		a12int_trace(A12_TRACE_ALLOC, "kind=error:codec=dtile:message=deflate failed");
+		a12int_encode_dtile_reset(S, chid, true);
+		return;
+	}
+
+	uint8_t hdr_buf[CONTROL_PACKET_SIZE];
+	a12int_vframehdr_build(hdr_buf, S->last_seen_seqnr, chid,
+		POSTPROCESS_VIDEO_DTILE, 0, vb->w, vb->h, vb->w, vb->h, 0, 0,
+		out_sz, pos, 1
+	);
+
+	a12int_trace(A12_TRACE_VDETAIL,
+		"kind=status:codec=dtile:new=%zu:cached=%zu:b_in=%zu:b_out=%zu",
+		n_new, n_cached, pos, out_sz
+	);
+
+	a12int_append_out(S,
+		STATE_CONTROL_PACKET, hdr_buf, CONTROL_PACKET_SIZE, NULL, 0);
+	chunk_pack(S, STATE_VIDEO_PACKET, chid, out, out_sz, chunk_sz);
+
+	free(out);
+}
+
 #if defined(WANT_H264_ENC) || defined(WANT_H264_DEC)
 void a12int_drop_videnc(struct a12_state* S, int chid, bool failed)
 {
@@ -573,12 +1225,36 @@ void a12int_drop_videnc(struct a12_state* S, int chid, bool failed)
 	a12int_trace(A12_TRACE_VIDEO, "dropping h264 context");
 }
 
-static unsigned long pick_bitrate(size_t w, size_t h, struct a12_vframe_opts o)
+/*
+ * Rough bits-per-pixel per bias for when we don't get a CRF or a specified
+ * bitrate by the caller, capped to what the link estimate says we can push
+ * while leaving room for audio, events and the estimate being optimistic.
+ */
+static unsigned long pick_bitrate(
+	struct a12_state* S, size_t w, size_t h, struct a12_vframe_opts o)
 {
-/* Just some rough 'better than nothing' table for when we don't get a CRF or a
- * specified bitrate by the caller during setup or through a later backpressure
- * estimation */
-	return 1000000;
+	float bpp = 0.1;
+	switch (o.bias){
+	case VFRAME_BIAS_LATENCY:
+		bpp = 0.07;
+	break;
+	case VFRAME_BIAS_QUALITY:
+		bpp = 0.15;
+	break;
+	default:
+	break;
+	}
+
+	unsigned long rate = bpp * w * h * 25;
+
+	struct a12_link_estimate link = a12_link_estimate(S);
+	if (link.rate_samples && link.mbit > 0){
+		unsigned long cap = link.mbit * 0.7 * 1000000.0f;
+		if (rate > cap)
+			rate = cap;
+	}
+
+	return rate < 250000 ? 250000 : rate;
 }
 
 static bool open_videnc(struct a12_state* S,
@@ -639,8 +1315,9 @@ static bool open_videnc(struct a12_state* S,
 	}
 	else {
 		encoder->bit_rate = venc_opts.bitrate > 0 ?
-			(venc_opts.bitrate * 1000000.0f) : pick_bitrate(vb->w, vb->h, venc_opts);
+			(venc_opts.bitrate * 1000000.0f) : pick_bitrate(S, vb->w, vb->h, venc_opts);
 	}
+	S->channels[chid].videnc.bitrate = encoder->bit_rate;
 	encoder->width = vb->w;
 	encoder->height = vb->h;
 
@@ -719,6 +1396,19 @@ void a12int_encode_h264(PACK_ARGS)
 		vb->h != S->channels[chid].videnc.h)
 		a12int_drop_videnc(S, chid, false);
 
+/* Or when the link estimate has drifted far enough from what the encoder was
+ * opened with, reopening costs an I-frame so there is a wide margin */
+	else if (S->channels[chid].videnc.encdec &&
+		!opts.variable && opts.bitrate <= 0){
+		unsigned long cur = S->channels[chid].videnc.bitrate;
+		unsigned long next = pick_bitrate(S, vb->w, vb->h, opts);
+		if (next > cur * 1.3 || next < cur * 0.7){
+			a12int_trace(A12_TRACE_VIDEO,
+				"kind=codec:status=rate:ch=%d:old=%lu:new=%lu", chid, cur, next);
+			a12int_drop_videnc(S, chid, false);
+		}
+	}
+
 /* If we don't have an encoder (first time or reset due to resize),
  * try to configure, and if the configuration fails (i.e. still no
  * encoder set) fallback to DPNG and only try again on new size. */
@@ -736,6 +1426,9 @@ void a12int_encode_h264(PACK_ARGS)
 	if (S->channels[chid].videnc.failed)
 		goto fallback;
 
+/* the DPNG fallback keeps its reference frame as long as it is being used */
+	a12int_encode_dpng_reset(S, chid);
+
 /* just for shorthand */
 	AVFrame* frame = S->channels[chid].videnc.frame;
 	AVCodecContext* encoder = S->channels[chid].videnc.encdec;
@@ -16,11 +16,38 @@ void a12int_encode_rgba(PACK_ARGS);
 void a12int_encode_dpng(PACK_ARGS);
 void a12int_encode_h264(PACK_ARGS);
 void a12int_encode_tz(PACK_ARGS);
+void a12int_encode_dtile(PACK_ARGS);
+void a12int_encode_dlz(PACK_ARGS);
+void a12int_encode_adaptive(PACK_ARGS);
 
+/*
+ * Forget what the tile encoder believes is on the sink surface so that the
+ * next dtile frame is sent in full. This is needed when another method has
+ * touched the surface, or with [cache] when the sink reported a decode error
+ * and the contents of its tile cache can't be trusted either.
+ */
+void a12int_encode_dtile_reset(struct a12_state* S, int chid, bool cache);
+
+/*
+ * Drop the accumulation buffer so that the next dpng/dlz/adaptive frame is
+ * an I frame, same reason as for dtile.
+ */
+void a12int_encode_dpng_reset(struct a12_state* S, int chid);
+
+/*
+ * Restart the TPACK stream so that the next frame carries the reset flag and
+ * doesn't depend on anything sent before it.
+ */
+void a12int_encode_tz_reset(struct a12_state* S, int chid);
+
+/*
+ * Send [n_frames] of interleaved [cfg.channels] samples from [buf] as one
+ * astream, either as is (S16) or ADPCM compressed depending on [opts].
+ */
 void a12int_encode_araw(struct a12_state* S,
 	uint8_t chid,
 	shmif_asample* buf,
-	uint16_t n_samples,
+	uint16_t n_frames,
 	struct a12_aframe_cfg cfg,
 	struct a12_aframe_opts opts, size_t chunk_sz
 );
@@ -10,6 +10,7 @@
 #define MINIZ_HAS_64BIT_REGISTERS 1
 #define MINIZ_UNALIGNED_USE_MEMCPY
 #include "miniz/miniz.h"
+#include "a12_audio.h"
 
 #if defined(WANT_H264_DEC) || defined(WANT_H264_ENC)
 #include <libavcodec/avcodec.h>
@@ -101,9 +102,149 @@ enum {
 	POSTPROCESS_VIDEO_DMINIZ = 3, /* DEFLATE - P frame (I -> P | P->P)    */
 	POSTPROCESS_VIDEO_MINIZ  = 4, /* DEFLATE - I frame                    */
 	POSTPROCESS_VIDEO_H264   = 5, /* ffmpeg or native decompressor        */
-	POSTPROCESS_VIDEO_TZ     = 6  /* DEFLATE+tpack (see shmif/tui/raster) */
+	POSTPROCESS_VIDEO_TZ     = 6, /* DEFLATE+tpack (see shmif/tui/raster) */
+	POSTPROCESS_VIDEO_DTILE  = 7, /* DEFLATE+changed tiles / tile-cache   */
+	POSTPROCESS_VIDEO_DLZ    = 8, /* fast LZ - P frame (see a12_lz.h)     */
+	POSTPROCESS_VIDEO_LZ     = 9, /* fast LZ - I frame                    */
+	POSTPROCESS_VIDEO_TZS    = 10 /* DEFLATE stream+tpack transform       */
 };
 
+enum {
+	POSTPROCESS_AUDIO_S16    = 0,
+	POSTPROCESS_AUDIO_ADPCM  = 1  /* IMA ADPCM (see a12_audio.h)          */
+};
+
+/*
+ * The last stage for the delta (dpng, dlz, adaptive) methods, the estimates
+ * are used by the adaptive method to pick the one that gets a frame across
+ * the fastest (compression time + transfer time).
+ */
+enum compress_stage {
+	COMPRESS_STORE   = 0, /* LZ framing, no match search   */
+	COMPRESS_LZ      = 1,
+	COMPRESS_DEFLATE = 2,
+	COMPRESS_STAGE_COUNT
+};
+
+struct compress_stats {
+	size_t frames;
+	float ns_per_byte[COMPRESS_STAGE_COUNT];
+	float ratio[COMPRESS_STAGE_COUNT];
+};
+
+/*
+ * vframe header [35] dataflags, BANDS means that the DEFLATE payload is split
+ * into [n:u8][n * length:u32] followed by n independently compressed streams,
+ * each covering ceil(h / n) rows (the last one the remainder) so that both
+ * sides can work on them in parallel.
+ */
+#define VFRAME_DATAFLAG_BANDS 1
+#define VFRAME_MAX_BANDS 16
+
+/*
+ * hello [53..56] features, a bitmap of the additions to the base format that
+ * the sender can decode. These are only used towards a peer that has announced
+ * them, older implementations leave the field zeroed and a side that never
+ * gets a hello back (psk- only) assumes that there are none.
+ */
+enum hello_features {
+	FEATURE_VFRAME_BANDS = 1,
+	FEATURE_VFRAME_TZS = 2,
+	FEATURE_AUDIO_ADPCM = 4,
+	FEATURE_VFRAME_LZ = 8,
+	FEATURE_VFRAME_DTILE = 16,
+
+/* not a format, set when the context options say that incoming binary
+ * transfers are checked against a cache (see BLOB_HOLD_SIZE) */
+	FEATURE_BLOB_CACHE = 32
+};
+#define FEATURES_LOCAL (FEATURE_VFRAME_BANDS | FEATURE_VFRAME_TZS | \
+	FEATURE_AUDIO_ADPCM | FEATURE_VFRAME_LZ | FEATURE_VFRAME_DTILE)
+
+/* don't bother splitting smaller inputs than this */
+#define VFRAME_BAND_THRESHOLD 262144
+
+/*
+ * Tile based delta encoding, the surface is split into TILE_SIZE^2 cells and
+ * only those that changed get sent. Both sides keep a direct-mapped cache of
+ * TILE_CACHE_SLOTS tiles indexed by hash so that contents that re-appear
+ * (scrolled in whole tiles, moved, switching back to a previous view) can be
+ * referenced instead of resent.
+ *
+ * Each tile record is [tx:u16][ty:u16][op:u8][hash:u64] followed by tw*th*3
+ * bytes of packed RGB for TILE_OP_NEW.
+ */
+#define TILE_SIZE 64
+#define TILE_CACHE_SLOTS 256
+#define TILE_RECORD_SZ 13
+
+enum {
+	TILE_OP_NEW    = 0,
+	TILE_OP_CACHED = 1
+};
+
+struct tile_cache {
+/* encoder: hash for each tile currently on the sink surface */
+	size_t w, h;
+	size_t cols, rows;
+	uint64_t* grid;
+
+/* both: hash in each cache slot, decoder also keeps the pixels */
+	uint64_t slot_hash[TILE_CACHE_SLOTS];
+	uint16_t slot_w[TILE_CACHE_SLOTS];
+	uint16_t slot_h[TILE_CACHE_SLOTS];
+	uint8_t* slot_px[TILE_CACHE_SLOTS];
+};
+
+void a12int_tile_cache_free(struct tile_cache** tc);
+
+/*
+ * TPACK stream (TZS), rather than deflating each tpack buffer on its own, the
+ * frame is transformed against what the previous frame left behind and fed
+ * through a DEFLATE stream that lives for as long as the channel does (sync
+ * flushed at the end of every frame):
+ *
+ *  [header:16]         the tpack header as-is
+ *  [lines * 9]         line headers, XOR the one at the same index last frame
+ *  [style runs]        [count-1:u8][ref:u8] until all cells are covered, ref
+ *                      indexes the style palette or is TZS_LITERAL followed by
+ *                      fg:3, bg:3, attr:2 which then replaces palette[next++]
+ *  [glyphs]            LEB128 coded code point / glyph index for each cell
+ *
+ * VFRAME_DATAFLAG_RESET marks the first frame of a new stream, both sides then
+ * start over with empty history. Losing a frame in the middle means that the
+ * sink can't continue and has to cancel with a decode error.
+ */
+#define VFRAME_DATAFLAG_RESET 2
+#define TZS_HEADER_SZ 16
+#define TZS_LINE_SZ 9
+#define TZS_CELL_SZ 12
+#define TZS_CELL_MAX (2 + 8 + 5) /* one-cell run, literal style, longest glyph */
+#define TZS_PALETTE 255
+#define TZS_LITERAL 255
+
+struct tpack_stream {
+	mz_stream zs;
+	bool broken;
+
+/* line table of the last frame */
+	uint8_t* lines;
+	size_t n_lines;
+	size_t lines_cap;
+
+	uint64_t palette[TZS_PALETTE];
+	uint8_t pal_next;
+
+/* transformed frame, built before deflate (encoder) or after inflate */
+	uint8_t* buf;
+	size_t buf_sz;
+};
+
+void a12int_tpack_stream_free(struct tpack_stream** ts, bool encoder);
+
+/* grow [buf] to fit at least [need] bytes, doubling from 4k */
+bool a12int_tzs_reserve(uint8_t** buf, size_t* buf_sz, size_t need);
+
 size_t a12int_header_size(int type);
 
 struct audio_frame {
@@ -114,10 +255,11 @@ struct audio_frame {
 	uint16_t nsamples;
 	uint8_t commit;
 
-/* only used for some postprocessing mode (i.e. decompression) */
+/* the encoded frame is collected here, and decoded into s16 after it */
 	uint8_t* inbuf;
 	size_t inbuf_pos;
 	size_t inbuf_sz;
+	size_t inbuf_cap;
 	size_t expanded_sz;
 };
 
@@ -176,14 +318,92 @@ struct blob_out {
 	bool streaming;
 	bool active;
 	uint64_t streamid;
+
+/* header has been sent, wait for a possible cancel before sending data */
+	unsigned long long hold_until;
 	struct blob_out* next;
 };
 
+/*
+ * File-backed transfers bigger than BLOB_HOLD_SIZE towards a peer that has
+ * announced FEATURE_BLOB_CACHE first send the header with the checksum and
+ * then wait for about one round-trip (BLOB_HOLD_DEFAULT when there is no
+ * estimate yet, never more than BLOB_HOLD_MAX) so that the receiver can cancel
+ * it before the bulk is sent if it has the contents cached. Other peers have
+ * nothing to cancel with and get the data streamed right away.
+ *
+ * The checksum itself is remembered for the last BLOB_HASH_CACHE descriptors
+ * so repeated transfers of the same file (fonts in particular) are not hashed
+ * again while the file is unchanged.
+ */
+#define BLOB_HOLD_SIZE 32768
+#define BLOB_HOLD_DEFAULT 100
+#define BLOB_HOLD_MAX 500
+#define BLOB_HASH_CACHE 8
+
+struct blob_hash {
+	uint64_t dev;
+	uint64_t ino;
+	uint64_t size;
+	uint64_t mtime_ns;
+	uint8_t checksum[16];
+};
+
+/*
+ * Packets that have been built but not yet sequenced, encrypted and MACed.
+ * Each channel has one FIFO per a12_queue_kind so that the flush stage can
+ * pick packets in priority order and interleave big transfers in between.
+ */
+struct out_packet;
+struct out_packet {
+	struct out_packet* next;
+	uint8_t type;
+	uint8_t chid;
+	size_t size;
+	size_t cap;
+	uint8_t data[];
+};
+
+struct out_queue {
+	struct out_packet* first;
+	struct out_packet* last;
+	size_t bytes;
+};
+
+/* upper bound on video/blob bytes serialized per flush, anything past this
+ * point will wait for the next flush so that control, events and audio that
+ * arrive in the meanwhile can be slotted in front */
+#define OUTQUEUE_BURST 65536
+
+/* when flushing through a12_flush_iov, payloads at least this big are
+ * encrypted in place and referenced rather than copied into the buffer */
+#define OUTQUEUE_DETACH 4096
+#define OUTQUEUE_IOV 64
+
+/* number of released packets kept around for reuse, the common sizes are few
+ * (control, audio/video chunks, blob blocks) so a short list covers them */
+#define OUTQUEUE_POOL 32
+
+/* slice of the output buffer ([data] == NULL) or a detached payload */
+struct out_segment {
+	uint8_t* data;
+	size_t ofs;
+	size_t len;
+};
+
 struct a12_channel {
 	int active;
 	struct arcan_shmif_cont* cont;
 	struct a12_unpack_cfg raw;
 
+/* signal mask held back until the segment is free again, see a12_tick */
+	int signal_pending;
+
+/* pending output, the CONTROL slot is only used for accounting as those
+ * packets are kept in a single shared FIFO to retain cross-channel order */
+	struct out_queue outq[A12_QUEUE_ALL];
+	size_t queued_vframes;
+
 /* can have one of each stream- type being prepared for unpack at the same time */
 	struct {
 		struct video_frame vframe;
@@ -193,6 +413,26 @@ struct a12_channel {
 
 /* used for both encoding and decoding, state is aliased into unpack_state */
 	struct shmifsrv_vbuffer acc;
+	struct compress_stats cstats;
+	struct tile_cache* tiles_out;
+	struct tile_cache* tiles_in;
+	struct tpack_stream* tpack_out;
+	struct tpack_stream* tpack_in;
+	struct a12int_adpcm adpcm_out[A12_AUDIO_MAXCH];
+	struct a12int_jitter* jitter;
+
+#ifdef WANT_H264_DEC
+/* converts decoded frames into the segment, separate from the videnc scaler
+ * as the same channel can both send and receive */
+	struct SwsContext* dec_scaler;
+#endif
+
+/* format of the last buffer requested from a raw audio destination */
+	struct {
+		size_t bytes;
+		uint32_t rate;
+		uint8_t channels;
+	} raw_abuf;
 	struct {
 		uint8_t* compression;
 #if defined(WANT_H264_ENC) || defined(WANT_H264_DEC)
@@ -204,12 +444,54 @@ struct a12_channel {
 			AVPacket* packet;
 			struct SwsContext* scaler;
 			size_t w, h;
+			unsigned long bitrate;
 			bool failed;
 		} videnc;
 #endif
 	};
 };
 
+/*
+ * Link estimation, every buffer handed out by a12_flush is recorded with the
+ * last sequence number it carried and the cumulative number of bytes. When the
+ * other side acknowledges (last seen seqnr in control/event packets) the
+ * records are retired and the delivery rate is sampled from the bytes acked
+ * since the record was sent. RTT comes from COMMAND_PING round-trips.
+ */
+#define LINK_HISTORY 64
+#define LINK_PING_INTERVAL 250
+#define LINK_MIN_SAMPLE_MS 20
+
+struct link_record {
+	uint64_t seqnr;
+	uint64_t bytes;
+	unsigned long long ts;
+
+/* acked state at the time the record was sent */
+	uint64_t acked_bytes;
+	unsigned long long acked_ts;
+
+/* nothing more was queued when this was flushed */
+	bool app_limited;
+};
+
+struct link_state {
+	struct link_record hist[LINK_HISTORY];
+	size_t hist_tail;
+	size_t hist_count;
+
+	uint64_t bytes_out;
+	uint64_t acked_seqnr;
+	uint64_t acked_bytes;
+	unsigned long long acked_ts;
+	unsigned long long last_ping;
+
+	float rtt;
+	float mbit;
+	size_t rtt_samples;
+	size_t rate_samples;
+};
+
 struct a12_state;
 struct a12_state {
 	struct a12_context_options* opts;
@@ -226,10 +508,34 @@ struct a12_state {
 	uint8_t buf_ind;
 	size_t buf_ofs;
 
+/* packets waiting for the next flush, control/event FIFO is shared for
+ * all channels, a/v/b are per channel with a round-robin cursor each */
+	struct out_queue ctrlq;
+	size_t queued[A12_QUEUE_ALL];
+	uint8_t queue_rr[A12_QUEUE_ALL];
+
+/* packets handed out through a12_flush_iov with their payloads referenced
+ * directly, these are released on the next flush */
+	struct out_packet* sent;
+	struct out_segment segs[OUTQUEUE_IOV];
+	size_t n_segs;
+	size_t segs_lim;
+	size_t seg_ofs;
+	size_t detached;
+
+/* released packets waiting to be reused by a12int_append_out */
+	struct out_packet* pool;
+	size_t pool_count;
+
+/* bandwidth / rtt estimation, see a12_link_estimate */
+	struct link_state link;
+
 /* linked list of pending binary transfers, can be re-ordered and affect
  * blocking / transfer state of events on the other side */
 	struct blob_out* pending;
 	size_t active_blobs;
+	struct blob_hash blob_hashes[BLOB_HASH_CACHE];
+	size_t blob_hash_ind;
 
 /* current event handler for binary transfer cache oracle */
 	struct a12_bhandler_res
@@ -270,6 +576,10 @@ struct a12_state {
  * needs to interpret first packet with MAC+nonce */
 	bool server;
 	int authentic;
+	uint32_t remote_features;
+
+/* never wait for the consumer of a segment, see a12_set_nonblock */
+	bool signal_nonblock;
 	blake3_hasher out_mac, in_mac;
 
 	struct chacha_ctx* enc_state;
@@ -280,4 +590,11 @@ void a12int_append_out(
 	struct a12_state* S, uint8_t type, uint8_t* out, size_t out_sz,
 	uint8_t* prepend, size_t prepend_sz);
 
+/*
+ * Forward [mask] (SHMIF_SIGVID, SHMIF_SIGAUD) to the segment of [ch], with a
+ * non-blocking state a video frame that can't be handed over yet is marked as
+ * pending on the channel rather than waited for.
+ */
+void a12int_signal(struct a12_state* S, struct a12_channel* ch, int mask);
+
 #endif
@@ -0,0 +1,177 @@
+/*
+ * Copyright: 2020, Björn Ståhl
+ * Description: A12 protocol state machine, fast LZ compression stage
+ * License: 3-Clause BSD, see COPYING file in arcan source repository.
+ * Reference: https://arcan-fe.com
+ */
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "a12_lz.h"
+
+#define LZ_HASH_BITS 14
+#define LZ_MIN_MATCH 4
+#define LZ_MAX_OFFSET 65535
+
+/* format constraints: the last 5 bytes are always literals and the last match
+ * has to start at least 12 bytes before the end of the block */
+#define LZ_LAST_LITERALS 5
+#define LZ_MFLIMIT 12
+
+static uint32_t read_u32(const uint8_t* src)
+{
+	uint32_t val;
+	memcpy(&val, src, 4);
+	return val;
+}
+
+static uint32_t lz_hash(uint32_t seq)
+{
+	return (seq * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+static size_t put_length(uint8_t* out, size_t len)
+{
+	size_t pos = 0;
+	while (len >= 255){
+		out[pos++] = 255;
+		len -= 255;
+	}
+	out[pos++] = len;
+	return pos;
+}
+
+static size_t put_sequence(uint8_t* out, const uint8_t* lit,
+	size_t n_lit, size_t offset, size_t match_len)
+{
+	size_t pos = 1;
+	uint8_t token = (n_lit >= 15 ? 15 : n_lit) << 4;
+
+	if (n_lit >= 15)
+		pos += put_length(&out[pos], n_lit - 15);
+
+	memcpy(&out[pos], lit, n_lit);
+	pos += n_lit;
+
+/* the last sequence is literals only */
+	if (match_len){
+		out[pos++] = offset & 0xff;
+		out[pos++] = offset >> 8;
+
+		match_len -= LZ_MIN_MATCH;
+		token |= match_len >= 15 ? 15 : match_len;
+		if (match_len >= 15)
+			pos += put_length(&out[pos], match_len - 15);
+	}
+
+	out[0] = token;
+	return pos;
+}
+
+size_t a12int_lz_bound(size_t in_sz)
+{
+	return in_sz + in_sz / 255 + 16;
+}
+
+size_t a12int_lz_compress(
+	const uint8_t* in, size_t in_sz, uint8_t* out, bool store)
+{
+	size_t ip = 0, anchor = 0, op = 0;
+
+	if (!store && in_sz > LZ_MFLIMIT){
+		uint32_t table[1 << LZ_HASH_BITS] = {0};
+		size_t limit = in_sz - LZ_MFLIMIT;
+		size_t match_limit = in_sz - LZ_LAST_LITERALS;
+
+		while (ip < limit){
+			uint32_t seq = read_u32(&in[ip]);
+			uint32_t hash = lz_hash(seq);
+			size_t ref = table[hash];
+			table[hash] = ip;
+
+/* step faster through data that doesn't compress */
+			if (ref >= ip || ip - ref > LZ_MAX_OFFSET || read_u32(&in[ref]) != seq){
+				ip += 1 + ((ip - anchor) >> 6);
+				continue;
+			}
+
+			size_t len = LZ_MIN_MATCH;
+			while (ip + len < match_limit && in[ref + len] == in[ip + len])
+				len++;
+
+			op += put_sequence(&out[op], &in[anchor], ip - anchor, ip - ref, len);
+			ip += len;
+			anchor = ip;
+		}
+	}
+
+	op += put_sequence(&out[op], &in[anchor], in_sz - anchor, 0, 0);
+	return op;
+}
+
+static bool get_length(const uint8_t* in, size_t in_sz, size_t* ip, size_t* len)
+{
+	uint8_t val;
+	do {
+		if (*ip >= in_sz)
+			return false;
+		val = in[(*ip)++];
+		*len += val;
+	} while (val == 255);
+
+	return true;
+}
+
+bool a12int_lz_decompress(const uint8_t* in,
+	size_t in_sz, uint8_t* out, size_t out_sz, size_t* out_len)
+{
+	size_t ip = 0, op = 0;
+
+	while (ip < in_sz){
+		uint8_t token = in[ip++];
+
+		size_t n_lit = token >> 4;
+		if (n_lit == 15 && !get_length(in, in_sz, &ip, &n_lit))
+			return false;
+
+		if (n_lit > in_sz - ip || n_lit > out_sz - op)
+			return false;
+
+		memcpy(&out[op], &in[ip], n_lit);
+		ip += n_lit;
+		op += n_lit;
+
+		if (ip == in_sz)
+			break;
+
+		if (in_sz - ip < 2)
+			return false;
+
+		size_t offset = in[ip] | (in[ip+1] << 8);
+		ip += 2;
+		if (!offset || offset > op)
+			return false;
+
+		size_t len = token & 0x0f;
+		if (len == 15 && !get_length(in, in_sz, &ip, &len))
+			return false;
+		len += LZ_MIN_MATCH;
+
+		if (len > out_sz - op)
+			return false;
+
+/* matches can overlap with the output (runs), so copy forward */
+		const uint8_t* src = &out[op - offset];
+		if (offset >= len)
+			memcpy(&out[op], src, len);
+		else
+			for (size_t i = 0; i < len; i++)
+				out[op + i] = src[i];
+		op += len;
+	}
+
+	*out_len = op;
+	return true;
+}
@@ -0,0 +1,29 @@
+#ifndef HAVE_A12_LZ
+#define HAVE_A12_LZ
+
+/*
+ * Small and fast LZ77 byte compressor for when DEFLATE costs more CPU than
+ * the link bandwidth it saves. The output follows the LZ4 block format, see
+ * HACKING.md for the details.
+ */
+
+/* worst case output size for [in_sz] bytes of input */
+size_t a12int_lz_bound(size_t in_sz);
+
+/*
+ * Compress [in_sz] bytes from [in] into [out] that is expected to fit at
+ * least a12int_lz_bound(in_sz) bytes. If [store] is set, no matches are
+ * searched for and the block is just a (cheap) literal copy.
+ * Returns the number of bytes written to [out].
+ */
+size_t a12int_lz_compress(
+	const uint8_t* in, size_t in_sz, uint8_t* out, bool store);
+
+/*
+ * Decompress [in_sz] bytes from [in] into [out] with room for [out_sz] bytes.
+ * Returns false if the block is malformed or would overflow [out], otherwise
+ * the number of decompressed bytes is set in [out_len].
+ */
+bool a12int_lz_decompress(const uint8_t* in,
+	size_t in_sz, uint8_t* out, size_t out_sz, size_t* out_len);
+#endif
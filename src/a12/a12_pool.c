@@ -0,0 +1,169 @@
+/*
+ * Copyright: 2020, Björn Ståhl
+ * Description: A12 protocol state machine, worker threads for codec stages
+ * License: 3-Clause BSD, see COPYING file in arcan source repository.
+ * Reference: https://arcan-fe.com
+ */
+#include <arcan_shmif.h>
+#include <arcan_shmif_server.h>
+
+#include <pthread.h>
+#include <unistd.h>
+
+#include "a12.h"
+#include "a12_int.h"
+#include "a12_pool.h"
+
+/* past this point the memory bandwidth becomes the limiting factor */
+#define POOL_MAX_WORKERS 15
+
+struct pool_batch;
+struct pool_batch {
+	void (*fn)(void*);
+	uint8_t* jobs;
+	size_t job_sz;
+	size_t n;
+
+	size_t next;
+	size_t done;
+	pthread_cond_t done_cond;
+
+	struct pool_batch* next_batch;
+};
+
+static struct {
+	pthread_mutex_t lock;
+	pthread_cond_t work;
+	pthread_once_t init;
+	struct pool_batch* first;
+	size_t workers;
+} pool = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.work = PTHREAD_COND_INITIALIZER,
+	.init = PTHREAD_ONCE_INIT
+};
+
+/* take the next job index from the first batch with unclaimed jobs, this
+ * unlinks a batch when its last job is claimed - must hold the lock */
+static struct pool_batch* claim_job(size_t* ind)
+{
+	struct pool_batch* batch = pool.first;
+	if (!batch)
+		return NULL;
+
+	*ind = batch->next++;
+	if (batch->next == batch->n)
+		pool.first = batch->next_batch;
+
+	return batch;
+}
+
+static void complete_job(struct pool_batch* batch)
+{
+	batch->done++;
+	if (batch->done == batch->n)
+		pthread_cond_signal(&batch->done_cond);
+}
+
+static void* pool_worker(void* tag)
+{
+	pthread_mutex_lock(&pool.lock);
+
+	for(;;){
+		size_t ind;
+		struct pool_batch* batch = claim_job(&ind);
+		if (!batch){
+			pthread_cond_wait(&pool.work, &pool.lock);
+			continue;
+		}
+
+		pthread_mutex_unlock(&pool.lock);
+		batch->fn(&batch->jobs[ind * batch->job_sz]);
+		pthread_mutex_lock(&pool.lock);
+
+		complete_job(batch);
+	}
+
+	return NULL;
+}
+
+static void pool_setup()
+{
+	long nproc = sysconf(_SC_NPROCESSORS_ONLN);
+	size_t want = nproc > 1 ? nproc - 1 : 0;
+	if (want > POOL_MAX_WORKERS)
+		want = POOL_MAX_WORKERS;
+
+	pthread_attr_t attr;
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+	for (size_t i = 0; i < want; i++){
+		pthread_t pth;
+		if (0 != pthread_create(&pth, &attr, pool_worker, NULL))
+			break;
+		pool.workers++;
+	}
+
+	pthread_attr_destroy(&attr);
+	a12int_trace(A12_TRACE_SYSTEM,
+		"kind=status:pool_workers=%zu:nproc=%ld", pool.workers, nproc);
+}
+
+size_t a12int_pool_size()
+{
+	pthread_once(&pool.init, pool_setup);
+	return pool.workers + 1;
+}
+
+void a12int_pool_run(void (*fn)(void*), void* jobs, size_t job_sz, size_t n)
+{
+	if (!n)
+		return;
+
+	pthread_once(&pool.init, pool_setup);
+
+/* nothing to gain from the queue dance */
+	if (n == 1 || !pool.workers){
+		for (size_t i = 0; i < n; i++)
+			fn(&((uint8_t*)jobs)[i * job_sz]);
+		return;
+	}
+
+	struct pool_batch batch = {
+		.fn = fn,
+		.jobs = jobs,
+		.job_sz = job_sz,
+		.n = n
+	};
+	pthread_cond_init(&batch.done_cond, NULL);
+
+	pthread_mutex_lock(&pool.lock);
+	struct pool_batch** tail = &pool.first;
+	while (*tail)
+		tail = &(*tail)->next_batch;
+	*tail = &batch;
+	pthread_cond_broadcast(&pool.work);
+
+/* help out with our own batch until all of it has been claimed */
+	while (batch.next < batch.n){
+		size_t ind = batch.next++;
+		if (batch.next == batch.n){
+			struct pool_batch** cur = &pool.first;
+			while (*cur != &batch)
+				cur = &(*cur)->next_batch;
+			*cur = batch.next_batch;
+		}
+
+		pthread_mutex_unlock(&pool.lock);
+		fn(&batch.jobs[ind * job_sz]);
+		pthread_mutex_lock(&pool.lock);
+		complete_job(&batch);
+	}
+
+	while (batch.done < batch.n)
+		pthread_cond_wait(&batch.done_cond, &pool.lock);
+
+	pthread_mutex_unlock(&pool.lock);
+	pthread_cond_destroy(&batch.done_cond);
+}
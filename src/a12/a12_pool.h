@@ -0,0 +1,20 @@
+#ifndef HAVE_A12_POOL
+#define HAVE_A12_POOL
+
+/*
+ * Process-wide set of worker threads for splitting up expensive codec work
+ * (deflate / inflate of large frames). The workers are started on first use
+ * and shared between all a12 states.
+ *
+ * Run [fn] on each of the [n] elements of [job_sz] bytes in [jobs] and return
+ * when all of them have completed. The calling thread takes part in the work
+ * so this is safe to use from any number of threads at the same time.
+ */
+void a12int_pool_run(void (*fn)(void*), void* jobs, size_t job_sz, size_t n);
+
+/*
+ * Number of threads (including the caller) that can work on a batch, use to
+ * decide how many pieces a job should be split into.
+ */
+size_t a12int_pool_size();
+#endif
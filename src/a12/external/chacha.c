@@ -129,21 +129,356 @@ static void chacha_counter_set(
 	chacha_block(ctx, ctx->keystream.u32);
 }
 
-static void chacha_apply(
-	struct chacha_ctx *ctx, uint8_t* buf, size_t length)
+/*
+ * Wide variants that produce several keystream blocks at once, one block per
+ * vector lane, and apply them directly. These are picked at runtime based on
+ * what the CPU supports and only used for whole blocks.
+ */
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#include <immintrin.h>
+#define CHACHA_X86
+#endif
+
+/* NEON is part of the baseline wherever the compiler defines __ARM_NEON, so
+ * that one is picked at build time rather than through detection */
+#if defined(__ARM_NEON) && defined(__GNUC__) && \
+	__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__ && !defined(CHACHA_NO_NEON)
+#include <arm_neon.h>
+#define CHACHA_NEON
+#endif
+
+/* grab the counter words (12..15) for [n] blocks and step the schedule past
+ * them, using the same 128-bit increment as chacha_block */
+static void chacha_lanes(struct chacha_ctx* ctx, size_t n, uint32_t lanes[4][8])
+{
+	uint32_t *const nonce = &ctx->schedule[counter_pos];
+
+	for (size_t i = 0; i < n; i++){
+		for (size_t j = 0; j < 4; j++)
+			lanes[j][i] = nonce[j];
+
+		if (!++nonce[0] && !++nonce[1] && !++nonce[2]){
+			++nonce[3];
+		}
+	}
+}
+
+#ifdef CHACHA_X86
+#ifndef CHACHA_NO_SSE2
+#define ROTV4(v, n) _mm_or_si128(_mm_slli_epi32(v, n), _mm_srli_epi32(v, 32 - (n)))
+#define QUARTERROUNDV4(x, a, b, c, d) \
+	x[a] = _mm_add_epi32(x[a], x[b]); x[d] = ROTV4(_mm_xor_si128(x[d], x[a]), 16); \
+	x[c] = _mm_add_epi32(x[c], x[d]); x[b] = ROTV4(_mm_xor_si128(x[b], x[c]), 12); \
+	x[a] = _mm_add_epi32(x[a], x[b]); x[d] = ROTV4(_mm_xor_si128(x[d], x[a]), 8); \
+	x[c] = _mm_add_epi32(x[c], x[d]); x[b] = ROTV4(_mm_xor_si128(x[b], x[c]), 7);
+
+__attribute__((target("sse2")))
+static void chacha_apply4_sse2(
+	struct chacha_ctx* ctx, const uint8_t* src, uint8_t* dst)
+{
+	uint32_t lanes[4][8];
+	__m128i in[16], x[16];
+
+	for (size_t i = 0; i < 12; i++)
+		in[i] = _mm_set1_epi32(ctx->schedule[i]);
+
+	chacha_lanes(ctx, 4, lanes);
+	for (size_t i = 0; i < 4; i++)
+		in[12 + i] = _mm_loadu_si128((__m128i*) lanes[i]);
+
+	memcpy(x, in, sizeof(x));
+
+	for (int i = ctx->iterations; i; i--){
+		QUARTERROUNDV4(x, 0, 4, 8, 12)
+		QUARTERROUNDV4(x, 1, 5, 9, 13)
+		QUARTERROUNDV4(x, 2, 6, 10, 14)
+		QUARTERROUNDV4(x, 3, 7, 11, 15)
+		QUARTERROUNDV4(x, 0, 5, 10, 15)
+		QUARTERROUNDV4(x, 1, 6, 11, 12)
+		QUARTERROUNDV4(x, 2, 7, 8, 13)
+		QUARTERROUNDV4(x, 3, 4, 9, 14)
+	}
+
+/* lane n of x[i] is word i of block n, transpose four words at a time */
+	for (size_t i = 0; i < 16; i += 4){
+		__m128i a = _mm_add_epi32(x[i+0], in[i+0]);
+		__m128i b = _mm_add_epi32(x[i+1], in[i+1]);
+		__m128i c = _mm_add_epi32(x[i+2], in[i+2]);
+		__m128i d = _mm_add_epi32(x[i+3], in[i+3]);
+
+		__m128i t0 = _mm_unpacklo_epi32(a, b);
+		__m128i t1 = _mm_unpacklo_epi32(c, d);
+		__m128i t2 = _mm_unpackhi_epi32(a, b);
+		__m128i t3 = _mm_unpackhi_epi32(c, d);
+
+		__m128i blk[4] = {
+			_mm_unpacklo_epi64(t0, t1),
+			_mm_unpackhi_epi64(t0, t1),
+			_mm_unpacklo_epi64(t2, t3),
+			_mm_unpackhi_epi64(t2, t3)
+		};
+
+		for (size_t j = 0; j < 4; j++){
+			size_t ofs = j * 64 + i * 4;
+			__m128i v = _mm_loadu_si128((const __m128i*) &src[ofs]);
+			_mm_storeu_si128((__m128i*) &dst[ofs], _mm_xor_si128(v, blk[j]));
+		}
+	}
+}
+#endif
+
+#ifndef CHACHA_NO_AVX2
+#define ROTV8(v, n) _mm256_or_si256(_mm256_slli_epi32(v, n), _mm256_srli_epi32(v, 32 - (n)))
+#define QUARTERROUNDV8(x, a, b, c, d) \
+	x[a] = _mm256_add_epi32(x[a], x[b]); \
+	x[d] = _mm256_shuffle_epi8(_mm256_xor_si256(x[d], x[a]), rot16); \
+	x[c] = _mm256_add_epi32(x[c], x[d]); x[b] = ROTV8(_mm256_xor_si256(x[b], x[c]), 12); \
+	x[a] = _mm256_add_epi32(x[a], x[b]); \
+	x[d] = _mm256_shuffle_epi8(_mm256_xor_si256(x[d], x[a]), rot8); \
+	x[c] = _mm256_add_epi32(x[c], x[d]); x[b] = ROTV8(_mm256_xor_si256(x[b], x[c]), 7);
+
+__attribute__((target("avx2")))
+static void chacha_apply8_avx2(
+	struct chacha_ctx* ctx, const uint8_t* src, uint8_t* dst)
+{
+	uint32_t lanes[4][8];
+	__m256i in[16], x[16];
+
+/* the 16 and 8 bit rotations are byte shuffles */
+	const __m256i rot16 = _mm256_setr_epi8(
+		2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13,
+		2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13);
+	const __m256i rot8 = _mm256_setr_epi8(
+		3, 0, 1, 2, 7, 4, 5, 6, 11, 8, 9, 10, 15, 12, 13, 14,
+		3, 0, 1, 2, 7, 4, 5, 6, 11, 8, 9, 10, 15, 12, 13, 14);
+
+	for (size_t i = 0; i < 12; i++)
+		in[i] = _mm256_set1_epi32(ctx->schedule[i]);
+
+	chacha_lanes(ctx, 8, lanes);
+	for (size_t i = 0; i < 4; i++)
+		in[12 + i] = _mm256_loadu_si256((__m256i*) lanes[i]);
+
+	memcpy(x, in, sizeof(x));
+
+	for (int i = ctx->iterations; i; i--){
+		QUARTERROUNDV8(x, 0, 4, 8, 12)
+		QUARTERROUNDV8(x, 1, 5, 9, 13)
+		QUARTERROUNDV8(x, 2, 6, 10, 14)
+		QUARTERROUNDV8(x, 3, 7, 11, 15)
+		QUARTERROUNDV8(x, 0, 5, 10, 15)
+		QUARTERROUNDV8(x, 1, 6, 11, 12)
+		QUARTERROUNDV8(x, 2, 7, 8, 13)
+		QUARTERROUNDV8(x, 3, 4, 9, 14)
+	}
+
+	for (size_t i = 0; i < 16; i++)
+		x[i] = _mm256_add_epi32(x[i], in[i]);
+
+/* lane n of x[i] is word i of block n, transpose eight words at a time where
+ * the unpacks work within each 128-bit half (block n and n+4) */
+	for (size_t i = 0; i < 16; i += 8){
+		__m256i t[8], u[8];
+		for (size_t j = 0; j < 8; j += 2){
+			t[j+0] = _mm256_unpacklo_epi32(x[i+j], x[i+j+1]);
+			t[j+1] = _mm256_unpackhi_epi32(x[i+j], x[i+j+1]);
+		}
+		for (size_t j = 0; j < 8; j += 4){
+			u[j+0] = _mm256_unpacklo_epi64(t[j+0], t[j+2]);
+			u[j+1] = _mm256_unpackhi_epi64(t[j+0], t[j+2]);
+			u[j+2] = _mm256_unpacklo_epi64(t[j+1], t[j+3]);
+			u[j+3] = _mm256_unpackhi_epi64(t[j+1], t[j+3]);
+		}
+
+		for (size_t j = 0; j < 4; j++){
+			__m256i lo = _mm256_permute2x128_si256(u[j], u[j+4], 0x20);
+			__m256i hi = _mm256_permute2x128_si256(u[j], u[j+4], 0x31);
+			size_t ofs_lo = j * 64 + i * 4;
+			size_t ofs_hi = (j + 4) * 64 + i * 4;
+
+			__m256i v = _mm256_loadu_si256((const __m256i*) &src[ofs_lo]);
+			_mm256_storeu_si256((__m256i*) &dst[ofs_lo], _mm256_xor_si256(v, lo));
+			v = _mm256_loadu_si256((const __m256i*) &src[ofs_hi]);
+			_mm256_storeu_si256((__m256i*) &dst[ofs_hi], _mm256_xor_si256(v, hi));
+		}
+	}
+}
+#endif
+#endif
+
+#ifdef CHACHA_NEON
+#define ROTN4(v, n) vsriq_n_u32(vshlq_n_u32(v, n), v, 32 - (n))
+#define ROTN4_16(v) vreinterpretq_u32_u16(vrev32q_u16(vreinterpretq_u16_u32(v)))
+#define QUARTERROUNDN4(x, a, b, c, d) \
+	x[a] = vaddq_u32(x[a], x[b]); x[d] = ROTN4_16(veorq_u32(x[d], x[a])); \
+	x[c] = vaddq_u32(x[c], x[d]); x[b] = ROTN4(veorq_u32(x[b], x[c]), 12); \
+	x[a] = vaddq_u32(x[a], x[b]); x[d] = ROTN4(veorq_u32(x[d], x[a]), 8); \
+	x[c] = vaddq_u32(x[c], x[d]); x[b] = ROTN4(veorq_u32(x[b], x[c]), 7);
+
+static void chacha_apply4_neon(
+	struct chacha_ctx* ctx, const uint8_t* src, uint8_t* dst)
+{
+	uint32_t lanes[4][8];
+	uint32x4_t in[16], x[16];
+
+	for (size_t i = 0; i < 12; i++)
+		in[i] = vdupq_n_u32(ctx->schedule[i]);
+
+	chacha_lanes(ctx, 4, lanes);
+	for (size_t i = 0; i < 4; i++)
+		in[12 + i] = vld1q_u32(lanes[i]);
+
+	memcpy(x, in, sizeof(x));
+
+	for (int i = ctx->iterations; i; i--){
+		QUARTERROUNDN4(x, 0, 4, 8, 12)
+		QUARTERROUNDN4(x, 1, 5, 9, 13)
+		QUARTERROUNDN4(x, 2, 6, 10, 14)
+		QUARTERROUNDN4(x, 3, 7, 11, 15)
+		QUARTERROUNDN4(x, 0, 5, 10, 15)
+		QUARTERROUNDN4(x, 1, 6, 11, 12)
+		QUARTERROUNDN4(x, 2, 7, 8, 13)
+		QUARTERROUNDN4(x, 3, 4, 9, 14)
+	}
+
+/* same transpose as the SSE2 version, trn pairs the even/odd lanes of two
+ * rows and the halves of those are then combined into whole blocks */
+	for (size_t i = 0; i < 16; i += 4){
+		uint32x4x2_t ab = vtrnq_u32(
+			vaddq_u32(x[i+0], in[i+0]), vaddq_u32(x[i+1], in[i+1]));
+		uint32x4x2_t cd = vtrnq_u32(
+			vaddq_u32(x[i+2], in[i+2]), vaddq_u32(x[i+3], in[i+3]));
+
+		uint32x4_t blk[4] = {
+			vcombine_u32(vget_low_u32(ab.val[0]), vget_low_u32(cd.val[0])),
+			vcombine_u32(vget_low_u32(ab.val[1]), vget_low_u32(cd.val[1])),
+			vcombine_u32(vget_high_u32(ab.val[0]), vget_high_u32(cd.val[0])),
+			vcombine_u32(vget_high_u32(ab.val[1]), vget_high_u32(cd.val[1]))
+		};
+
+		for (size_t j = 0; j < 4; j++){
+			size_t ofs = j * 64 + i * 4;
+			uint8x16_t v = vld1q_u8(&src[ofs]);
+			vst1q_u8(&dst[ofs], veorq_u8(v, vreinterpretq_u8_u32(blk[j])));
+		}
+	}
+}
+#endif
+
+enum chacha_simd {
+	CHACHA_SIMD_UNKNOWN = 0,
+	CHACHA_SIMD_NONE,
+	CHACHA_SIMD_SSE2,
+	CHACHA_SIMD_AVX2,
+	CHACHA_SIMD_NEON
+};
+
+/* detected once, the race on first use is harmless as all agree on the value */
+static enum chacha_simd chacha_simd_level = CHACHA_SIMD_UNKNOWN;
+
+static enum chacha_simd chacha_simd(void)
 {
-	if (!length)
-		return;
+	if (chacha_simd_level != CHACHA_SIMD_UNKNOWN)
+		return chacha_simd_level;
 
+	enum chacha_simd level = CHACHA_SIMD_NONE;
+#ifdef CHACHA_X86
+	__builtin_cpu_init();
+#ifndef CHACHA_NO_SSE2
+	if (__builtin_cpu_supports("sse2"))
+		level = CHACHA_SIMD_SSE2;
+#endif
+#ifndef CHACHA_NO_AVX2
+	if (__builtin_cpu_supports("avx2"))
+		level = CHACHA_SIMD_AVX2;
+#endif
+#endif
+#ifdef CHACHA_NEON
+	level = CHACHA_SIMD_NEON;
+#endif
+
+	chacha_simd_level = level;
+	return level;
+}
+
+/* apply as many whole blocks as the widest available variant can take,
+ * returns the number of bytes consumed (can be 0) */
+static size_t chacha_apply_wide(struct chacha_ctx* ctx,
+	const uint8_t* src, uint8_t* dst, size_t length)
+{
+	size_t ofs = 0;
+
+	switch (chacha_simd()){
+#ifdef CHACHA_X86
+#ifndef CHACHA_NO_AVX2
+	case CHACHA_SIMD_AVX2:
+		for (; length - ofs >= 512; ofs += 512)
+			chacha_apply8_avx2(ctx, &src[ofs], &dst[ofs]);
+/* fallthrough */
+#endif
+#ifndef CHACHA_NO_SSE2
+	case CHACHA_SIMD_SSE2:
+		for (; length - ofs >= 256; ofs += 256)
+			chacha_apply4_sse2(ctx, &src[ofs], &dst[ofs]);
+	break;
+#endif
+#endif
+#ifdef CHACHA_NEON
+	case CHACHA_SIMD_NEON:
+		for (; length - ofs >= 256; ofs += 256)
+			chacha_apply4_neon(ctx, &src[ofs], &dst[ofs]);
+	break;
+#endif
+	default:
+	break;
+	}
+
+	return ofs;
+}
+
+/* apply the keystream to [src] with the result going to [dst], these can be
+ * the same buffer, or different so that the cipher can be fused with a copy */
+static void chacha_apply_copy(struct chacha_ctx *ctx,
+	const uint8_t* src, uint8_t* dst, size_t length)
+{
 	size_t ofs = 0;
 	while(ofs < length){
+
+/* at a block boundary the wide versions can go straight from the schedule */
+		if (ctx->pos == 64 && length - ofs >= 256){
+			size_t nb = chacha_apply_wide(ctx, &src[ofs], &dst[ofs], length - ofs);
+			ofs += nb;
+			if (ofs == length)
+				break;
+		}
+
 		if (ctx->pos == 64)
 			chacha_block(ctx, ctx->keystream.u32);
 
+/* whole keystream blocks can be done a word at a time */
+		if (ctx->pos == 0 && length - ofs >= 64){
+			for (size_t i = 0; i < 64; i += 8){
+				uint64_t a, b;
+				memcpy(&a, &src[ofs + i], 8);
+				memcpy(&b, &ctx->keystream.u8[i], 8);
+				a ^= b;
+				memcpy(&dst[ofs + i], &a, 8);
+			}
+			ctx->pos = 64;
+			ofs += 64;
+			continue;
+		}
+
 		size_t nib = 64 - ctx->pos;
 		while (nib && ofs < length){
-			buf[ofs] ^= ctx->keystream.u8[ctx->pos++];
+			dst[ofs] = src[ofs] ^ ctx->keystream.u8[ctx->pos++];
 			nib--, ofs++;
 		}
 	}
 }
+
+static void chacha_apply(
+	struct chacha_ctx *ctx, uint8_t* buf, size_t length)
+{
+	chacha_apply_copy(ctx, buf, buf, length);
+}
@@ -23,7 +23,14 @@ struct a12helper_opts {
 /* set to ignore type- heuristics and force a specific encoder */
 	bool force_default;
 	int dirfd_temp;
+
+/* a12cl_shmifsrv- specific: set to a directory and completed non-streaming
+ * binary transfers are kept there, keyed on their checksum, so the next time
+ * the same contents is announced the transfer can be cancelled and served
+ * locally. [cache_limit] is the size in bytes the directory is trimmed down
+ * to, least recently used first, 0 for no limit. */
 	int dirfd_cache;
+	size_t cache_limit;
 
 /* a12cl_shmifsrv- specific: set to a valid local connection-point and incoming
  * EXIT_ events will be translated to DEVICE_NODE events, preventing the remote
@@ -59,4 +66,54 @@ void a12helper_a12cl_shmifsrv(struct a12_state* S,
 int a12helper_a12srv_shmifcl(
 	struct a12_state* S, const char* cp, int fd_in, int fd_out);
 
+/*
+ * Single-process alternative to a12helper_a12srv_shmifcl for hosting many,
+ * mostly idle, sessions. One thread multiplexes the sockets and segments of
+ * all sessions, the local connection for a session is only made once it has
+ * authenticated.
+ *
+ * [max_sessions] : new sessions past this number are rejected, 0 = no limit
+ * [session_limit] : when the a12_footprint of a session goes past this many
+ *                   bytes, events from its segments are left unread until
+ *                   the queued output has been written, 0 = no limit
+ * [stats_interval] : emit a summary of the number of sessions and their
+ *                    footprint on the alloc trace group every n ms, 0 = off
+ */
+struct a12helper_mux;
+struct a12helper_mux_opts {
+	size_t max_sessions;
+	size_t session_limit;
+	unsigned stats_interval;
+};
+
+/*
+ * Create the multiplexer and start its thread, sessions connect to [cp]
+ * (or ARCAN_CONNPATH if NULL). Returns NULL if that is not set or if the
+ * thread couldn't be started.
+ */
+struct a12helper_mux* a12helper_mux_create(
+	const char* cp, struct a12helper_mux_opts);
+
+/*
+ * Hand over a prenegotiated connection [S] over the socket [fd], the mux
+ * takes ownership of both. Safe to call from any thread.
+ */
+bool a12helper_mux_add(struct a12helper_mux*, struct a12_state* S, int fd);
+
+/*
+ * Binary transfer cache, see dirfd_cache in a12helper_opts.
+ *
+ * Lookup returns a read-only descriptor to the entry matching [checksum] if
+ * it exists and is [size] bytes, or -1.
+ *
+ * Store copies the contents of [fd] into the cache if it matches [checksum]
+ * and evicts older entries if [limit] is exceeded. The descriptor is read
+ * with pread so its file offset is left untouched.
+ */
+int a12helper_cache_lookup(
+	int dirfd, const uint8_t checksum[static 16], size_t size);
+
+bool a12helper_cache_store(
+	int dirfd, size_t limit, const uint8_t checksum[static 16], int fd);
+
 #endif
@@ -0,0 +1,284 @@
+/*
+ * Copyright: 2020, Bjorn Stahl
+ * License: 3-Clause BSD
+ * Description: Content-addressed store for completed binary transfers (fonts,
+ * state blobs, clipboard contents, ...). Entries are named after the hex-
+ * encoded BLAKE3 checksum that the sender provides in the stream header so
+ * that a later transfer of the same contents can be cancelled and served from
+ * here. The mtime of an entry is bumped on every hit and the least recently
+ * used ones are evicted when the directory grows past the set limit.
+ */
+#include <arcan_shmif.h>
+#include <arcan_shmif_server.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "a12.h"
+#include "a12_int.h"
+#include "a12_helper.h"
+
+#define CACHE_NAME_LEN 32
+
+/* tmp_<name>_<random> while a store is being written and verified, anything
+ * older than this has been left behind by a store that never finished */
+#define CACHE_TMP_PREFIX "tmp_"
+#define CACHE_TMP_LEN (4 + CACHE_NAME_LEN + 1 + 16)
+#define CACHE_TMP_STALE 3600
+
+extern void arcan_random(uint8_t* dst, size_t);
+
+struct cache_entry {
+	char name[CACHE_NAME_LEN + 1];
+	off_t size;
+	struct timespec mtime;
+};
+
+static void cache_name(const uint8_t checksum[static 16], char* out)
+{
+	static const char digits[] = "0123456789abcdef";
+	for (size_t i = 0; i < 16; i++){
+		out[i * 2 + 0] = digits[checksum[i] >> 4];
+		out[i * 2 + 1] = digits[checksum[i] & 0x0f];
+	}
+	out[CACHE_NAME_LEN] = '\0';
+}
+
+static bool cache_entry_name(const char* name)
+{
+	size_t i = 0;
+	for (; name[i]; i++){
+		if (i == CACHE_NAME_LEN)
+			return false;
+		if (!((name[i] >= '0' && name[i] <= '9') || (name[i] >= 'a' && name[i] <= 'f')))
+			return false;
+	}
+	return i == CACHE_NAME_LEN;
+}
+
+static int entry_cmp(const void* a, const void* b)
+{
+	const struct cache_entry* A = a;
+	const struct cache_entry* B = b;
+	if (A->mtime.tv_sec != B->mtime.tv_sec)
+		return A->mtime.tv_sec < B->mtime.tv_sec ? -1 : 1;
+	if (A->mtime.tv_nsec != B->mtime.tv_nsec)
+		return A->mtime.tv_nsec < B->mtime.tv_nsec ? -1 : 1;
+	return 0;
+}
+
+/*
+ * Scan the directory, sweep temporaries from interrupted stores and, if there
+ * is a [limit], drop the least recently used entries until under it.
+ */
+static void cache_evict(int dirfd, size_t limit)
+{
+	int fd = openat(dirfd, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (-1 == fd)
+		return;
+
+	DIR* dir = fdopendir(fd);
+	if (!dir){
+		close(fd);
+		return;
+	}
+
+	struct cache_entry* entries = NULL;
+	size_t n_entries = 0;
+	size_t cap = 0;
+	size_t total = 0;
+	struct dirent* ent;
+	time_t now = time(NULL);
+
+	while ((ent = readdir(dir))){
+		struct stat fs;
+
+		if (strncmp(ent->d_name, CACHE_TMP_PREFIX, 4) == 0 &&
+			0 == fstatat(dirfd, ent->d_name, &fs, AT_SYMLINK_NOFOLLOW) &&
+			S_ISREG(fs.st_mode) && now - fs.st_mtime > CACHE_TMP_STALE){
+			a12int_trace(A12_TRACE_BTRANSFER,
+				"kind=cache:status=stale:name=%s", ent->d_name);
+			unlinkat(dirfd, ent->d_name, 0);
+			continue;
+		}
+
+		if (!cache_entry_name(ent->d_name))
+			continue;
+
+		if (-1 == fstatat(dirfd, ent->d_name, &fs, AT_SYMLINK_NOFOLLOW) ||
+			!S_ISREG(fs.st_mode))
+			continue;
+
+		if (n_entries == cap){
+			size_t new_cap = cap ? cap * 2 : 64;
+			struct cache_entry* new = realloc(entries, new_cap * sizeof(struct cache_entry));
+			if (!new)
+				break;
+			entries = new;
+			cap = new_cap;
+		}
+
+		struct cache_entry* dst = &entries[n_entries++];
+		memcpy(dst->name, ent->d_name, CACHE_NAME_LEN + 1);
+		dst->size = fs.st_size;
+		dst->mtime = fs.st_mtim;
+		total += fs.st_size;
+	}
+
+	closedir(dir);
+
+/* drop the oldest until we are back under the limit */
+	if (limit && total > limit){
+		qsort(entries, n_entries, sizeof(struct cache_entry), entry_cmp);
+
+		for (size_t i = 0; i < n_entries && total > limit; i++){
+			if (-1 == unlinkat(dirfd, entries[i].name, 0))
+				continue;
+
+			total -= entries[i].size;
+			a12int_trace(A12_TRACE_BTRANSFER,
+				"kind=cache:status=evicted:name=%s:size=%zu",
+				entries[i].name, (size_t) entries[i].size);
+		}
+	}
+
+	free(entries);
+}
+
+int a12helper_cache_lookup(
+	int dirfd, const uint8_t checksum[static 16], size_t size)
+{
+	if (-1 == dirfd)
+		return -1;
+
+	char name[CACHE_NAME_LEN + 1];
+	cache_name(checksum, name);
+
+	int fd = openat(dirfd, name, O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+	if (-1 == fd)
+		return -1;
+
+/* a size mismatch means a broken entry or a truncated checksum collision,
+ * either way it should not be used */
+	struct stat fs;
+	if (-1 == fstat(fd, &fs) || !S_ISREG(fs.st_mode) || (size_t) fs.st_size != size){
+		a12int_trace(A12_TRACE_BTRANSFER,
+			"kind=cache:status=mismatch:name=%s", name);
+		close(fd);
+		return -1;
+	}
+
+/* mark as recently used, this is what eviction goes by */
+	utimensat(dirfd, name, NULL, 0);
+	a12int_trace(A12_TRACE_BTRANSFER, "kind=cache:status=hit:name=%s", name);
+
+	return fd;
+}
+
+bool a12helper_cache_store(
+	int dirfd, size_t limit, const uint8_t checksum[static 16], int fd)
+{
+	if (-1 == dirfd || -1 == fd)
+		return false;
+
+	char name[CACHE_NAME_LEN + 1];
+	cache_name(checksum, name);
+
+	struct stat fs;
+	if (-1 == fstat(fd, &fs) || !fs.st_size || (limit && (size_t) fs.st_size > limit))
+		return false;
+
+/* already known, just refresh */
+	if (0 == utimensat(dirfd, name, NULL, 0))
+		return true;
+
+/* write to a temporary name and only rename into place when the contents has
+ * been verified to match the checksum. The name is unique per store so that
+ * neither a parallel store of the same contents (other connection) nor one
+ * left behind by a process that died can block it, the rename is atomic and
+ * the contents identical so whichever comes last wins */
+	char tmpname[CACHE_TMP_LEN + 1];
+	int out = -1;
+	for (size_t i = 0; i < 4 && -1 == out; i++){
+		uint64_t rnd;
+		arcan_random((uint8_t*) &rnd, sizeof(rnd));
+		snprintf(tmpname, sizeof(tmpname), CACHE_TMP_PREFIX "%s_%016"PRIx64, name, rnd);
+		out = openat(dirfd, tmpname, O_CREAT | O_EXCL | O_WRONLY | O_CLOEXEC, 0600);
+		if (-1 == out && errno != EEXIST)
+			break;
+	}
+	if (-1 == out)
+		return false;
+
+	size_t buf_sz = 65536;
+	uint8_t* buf = malloc(buf_sz);
+	if (!buf){
+		close(out);
+		unlinkat(dirfd, tmpname, 0);
+		return false;
+	}
+
+	blake3_hasher hash;
+	blake3_hasher_init(&hash);
+	off_t pos = 0;
+	bool ok = true;
+
+	while (ok && pos < fs.st_size){
+		ssize_t nr = pread(fd, buf, buf_sz, pos);
+		if (-1 == nr){
+			if (errno == EINTR || errno == EAGAIN)
+				continue;
+			ok = false;
+			break;
+		}
+		if (0 == nr){
+			ok = false;
+			break;
+		}
+
+		blake3_hasher_update(&hash, buf, nr);
+		pos += nr;
+
+		size_t ofs = 0;
+		while (ofs < (size_t) nr){
+			ssize_t nw = write(out, &buf[ofs], nr - ofs);
+			if (-1 == nw){
+				if (errno == EINTR || errno == EAGAIN)
+					continue;
+				ok = false;
+				break;
+			}
+			ofs += nw;
+		}
+	}
+
+	free(buf);
+	close(out);
+
+	uint8_t ref[16];
+	blake3_hasher_finalize(&hash, ref, 16);
+
+/* the checksum comes from the other side, never let it taint the cache */
+	if (!ok || memcmp(ref, checksum, 16) != 0){
+		a12int_trace(A12_TRACE_BTRANSFER,
+			"kind=cache:status=%s:name=%s", ok ? "badsum" : "eio", name);
+		unlinkat(dirfd, tmpname, 0);
+		return false;
+	}
+
+	if (-1 == renameat(dirfd, tmpname, dirfd, name)){
+		unlinkat(dirfd, tmpname, 0);
+		return false;
+	}
+
+	a12int_trace(A12_TRACE_BTRANSFER,
+		"kind=cache:status=stored:name=%s:size=%zu", name, (size_t) fs.st_size);
+
+	cache_evict(dirfd, limit);
+
+	return true;
+}
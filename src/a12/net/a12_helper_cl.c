@@ -370,7 +370,13 @@ int a12helper_a12srv_shmifcl(
 		{.fd = fd_out,       .events = POLLOUT | errmask}
 	};
 
-	while(-1 != poll(fds, n_fd, -1)){
+/* wake up on a timeout when a binary transfer is held back waiting for the
+ * other side to cancel it, otherwise it would only resume on the next event,
+ * and for a12_tick to keep audio playing out in between packets */
+	int timeout = -1;
+	unsigned hold = 0;
+
+	while(-1 != poll(fds, n_fd, timeout)){
 		if (
 			(fds[0].revents & errmask) ||
 			(fds[1].revents & errmask) ||
@@ -438,9 +444,18 @@ int a12helper_a12srv_shmifcl(
 		if (!outbuf_sz){
 			BEGIN_CRITICAL(&cl, "step-buffer");
 				outbuf_sz = a12_flush(S, &outbuf, A12_FLUSH_ALL);
+				hold = a12_queue_depth(S, -1).blob_hold;
 			END_CRITICAL(&cl);
 		}
 
+		BEGIN_CRITICAL(&cl, "tick");
+			unsigned tick = a12_tick(S);
+		END_CRITICAL(&cl);
+
+		timeout = hold ? (int) hold : -1;
+		if (tick && (!hold || tick < hold))
+			timeout = tick;
+
 /* poll accordingly */
 		n_fd = outbuf_sz > 0 ? 3 : 2;
 	}
@@ -0,0 +1,855 @@
+/*
+ * Copyright: 2020, Bjorn Stahl
+ * License: 3-Clause BSD
+ * Description: Single-process alternative to a12helper_a12srv_shmifcl for
+ * hosting many sessions. Rather than one process per connection and one thread
+ * per segment, one thread multiplexes the sockets and segment event pipes of
+ * all sessions over epoll. Each session is just its a12 state machine, its
+ * segments and a little bit of output tracking, and the heavy codec work goes
+ * to the process-wide a12 worker pool that all sessions then share.
+ *
+ * Nothing on the thread may wait for a single session. Frames are handed to
+ * the segments without blocking (a12_set_nonblock) and the ones a consumer
+ * isn't ready for are retried from a12_tick. Events are only enqueued when
+ * there is room, the rest are kept with the session and retried shortly
+ * after. The local connection is opened by a short-lived worker thread and
+ * handed back like new sessions are. The segments keep their guard thread so
+ * that the few calls that still wait, resize, are released if the server
+ * dies.
+ */
+#include <arcan_shmif.h>
+#include <arcan_shmif_server.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/epoll.h>
+#include <pthread.h>
+
+#include "a12.h"
+#include "a12_int.h"
+#include "a12_helper.h"
+
+/* upper bound on buffers written per session and wakeup so that one busy
+ * session can't starve the rest, the remainder waits for the next EPOLLOUT */
+#define MUX_FLUSH_ROUNDS 4
+#define MUX_EVENTS 64
+
+/* events held back for a full segment queue are retried this often, past
+ * the limit the session socket isn't read until they have come down */
+#define MUX_RETRY_MS 4
+#define MUX_PENDING_LIMIT 256
+
+enum mux_kind {
+	MUX_WAKEUP = 0,
+	MUX_SOCKET,
+	MUX_SEGMENT
+};
+
+struct mux_session;
+
+struct mux_pending {
+	uint8_t chid;
+	struct arcan_event ev;
+};
+
+/* epoll user data, one per socket and one per segment */
+struct mux_source {
+	int kind;
+	struct mux_session* session;
+	struct arcan_shmif_cont* C;
+	uint8_t chid;
+};
+
+struct mux_session {
+	struct a12helper_mux* mux;
+	struct mux_source sock;
+	struct a12_state* S;
+	int fd;
+
+	struct mux_source* segments[256];
+	size_t n_segments;
+
+/* the output buffer currently being written */
+	struct iovec outv[OUTQUEUE_IOV];
+	size_t outv_n;
+	size_t outv_ofs;
+	size_t out_sz;
+	bool want_out;
+
+/* stop reading segment events while over the footprint limit */
+	bool throttled;
+
+/* events the segment queue had no room for, in the order they came */
+	struct mux_pending* pending;
+	size_t pending_n;
+	size_t pending_cap;
+	unsigned long long retry_at;
+
+/* stop reading the socket while too many events are held back */
+	bool stalled;
+
+/* the local connection is being opened by a worker, the session can't be
+ * released until it reports back */
+	bool connecting;
+
+/* a binary transfer is held back until then, flush again */
+	unsigned long long wake_at;
+
+/* audio playout or a held back signal is due, a12_tick again */
+	unsigned long long tick_at;
+
+	bool dead;
+	struct mux_session* next;
+};
+
+/* a new session [S, fd], or the [cont] opened for [session] by a worker */
+struct mux_handover {
+	struct a12_state* S;
+	int fd;
+	struct mux_session* session;
+	struct arcan_shmif_cont* cont;
+};
+
+struct a12helper_mux {
+	struct a12helper_mux_opts opts;
+	int epfd;
+	int wake[2];
+	struct mux_source wake_src;
+
+	struct mux_session* sessions;
+	size_t n_sessions;
+	unsigned long long last_stats;
+
+/* shared by all sessions, unpack consumes everything so there is no need
+ * to keep it around per session */
+	uint8_t inbuf[9000];
+};
+
+static void source_mask(struct mux_session* session, struct mux_source* src)
+{
+	int fd = src->kind == MUX_SOCKET ? session->fd : src->C->epipe;
+	uint32_t events = 0;
+
+	if (src->kind == MUX_SOCKET)
+		events = (session->stalled ? 0 : EPOLLIN) |
+			(session->want_out ? EPOLLOUT : 0);
+	else if (!session->throttled)
+		events = EPOLLIN;
+
+	epoll_ctl(session->mux->epfd, EPOLL_CTL_MOD, fd,
+		&(struct epoll_event){.events = events, .data.ptr = src});
+}
+
+static bool source_add(
+	struct mux_session* session, struct arcan_shmif_cont* c, uint8_t chid)
+{
+	struct mux_source* src = malloc(sizeof(struct mux_source));
+	struct arcan_shmif_cont* cont = malloc(sizeof(struct arcan_shmif_cont));
+	if (!src || !cont){
+		free(src);
+		free(cont);
+		return false;
+	}
+
+	*cont = *c;
+	*src = (struct mux_source){
+		.kind = MUX_SEGMENT,
+		.session = session,
+		.C = cont,
+		.chid = chid
+	};
+
+	if (-1 == epoll_ctl(session->mux->epfd, EPOLL_CTL_ADD, cont->epipe,
+		&(struct epoll_event){
+			.events = session->throttled ? 0 : EPOLLIN, .data.ptr = src})){
+		free(src);
+		free(cont);
+		return false;
+	}
+
+	a12_set_destination(session->S, cont, chid);
+	session->segments[chid] = src;
+	session->n_segments++;
+	return true;
+}
+
+static void source_drop(struct mux_session* session, uint8_t chid, bool notify)
+{
+	struct mux_source* src = session->segments[chid];
+	if (!src)
+		return;
+
+	epoll_ctl(session->mux->epfd, EPOLL_CTL_DEL, src->C->epipe, NULL);
+	a12_set_channel(session->S, chid);
+	if (notify)
+		a12_channel_shutdown(session->S, "");
+	a12_channel_close(session->S);
+
+	a12int_trace(A12_TRACE_ALLOC, "kind=segment:status=closed:chid=%d", (int)chid);
+	arcan_shmif_drop(src->C);
+	free(src->C);
+	free(src);
+	session->segments[chid] = NULL;
+	session->n_segments--;
+}
+
+static void* connect_worker(void* tag)
+{
+	struct mux_handover* msg = tag;
+	*msg->cont = arcan_shmif_open(SEGID_UNKNOWN, SHMIF_NOACTIVATE, NULL);
+
+	if (sizeof(*msg) != write(msg->session->mux->wake[1], msg, sizeof(*msg))){
+		a12int_trace(A12_TRACE_SYSTEM,
+			"kind=error:status=EPIPE:message=couldn't hand back local connection");
+	}
+
+	free(msg);
+	return NULL;
+}
+
+/* the local connection is deferred until the session has authenticated so
+ * that connections that never get that far only cost the state machine, and
+ * opening it can wait on the server so that is left to a worker */
+static bool session_connect(struct mux_session* session)
+{
+	if (session->segments[0] || session->connecting)
+		return true;
+
+	struct mux_handover* msg = malloc(sizeof(struct mux_handover));
+	struct arcan_shmif_cont* cont = malloc(sizeof(struct arcan_shmif_cont));
+	if (!msg || !cont){
+		free(msg);
+		free(cont);
+		session->dead = true;
+		return false;
+	}
+
+	*cont = (struct arcan_shmif_cont){0};
+	*msg = (struct mux_handover){
+		.session = session,
+		.cont = cont
+	};
+
+	pthread_t pth;
+	pthread_attr_t pthattr;
+	pthread_attr_init(&pthattr);
+	pthread_attr_setdetachstate(&pthattr, PTHREAD_CREATE_DETACHED);
+
+	if (0 != pthread_create(&pth, &pthattr, connect_worker, msg)){
+		a12int_trace(A12_TRACE_SYSTEM,
+			"kind=error:status=EAGAIN:message=couldn't spawn connect worker");
+		free(msg);
+		free(cont);
+		session->dead = true;
+		return false;
+	}
+
+	session->connecting = true;
+	a12int_trace(A12_TRACE_ALLOC, "kind=segment:status=connecting:chid=0");
+	return true;
+}
+
+static void session_stall(struct mux_session* session, bool on)
+{
+	if (session->stalled == on)
+		return;
+
+	session->stalled = on;
+	a12int_trace(A12_TRACE_EVENT,
+		"kind=mux:status=%s:pending=%zu", on ? "stalled" : "resumed",
+		session->pending_n);
+	source_mask(session, &session->sock);
+}
+
+/* hand the held back events to their segments in order until one doesn't
+ * fit, the ones for a segment that has gone away since are dropped */
+static void session_deliver(struct mux_session* session)
+{
+/* the worker delivers once it has the segment */
+	if (session->connecting){
+		session->retry_at = 0;
+		return;
+	}
+
+	size_t i = 0;
+	for (; i < session->pending_n; i++){
+		struct mux_pending* cur = &session->pending[i];
+		struct mux_source* src = session->segments[cur->chid];
+		if (!src)
+			continue;
+
+		if (arcan_shmif_tryenqueue(src->C, &cur->ev) <= 0)
+			break;
+	}
+
+	session->pending_n -= i;
+	memmove(session->pending,
+		&session->pending[i], session->pending_n * sizeof(struct mux_pending));
+
+	session->retry_at =
+		session->pending_n ? arcan_timemillis() + MUX_RETRY_MS : 0;
+
+	if (session->pending_n < MUX_PENDING_LIMIT / 2)
+		session_stall(session, false);
+}
+
+static void session_forward(
+	struct mux_session* session, uint8_t chid, struct arcan_event* ev)
+{
+	if (session->pending_n)
+		session_deliver(session);
+
+/* anything already held back goes first to keep the order */
+	struct mux_source* src = session->segments[chid];
+	if (!session->pending_n && src && arcan_shmif_tryenqueue(src->C, ev) > 0)
+		return;
+
+	if (session->pending_n == session->pending_cap){
+		size_t cap = session->pending_cap ? session->pending_cap * 2 : 16;
+		struct mux_pending* pending =
+			realloc(session->pending, cap * sizeof(struct mux_pending));
+
+		if (!pending){
+			a12int_trace(A12_TRACE_ALLOC,
+				"kind=error:status=ENOMEM:message=event dropped:chid=%d", (int)chid);
+			return;
+		}
+
+		session->pending = pending;
+		session->pending_cap = cap;
+	}
+
+	session->pending[session->pending_n++] = (struct mux_pending){
+		.chid = chid,
+		.ev = *ev
+	};
+
+	if (!session->retry_at && !session->connecting)
+		session->retry_at = arcan_timemillis() + MUX_RETRY_MS;
+
+	if (session->pending_n >= MUX_PENDING_LIMIT)
+		session_stall(session, true);
+}
+
+static void on_mux_event(
+	struct arcan_shmif_cont* cont, int chid, struct arcan_event* ev, void* tag)
+{
+	struct mux_session* session = tag;
+
+/* the first events can arrive in the same buffer that completed the
+ * authentication, so connect on demand as well and hold them until then */
+	bool opening = !cont && chid == 0 && !session->dead &&
+		a12_auth_state(session->S) > 0 && session_connect(session);
+
+	if (!cont && !opening){
+		a12int_trace(A12_TRACE_SYSTEM,
+			"ignore incoming event (%s) on unknown context, channel: %d",
+			arcan_shmif_eventstr(ev, NULL, 0), chid
+		);
+		return;
+	}
+
+	if (arcan_shmif_descrevent(ev)){
+		a12int_trace(A12_TRACE_SYSTEM,
+			"kind=error:status=EINVAL:message=incoming descr- event ignored");
+		return;
+	}
+
+	a12int_trace(A12_TRACE_EVENT,
+		"client event: %s on ch %d", arcan_shmif_eventstr(ev, NULL, 0), chid);
+	session_forward(session, chid, ev);
+
+/* same as in the threaded version, mark the origin as networked */
+	if (ev->category == EVENT_EXTERNAL && ev->ext.kind == EVENT_EXTERNAL_REGISTER){
+		session_forward(session, chid, &(struct arcan_event){
+			.category = EVENT_EXTERNAL,
+			.ext.kind = EVENT_EXTERNAL_PRIVDROP,
+			.ext.privdrop = {
+				.networked = true
+			}
+		});
+	}
+}
+
+static void add_segment(struct mux_session* session,
+	struct mux_source* parent, arcan_event* ev)
+{
+	int chid = 1;
+	for (; chid < 256 && session->segments[chid]; chid++){}
+	if (chid == 256)
+		return;
+
+	int segkind = ev->tgt.ioevs[2].iv;
+	int cookie = ev->tgt.ioevs[3].iv;
+
+	a12int_trace(A12_TRACE_ALLOC, "kind=segment:chid=%d:stage=open", chid);
+	a12_channel_new(session->S, chid, segkind, cookie);
+
+	struct arcan_shmif_cont cont =
+		arcan_shmif_acquire(parent->C, NULL, segkind, 0);
+
+	if (!cont.addr || !source_add(session, &cont, chid)){
+		a12int_trace(A12_TRACE_SYSTEM, "kind=segment:status=EINVAL:chid=%d", chid);
+		if (cont.addr)
+			arcan_shmif_drop(&cont);
+		a12_set_channel(session->S, chid);
+		a12_channel_close(session->S);
+		return;
+	}
+
+	a12int_trace(A12_TRACE_ALLOC, "kind=segment:status=assigned:chid=%d", chid);
+}
+
+static void segment_event(struct mux_session* session, struct mux_source* src)
+{
+	arcan_event ev;
+	int pv;
+
+	while ((pv = arcan_shmif_poll(src->C, &ev)) > 0){
+		if (ev.category == EVENT_TARGET){
+			if (ev.tgt.kind == TARGET_COMMAND_NEWSEGMENT){
+				add_segment(session, src, &ev);
+				continue;
+			}
+
+/* see dispatch_event in a12_helper_cl.c for why these are masked */
+			if (ev.tgt.kind == TARGET_COMMAND_DEVICE_NODE ||
+				ev.tgt.kind == TARGET_COMMAND_EXIT)
+				continue;
+		}
+
+		a12int_trace(A12_TRACE_EVENT,
+			"kind=enqueue:event=%s", arcan_shmif_eventstr(&ev, NULL, 0));
+		a12_set_channel(session->S, src->chid);
+		a12_channel_enqueue(session->S, &ev);
+	}
+
+/* and if the primary dies, all die */
+	if (pv < 0){
+		uint8_t chid = src->chid;
+		source_drop(session, chid, true);
+		if (chid == 0)
+			session->dead = true;
+	}
+}
+
+static void session_tick(struct mux_session* session)
+{
+	unsigned next = a12_tick(session->S);
+	session->tick_at = next ? arcan_timemillis() + next : 0;
+}
+
+static void socket_event(struct a12helper_mux* mux, struct mux_session* session)
+{
+	ssize_t nr = recv(session->fd, mux->inbuf, sizeof(mux->inbuf), 0);
+	if (-1 == nr){
+		if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR){
+			a12int_trace(A12_TRACE_SYSTEM, "data-in, error: %s", strerror(errno));
+			session->dead = true;
+		}
+		return;
+	}
+
+	if (0 == nr){
+		a12int_trace(A12_TRACE_SYSTEM, "data-in, other side closed connection");
+		session->dead = true;
+		return;
+	}
+
+	a12int_trace(A12_TRACE_TRANSFER, "unpack %zd bytes", nr);
+	a12_unpack(session->S, mux->inbuf, nr, session, on_mux_event);
+	session_tick(session);
+
+	if (a12_poll(session->S) < 0){
+		session->dead = true;
+		return;
+	}
+
+	if (!session->segments[0] && a12_auth_state(session->S) > 0)
+		session_connect(session);
+}
+
+static void connect_done(
+	struct mux_session* session, struct arcan_shmif_cont* cont)
+{
+	session->connecting = false;
+
+	if (session->dead){
+		if (cont->addr)
+			arcan_shmif_drop(cont);
+	}
+	else if (!cont->addr){
+		a12int_trace(A12_TRACE_SYSTEM,
+			"kind=error:status=ENOENT:message=couldn't connect to local server");
+		session->dead = true;
+	}
+	else if (!source_add(session, cont, 0)){
+		arcan_shmif_drop(cont);
+		session->dead = true;
+	}
+	else {
+		a12int_trace(A12_TRACE_ALLOC, "kind=segment:status=opened:chid=0");
+		session_deliver(session);
+	}
+
+	free(cont);
+}
+
+static void session_throttle(struct mux_session* session, bool on)
+{
+	if (session->throttled == on)
+		return;
+
+	session->throttled = on;
+	a12int_trace(A12_TRACE_ALLOC,
+		"kind=mux:status=%s:footprint=%zu", on ? "throttled" : "resumed",
+		a12_footprint(session->S));
+
+	for (size_t i = 0; i < 256; i++){
+		if (session->segments[i])
+			source_mask(session, session->segments[i]);
+	}
+}
+
+static void session_flush(
+	struct a12helper_mux* mux, struct mux_session* session)
+{
+	if (session->dead)
+		return;
+
+	size_t i = 0;
+	for (; i < MUX_FLUSH_ROUNDS; i++){
+		if (!session->out_sz){
+			session->outv_n = OUTQUEUE_IOV;
+			session->outv_ofs = 0;
+			session->out_sz = a12_flush_iov(
+				session->S, session->outv, &session->outv_n, A12_FLUSH_ALL);
+			if (!session->out_sz)
+				break;
+		}
+
+		ssize_t nw = writev(session->fd, &session->outv[session->outv_ofs],
+			session->outv_n - session->outv_ofs);
+
+		if (-1 == nw){
+			if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+				break;
+			a12int_trace(A12_TRACE_SYSTEM, "data-out, error: %s", strerror(errno));
+			session->dead = true;
+			return;
+		}
+
+		session->out_sz -= nw;
+		while (nw > 0){
+			struct iovec* cur = &session->outv[session->outv_ofs];
+			if ((size_t) nw >= cur->iov_len){
+				nw -= cur->iov_len;
+				session->outv_ofs++;
+				continue;
+			}
+			cur->iov_base = (uint8_t*) cur->iov_base + nw;
+			cur->iov_len -= nw;
+			nw = 0;
+		}
+
+/* socket buffer full, wait for EPOLLOUT */
+		if (session->out_sz)
+			break;
+	}
+
+	bool want_out = session->out_sz > 0 || i == MUX_FLUSH_ROUNDS;
+	if (want_out != session->want_out){
+		session->want_out = want_out;
+		source_mask(session, &session->sock);
+	}
+
+	unsigned hold = a12_queue_depth(session->S, -1).blob_hold;
+	session->wake_at = hold ? arcan_timemillis() + hold : 0;
+
+/* what is queued can only go down by writing it out, so stop taking in more
+ * events from the segments until it has come down again */
+	if (mux->opts.session_limit){
+		size_t fp = a12_footprint(session->S);
+		if (fp > mux->opts.session_limit)
+			session_throttle(session, true);
+		else if (fp < mux->opts.session_limit / 2)
+			session_throttle(session, false);
+	}
+}
+
+static void session_add(struct a12helper_mux* mux, struct a12_state* S, int fd)
+{
+	if (mux->opts.max_sessions && mux->n_sessions >= mux->opts.max_sessions){
+		a12int_trace(A12_TRACE_SYSTEM,
+			"kind=error:status=EBUSY:message=session limit reached");
+		a12_free(S);
+		close(fd);
+		return;
+	}
+
+	struct mux_session* session = malloc(sizeof(struct mux_session));
+	if (!session){
+		a12_free(S);
+		close(fd);
+		return;
+	}
+
+	*session = (struct mux_session){
+		.mux = mux,
+		.S = S,
+		.fd = fd,
+		.sock = {
+			.kind = MUX_SOCKET
+		}
+	};
+	session->sock.session = session;
+
+	a12_set_nonblock(S, true);
+
+	int flags = fcntl(fd, F_GETFL);
+	if (-1 == flags || -1 == fcntl(fd, F_SETFL, flags | O_NONBLOCK) ||
+		-1 == epoll_ctl(mux->epfd, EPOLL_CTL_ADD, fd,
+			&(struct epoll_event){.events = EPOLLIN, .data.ptr = &session->sock})){
+		a12int_trace(A12_TRACE_SYSTEM, "kind=error:status=EBADFD");
+		a12_free(S);
+		close(fd);
+		free(session);
+		return;
+	}
+
+	session->next = mux->sessions;
+	mux->sessions = session;
+	mux->n_sessions++;
+	a12int_trace(A12_TRACE_SYSTEM, "kind=mux:status=added:sessions=%zu", mux->n_sessions);
+}
+
+/* a dead session waiting on its connect worker is kept, but its socket
+ * shouldn't keep waking the thread */
+static void session_close_socket(
+	struct a12helper_mux* mux, struct mux_session* session)
+{
+	if (-1 == session->fd)
+		return;
+
+	epoll_ctl(mux->epfd, EPOLL_CTL_DEL, session->fd, NULL);
+	close(session->fd);
+	session->fd = -1;
+}
+
+static void session_free(struct a12helper_mux* mux, struct mux_session* session)
+{
+	for (size_t i = 1; i < 256; i++)
+		source_drop(session, i, false);
+	source_drop(session, 0, false);
+
+	session_close_socket(mux, session);
+	free(session->pending);
+
+	if (!a12_free(session->S)){
+		a12int_trace(A12_TRACE_ALLOC, "error cleaning up a12 context");
+	}
+
+	mux->n_sessions--;
+	a12int_trace(A12_TRACE_SYSTEM,
+		"kind=mux:status=removed:sessions=%zu", mux->n_sessions);
+	free(session);
+}
+
+static void wakeup_event(struct a12helper_mux* mux)
+{
+	struct mux_handover msg;
+	while (sizeof(msg) == read(mux->wake[0], &msg, sizeof(msg))){
+		if (msg.session)
+			connect_done(msg.session, msg.cont);
+		else
+			session_add(mux, msg.S, msg.fd);
+	}
+}
+
+static void mux_stats(struct a12helper_mux* mux)
+{
+	size_t total = 0, max = 0, segments = 0;
+	for (struct mux_session* cur = mux->sessions; cur; cur = cur->next){
+		size_t fp = a12_footprint(cur->S) + sizeof(struct mux_session) +
+			cur->n_segments * (sizeof(struct mux_source) + sizeof(struct arcan_shmif_cont));
+		total += fp;
+		segments += cur->n_segments;
+		if (fp > max)
+			max = fp;
+	}
+
+	a12int_trace(A12_TRACE_ALLOC,
+		"kind=mux:sessions=%zu:segments=%zu:footprint=%zu:max=%zu",
+		mux->n_sessions, segments, total, max);
+}
+
+static int next_timeout(struct a12helper_mux* mux, unsigned long long now)
+{
+	unsigned long long next = 0;
+	if (mux->opts.stats_interval)
+		next = mux->last_stats + mux->opts.stats_interval;
+
+	for (struct mux_session* cur = mux->sessions; cur; cur = cur->next){
+		if (cur->wake_at && (!next || cur->wake_at < next))
+			next = cur->wake_at;
+		if (cur->tick_at && (!next || cur->tick_at < next))
+			next = cur->tick_at;
+		if (cur->retry_at && (!next || cur->retry_at < next))
+			next = cur->retry_at;
+	}
+
+	if (!next)
+		return -1;
+
+	return next > now ? (int)(next - now) : 0;
+}
+
+static void* mux_thread(void* tag)
+{
+	struct a12helper_mux* mux = tag;
+	struct epoll_event evs[MUX_EVENTS];
+	mux->last_stats = arcan_timemillis();
+
+	for(;;){
+		int nev = epoll_wait(mux->epfd, evs, MUX_EVENTS,
+			next_timeout(mux, arcan_timemillis()));
+
+		if (-1 == nev){
+			if (errno == EINTR)
+				continue;
+			a12int_trace(A12_TRACE_SYSTEM, "kind=error:message=epoll: %s", strerror(errno));
+			break;
+		}
+
+		for (int i = 0; i < nev; i++){
+			struct mux_source* src = evs[i].data.ptr;
+			struct mux_session* session = src->session;
+
+			if (src->kind == MUX_WAKEUP){
+				wakeup_event(mux);
+				continue;
+			}
+
+/* anything else in the batch that refers to a dead session is ignored, the
+ * session itself is only released after the batch */
+			if (session->dead)
+				continue;
+
+			if (src->kind == MUX_SOCKET){
+				if (evs[i].events & EPOLLIN)
+					socket_event(mux, session);
+				else if (evs[i].events & (EPOLLERR | EPOLLHUP))
+					session->dead = true;
+			}
+			else if (evs[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP))
+				segment_event(session, src);
+
+			session_flush(mux, session);
+		}
+
+		unsigned long long now = arcan_timemillis();
+		struct mux_session** cur = &mux->sessions;
+		while (*cur){
+			struct mux_session* session = *cur;
+			if (!session->dead && session->tick_at && session->tick_at <= now)
+				session_tick(session);
+
+			if (!session->dead && session->wake_at && session->wake_at <= now)
+				session_flush(mux, session);
+
+			if (!session->dead && session->retry_at && session->retry_at <= now)
+				session_deliver(session);
+
+			if (session->dead && session->connecting){
+				session_close_socket(mux, session);
+				session->retry_at = session->tick_at = session->wake_at = 0;
+			}
+			else if (session->dead){
+				*cur = session->next;
+				session_free(mux, session);
+				continue;
+			}
+			cur = &session->next;
+		}
+
+		if (mux->opts.stats_interval && now - mux->last_stats >= mux->opts.stats_interval){
+			mux->last_stats = now;
+			mux_stats(mux);
+		}
+	}
+
+	return NULL;
+}
+
+struct a12helper_mux* a12helper_mux_create(
+	const char* cp, struct a12helper_mux_opts opts)
+{
+	if (!cp)
+		cp = getenv("ARCAN_CONNPATH");
+	else
+		setenv("ARCAN_CONNPATH", cp, 1);
+
+	if (!cp){
+		a12int_trace(A12_TRACE_SYSTEM, "No connection point was specified");
+		return NULL;
+	}
+
+	struct a12helper_mux* mux = malloc(sizeof(struct a12helper_mux));
+	if (!mux)
+		return NULL;
+
+	*mux = (struct a12helper_mux){
+		.opts = opts,
+		.wake_src = {
+			.kind = MUX_WAKEUP
+		}
+	};
+
+	mux->epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (-1 == mux->epfd){
+		free(mux);
+		return NULL;
+	}
+
+	if (-1 == pipe(mux->wake)){
+		close(mux->epfd);
+		free(mux);
+		return NULL;
+	}
+
+	fcntl(mux->wake[0], F_SETFD, FD_CLOEXEC);
+	fcntl(mux->wake[1], F_SETFD, FD_CLOEXEC);
+	fcntl(mux->wake[0], F_SETFL, O_NONBLOCK);
+	epoll_ctl(mux->epfd, EPOLL_CTL_ADD, mux->wake[0],
+		&(struct epoll_event){.events = EPOLLIN, .data.ptr = &mux->wake_src});
+
+	pthread_t pth;
+	pthread_attr_t pthattr;
+	pthread_attr_init(&pthattr);
+	pthread_attr_setdetachstate(&pthattr, PTHREAD_CREATE_DETACHED);
+
+	if (0 != pthread_create(&pth, &pthattr, mux_thread, mux)){
+		close(mux->wake[0]);
+		close(mux->wake[1]);
+		close(mux->epfd);
+		free(mux);
+		return NULL;
+	}
+
+	return mux;
+}
+
+bool a12helper_mux_add(struct a12helper_mux* mux, struct a12_state* S, int fd)
+{
+/* below PIPE_BUF so the write is atomic even with several producers */
+	struct mux_handover msg = {
+		.S = S,
+		.fd = fd
+	};
+
+	return sizeof(msg) == write(mux->wake[1], &msg, sizeof(msg));
+}
@@ -15,6 +15,7 @@
 #include <sys/wait.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <stdatomic.h>
 #include <pthread.h>
 
@@ -23,6 +24,17 @@
 #include "a12_helper.h"
 #include "arcan_mem.h"
 
+/* video frames dropped while the link is backed up, [vb] is the last one with
+ * the region set to the union of their damage and its buffer pointing to our
+ * own complete copy of that frame */
+struct video_pace {
+	bool pending;
+	size_t dropped;
+	shmif_pixel* buf;
+	size_t buf_sz;
+	struct shmifsrv_vbuffer vb;
+};
+
 struct shmifsrv_thread_data {
 	struct shmifsrv_client* C;
 	struct a12_state* S;
@@ -30,7 +42,9 @@ struct shmifsrv_thread_data {
 	struct a12helper_opts opts;
 	float font_sz;
 	int kill_fd;
+	int link_class;
 	uint8_t chid;
+	struct video_pace pace;
 };
 
 /* [THREADING]
@@ -38,20 +52,63 @@ struct shmifsrv_thread_data {
  * due to the buffer function and the channel- state tracker, not impossible just
  * easier to solve like this).
  *
- * The buffer-out is simply a way for the main feed thread to forward the current
- * pending buffer output
- *
+ * The client threads pace video on their own by looking at how much is queued
+ * for their channel and how much is inflight on the link, see video_paced.
 */
 static bool spawn_thread(struct shmifsrv_thread_data* inarg);
 static pthread_mutex_t giant_lock = PTHREAD_MUTEX_INITIALIZER;
 
 static const char* last_lock;
-static _Atomic volatile size_t buffer_out = 0;
 static _Atomic volatile uint8_t n_segments;
 
 #define BEGIN_CRITICAL(X, Y) do{pthread_mutex_lock(X); last_lock = Y;} while(0);
 #define END_CRITICAL(X) do{pthread_mutex_unlock(X);} while(0);
 
+/*
+ * Coarse classes of the link to the other side, used to pick the codec. The
+ * estimate only drops when there is data backed up, and changing class needs
+ * a margin past the threshold so that a noisy estimate doesn't flip between
+ * codecs (each flip costs a full frame).
+ */
+enum link_class {
+	LINK_UNKNOWN = 0,
+	LINK_SLOW,
+	LINK_MEDIUM,
+	LINK_FAST
+};
+
+#define LINK_SLOW_MBIT 20.0
+#define LINK_FAST_MBIT 200.0
+#define LINK_WAN_RTT 80.0
+
+static void update_link_class(struct shmifsrv_thread_data* data)
+{
+	struct a12_link_estimate est = a12_link_estimate(data->S);
+	if (!est.rate_samples)
+		return;
+
+	struct a12_queue_depth qd = a12_queue_depth(data->S, -1);
+	bool backlog = qd.vframes > 0 ||
+		(est.rtt_samples && est.rtt_ms > LINK_WAN_RTT);
+
+	int cls = data->link_class;
+	if (est.mbit > LINK_FAST_MBIT * 1.25 && !backlog)
+		cls = LINK_FAST;
+	else if (est.mbit < LINK_SLOW_MBIT * 0.8 && backlog)
+		cls = LINK_SLOW;
+	else if (cls == LINK_UNKNOWN ||
+		(cls == LINK_FAST && est.mbit < LINK_FAST_MBIT * 0.8) ||
+		(cls == LINK_SLOW && est.mbit > LINK_SLOW_MBIT * 1.25))
+		cls = LINK_MEDIUM;
+
+	if (cls != data->link_class){
+		a12int_trace(A12_TRACE_VIDEO,
+			"kind=link:class=%d:mbit=%.2f:rtt=%.2f:vframes=%zu",
+			cls, est.mbit, est.rtt_ms, qd.vframes);
+		data->link_class = cls;
+	}
+}
+
 /*
  * Figure out encoding parameters based on client type and buffer parameters.
  * This is the first heurstic catch-all to later feed in backpressure,
@@ -84,6 +141,8 @@ static struct a12_vframe_opts vopts_from_segment(
 	}
 #endif
 
+	update_link_class(data);
+
 	switch (shmifsrv_client_type(data->C)){
 	case SEGID_LWA:
 		a12int_trace(A12_TRACE_VIDEO, "lwa -> h264, balanced");
@@ -92,6 +151,12 @@ static struct a12_vframe_opts vopts_from_segment(
 			.bias = VFRAME_BIAS_BALANCED
 		};
 	case SEGID_GAME:
+		if (data->link_class == LINK_FAST){
+			a12int_trace(A12_TRACE_VIDEO, "game, fast link -> adaptive");
+			return (struct a12_vframe_opts){
+				.method = VFRAME_METHOD_ADAPTIVE
+			};
+		}
 		a12int_trace(A12_TRACE_VIDEO, "game -> h264, latency");
 		return (struct a12_vframe_opts){
 			.method = VFRAME_METHOD_H264,
@@ -120,6 +185,21 @@ static struct a12_vframe_opts vopts_from_segment(
 				.bias = data->opts.default_bias
 			};
 		}
+		if (data->link_class == LINK_FAST){
+			a12int_trace(A12_TRACE_VIDEO,
+				"default (%d), fast link -> adaptive", shmifsrv_client_type(data->C));
+			return (struct a12_vframe_opts){
+				.method = VFRAME_METHOD_ADAPTIVE
+			};
+		}
+		else if (data->link_class == LINK_SLOW){
+			a12int_trace(A12_TRACE_VIDEO,
+				"default (%d), slow link -> h264", shmifsrv_client_type(data->C));
+			return (struct a12_vframe_opts){
+				.method = VFRAME_METHOD_H264,
+				.bias = VFRAME_BIAS_LATENCY
+			};
+		}
 		a12int_trace(A12_TRACE_VIDEO,
 			"default (%d) -> dpng", shmifsrv_client_type(data->C));
 		return (struct a12_vframe_opts){
@@ -129,6 +209,139 @@ static struct a12_vframe_opts vopts_from_segment(
 	}
 }
 
+/*
+ * Video pacing. When the client produces frames faster than the link can take
+ * them, encoding each one only moves the backlog into the output queue and the
+ * latency grows without bound. Instead frames are dropped while more than the
+ * link can carry in PACE_LAG_MS (on top of what the round-trip keeps inflight)
+ * is queued for the channel, and the first frame after it has drained is sent
+ * with the union of the damage of those that were dropped.
+ *
+ * The damaged region of a dropped frame (grown to cover earlier drops) is copied
+ * out before the client is released, should it not produce another frame that
+ * copy is what gets sent.
+ */
+#define PACE_LAG_MS 100
+#define PACE_MIN_BYTES 262144
+
+static bool video_paced(struct shmifsrv_thread_data* data)
+{
+	struct a12_queue_depth qd = a12_queue_depth(data->S, data->chid);
+	if (qd.vframes > 0)
+		return true;
+
+	size_t queued = qd.bytes[A12_QUEUE_VIDEO];
+	size_t budget = PACE_MIN_BYTES;
+
+/* the inflight count comes from the acknowledgements, without any rate
+ * samples the other side might not send those */
+	struct a12_link_estimate est = a12_link_estimate(data->S);
+	if (est.rate_samples){
+		float ms = PACE_LAG_MS + (est.rtt_samples ? est.rtt_ms : 0);
+		size_t link = est.mbit * 125000.0 * ms / 1000.0;
+		if (link > budget)
+			budget = link;
+		queued += est.inflight;
+	}
+
+	return queued > budget;
+}
+
+static struct arcan_shmif_region vb_damage(struct shmifsrv_vbuffer* vb)
+{
+	struct arcan_shmif_region r = vb->region;
+	if (!vb->flags.subregion ||
+		r.x2 <= r.x1 || r.y2 <= r.y1 || r.x2 > vb->w || r.y2 > vb->h)
+		return (struct arcan_shmif_region){.x2 = vb->w, .y2 = vb->h};
+	return r;
+}
+
+static struct arcan_shmif_region region_union(
+	struct arcan_shmif_region a, struct arcan_shmif_region b)
+{
+	return (struct arcan_shmif_region){
+		.x1 = a.x1 < b.x1 ? a.x1 : b.x1,
+		.y1 = a.y1 < b.y1 ? a.y1 : b.y1,
+		.x2 = a.x2 > b.x2 ? a.x2 : b.x2,
+		.y2 = a.y2 > b.y2 ? a.y2 : b.y2
+	};
+}
+
+/* returns false if the frame can't be dropped and the client should be held
+ * until the link has drained, that is the case for tpack (the decoder needs
+ * every frame) and for buffers we can't copy */
+static bool video_drop(
+	struct shmifsrv_thread_data* data, struct shmifsrv_vbuffer* vb)
+{
+	if (vb->flags.tpack || vb->flags.compressed || vb->flags.hwhandles)
+		return false;
+
+	size_t px = vb->w * vb->h;
+	if (data->pace.buf_sz < px){
+		shmif_pixel* buf = malloc(px * sizeof(shmif_pixel));
+		if (!buf)
+			return false;
+
+		free(data->pace.buf);
+		data->pace.buf = buf;
+		data->pace.buf_sz = px;
+	}
+
+/* the encoder can read outside of the region (h264 converts the whole buffer,
+ * dpng/dlz/dtile send everything on an I-frame), so the first drop in a run
+ * and any new size copies the entire frame. After that the copy only needs
+ * the damage of this frame to stay current, while the region that is sent on
+ * resume grows to cover all the drops */
+	struct arcan_shmif_region full = {.x2 = vb->w, .y2 = vb->h};
+	struct arcan_shmif_region r = vb_damage(vb);
+	struct arcan_shmif_region copy = r;
+
+	if (!data->pace.pending)
+		copy = full;
+	else if (data->pace.vb.w != vb->w || data->pace.vb.h != vb->h)
+		r = copy = full;
+	else
+		r = region_union(r, data->pace.vb.region);
+
+	for (size_t y = copy.y1; y < copy.y2; y++)
+		memcpy(&data->pace.buf[y * vb->w + copy.x1],
+			&vb->buffer[y * vb->pitch + copy.x1],
+			(copy.x2 - copy.x1) * sizeof(shmif_pixel));
+
+	data->pace.vb = *vb;
+	data->pace.vb.buffer = data->pace.buf;
+	data->pace.vb.pitch = vb->w;
+	data->pace.vb.stride = vb->w * sizeof(shmif_pixel);
+	data->pace.vb.flags.subregion = true;
+	data->pace.vb.region = r;
+	data->pace.pending = true;
+	data->pace.dropped++;
+
+	a12int_trace(A12_TRACE_VDETAIL,
+		"kind=drop:ch=%d:dropped=%zu:region=%d,%d-%d,%d",
+		(int)data->chid, data->pace.dropped, r.x1, r.y1, r.x2, r.y2);
+	return true;
+}
+
+/* fold the damage from dropped frames into the frame about to be sent */
+static void video_merge_dropped(
+	struct shmifsrv_thread_data* data, struct shmifsrv_vbuffer* vb)
+{
+	if (!data->pace.pending)
+		return;
+
+	if (data->pace.vb.w == vb->w && data->pace.vb.h == vb->h)
+		vb->region = region_union(vb_damage(vb), data->pace.vb.region);
+	else
+		vb->region = (struct arcan_shmif_region){.x2 = vb->w, .y2 = vb->h};
+	vb->flags.subregion = true;
+
+	a12int_trace(A12_TRACE_VIDEO,
+		"kind=resume:ch=%d:dropped=%zu", (int)data->chid, data->pace.dropped);
+	data->pace.pending = false;
+	data->pace.dropped = 0;
+}
+
 extern uint8_t* arcan_base64_encode(
 	const uint8_t* data, size_t inl, size_t* outl, enum arcan_memhint hint);
 
@@ -188,6 +401,7 @@ static void dispatch_bdata(
 static struct a12_bhandler_res incoming_bhandler(
 	struct a12_state* S, struct a12_bhandler_meta md, void* tag)
 {
+	struct a12helper_opts* opts = tag;
 	struct a12_bhandler_res res = {
 		.fd = -1,
 		.flag = A12_BHANDLER_DONTWANT
@@ -195,7 +409,9 @@ static struct a12_bhandler_res incoming_bhandler(
 
 /* early out case - on completed / on cancelled, the descriptor either
  * comes from the temp or the cache so no unlink is needed, just fwd+close */
-	if (md.fd != -1){
+	if (md.state != A12_BHANDLER_INITIALIZE){
+		if (md.fd == -1)
+			return res;
 
 /* these events cover only one direction, the other (_OUT, _STORE, ...)
  * requires this side to be proactive when receiving the event, forward the
@@ -205,6 +421,10 @@ static struct a12_bhandler_res incoming_bhandler(
 			!md.streaming && md.state != A12_BHANDLER_CANCELLED){
 			a12int_trace(A12_TRACE_BTRANSFER,
 				"kind=accept:ch=%d:stream=%"PRIu64, md.channel, md.streamid);
+
+/* keep a verified copy around for the next time the same contents comes */
+			a12helper_cache_store(
+				opts->dirfd_cache, opts->cache_limit, md.checksum, md.fd);
 			dispatch_bdata(S, md.fd, md.type, md.dcont->user);
 		}
 /* already been dispatched as a pipe */
@@ -214,6 +434,9 @@ static struct a12_bhandler_res incoming_bhandler(
 		return res;
 	}
 
+	if (!md.dcont || !md.dcont->user)
+		return res;
+
 /* So the handler wants a descriptor for us to store or stream the transfer
  * into. If it is streaming, a pipe is sufficient and we can start the fwd
  * immediately. */
@@ -222,26 +445,27 @@ static struct a12_bhandler_res incoming_bhandler(
 		if (-1 != pipe(fd)){
 			res.flag = A12_BHANDLER_NEWFD;
 			res.fd = fd[1];
-			dispatch_bdata(S, md.fd, res.fd, md.dcont->user);
+			dispatch_bdata(S, fd[0], md.type, md.dcont->user);
 		}
 		return res;
 	}
 
-/* INCOMPLETE
- * If there is a !0 checksum and a cache_dir has been set, check the cache for
- * a possible match by going to base64 and try to open. If successful, update
- * its timestamp, return that it was cached and trigger dispatch_bdata */
+/* If there is a !0 checksum and a cache dir has been set, check the cache for
+ * a match. The a12 state machine will cancel the transfer and come back with
+ * the descriptor as COMPLETED, which forwards it like any other transfer. */
 	size_t i = 0;
 	for (; i < 16; i++){
 		if (md.checksum[i] != 0){
 			break;
 		}
 	}
-	if (0 && i == 16){
-		a12int_trace(A12_TRACE_MISSING,
-			"btransfer cache-lookup and forward");
-		res.flag = A12_BHANDLER_CACHED;
-		return res;
+	if (i != 16 && opts->dirfd_cache != -1){
+		int fd = a12helper_cache_lookup(opts->dirfd_cache, md.checksum, md.known_size);
+		if (-1 != fd){
+			res.flag = A12_BHANDLER_CACHED;
+			res.fd = fd;
+			return res;
+		}
 	}
 
 /*
@@ -413,6 +637,7 @@ static void on_srv_event(
 		return;
 	}
 	*new_data = *data;
+	new_data->pace = (struct video_pace){0};
 
 /* Then we forward the subsegment to the local client */
 	new_data->chid = ev->tgt.ioevs[0].iv;
@@ -448,17 +673,20 @@ static void on_srv_event(
 		"kind=new_channel:src_ch=%d:dst_ch=%d", chid, (int)new_data->chid);
 }
 
+/* shmifsrv reports the size of the buffer in bytes, unless the link has shown
+ * that it has plenty of headroom the audio is ADPCM compressed to a quarter */
 static void on_audio_cb(shmif_asample* buf,
-	size_t n_samples,  unsigned channels, unsigned rate, void* tag)
+	size_t n_bytes, unsigned channels, unsigned rate, void* tag)
 {
-	struct a12_state* S = tag;
-	a12_channel_aframe(S, buf, n_samples,
+	struct shmifsrv_thread_data* data = tag;
+	a12_channel_aframe(data->S, buf, n_bytes / sizeof(shmif_asample),
 		(struct a12_aframe_cfg){
 			.channels = channels,
 			.samplerate = rate
 		},
 		(struct a12_aframe_opts){
-			.method = AFRAME_METHOD_RAW
+			.method = data->link_class == LINK_FAST ?
+				AFRAME_METHOD_RAW : AFRAME_METHOD_ADPCM
 		}
 	);
 }
@@ -527,14 +755,10 @@ static void* client_thread(void* inarg)
 				goto out;
 			}
 
-/* the shared buffer_out marks if we should wait a bit before releasing the
- * client as to not keep oversaturating with incoming video frames, we could
- * threshold this to something more reasonable, or better yet, track the
- * trending curve and time-delay and use that to adjust the encoding parameters */
+/* while the link is backed up frames are dropped (or the client is held if
+ * that is not possible), see video_paced */
+			bool hold = false;
 			if (pv & CLIENT_VBUFFER_READY){
-				if (atomic_load(&buffer_out) > 0){
-					break;
-				}
 
 /* two option, one is to map the dma-buf ourselves and do the readback, or with
  * streams map the stream and convert to h264 on gpu, but easiest now is to
@@ -543,16 +767,18 @@ static void* client_thread(void* inarg)
 				a12int_trace(A12_TRACE_VDETAIL, "video-buffer");
 				struct shmifsrv_vbuffer vb = shmifsrv_video(data->C);
 				BEGIN_CRITICAL(&giant_lock, "video-buffer");
-					a12_set_channel(data->S, data->chid);
-					a12_channel_vframe(data->S, &vb, vopts_from_segment(data, vb));
-					dirty = true;
+					if (!video_paced(data)){
+						video_merge_dropped(data, &vb);
+						a12_set_channel(data->S, data->chid);
+						a12_channel_vframe(data->S, &vb, vopts_from_segment(data, vb));
+						dirty = true;
+					}
+					else
+						hold = !video_drop(data, &vb);
 				END_CRITICAL(&giant_lock);
 
-/* the other part is to, after a certain while of VBUFFER_READY but not any
- * buffer- out space, track if any of our segments have focus, if so, inject it
- * anyhow (should help responsiveness), increase video compression time-
- * tradeoff and defer the step stage so the client gets that we are limited */
-				shmifsrv_video_step(data->C);
+				if (!hold)
+					shmifsrv_video_step(data->C);
 			}
 
 /* send audio anyway, as not all clients are providing audio and there is less
@@ -562,10 +788,28 @@ static void* client_thread(void* inarg)
 				a12int_trace(A12_TRACE_AUDIO, "audio-buffer");
 				BEGIN_CRITICAL(&giant_lock, "audio_buffer");
 					a12_set_channel(data->S, data->chid);
-					shmifsrv_audio(data->C, on_audio_cb, data->S);
+					shmifsrv_audio(data->C, on_audio_cb, data);
 					dirty = true;
 				END_CRITICAL(&giant_lock);
 			}
+
+/* the held frame stays ready, so come back to it after the next poll */
+			if (hold)
+				break;
+		}
+
+/* the link drained without the client sending anything new, so the copy of
+ * the last dropped frame is what the other side is missing */
+		if (data->pace.pending){
+			BEGIN_CRITICAL(&giant_lock, "video-dropped");
+				if (!video_paced(data)){
+					struct shmifsrv_vbuffer vb = data->pace.vb;
+					video_merge_dropped(data, &vb);
+					a12_set_channel(data->S, data->chid);
+					a12_channel_vframe(data->S, &vb, vopts_from_segment(data, vb));
+					dirty = true;
+				}
+			END_CRITICAL(&giant_lock);
 		}
 
 	}
@@ -589,6 +833,7 @@ out:
 
 	atomic_fetch_sub(&n_segments, 1);
 
+	free(data->pace.buf);
 	free(inarg);
 	return NULL;
 }
@@ -616,10 +861,13 @@ static bool spawn_thread(struct shmifsrv_thread_data* inarg)
 void a12helper_a12cl_shmifsrv(struct a12_state* S,
 	struct shmifsrv_client* C, int fd_in, int fd_out, struct a12helper_opts opts)
 {
-	uint8_t* outbuf = NULL;
+/* the output is picked up as a set of slices so that big frames can be
+ * written straight from where they were encrypted */
+	struct iovec outv[OUTQUEUE_IOV];
+	size_t outv_n = 0;
+	size_t outv_ofs = 0;
 	size_t outbuf_sz = 0;
 
-
 /* tie an empty context as channel destination, we use this as a type- wrapper
  * for the shmifsrv_client now, this logic is slightly different on the
  * shmifsrv_client side. */
@@ -693,7 +941,7 @@ void a12helper_a12cl_shmifsrv(struct a12_state* S,
 
 /* pending out, flush or grab next out buffer */
 		if (n_fd == 3 && (fds[2].revents & POLLOUT) && outbuf_sz){
-			ssize_t nw = write(fd_out, outbuf, outbuf_sz);
+			ssize_t nw = writev(fd_out, &outv[outv_ofs], outv_n - outv_ofs);
 
 			if (a12_trace_targets & A12_TRACE_TRANSFER){
 				BEGIN_CRITICAL(&giant_lock, "buffer-send");
@@ -703,8 +951,16 @@ void a12helper_a12cl_shmifsrv(struct a12_state* S,
 			}
 
 			if (nw > 0){
-				outbuf += nw;
 				outbuf_sz -= nw;
+				while (nw > 0){
+					if ((size_t) nw >= outv[outv_ofs].iov_len){
+						nw -= outv[outv_ofs++].iov_len;
+						continue;
+					}
+					outv[outv_ofs].iov_base = (uint8_t*)outv[outv_ofs].iov_base + nw;
+					outv[outv_ofs].iov_len -= nw;
+					nw = 0;
+				}
 			}
 		}
 
@@ -736,7 +992,9 @@ void a12helper_a12cl_shmifsrv(struct a12_state* S,
 
 		if (!outbuf_sz){
 			BEGIN_CRITICAL(&giant_lock, "get-buffer");
-				outbuf_sz = a12_flush(S, &outbuf, 0);
+				outv_n = OUTQUEUE_IOV;
+				outv_ofs = 0;
+				outbuf_sz = a12_flush_iov(S, outv, &outv_n, 0);
 			END_CRITICAL(&giant_lock);
 		}
 		n_fd = outbuf_sz > 0 ? 3 : 2;
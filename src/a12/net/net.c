@@ -24,7 +24,8 @@
 
 enum mt_mode {
 	MT_SINGLE = 0,
-	MT_FORK = 1
+	MT_FORK = 1,
+	MT_MUX = 2
 };
 
 static const char* trace_groups[] = {
@@ -116,17 +117,51 @@ static void single_a12srv(struct a12_state* S, int fd, void* tag)
 	a12helper_a12srv_shmifcl(S, NULL, fd, fd);
 }
 
+static void mux_a12srv(struct a12_state* S, int fd, void* tag)
+{
+	if (!a12helper_mux_add(tag, S, fd)){
+		a12int_trace(A12_TRACE_SYSTEM, "couldn't hand over to mux");
+		a12_free(S);
+		close(fd);
+	}
+}
+
+/* the binary transfer cache is optional, a missing directory just means that
+ * everything gets transferred */
+static int open_cache(struct anet_options* args)
+{
+	if (!args->cache_dir)
+		return -1;
+
+	int fd = open(args->cache_dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (-1 == fd && errno == ENOENT){
+		if (0 == mkdir(args->cache_dir, 0700))
+			fd = open(args->cache_dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	}
+
+	if (-1 == fd)
+		fprintf(stderr, "couldn't open cache dir (%s), caching disabled\n", args->cache_dir);
+
+	return fd;
+}
+
 static void a12cl_dispatch(
 	struct anet_options* args,
 	struct a12_state* S, struct shmifsrv_client* cl, int fd)
 {
+	int cache = open_cache(args);
+
 /* note that the a12helper will do the cleanup / free */
 	a12helper_a12cl_shmifsrv(S, cl, fd, fd, (struct a12helper_opts){
 		.dirfd_temp = -1,
-		.dirfd_cache = -1,
+		.dirfd_cache = cache,
+		.cache_limit = args->cache_limit,
 		.redirect_exit = args->redirect_exit,
 		.devicehint_cp = args->devicehint_cp
 	});
+
+	if (-1 != cache)
+		close(cache);
 }
 
 static void fork_a12cl_dispatch(
@@ -138,7 +173,8 @@ static void fork_a12cl_dispatch(
 /* missing: extend sandboxing, close stdio */
 		a12helper_a12cl_shmifsrv(S, cl, fd, fd, (struct a12helper_opts){
 			.dirfd_temp = -1,
-			.dirfd_cache = -1,
+			.dirfd_cache = open_cache(args),
+			.cache_limit = args->cache_limit,
 			.redirect_exit = args->redirect_exit,
 			.devicehint_cp = args->devicehint_cp
 		});
@@ -300,12 +336,18 @@ static bool show_usage(const char* msg)
 	"\tBridge remote arcan applications: arcan-net [-Xtd] -l port [ip]\n\n"
 	"Forward-local options:\n"
 	"\t-X            \t Disable EXIT-redirect to ARCAN_CONNPATH env (if set)\n"
-	"\t-r, --retry n \t Limit retry-reconnect attempts to 'n' tries\n\n"
+	"\t-r, --retry n \t Limit retry-reconnect attempts to 'n' tries\n"
+	"\t-c, --cache dir\t Keep received fonts/state/blobs in <dir> and skip\n"
+	"\t              \t transfers of contents that is already there\n"
+	"\t--cache-limit mb\t Trim the cache dir to <mb> megabytes (default 256)\n\n"
 	"Options:\n"
 	"\t-b dir        \t Set basedir to <dir> (for config, keys/ accepted/ cache/)\n"
 	"\t-a, --auth n  \t (Registering key) read authentication string from stdin\n"
 	"\t              \t overrides possible A12_BASE_DIR environment\n"
 	"\t-t            \t Single- client (no fork/mt)\n"
+	"\t-m, --mux     \t (Bridge) serve all clients from one process and thread\n"
+	"\t--max-sessions n\t (Bridge, -m) reject clients past n sessions\n"
+	"\t--session-limit kb\t (Bridge, -m) stop reading a client over kb memory\n"
 	"\t-d bitmap     \t set trace bitmap (bitmask or key1,key2,...)\n"
 	"\nTrace groups (stderr):\n"
 	"\tvideo:1      audio:2      system:4    event:8      transfer:16\n"
@@ -419,9 +461,32 @@ static bool apply_commandline(int argc, char** argv, struct anet_options* opts)
 		else if (strcmp(argv[i], "-t") == 0){
 			opts->mt_mode = MT_SINGLE;
 		}
+		else if (strcmp(argv[i], "-m") == 0 || strcmp(argv[i], "--mux") == 0){
+			opts->mt_mode = MT_MUX;
+		}
+		else if (strcmp(argv[i], "--max-sessions") == 0){
+			if (i == argc - 1)
+				return show_usage("Missing count argument to --max-sessions");
+			opts->max_sessions = strtoul(argv[++i], NULL, 10);
+		}
+		else if (strcmp(argv[i], "--session-limit") == 0){
+			if (i == argc - 1)
+				return show_usage("Missing kilobytes argument to --session-limit");
+			opts->session_limit = strtoul(argv[++i], NULL, 10) * 1024;
+		}
 		else if (strcmp(argv[i], "-X") == 0){
 			opts->redirect_exit = NULL;
 		}
+		else if (strcmp(argv[i], "-c") == 0 || strcmp(argv[i], "--cache") == 0){
+			if (i == argc - 1)
+				return show_usage("Missing dir argument to -c,--cache");
+			opts->cache_dir = argv[++i];
+		}
+		else if (strcmp(argv[i], "--cache-limit") == 0){
+			if (i == argc - 1)
+				return show_usage("Missing megabytes argument to --cache-limit");
+			opts->cache_limit = strtoul(argv[++i], NULL, 10) * 1024 * 1024;
+		}
 		else if (strcmp(argv[i], "-r") == 0 || strcmp(argv[i], "--retry") == 0){
 			if (1 < argc - 1){
 				opts->retry_count = (ssize_t) strtol(argv[++i], NULL, 10);
@@ -438,6 +503,8 @@ int main(int argc, char** argv)
 {
 	struct anet_options anet = {
 		.retry_count = -1,
+		.cache_limit = 256 * 1024 * 1024,
+		.session_limit = 16 * 1024 * 1024,
 		.mt_mode = MT_FORK
 	};
 	anet.opts = a12_sensitive_alloc(sizeof(struct a12_context_options));
@@ -465,11 +532,34 @@ int main(int argc, char** argv)
 			fprintf(stderr, "%s", errmsg ? errmsg : "");
 			free(errmsg);
 		break;
+		case MT_MUX:{
+			struct a12helper_mux* mux = a12helper_mux_create(NULL,
+				(struct a12helper_mux_opts){
+					.max_sessions = anet.max_sessions,
+					.session_limit = anet.session_limit,
+					.stats_interval = a12_trace_targets & A12_TRACE_ALLOC ? 10000 : 0
+				}
+			);
+			if (!mux){
+				fprintf(stderr, "couldn't setup mux, is ARCAN_CONNPATH set?\n");
+				break;
+			}
+			anet_listen(&anet, &errmsg, mux_a12srv, mux);
+			fprintf(stderr, "%s", errmsg ? errmsg : "");
+			free(errmsg);
+		}
+		break;
 		default:
 		break;
 		}
 		return EXIT_FAILURE;
 	}
+
+/* this side checks incoming binary transfers against the cache dir, if one is
+ * set the other end can hold bigger ones back until we have had a chance to
+ * cancel them */
+	anet.opts->blob_cache = anet.cache_dir != NULL;
+
 	if (anet.mode == ANET_SHMIF_SRV_INHERIT){
 		return a12_preauth(&anet, a12cl_dispatch);
 	}
@@ -101,6 +101,9 @@ arcan_errc arcan_frameserver_free(arcan_frameserver* src)
 
 	arcan_conductor_deregister_frameserver(src);
 
+	agp_drop_rendertarget(src->desc.text.atlas_dst);
+	src->desc.text.atlas_dst = NULL;
+
 	arcan_aobj_id aid = src->aid;
 	uintptr_t tag = src->tag;
 	arcan_vobj_id vid = src->vid;
@@ -190,6 +193,18 @@ bool arcan_frameserver_control_chld(arcan_frameserver* src){
 	return true;
 }
 
+/* the last TPACK frame went through the atlas and only exists in the texture,
+ * bring the raw buffer of the store up to date with it */
+static void atlas_readback(arcan_frameserver* src)
+{
+	if (!src->desc.text.raw_stale)
+		return;
+
+	src->desc.text.raw_stale = false;
+	if (!agp_rendertarget_readback(src->desc.text.atlas_dst))
+		arcan_warning("frameserver:tpack, couldn't read back the store\n");
+}
+
 static bool push_buffer(arcan_frameserver* src,
 	struct agp_vstore* store, struct arcan_shmif_region* dirty)
 {
@@ -250,6 +265,12 @@ static bool push_buffer(arcan_frameserver* src,
 
 		arcan_video_resizefeed(src->vid, src->desc.width, src->desc.height);
 
+/* the texture behind the store is rebuilt so the atlas target is stale, and
+ * the raw buffer has been replaced along with it */
+		agp_drop_rendertarget(src->desc.text.atlas_dst);
+		src->desc.text.atlas_dst = NULL;
+		src->desc.text.raw_stale = false;
+
 		src->desc.rz_flag = false;
 		explicit = true;
 	}
@@ -270,12 +291,28 @@ static bool push_buffer(arcan_frameserver* src,
 				src->desc.text.hint, NULL, NULL
 			);
 
-/* this is the next step to change, of course we should merge the buffers into
- * a tpack_vstore and then use normal txcos etc. to pick our visible set, and a
- * MSDF text atlas to get drawing lists, removing the last 'big buffer'
- * requirement */
-		tui_raster_renderagp(raster, store,
-			(uint8_t*) buf, src->desc.width * src->desc.height * sizeof(shmif_pixel));
+/* prefer drawing the cells as quads against the glyph atlas of the group,
+ * then only glyphs that are missing from the atlas are rastered and there is
+ * no surface upload, fall back to rastering everything if that can't be done */
+		size_t buf_sz = src->desc.width * src->desc.height * sizeof(shmif_pixel);
+		if (!src->desc.text.atlas_fail &&
+			(!src->desc.text.atlas_dst || src->desc.text.atlas_store != store)){
+			agp_drop_rendertarget(src->desc.text.atlas_dst);
+			src->desc.text.atlas_dst = agp_setup_rendertarget(store, RENDERTARGET_COLOR);
+			src->desc.text.atlas_store = store;
+			src->desc.text.atlas_fail = !src->desc.text.atlas_dst;
+		}
+
+		if (src->desc.text.atlas_dst &&
+			arcan_renderfun_fontatlas(src->desc.text.group,
+				raster, store, src->desc.text.atlas_dst, (uint8_t*) buf, buf_sz)){
+			src->desc.text.raw_stale = true;
+		}
+/* a delta frame rastered into raw needs the rest of raw to be current */
+		else {
+			atlas_readback(src);
+			tui_raster_renderagp(raster, store, (uint8_t*) buf, buf_sz);
+		}
 
 		TRACE_MARK_EXIT("frameserver", "buffer-tpack-raster", TRACE_SYS_DEFAULT, src->vid, 0, "");
 		goto commit_mask;
@@ -558,6 +595,16 @@ void arcan_frameserver_lock_buffers(int state)
 	g_buffers_locked = state;
 }
 
+void arcan_frameserver_synch_raw(arcan_frameserver* src)
+{
+	if (!src)
+		return;
+
+	atlas_readback(src);
+	agp_drop_rendertarget(src->desc.text.atlas_dst);
+	src->desc.text.atlas_dst = NULL;
+}
+
 int arcan_frameserver_releaselock(struct arcan_frameserver* tgt)
 {
 	if (!tgt->flags.release_pending || !tgt->shm.ptr){
@@ -50,6 +50,16 @@ struct arcan_frameserver_meta {
 		struct arcan_renderfun_fontgroup* group;
 		int hint;
 		float szmm;
+
+/* rendertarget for drawing TPACK into the store through the glyph atlas,
+ * rebuilt if the store changes, atlas_fail disables the attempt */
+		struct agp_rendertarget* atlas_dst;
+		struct agp_vstore* atlas_store;
+		bool atlas_fail;
+
+/* drawing through the atlas only updates the texture, so the raw buffer of
+ * the store lags behind until arcan_frameserver_synch_raw */
+		bool raw_stale;
 	} text;
 
 /* tracking state for displayhint events */
@@ -466,6 +476,15 @@ void arcan_frameserver_displayhint(
  */
 void arcan_frameserver_lock_buffers(int state);
 
+/*
+ * TPACK contents drawn through the glyph atlas only exist on the GPU, read
+ * them back into the raw buffer of the store so that anything working from
+ * that (context push/pop, readback, storage access) gets the current frame.
+ * The atlas rendertarget is dropped and rebuilt on the next frame, as the
+ * store texture it refers to might not survive. No-op for other sources.
+ */
+void arcan_frameserver_synch_raw(arcan_frameserver* src);
+
 /*
  * IF the frameserver is in pending-release state, this will send signals
  * unlock semaphores and clear the flag. This is used in combination with
@@ -9599,6 +9599,7 @@ static int procimage_histo(lua_State* ctx)
 	arcan_vobject* vobj;
 	luaL_checkvid(ctx, 2, &vobj);
 
+	arcan_vint_synch_raw(vobj);
 	if (!vobj->vstore || vobj->vstore->txmapped == TXSTATE_OFF ||
 		!vobj->vstore->vinf.text.raw)
 		arcan_fatal("calcImage:histogram_impose, "
@@ -9997,6 +9998,7 @@ static int imagestorage(lua_State* ctx)
 		LUA_ETRACE("image_access_storage", NULL, 1);
 	}
 
+	arcan_vint_synch_raw(vobj);
 	if (!vobj->vstore->vinf.text.raw){
 		arcan_warning("image_access_storage(), referenced object "
 			"does not have a valid backing store.");
@@ -11868,6 +11870,7 @@ static int net_pushcl(lua_State* ctx)
 
 /* we can't delete the frameserver immediately as the child might
  * not have mapped the memory yet, so we defer and use a callback */
+		arcan_vint_synch_raw(dvobj);
 		memcpy(srv->vbufs[0], dvobj->vstore->vinf.text.raw,
 			dvobj->vstore->vinf.text.s_raw);
 
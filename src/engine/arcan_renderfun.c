@@ -22,6 +22,14 @@
 #define ARCAN_FONT_CACHE_LIMIT 8
 #endif
 
+#ifndef ARCAN_RENDER_CACHE_LIMIT
+#define ARCAN_RENDER_CACHE_LIMIT 64
+#endif
+
+#ifndef ARCAN_RENDER_CACHE_BUDGET
+#define ARCAN_RENDER_CACHE_BUDGET (16 * 1024 * 1024)
+#endif
+
 #define ARCAN_TTF
 
 #include "arcan_math.h"
@@ -117,6 +125,41 @@ static struct tui_font builtin_bitmap;
 static struct font_entry font_cache[ARCAN_FONT_CACHE_LIMIT] = {
 };
 
+/*
+ * Memoized results of renderfmtstr. The output is a function of the message,
+ * the density, hinting and the state that persists between calls (style and
+ * pt_size on entry), as long as the font slots stay the same. Any change to
+ * the font cache flushes all entries. The state on exit is kept so that a hit
+ * leaves last_style as a full render would have.
+ */
+struct render_entry {
+	char* message;
+	uint64_t hash;
+	uint64_t used;
+
+/* key */
+	float hdpi, vdpi;
+	int hint;
+	bool pot;
+	int style;
+	size_t pt_size;
+
+/* result */
+	struct text_format exit;
+	av_pixel* buf;
+	uint32_t d_sz;
+	size_t dw, dh, maxw, maxh;
+	unsigned int n_lines;
+	struct renderline_meta* lines;
+	size_t bytes;
+};
+
+static struct {
+	struct render_entry ent[ARCAN_RENDER_CACHE_LIMIT];
+	size_t bytes;
+	uint64_t tick;
+} render_cache;
+
 static uint16_t nexthigher(uint16_t k)
 {
 	k--;
@@ -225,8 +268,28 @@ static void update_style(struct text_format* dst, struct font_entry* font)
 	dst->font = font;
 }
 
+static void render_cache_drop(struct render_entry* ent)
+{
+	if (!ent->message)
+		return;
+
+	render_cache.bytes -= ent->bytes;
+	arcan_mem_free(ent->buf);
+	arcan_mem_free(ent->lines);
+	free(ent->message);
+	*ent = (struct render_entry){};
+}
+
+static void render_cache_flush()
+{
+	for (size_t i = 0; i < ARCAN_RENDER_CACHE_LIMIT; i++)
+		render_cache_drop(&render_cache.ent[i]);
+}
+
 static void zap_slot(int i)
 {
+	render_cache_flush();
+
 	for (size_t j = 0; j < font_cache[i].chain.count; j++){
 		if (font_cache[i].chain.fd[j] != BADFD){
 			close(font_cache[i].chain.fd[j]);
@@ -314,8 +377,11 @@ static struct font_entry* grab_font(const char* fname, size_t size)
 				arcan_warning("grab font(), couldn't duplicate entire "
 					"fallback chain (fail @ ind %d)\n", i);
 			}
-			else
+/* same face at another size, pool the glyphs under one cache budget */
+			else {
+				TTF_ShareCache(newch.data[count], matchf->chain.data[i]);
 				count++;
+			}
 		}
 		newch.count = count;
 	}
@@ -358,6 +424,8 @@ bool arcan_video_defaultfont(const char* ident,
 	if (BADFD == fd)
 		return false;
 
+	render_cache_flush();
+
 /* try to load */
 	TTF_Font* font = TTF_OpenFontFD(fd, sz, default_hdpi, default_vdpi);
 	if (!font)
@@ -1404,6 +1472,204 @@ av_pixel* arcan_renderfun_renderfmtstr_extended(const char** msgarray,
 	);
 }
 
+static uint64_t render_hash(const char* msg)
+{
+	uint64_t h = 0xcbf29ce484222325ull;
+	while (*msg){
+		h ^= (uint8_t) *msg++;
+		h *= 0x100000001b3ull;
+	}
+	return h;
+}
+
+/* embedded images and vids can change without the message changing */
+static bool render_cacheable(const char* msg)
+{
+	while (*msg){
+		if (*msg++ != '\\')
+			continue;
+
+		if (*msg == '\\'){
+			msg++;
+			continue;
+		}
+
+		if (*msg == '!')
+			msg++;
+
+		if (*msg == 'p' || *msg == 'P' || *msg == 'e' || *msg == 'E')
+			return false;
+	}
+
+	return true;
+}
+
+static struct render_entry* render_cache_find(
+	const char* msg, uint64_t hash, bool pot)
+{
+	for (size_t i = 0; i < ARCAN_RENDER_CACHE_LIMIT; i++){
+		struct render_entry* ent = &render_cache.ent[i];
+		if (!ent->message || ent->hash != hash || ent->pot != pot ||
+			ent->hint != default_hint || ent->style != last_style.style ||
+			ent->pt_size != last_style.pt_size ||
+			fabs(ent->hdpi - default_hdpi) > EPSILON ||
+			fabs(ent->vdpi - default_vdpi) > EPSILON ||
+			strcmp(ent->message, msg) != 0)
+			continue;
+
+		ent->used = ++render_cache.tick;
+		return ent;
+	}
+
+	return NULL;
+}
+
+/* [entry] is the style and pt_size that the render started with */
+static void render_cache_store(const char* msg, uint64_t hash, bool pot,
+	struct text_format* entry, av_pixel* raw, uint32_t d_sz,
+	size_t dw, size_t dh, size_t maxw, size_t maxh,
+	unsigned int n_lines, struct renderline_meta* lines)
+{
+	size_t lines_sz = sizeof(struct renderline_meta) * (n_lines + 1);
+	size_t bytes = d_sz + lines_sz + strlen(msg) + 1;
+
+/* don't let one large block of text push out everything else */
+	if (bytes > ARCAN_RENDER_CACHE_BUDGET / 4)
+		return;
+
+/* pick a free slot or the least recently used, then trim to the budget */
+	struct render_entry* dst = &render_cache.ent[0];
+	for (size_t i = 0; i < ARCAN_RENDER_CACHE_LIMIT; i++){
+		struct render_entry* ent = &render_cache.ent[i];
+		if (!ent->message){
+			dst = ent;
+			break;
+		}
+		if (ent->used < dst->used)
+			dst = ent;
+	}
+	render_cache_drop(dst);
+
+	while (render_cache.bytes + bytes > ARCAN_RENDER_CACHE_BUDGET){
+		struct render_entry* lru = NULL;
+		for (size_t i = 0; i < ARCAN_RENDER_CACHE_LIMIT; i++){
+			struct render_entry* ent = &render_cache.ent[i];
+			if (ent->message && (!lru || ent->used < lru->used))
+				lru = ent;
+		}
+		render_cache_drop(lru);
+	}
+
+	struct render_entry ent = {
+		.message = strdup(msg),
+		.hash = hash,
+		.used = ++render_cache.tick,
+		.hdpi = default_hdpi,
+		.vdpi = default_vdpi,
+		.hint = default_hint,
+		.pot = pot,
+		.style = entry->style,
+		.pt_size = entry->pt_size,
+		.exit = last_style,
+		.d_sz = d_sz,
+		.dw = dw,
+		.dh = dh,
+		.maxw = maxw,
+		.maxh = maxh,
+		.n_lines = n_lines,
+		.bytes = bytes
+	};
+	ent.exit.surf.buf = NULL;
+	ent.exit.endofs = NULL;
+
+	ent.buf = arcan_alloc_mem(d_sz,
+		ARCAN_MEM_VBUFFER, ARCAN_MEM_NONFATAL, ARCAN_MEMALIGN_PAGE);
+	ent.lines = arcan_alloc_mem(lines_sz,
+		ARCAN_MEM_VSTRUCT, ARCAN_MEM_NONFATAL, ARCAN_MEMALIGN_NATURAL);
+
+	if (!ent.message || !ent.buf || !ent.lines){
+		free(ent.message);
+		arcan_mem_free(ent.buf);
+		arcan_mem_free(ent.lines);
+		return;
+	}
+
+	memcpy(ent.buf, raw, d_sz);
+	memcpy(ent.lines, lines, lines_sz);
+	*dst = ent;
+	render_cache.bytes += bytes;
+}
+
+/* same contract as process_chain, but from a cached result */
+static av_pixel* render_cache_apply(struct render_entry* ent,
+	arcan_vobject* dst, bool norender,
+	unsigned int* n_lines, struct renderline_meta** lineheights, size_t* dw,
+	size_t* dh, uint32_t* d_sz, size_t* maxw, size_t* maxh)
+{
+	last_style = ent->exit;
+	*dw = ent->dw;
+	*dh = ent->dh;
+	*d_sz = ent->d_sz;
+	*maxw = ent->maxw;
+	*maxh = ent->maxh;
+
+	if (norender)
+		return NULL;
+
+	av_pixel* raw;
+	bool upload = true;
+
+	if (dst){
+		struct agp_vstore* s = dst->vstore;
+
+/* re-rendering the same contents into the same store (status bars, clocks
+ * that did not tick) leaves the texture as it is */
+		if (s->vinf.text.raw && s->vinf.text.s_raw == ent->d_sz &&
+			s->w == ent->dw && s->h == ent->dh &&
+			0 == memcmp(s->vinf.text.raw, ent->buf, ent->d_sz)){
+			raw = s->vinf.text.raw;
+			upload = false;
+		}
+		else {
+			arcan_mem_free(s->vinf.text.raw);
+			raw = s->vinf.text.raw = arcan_alloc_mem(ent->d_sz,
+				ARCAN_MEM_VBUFFER, 0, ARCAN_MEMALIGN_PAGE);
+			s->vinf.text.s_raw = ent->d_sz;
+			s->w = ent->dw;
+			s->h = ent->dh;
+		}
+	}
+	else{
+		raw = arcan_alloc_mem(ent->d_sz, ARCAN_MEM_VBUFFER,
+			ARCAN_MEM_NONFATAL, ARCAN_MEMALIGN_PAGE);
+	}
+
+	if (!raw)
+		return NULL;
+
+	if (upload)
+		memcpy(raw, ent->buf, ent->d_sz);
+
+	if (n_lines)
+		*n_lines = ent->n_lines;
+
+	if (lineheights){
+		size_t lines_sz = sizeof(struct renderline_meta) * (ent->n_lines + 1);
+		*lineheights = arcan_alloc_mem(lines_sz, ARCAN_MEM_VSTRUCT,
+			ARCAN_MEM_TEMPORARY, ARCAN_MEMALIGN_NATURAL);
+		memcpy(*lineheights, ent->lines, lines_sz);
+	}
+
+	if (dst){
+		if (upload)
+			agp_resize_vstore(dst->vstore, ent->dw, ent->dh);
+		dst->vstore->vinf.text.hppcm = default_hdpi / 2.54;
+		dst->vstore->vinf.text.vppcm = default_vdpi / 2.54;
+	}
+
+	return raw;
+}
+
 av_pixel* arcan_renderfun_renderfmtstr(const char* message,
 	arcan_vobj_id dstore,
 	bool pot, unsigned int* n_lines, struct renderline_meta** lineheights,
@@ -1414,6 +1680,22 @@ av_pixel* arcan_renderfun_renderfmtstr(const char* message,
 		return NULL;
 
 	av_pixel* raw = NULL;
+	arcan_vobject* dst = arcan_video_getobject(dstore);
+
+	last_style.newline = 0;
+	last_style.tab = 0;
+	last_style.cr = false;
+
+	bool cacheable = render_cacheable(message);
+	uint64_t hash = 0;
+
+	if (cacheable){
+		hash = render_hash(message);
+		struct render_entry* ent = render_cache_find(message, hash, pot);
+		if (ent)
+			return render_cache_apply(ent, dst, norender,
+				n_lines, lineheights, dw, dh, d_sz, maxw, maxh);
+	}
 
 /* (A) parse format string and build chains of renderblocks */
 	struct rcell* root = arcan_alloc_mem(sizeof(struct rcell),
@@ -1421,21 +1703,43 @@ av_pixel* arcan_renderfun_renderfmtstr(const char* message,
 		ARCAN_MEMALIGN_NATURAL
 	);
 
+	struct text_format entry = last_style;
 	char* work = strdup(message);
-	last_style.newline = 0;
-	last_style.tab = 0;
-	last_style.cr = false;
 
 	int chainlines = build_textchain(work, root, false, false, true);
 	arcan_mem_free(work);
 
-	if (chainlines > 0){
-		raw = process_chain(root, arcan_video_getobject(dstore),
+	if (chainlines <= 0)
+		return raw;
+
+/* a size-only pass does not produce anything to store */
+	if (norender || !cacheable){
+		return process_chain(root, dst,
 			chainlines, norender, pot, n_lines, lineheights,
 			dw, dh, d_sz, maxw, maxh
 		);
 	}
 
+	unsigned int lines_n = 0;
+	struct renderline_meta* lines = NULL;
+
+	raw = process_chain(root, dst,
+		chainlines, false, pot, &lines_n, &lines, dw, dh, d_sz, maxw, maxh);
+
+	if (!raw || !*d_sz)
+		return raw;
+
+	render_cache_store(message, hash, pot, &entry,
+		raw, *d_sz, *dw, *dh, *maxw, *maxh, lines_n, lines);
+
+	if (n_lines)
+		*n_lines = lines_n;
+
+	if (lineheights)
+		*lineheights = lines;
+	else
+		arcan_mem_free(lines);
+
 	return raw;
 }
 
@@ -1474,12 +1778,24 @@ struct arcan_renderfun_fontgroup {
 	float ppcm;
 	float size_mm;
 
-/* when adding atlas support, reference the internal font here instead */
+/* GPU side of the glyph atlas that the raster keeps, along with the quads
+ * for the batch being drawn, see arcan_renderfun_fontatlas */
+	struct agp_vstore* atlas;
+	struct agp_mesh_store mesh;
+	size_t mesh_cap;
 };
 
 static void build_font_group(
 	struct arcan_renderfun_fontgroup* grp, int* fds, size_t n_fonts);
 
+static void drop_atlas(struct arcan_renderfun_fontgroup* grp)
+{
+	if (grp->atlas){
+		arcan_vint_drop_vstore(grp->atlas);
+		grp->atlas = NULL;
+	}
+}
+
 static void close_font_slot(struct arcan_renderfun_fontgroup* grp, int slot)
 {
 	if (!(grp->font[slot].fd && grp->font[slot].fd != BADFD) ||
@@ -1606,6 +1922,7 @@ void arcan_renderfun_fontgroup_replace(
 		tui_raster_free(group->raster);
 		group->raster = NULL;
 	}
+	drop_atlas(group);
 
 /* can't accomodate, ignore */
 	if (slot >= group->used){
@@ -1627,6 +1944,8 @@ void arcan_renderfun_release_fontgroup(struct arcan_renderfun_fontgroup* group)
 	group->used = 0;
 
 	tui_raster_free(group->raster);
+	drop_atlas(group);
+	agp_drop_mesh(&group->mesh);
 	arcan_mem_free(group->font);
 	arcan_mem_free(group);
 }
@@ -1650,6 +1969,7 @@ struct tui_raster_context* arcan_renderfun_fontraster(
 		}
 		tui_raster_free(group->raster);
 		group->raster = NULL;
+		drop_atlas(group);
 	}
 
 /* otherwise, build a new list (_setup will copy internally) */
@@ -1698,6 +2018,156 @@ struct tui_raster_context* arcan_renderfun_fontraster(
 	return group->raster;
 }
 
+static bool grow_mesh(struct arcan_renderfun_fontgroup* grp, size_t n_quads)
+{
+	if (grp->mesh_cap >= n_quads)
+		return true;
+
+/* vertex, texture coordinates, foreground and background for 6 vertices */
+	size_t nv = n_quads * 6;
+	uint8_t* buf = arcan_alloc_mem(nv * sizeof(float) * (2 + 2 + 3 + 3),
+		ARCAN_MEM_VBUFFER, ARCAN_MEM_NONFATAL, ARCAN_MEMALIGN_NATURAL);
+	if (!buf)
+		return false;
+
+	agp_drop_mesh(&grp->mesh);
+	float* fb = (float*) buf;
+	grp->mesh = (struct agp_mesh_store){
+		.shared_buffer = buf,
+		.shared_buffer_sz = nv * sizeof(float) * (2 + 2 + 3 + 3),
+		.verts = fb,
+		.txcos = &fb[nv * 2],
+		.colors = &fb[nv * 4],
+		.normals = &fb[nv * 7],
+		.vertex_size = 2,
+		.type = AGP_MESH_TRISOUP,
+		.nodepth = true
+	};
+	grp->mesh_cap = n_quads;
+
+	return true;
+}
+
+static void draw_atlas_batch(struct tui_raster_batch* batch, void* tag)
+{
+	struct arcan_renderfun_fontgroup* grp = tag;
+
+/* the raster can rebuild its atlas at another size on a font change */
+	if (grp->atlas &&
+		(grp->atlas->w != batch->atlas_w || grp->atlas->h != batch->atlas_h))
+		drop_atlas(grp);
+
+/* a new store needs all of the atlas, not only what changed */
+	if (!grp->atlas){
+		struct agp_vstore* vs = arcan_alloc_mem(sizeof(struct agp_vstore),
+			ARCAN_MEM_VSTRUCT, ARCAN_MEM_BZERO, ARCAN_MEMALIGN_NATURAL);
+		vs->txmapped = TXSTATE_TEX2D;
+		vs->txu = ARCAN_VTEX_CLAMP;
+		vs->txv = ARCAN_VTEX_CLAMP;
+		vs->scale = ARCAN_VIMAGE_NOPOW2;
+		vs->imageproc = IMAGEPROC_NORMAL;
+		vs->filtermode = ARCAN_VFILTER_NONE;
+		vs->refcount = 1;
+		agp_empty_vstore(vs, batch->atlas_w, batch->atlas_h);
+		grp->atlas = vs;
+
+		batch->x1 = batch->y1 = 0;
+		batch->x2 = batch->atlas_w;
+		batch->y2 = batch->atlas_h;
+	}
+
+	if (batch->x2 > batch->x1){
+		struct stream_meta stream = {
+			.buf = batch->atlas,
+			.x1 = batch->x1, .y1 = batch->y1,
+			.w = batch->x2 - batch->x1, .h = batch->y2 - batch->y1,
+			.dirty = true
+		};
+		stream = agp_stream_prepare(grp->atlas, stream, STREAM_RAW_DIRECT);
+		agp_stream_commit(grp->atlas, stream);
+	}
+
+	if (!batch->n_quads || !grow_mesh(grp, batch->n_quads))
+		return;
+
+	float* verts = grp->mesh.verts;
+	float* txcos = grp->mesh.txcos;
+	float* fg = grp->mesh.colors;
+	float* bg = grp->mesh.normals;
+	float sf = 1.0 / (float) batch->atlas_w;
+	float tf = 1.0 / (float) batch->atlas_h;
+
+	for (size_t i = 0; i < batch->n_quads; i++){
+		struct tui_raster_quad* q = &batch->quads[i];
+		float x1 = q->x1, y1 = q->y1, x2 = q->x2, y2 = q->y2;
+		float s1 = q->s1 * sf, t1 = q->t1 * tf, s2 = q->s2 * sf, t2 = q->t2 * tf;
+
+		float v[] = {x1, y1, x2, y1, x2, y2, x1, y1, x2, y2, x1, y2};
+		float t[] = {s1, t1, s2, t1, s2, t2, s1, t1, s2, t2, s1, t2};
+		memcpy(verts, v, sizeof(v));
+		memcpy(txcos, t, sizeof(t));
+		verts += 12;
+		txcos += 12;
+
+		uint8_t fc[4], bc[4];
+		SHMIF_RGBA_DECOMP(q->fc, &fc[0], &fc[1], &fc[2], &fc[3]);
+		SHMIF_RGBA_DECOMP(q->bc, &bc[0], &bc[1], &bc[2], &bc[3]);
+
+/* the shader takes a negative foreground as 'use the glyph colors' */
+		float fv[3] = {-1.0, -1.0, -1.0};
+		if (!q->color)
+			for (size_t j = 0; j < 3; j++)
+				fv[j] = (float) fc[j] / 255.0;
+
+		for (size_t j = 0; j < 6; j++){
+			*fg++ = fv[0];
+			*fg++ = fv[1];
+			*fg++ = fv[2];
+			*bg++ = (float) bc[0] / 255.0;
+			*bg++ = (float) bc[1] / 255.0;
+			*bg++ = (float) bc[2] / 255.0;
+		}
+	}
+	grp->mesh.n_vertices = batch->n_quads * 6;
+
+	agp_shader_envv(OBJ_OPACITY,
+		&(float){(float) batch->alpha / 255.0}, sizeof(float));
+	agp_activate_vstore(grp->atlas);
+	agp_submit_mesh(&grp->mesh, MESH_FACING_BOTH | MESH_FACING_NODEPTH);
+	agp_deactivate_vstore();
+}
+
+bool arcan_renderfun_fontatlas(struct arcan_renderfun_fontgroup* group,
+	struct tui_raster_context* raster, struct agp_vstore* dst,
+	struct agp_rendertarget* rtgt, uint8_t* buf, size_t buf_sz)
+{
+	if (!group || !raster || !dst || !rtgt)
+		return false;
+
+	agp_shader_id shid = agp_default_shader(TPACK_2D);
+	if (shid == BROKEN_SHADER)
+		return false;
+
+/* same orientation as rendertargets so rows match what a raw upload gives */
+	_Alignas(16) float imatr[16];
+	_Alignas(16) float proj[16];
+	identity_matrix(imatr);
+	build_orthographic_matrix(proj, 0, dst->w, 0, dst->h, 0, 1);
+
+	agp_activate_rendertarget(rtgt);
+	agp_pipeline_hint(PIPELINE_2D);
+	agp_blendstate(BLEND_NONE);
+	agp_shader_activate(shid);
+	agp_shader_envv(MODELVIEW_MATR, imatr, sizeof(float) * 16);
+	agp_shader_envv(PROJECTION_MATR, proj, sizeof(float) * 16);
+
+	int rv = tui_raster_tolist(
+		raster, dst->w, dst->h, buf, buf_sz, draw_atlas_batch, group);
+
+	agp_activate_rendertarget(NULL);
+	return rv == 1;
+}
+
 static void build_font_group(
 	struct arcan_renderfun_fontgroup* grp, int* fds, size_t n_fonts)
 {
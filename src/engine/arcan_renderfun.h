@@ -51,6 +51,10 @@
  * many costly glyph cache invalidations. Since DPI is static and homogenous
  * most of the time this only really matters in the arcan use case where
  * per-rendertarget different densities is a thing.
+ * On top of that, results of single message calls are memoized on message,
+ * density and the persisted style (ARCAN_RENDER_CACHE_LIMIT entries within
+ * ARCAN_RENDER_CACHE_BUDGET bytes). Messages that embed images or vids are
+ * always rendered, and changing the default font drops all results.
  */
 
 #ifndef HAVE_RLINE_META
@@ -167,3 +171,15 @@ struct tui_raster_context* arcan_renderfun_fontraster(
 	float ppcm, float size_mm,
 	int hint, size_t* cellw, size_t* cellh
 );
+
+/*
+ * Draw a TPACK buffer into [dst] through [rtgt] (bound to [dst]) on the GPU,
+ * using a glyph atlas shared by the users of the font group. Only glyphs that
+ * are missing from the atlas get rastered on the CPU. Returns false if this
+ * is not possible and the caller should use tui_raster_renderagp instead.
+ */
+struct agp_rendertarget;
+bool arcan_renderfun_fontatlas(struct arcan_renderfun_fontgroup*,
+	struct tui_raster_context* raster, struct agp_vstore* dst,
+	struct agp_rendertarget* rtgt, uint8_t* buf, size_t buf_sz
+);
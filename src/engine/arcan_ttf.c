@@ -26,6 +26,7 @@
 #include <stdint.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <sys/stat.h>
 
 #include <ft2build.h>
 #include FT_FREETYPE_H
@@ -58,8 +59,39 @@
 #define CACHED_BITMAP	0x01
 #define CACHED_PIXMAP	0x02
 
+/* byte budget for the bitmaps and entries in one glyph cache */
+#ifndef TTF_GLYPH_CACHE_BUDGET
+#define TTF_GLYPH_CACHE_BUDGET (4 * 1024 * 1024)
+#endif
+
+/* Everything in the font state that changes the rasterized glyph, the font
+ * itself is implied by the cache (shared only between instances of a face) */
+struct glyph_key {
+	uint32_t ch;
+	bool by_ind;
+	int style;
+	int outline;
+	int hinting;
+	int ptsize;
+	uint16_t hdpi, vdpi;
+};
+
 /* Cached glyph information */
 typedef struct cached_glyph {
+	struct glyph_key key;
+	uint64_t hash;
+
+/* lru order, head of the cache is the most recently used */
+	struct cached_glyph* prev;
+	struct cached_glyph* next;
+
+/* set while the glyph is the current one of a font and can't be evicted */
+	size_t pins;
+	size_t bytes;
+
+/* the codepoint has no glyph in the face */
+	bool missing;
+
 	int stored;
 	FT_UInt index;
 	FT_Bitmap bitmap;
@@ -70,7 +102,6 @@ typedef struct cached_glyph {
 	int maxy;
 	int yoffset;
 	int advance;
-	uint32_t cached;
 
 /* special case, set this to true when we deal with non- scalable fonts with
  * embedded bitmaps where we scale to fit the set pt- size (or, with a
@@ -79,6 +110,20 @@ typedef struct cached_glyph {
 
 } c_glyph;
 
+/* Open addressed (linear probing) table of glyphs with a byte budget, the
+ * least recently used glyphs are evicted when the budget is exceeded. The
+ * table can be shared between fonts that are opened from the same face. */
+struct glyph_cache {
+	c_glyph** slots;
+	size_t cap;
+	size_t count;
+	size_t bytes;
+	size_t budget;
+	size_t refs;
+	c_glyph* head;
+	c_glyph* tail;
+};
+
 /* The structure used to hold internal font information */
 struct _TTF_Font {
 	/* Freetype2 maintains all sorts of useful info itself */
@@ -108,7 +153,7 @@ struct _TTF_Font {
 
 	/* Cache for style-transformed glyphs */
 	c_glyph *current;
-	c_glyph cache[257]; /* 257 is a prime */
+	struct glyph_cache* cache;
 
 	/* We are responsible for closing the font stream */
 	FILE* src;
@@ -118,6 +163,8 @@ struct _TTF_Font {
 	/* For non-scalable formats, we must remember which font index size */
 	int font_size_family;
 	int ptsize;
+	uint16_t hdpi, vdpi;
+	long index;
 
 	/* really just flags passed into FT_Load_Glyph */
 	int hinting;
@@ -238,15 +285,24 @@ int TTF_Init( void )
 	return status;
 }
 
+/* positional reads so that fonts opened from dups of the same descriptor,
+ * which share the file offset, can be used from different threads */
 static unsigned long ft_read(FT_Stream stream, unsigned long ofs,
 	unsigned char* buf, unsigned long count)
 {
 	FILE* fpek = stream->descriptor.pointer;
-	fseek(fpek, (int) ofs, SEEK_SET);
 	if (count == 0)
 		return 0;
 
-	return fread(buf, 1, count, fpek);
+	size_t pos = 0;
+	while (pos < count){
+		ssize_t nr = pread(fileno(fpek), &buf[pos], count - pos, ofs + pos);
+		if (nr <= 0)
+			break;
+		pos += nr;
+	}
+
+	return pos;
 }
 
 static int ft_sizeind(FT_Face face, float ys)
@@ -282,6 +338,47 @@ void TTF_Resize(TTF_Font* font, int ptsize, uint16_t hdpi, uint16_t vdpi)
 {
 	float emsize = ptsize * 64.0;
 	FT_Set_Char_Size(font->face, 0, emsize, hdpi, vdpi);
+	font->ptsize = ptsize;
+	font->hdpi = hdpi;
+	font->vdpi = vdpi;
+}
+
+TTF_Font* TTF_CloneFont(TTF_Font* font)
+{
+	if (!font || !font->src)
+		return NULL;
+
+	int fd = dup(fileno(font->src));
+	if (-1 == fd)
+		return NULL;
+
+	fcntl(fd, F_SETFD, FD_CLOEXEC);
+	FILE* fstream = fdopen(fd, "r");
+	if (!fstream){
+		close(fd);
+		return NULL;
+	}
+
+	TTF_Font* res = TTF_OpenFontIndexRW(fstream, 1,
+		font->ptsize, font->hdpi, font->vdpi, font->index);
+	if (!res)
+		return NULL;
+
+/* carry over the metrics as well, TTF_Resize does not update them */
+	res->height = font->height;
+	res->ascent = font->ascent;
+	res->descent = font->descent;
+	res->lineskip = font->lineskip;
+	res->style = font->style;
+	res->outline = font->outline;
+	res->kerning = font->kerning;
+	res->glyph_overhang = font->glyph_overhang;
+	res->glyph_italics = font->glyph_italics;
+	res->underline_offset = font->underline_offset;
+	res->underline_height = font->underline_height;
+	res->hinting = font->hinting;
+
+	return res;
 }
 
 TTF_Font* TTF_OpenFontIndexRW( FILE* src, int freesrc, int ptsize,
@@ -339,6 +436,9 @@ TTF_Font* TTF_OpenFontIndexRW( FILE* src, int freesrc, int ptsize,
 	font->args.flags = FT_OPEN_STREAM;
 	font->args.stream = stream;
 	font->ptsize = ptsize;
+	font->hdpi = hdpi;
+	font->vdpi = vdpi;
+	font->index = index;
 
 	error = FT_Open_Face( library, &font->args, index, &font->face );
 	if( error ) {
@@ -494,22 +594,230 @@ static void Flush_Glyph( c_glyph* glyph )
 		free( glyph->pixmap.buffer );
 		glyph->pixmap.buffer = 0;
 	}
-	glyph->cached = 0;
 }
 
-void TTF_Flush_Cache( TTF_Font* font )
+static uint64_t key_hash(const struct glyph_key* key)
 {
-	int i;
-	int size = sizeof( font->cache ) / sizeof( font->cache[0] );
+	uint64_t h = (uint64_t) key->ch << 1 | key->by_ind;
+	h ^= (uint64_t) key->ptsize << 33 ^ (uint64_t) key->style << 50;
+	h ^= ((uint64_t) key->hdpi << 16 | key->vdpi) * 0x9e3779b97f4a7c15ull;
+	h ^= ((uint64_t) key->outline << 8 | (key->hinting & 0xff)) << 40;
+
+/* murmur3 finalizer */
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdull;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ull;
+	h ^= h >> 33;
+	return h;
+}
+
+static bool key_eq(const struct glyph_key* a, const struct glyph_key* b)
+{
+	return a->ch == b->ch && a->by_ind == b->by_ind &&
+		a->style == b->style && a->outline == b->outline &&
+		a->hinting == b->hinting && a->ptsize == b->ptsize &&
+		a->hdpi == b->hdpi && a->vdpi == b->vdpi;
+}
+
+static size_t glyph_bytes(c_glyph* glyph)
+{
+	size_t res = sizeof(c_glyph);
+	if (glyph->bitmap.buffer)
+		res += (size_t) glyph->bitmap.pitch * glyph->bitmap.rows;
+	if (glyph->pixmap.buffer)
+		res += (size_t) glyph->pixmap.pitch * glyph->pixmap.rows;
+	return res;
+}
+
+static void lru_unlink(struct glyph_cache* cache, c_glyph* glyph)
+{
+	if (glyph->prev)
+		glyph->prev->next = glyph->next;
+	else
+		cache->head = glyph->next;
 
-	for( i = 0; i < size; ++i ) {
-		if( font->cache[i].cached ) {
-			Flush_Glyph( &font->cache[i] );
+	if (glyph->next)
+		glyph->next->prev = glyph->prev;
+	else
+		cache->tail = glyph->prev;
+
+	glyph->prev = glyph->next = NULL;
+}
+
+static void lru_push(struct glyph_cache* cache, c_glyph* glyph)
+{
+	glyph->next = cache->head;
+	if (cache->head)
+		cache->head->prev = glyph;
+	else
+		cache->tail = glyph;
+	cache->head = glyph;
+}
+
+static c_glyph** cache_slot(
+	struct glyph_cache* cache, const struct glyph_key* key, uint64_t hash)
+{
+	size_t mask = cache->cap - 1;
+	size_t i = hash & mask;
+
+	while (cache->slots[i]){
+		if (cache->slots[i]->hash == hash && key_eq(&cache->slots[i]->key, key))
+			break;
+		i = (i + 1) & mask;
+	}
+
+	return &cache->slots[i];
+}
+
+static bool cache_grow(struct glyph_cache* cache)
+{
+	size_t cap = cache->cap ? cache->cap * 2 : 64;
+	c_glyph** slots = calloc(cap, sizeof(c_glyph*));
+	if (!slots)
+		return false;
+
+	c_glyph** old = cache->slots;
+	size_t old_cap = cache->cap;
+	cache->slots = slots;
+	cache->cap = cap;
+
+	for (size_t i = 0; i < old_cap; i++)
+		if (old[i])
+			*cache_slot(cache, &old[i]->key, old[i]->hash) = old[i];
+
+	free(old);
+	return true;
+}
+
+/* backward shift deletion, keeps the probe sequences intact without tombs */
+static void cache_remove(struct glyph_cache* cache, c_glyph* glyph)
+{
+	size_t mask = cache->cap - 1;
+	size_t i = cache_slot(cache, &glyph->key, glyph->hash) - cache->slots;
+	cache->slots[i] = NULL;
+
+	for (size_t j = (i + 1) & mask; cache->slots[j]; j = (j + 1) & mask){
+		size_t k = cache->slots[j]->hash & mask;
+		if ( (j > i && (k <= i || k > j)) || (j < i && (k <= i && k > j)) ){
+			cache->slots[i] = cache->slots[j];
+			cache->slots[j] = NULL;
+			i = j;
 		}
+	}
+
+	lru_unlink(cache, glyph);
+	cache->bytes -= glyph->bytes;
+	cache->count--;
+	Flush_Glyph(glyph);
+	free(glyph);
+}
+
+/* evict from the least recently used end until we fit in the budget, glyphs
+ * that are the current of some font are skipped as callers still use them */
+static void cache_trim(struct glyph_cache* cache)
+{
+	c_glyph* cur = cache->tail;
+
+	while (cur && cache->bytes > cache->budget){
+		c_glyph* prev = cur->prev;
+		if (!cur->pins)
+			cache_remove(cache, cur);
+		cur = prev;
+	}
+}
+
+static struct glyph_cache* font_cache(TTF_Font* font)
+{
+	if (font->cache)
+		return font->cache;
+
+	font->cache = malloc(sizeof(struct glyph_cache));
+	if (!font->cache)
+		return NULL;
+
+	*font->cache = (struct glyph_cache){
+		.budget = TTF_GLYPH_CACHE_BUDGET,
+		.refs = 1
+	};
+
+	return font->cache;
+}
+
+static void set_current(TTF_Font* font, c_glyph* glyph)
+{
+	if (font->current)
+		font->current->pins--;
+
+	font->current = glyph;
+
+	if (glyph)
+		glyph->pins++;
+}
+
+static void release_cache(TTF_Font* font)
+{
+	set_current(font, NULL);
+	struct glyph_cache* cache = font->cache;
+	font->cache = NULL;
+
+	if (!cache || --cache->refs > 0)
+		return;
+
+	while (cache->head){
+		c_glyph* next = cache->head->next;
+		Flush_Glyph(cache->head);
+		free(cache->head);
+		cache->head = next;
+	}
+
+	free(cache->slots);
+	free(cache);
+}
+
+void TTF_Flush_Cache( TTF_Font* font )
+{
+	if (!font->cache)
+		return;
 
+	c_glyph* cur = font->cache->tail;
+	while (cur){
+		c_glyph* prev = cur->prev;
+		if (!cur->pins)
+			cache_remove(font->cache, cur);
+		cur = prev;
 	}
 }
 
+bool TTF_ShareCache(TTF_Font* dst, TTF_Font* src)
+{
+	if (!dst || !src || dst == src || !dst->src || !src->src)
+		return false;
+
+	if (dst->cache && dst->cache == src->cache)
+		return true;
+
+/* glyph indices are only valid within the same face of the same file */
+	struct stat dst_st, src_st;
+	if (-1 == fstat(fileno(dst->src), &dst_st) ||
+		-1 == fstat(fileno(src->src), &src_st))
+		return false;
+
+	if (dst_st.st_dev != src_st.st_dev ||
+		dst_st.st_ino != src_st.st_ino || dst->index != src->index)
+		return false;
+
+	struct glyph_cache* cache = font_cache(src);
+	if (!cache)
+		return false;
+
+	release_cache(dst);
+	dst->cache = cache;
+	cache->refs++;
+
+	return true;
+}
+
 static FT_Error Load_Glyph(
 	TTF_Font* font, uint32_t ch, c_glyph* cached, int want, bool by_ind )
 {
@@ -610,7 +918,9 @@ static FT_Error Load_Glyph(
 		if( (font->outline > 0) && glyph->format != FT_GLYPH_FORMAT_BITMAP ) {
 			FT_Stroker stroker;
 			FT_Get_Glyph( glyph, &bitmap_glyph );
-			error = FT_Stroker_New( library, &stroker );
+/* the library is per thread and the glyph might be loaded on a raster worker
+ * for a font opened elsewhere, so take the one that the face belongs to */
+			error = FT_Stroker_New( glyph->library, &stroker );
 			if( error ) {
 				return error;
 			}
@@ -832,27 +1142,69 @@ static FT_Error Load_Glyph(
 		}
 	}
 
-	/* We're done, mark this glyph cached */
-	cached->cached = ch;
-
 	return 0;
 }
 
 static FT_Error Find_Glyph(
 	TTF_Font* font, uint32_t ch, int want, bool by_ind)
 {
-	int retval = 0;
-	int hsize = sizeof( font->cache ) / sizeof( font->cache[0] );
+	struct glyph_cache* cache = font_cache(font);
+	if (!cache)
+		return FT_Err_Out_Of_Memory;
+
+	struct glyph_key key = {
+		.ch = ch,
+		.by_ind = by_ind,
+		.style = font->style & ~TTF_STYLE_NO_GLYPH_CHANGE,
+		.outline = font->outline,
+		.hinting = font->hinting,
+		.ptsize = font->ptsize,
+		.hdpi = font->hdpi,
+		.vdpi = font->vdpi
+	};
+	uint64_t hash = key_hash(&key);
+
+/* keep the load factor below 1/2 so probe sequences stay short */
+	if (cache->count * 2 >= cache->cap && !cache_grow(cache))
+		return FT_Err_Out_Of_Memory;
+
+	c_glyph** slot = cache_slot(cache, &key, hash);
+	c_glyph* glyph = *slot;
+
+	if (glyph){
+		lru_unlink(cache, glyph);
+		lru_push(cache, glyph);
+	}
+	else {
+		glyph = calloc(1, sizeof(c_glyph));
+		if (!glyph)
+			return FT_Err_Out_Of_Memory;
+
+		glyph->key = key;
+		glyph->hash = hash;
+		glyph->bytes = sizeof(c_glyph);
+		*slot = glyph;
+		lru_push(cache, glyph);
+		cache->count++;
+		cache->bytes += glyph->bytes;
+	}
 
-	int h = ch % hsize;
-	font->current = &font->cache[h];
+	set_current(font, glyph);
 
-	if (font->current->cached != ch)
-		Flush_Glyph( font->current );
+	if (glyph->missing)
+		return -1;
 
-	if ( (font->current->stored & want) != want ) {
-		retval = Load_Glyph( font, ch, font->current, want, by_ind );
+	int retval = 0;
+	if ( (glyph->stored & want) != want ) {
+		retval = Load_Glyph( font, ch, glyph, want, by_ind );
+		glyph->missing = glyph->index == 0;
+
+		size_t bytes = glyph_bytes(glyph);
+		cache->bytes += bytes - glyph->bytes;
+		glyph->bytes = bytes;
+		cache_trim(cache);
 	}
+
 	return retval;
 }
 
@@ -869,10 +1221,17 @@ TTF_Font* TTF_FindGlyph(
 	return NULL;
 }
 
+bool TTF_GlyphIsColor(TTF_Font** fonts, int n, uint32_t ch)
+{
+	TTF_Font* font = TTF_FindGlyph(fonts, n, ch, CACHED_METRICS | CACHED_PIXMAP, false);
+	return font && font->current &&
+		font->current->pixmap.pixel_mode == FT_PIXEL_MODE_BGRA;
+}
+
 void TTF_CloseFont( TTF_Font* font )
 {
 	if ( font ) {
-		TTF_Flush_Cache( font );
+		release_cache( font );
 		if ( font->face ) {
 			FT_Done_Face( font->face );
 		}
@@ -1049,17 +1408,10 @@ int TTF_GlyphMetrics(TTF_Font *font, uint32_t ch,
 }
 */
 
+/* the style is part of the glyph cache key, no need to flush on change */
 void TTF_SetFontStyle( TTF_Font* font, int style )
 {
-	int prev_style = font->style;
 	font->style = style | font->face_style;
-
-	/* Flush the cache if the style has changed.
-	* Ignore UNDERLINE which does not impact glyph drawning.
-	* */
-	if ( (font->style | TTF_STYLE_NO_GLYPH_CHANGE ) != ( prev_style | TTF_STYLE_NO_GLYPH_CHANGE )) {
-		TTF_Flush_Cache( font );
-	}
 }
 
 _Thread_local static size_t pool_cnt;
@@ -1293,15 +1645,151 @@ static inline av_pixel pack_subpx(uint8_t fg[4],
 		return PACK(fg[0], fg[1], fg[2], 0xff);
 }
 
+/*
+ * Row kernels for compositing glyph coverage, see arcan_ttf_rows.h. They are
+ * built with the GCC vector extensions, once 4 pixels wide for whatever the
+ * baseline maps that to (SSE2 / NEON), and on x86 once more 8 pixels wide for
+ * AVX2, which is picked at runtime if the CPU has it. Define TTF_NO_VECTOR to
+ * only use the scalar path, TTF_NO_AVX2 to skip the wide version.
+ */
+#if defined(__GNUC__) && !defined(TTF_NO_VECTOR)
+#define TTF_VECTOR
+
+/* channel positions in the packed pixel, folds to constants */
+#define SHIFT_R __builtin_ctz(PACK(0xff, 0, 0, 0))
+#define SHIFT_G __builtin_ctz(PACK(0, 0xff, 0, 0))
+#define SHIFT_B __builtin_ctz(PACK(0, 0, 0xff, 0))
+#define SHIFT_A __builtin_ctz(PACK(0, 0, 0, 0xff))
+
+#define TTF_ROWS_BYTES 16
+#define TTF_ROWS_SFX v4
+#define TTF_ROWS_ATTR
+#include "arcan_ttf_rows.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && !defined(TTF_NO_AVX2)
+#define TTF_AVX2
+
+#define TTF_ROWS_BYTES 32
+#define TTF_ROWS_SFX avx2
+#define TTF_ROWS_ATTR __attribute__((target("avx2")))
+#include "arcan_ttf_rows.h"
+#endif
+
+enum ttf_simd {
+	TTF_SIMD_UNKNOWN = 0,
+	TTF_SIMD_NONE,
+	TTF_SIMD_AVX2
+};
+
+/* detected once, the race on first use is harmless as all agree on the value */
+static enum ttf_simd ttf_simd_level = TTF_SIMD_UNKNOWN;
+
+static enum ttf_simd ttf_simd(void)
+{
+	if (ttf_simd_level != TTF_SIMD_UNKNOWN)
+		return ttf_simd_level;
+
+	enum ttf_simd level = TTF_SIMD_NONE;
+#ifdef TTF_AVX2
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		level = TTF_SIMD_AVX2;
+#endif
+
+	ttf_simd_level = level;
+	return level;
+}
+#endif
+
+static void blend_row(PIXEL* out,
+	const uint8_t* src, int n, uint8_t fg[4], uint8_t bg[4])
+{
+	int i = 0;
+#ifdef TTF_VECTOR
+	if (sizeof(PIXEL) == sizeof(uint32_t)){
+#ifdef TTF_AVX2
+		if (ttf_simd() == TTF_SIMD_AVX2)
+			i = blend_row_avx2(out, src, i, n, fg, bg);
+#endif
+		i = blend_row_v4(out, src, i, n, fg, bg);
+	}
+#endif
+	for (; i < n; i++)
+		out[i] = pack_pixel_bg(fg, bg, src[i]);
+}
+
+static void cover_row(PIXEL* out, const uint8_t* src, int n, uint8_t fg[4])
+{
+	int i = 0;
+#ifdef TTF_VECTOR
+	if (sizeof(PIXEL) == sizeof(uint32_t)){
+#ifdef TTF_AVX2
+		if (ttf_simd() == TTF_SIMD_AVX2)
+			i = cover_row_avx2(out, src, i, n, fg);
+#endif
+		i = cover_row_v4(out, src, i, n, fg);
+	}
+#endif
+	for (; i < n; i++)
+		if (src[i])
+			out[i] = pack_pixel(fg, src[i]);
+}
+
+/* subpixel coverage comes in separate r, g, b channels [step] bytes apart */
+static void subpx_row(PIXEL* out, const uint8_t* r, const uint8_t* g,
+	const uint8_t* b, int step, int n, uint8_t fg[4], uint8_t bg[4], bool usebg)
+{
+	int i = 0;
+#ifdef TTF_VECTOR
+	if (sizeof(PIXEL) == sizeof(uint32_t)){
+#ifdef TTF_AVX2
+		if (ttf_simd() == TTF_SIMD_AVX2)
+			i = subpx_row_avx2(out, r, g, b, step, i, n, fg, bg, usebg);
+#endif
+		i = subpx_row_v4(out, r, g, b, step, i, n, fg, bg, usebg);
+	}
+#endif
+	for (; i < n; i++){
+		uint8_t cr = r[i * step], cg = g[i * step], cb = b[i * step];
+		if (usebg)
+			out[i] = pack_subpx_bg(fg, bg, cr, cg, cb);
+		else if (cr | cg | cb)
+			out[i] = pack_subpx(fg, cr, cg, cb);
+	}
+}
+
+/* number of pixels that can be written on a glyph row starting at [out] */
+static inline int row_span(PIXEL* out, PIXEL* ubound, int gwidth, size_t width)
+{
+	int n = gwidth;
+	if (n < 0)
+		return 0;
+
+	if ((size_t) n > width)
+		n = width;
+
+	if (out >= ubound)
+		return 0;
+
+	if (ubound - out < n)
+		n = ubound - out;
+
+	return n;
+}
+
 static void yfill(PIXEL* dst, PIXEL clr, int yfill, int w, int h, int stride)
 {
+	if (yfill <= 0 || w <= 0)
+		return;
+
+/* fill one row and replicate it */
+	for (int col = 0; col < w; col++)
+		dst[col] = clr;
+
 	for (int br = 0, ur = h-1; br < yfill; br++, ur--){
-		PIXEL* dr = &dst[br * stride];
-		for (int col = 0; col < w; col++)
-			*dr++ = clr;
-		dr = &dst[ur * stride];
-		for (int col = 0; col < w; col++)
-			*dr++ = clr;
+		if (br)
+			memcpy(&dst[br * stride], dst, w * sizeof(PIXEL));
+		memcpy(&dst[ur * stride], dst, w * sizeof(PIXEL));
 	}
 }
 
@@ -1327,7 +1815,8 @@ static bool render_unicode(
 	}
 	else {
 		gwidth = glyph->pixmap.width;
-		if (outf->outline <= 0 && width > glyph->maxx - glyph->minx)
+		if (outf->outline <= 0 && width > glyph->maxx - glyph->minx &&
+			glyph->maxx - glyph->minx < gwidth)
 			gwidth = glyph->maxx - glyph->minx;
 
 /* do kerning, if possible AC-Patch */
@@ -1425,22 +1914,14 @@ static bool render_unicode(
 			uint8_t* src = (uint8_t*)(glyph->pixmap.buffer+glyph->pixmap.pitch*row);
 			out = out < dst ? dst : out;
 
-			for (int col = 0; col < gwidth && col < width && out < ubound; col++){
-				uint8_t b = *src++;
-				uint8_t g = *src++;
-				uint8_t r = *src++;
-
-				if (usebg)
-					*out++ = pack_subpx_bg(fg, bg, r, g, b);
-				else if (b|g|r)
-					*out++ = pack_subpx(fg, r, g, b);
-				else
-					out++;
-			}
+/* interleaved as b, g, r */
+			subpx_row(out, &src[2], &src[1], src, 3,
+				row_span(out, ubound, gwidth, width), fg, bg, usebg);
 		}
 	}
 	else if (glyph->pixmap.pixel_mode == FT_PIXEL_MODE_LCD_V){
-		for (int row = 0; row < glyph->pixmap.rows; ++row){
+/* the pixmap has three subrows per glyph row */
+		for (int row = 0; row < glyph->pixmap.rows / 3; ++row){
 			if (row+glyph->yoffset < 0 || row+glyph->yoffset >= height)
 				continue;
 
@@ -1448,18 +1929,10 @@ static bool render_unicode(
 			uint8_t* src = (uint8_t*)(glyph->pixmap.buffer+(glyph->pixmap.pitch*3)*row);
 			out = out < dst ? dst : out;
 
-			for (int col = 0; col < gwidth && col < width && out < ubound; col++){
-				uint8_t b = *src;
-				uint8_t g = *(src + glyph->pixmap.pitch);
-				uint8_t r = *(src + glyph->pixmap.pitch + glyph->pixmap.pitch);
-
-				if (usebg)
-					*out++ = pack_subpx_bg(fg, bg, r, g, b);
-				else if (b|g|r)
-					*out++ = pack_subpx(fg, r, g, b);
-				else
-					out++;
-			}
+/* one row each for b, g, r */
+			int pitch = glyph->pixmap.pitch;
+			subpx_row(out, &src[pitch * 2], &src[pitch], src, 1,
+				row_span(out, ubound, gwidth, width), fg, bg, usebg);
 		}
 	}
 	else
@@ -1473,15 +1946,12 @@ static bool render_unicode(
 		PIXEL* out = &dst[(row+glyph->yoffset)*stride+(*xstart+glyph->minx)];
 		uint8_t* src = (uint8_t*)(glyph->pixmap.buffer+glyph->pixmap.pitch * row);
 		out = out < dst ? dst : out;
-		for (int col = 0; col < gwidth && col < width && out < ubound; col++){
-			uint8_t a = *src++;
-			if (usebg)
-				*out++ = pack_pixel_bg(fg, bg, a);
-			else if (a)
-				*out++ = pack_pixel(fg, a);
-			else
-				out++;
-		}
+		int n = row_span(out, ubound, gwidth, width);
+
+		if (usebg)
+			blend_row(out, src, n, fg, bg);
+		else
+			cover_row(out, src, n, fg);
 	}
 
 /* Underline / Strikethrough can be handled by the caller for this func
@@ -1577,7 +2047,6 @@ int TTF_GetFontStyle( const TTF_Font* font )
 void TTF_SetFontOutline( TTF_Font* font, int outline )
 {
 	font->outline = outline;
-	TTF_Flush_Cache( font );
 }
 
 int TTF_GetFontOutline( const TTF_Font* font )
@@ -1599,8 +2068,6 @@ void TTF_SetFontHinting( TTF_Font* font, int hinting )
 		font->hinting = FT_RENDER_MODE_LCD_V;
 	else
 		font->hinting = FT_RENDER_MODE_NORMAL;
-
-	TTF_Flush_Cache( font );
 }
 
 int TTF_GetFontHinting( const TTF_Font* font )
@@ -1662,9 +2129,4 @@ void TTF_ProbeFont(TTF_Font* font, size_t* dw, size_t* dh)
 		if (h > *dh)
 			*dh = h;
 	}
-
-/*
- * Flush the cache so we're not biased or collide with byIndex or byValue
- */
-	TTF_Flush_Cache(font);
 }
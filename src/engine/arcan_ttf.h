@@ -75,6 +75,11 @@ int UTF8_to_UTF32(uint32_t* out, const uint8_t* in, size_t len);
 
 void TTF_Resize(TTF_Font* font, int ptsize, uint16_t hdpi, uint16_t vdpi);
 
+/* Open a second, independent instance of [font] with the same size and
+ * settings. Each instance keeps its own glyph cache and FreeType face so two
+ * instances can render from different threads. */
+TTF_Font* TTF_CloneFont(TTF_Font* font);
+
 /* Set and retrieve the font style */
 #define TTF_STYLE_NORMAL 0x00
 #define TTF_STYLE_BOLD 0x01
@@ -134,6 +139,10 @@ char* TTF_FontFaceStyleName(const TTF_Font *font);
 TTF_Font* TTF_FindGlyph(
 	TTF_Font** fonts, int n, uint32_t ch, int want, bool by_ind);
 
+/* Check if the glyph for [ch] is drawn in its own colors (BGRA bitmaps, e.g.
+ * emoji) rather than as coverage of the foreground color */
+bool TTF_GlyphIsColor(TTF_Font** fonts, int n, uint32_t ch);
+
 /* Get the metrics (dimensions) of a glyph
  * To understand what these metrics mean, here is a useful link:
  * http://freetype.sourceforge.net/freetype2/docs/tutorial/step2.html
@@ -193,6 +202,14 @@ bool TTF_RenderUNICODEglyph(PIXEL* dst,
 
 void TTF_Flush_Cache( TTF_Font* font );
 
+/*
+ * Let [dst] use the glyph cache of [src]. This only succeeds if both are
+ * opened from the same file and face index, glyphs are keyed on size, style
+ * and hinting so the fonts may differ in those. The shared cache is not
+ * synchronized, both fonts have to be used from the same thread.
+ */
+bool TTF_ShareCache(TTF_Font* dst, TTF_Font* src);
+
 /*
  * Same as TTF_RenderUNICODEglyph above, but 'ch' references the glyph index in
  * the font-chain, not the unicode codepoint.  This is only for special/trusted
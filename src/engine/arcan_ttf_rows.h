@@ -0,0 +1,166 @@
+/*
+ * Row kernels for compositing glyph coverage, included by arcan_ttf.c once
+ * for every vector width it dispatches between. Before each inclusion it
+ * defines:
+ *
+ *  TTF_ROWS_BYTES - vector width in bytes, 16 (4 pixels) or 32 (8 pixels)
+ *  TTF_ROWS_SFX   - suffix for the names of the kernels and their helpers
+ *  TTF_ROWS_ATTR  - attributes for the functions, e.g. a target("avx2")
+ *
+ * The kernels produce the same output as the pack_ functions in arcan_ttf.c
+ * without any per-pixel branching. The channels are blended two at a time in
+ * 16-bit lanes, so the packing order of PIXEL does not matter. Each kernel
+ * starts at pixel [i], covers as many whole vectors as fit in [n] and returns
+ * where it stopped, the rest is left to a narrower kernel or the scalar path.
+ */
+
+#define TTF_ROWS_CAT2(A, B) A ## _ ## B
+#define TTF_ROWS_CAT(A, B) TTF_ROWS_CAT2(A, B)
+#define TTF_ROWS_FN(N) TTF_ROWS_CAT(N, TTF_ROWS_SFX)
+
+#define TTF_ROWS_LANES (TTF_ROWS_BYTES / 4)
+#define vu32 TTF_ROWS_FN(vu32)
+#define vu16 TTF_ROWS_FN(vu16)
+#define vu8 TTF_ROWS_FN(vu8)
+
+typedef uint32_t vu32 __attribute__((vector_size(TTF_ROWS_BYTES)));
+typedef uint16_t vu16 __attribute__((vector_size(TTF_ROWS_BYTES)));
+typedef uint8_t vu8 __attribute__((vector_size(TTF_ROWS_LANES)));
+
+TTF_ROWS_ATTR static inline vu32 TTF_ROWS_FN(vload)(const uint8_t* src, int step)
+{
+	if (step == 1){
+		vu8 v;
+		memcpy(&v, src, sizeof(v));
+		return __builtin_convertvector(v, vu32);
+	}
+
+	vu32 v;
+	for (int i = 0; i < TTF_ROWS_LANES; i++)
+		v[i] = src[i * step];
+	return v;
+}
+
+TTF_ROWS_ATTR static inline vu32 TTF_ROWS_FN(vsplat)(vu32 v)
+{
+	return v | v << 8 | v << 16 | v << 24;
+}
+
+/* same rounding as the scalar (x + 0x80) / 255 approximation */
+TTF_ROWS_ATTR static inline vu16 TTF_ROWS_FN(vdiv255)(vu16 x)
+{
+	x += 0x80;
+	return (x + (x >> 8)) >> 8;
+}
+
+/* (x * y + z * w) / 255 for each byte in the pixels */
+TTF_ROWS_ATTR static inline vu32 TTF_ROWS_FN(vmix)(vu32 x, vu32 y, vu32 z, vu32 w)
+{
+	const vu32 m = (vu32){} + 0x00ff00ff;
+
+	vu16 lo = TTF_ROWS_FN(vdiv255)(
+		(vu16)(x & m) * (vu16)(y & m) + (vu16)(z & m) * (vu16)(w & m));
+	vu16 hi = TTF_ROWS_FN(vdiv255)(
+		(vu16)(x >> 8 & m) * (vu16)(y >> 8 & m) +
+		(vu16)(z >> 8 & m) * (vu16)(w >> 8 & m));
+
+	return (vu32) lo | (vu32) hi << 8;
+}
+
+/* pack_pixel_bg alpha, bg[3] unless coverage is at least twice that */
+TTF_ROWS_ATTR static inline vu32 TTF_ROWS_FN(valpha)(vu32 a, uint8_t bg_a)
+{
+	vu32 full = (vu32)(a == 255);
+	vu32 keep = (vu32)(a < (uint32_t)(2 * bg_a));
+	return (full & 255) | (~full & ((keep & bg_a) | (~keep & a)));
+}
+
+TTF_ROWS_ATTR static inline void TTF_ROWS_FN(vstore)(PIXEL* out, vu32 px, vu32 mask)
+{
+	vu32 cur;
+	memcpy(&cur, out, sizeof(vu32));
+	cur = (px & mask) | (cur & ~mask);
+	memcpy(out, &cur, sizeof(vu32));
+}
+
+TTF_ROWS_ATTR static int TTF_ROWS_FN(blend_row)(PIXEL* out,
+	const uint8_t* src, int i, int n, uint8_t fg[4], uint8_t bg[4])
+{
+	vu32 vf = (vu32){} + PACK(fg[0], fg[1], fg[2], 0);
+	vu32 vb = (vu32){} + PACK(bg[0], bg[1], bg[2], 0);
+	uint8_t bg_a = bg[3];
+
+	for (; i + TTF_ROWS_LANES <= n; i += TTF_ROWS_LANES){
+		vu32 a = TTF_ROWS_FN(vload)(&src[i], 1);
+		vu32 px = TTF_ROWS_FN(vmix)(
+			vf, TTF_ROWS_FN(vsplat)(a), vb, TTF_ROWS_FN(vsplat)(255 - a));
+		px |= TTF_ROWS_FN(valpha)(a, bg_a) << SHIFT_A;
+		memcpy(&out[i], &px, sizeof(vu32));
+	}
+
+	return i;
+}
+
+TTF_ROWS_ATTR static int TTF_ROWS_FN(cover_row)(PIXEL* out,
+	const uint8_t* src, int i, int n, uint8_t fg[4])
+{
+	vu32 vf = (vu32){} + PACK(fg[0], fg[1], fg[2], 0);
+
+	for (; i + TTF_ROWS_LANES <= n; i += TTF_ROWS_LANES){
+		vu32 a = TTF_ROWS_FN(vload)(&src[i], 1);
+		TTF_ROWS_FN(vstore)(&out[i], vf | a << SHIFT_A, (vu32)(a != 0));
+	}
+
+	return i;
+}
+
+TTF_ROWS_ATTR static int TTF_ROWS_FN(subpx_row)(PIXEL* out,
+	const uint8_t* r, const uint8_t* g, const uint8_t* b, int step,
+	int i, int n, uint8_t fg[4], uint8_t bg[4], bool usebg)
+{
+	vu32 z = {};
+	vu32 vf = z + PACK(fg[0], fg[1], fg[2], 0);
+	vu32 vb = z + PACK(bg[0], bg[1], bg[2], 0);
+	vu32 solid = z + PACK(fg[0], fg[1], fg[2], 0xff);
+	uint8_t bg_a = bg[3];
+
+	for (; i + TTF_ROWS_LANES <= n; i += TTF_ROWS_LANES){
+		vu32 vr = TTF_ROWS_FN(vload)(&r[i * step], step);
+		vu32 vg = TTF_ROWS_FN(vload)(&g[i * step], step);
+		vu32 vb_ = TTF_ROWS_FN(vload)(&b[i * step], step);
+
+/* (r + g + b) / 3, exact for the 0..765 range */
+		vu32 a = (vr + vg + vb_) * 683 >> 11;
+
+/* foreground scaled by the coverage of each channel */
+		vu32 px = TTF_ROWS_FN(vmix)(
+			vr << SHIFT_R | vg << SHIFT_G | vb_ << SHIFT_B, vf, z, z);
+
+		if (usebg){
+			px = TTF_ROWS_FN(vmix)(
+				px, TTF_ROWS_FN(vsplat)(a), vb, TTF_ROWS_FN(vsplat)(255 - a));
+			px |= TTF_ROWS_FN(valpha)(a, bg_a) << SHIFT_A;
+		}
+		else
+			px |= a << SHIFT_A;
+
+		vu32 full = (vu32)(a == 255);
+		px = (solid & full) | (px & ~full);
+
+		TTF_ROWS_FN(vstore)(&out[i], px,
+			usebg ? z - 1 : (vu32)((vr | vg | vb_) != 0));
+	}
+
+	return i;
+}
+
+#undef vu32
+#undef vu16
+#undef vu8
+#undef TTF_ROWS_LANES
+#undef TTF_ROWS_FN
+#undef TTF_ROWS_CAT
+#undef TTF_ROWS_CAT2
+#undef TTF_ROWS_BYTES
+#undef TTF_ROWS_SFX
+#undef TTF_ROWS_ATTR
@@ -298,8 +298,10 @@ static void deallocate_gl_context(
  * but not for the cases where we share store with the world */
 			else if (
 				!FL_TEST(current, FL_PRSIST) && !FL_TEST(current, FL_RTGT) &&
-				current->vstore != safe_store)
+				current->vstore != safe_store){
+				arcan_vint_synch_raw(current);
 				agp_null_vstore(current->vstore);
+			}
 		}
 	}
 
@@ -5258,6 +5260,9 @@ arcan_errc arcan_video_forceread(
 	*dptr  = arcan_alloc_mem(*dsize, ARCAN_MEM_VBUFFER,
 		ARCAN_MEM_TEMPORARY | ARCAN_MEM_NONFATAL, ARCAN_MEMALIGN_PAGE);
 
+	if (local)
+		arcan_vint_synch_raw(vobj);
+
 	if (local && dstore->vinf.text.raw && dstore->vinf.text.s_raw > 0){
 		memcpy(dptr, dstore->vinf.text.raw, *dsize);
 	}
@@ -5948,6 +5953,12 @@ bool arcan_video_contextsize(unsigned newlim)
 	return true;
 }
 
+void arcan_vint_synch_raw(arcan_vobject* vobj)
+{
+	if (vobj && vobj->feed.state.tag == ARCAN_TAG_FRAMESERV)
+		arcan_frameserver_synch_raw(vobj->feed.state.ptr);
+}
+
 void arcan_video_restore_external(bool keep_events)
 {
 	if (!keep_events)
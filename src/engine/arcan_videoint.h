@@ -440,6 +440,12 @@ void arcan_vint_joinasynch(arcan_vobject* img, bool emit, bool force);
 
 void arcan_vint_reraster(arcan_vobject* img, struct rendertarget*);
 
+/*
+ * make sure that the raw buffer of the vstore matches what is on the GPU
+ * before working from it, only some frameserver feeds can fall behind
+ */
+void arcan_vint_synch_raw(arcan_vobject* vobj);
+
 /*
  * Figure out what the vid will be for the next object allocated in this
  * context. This function is primarily used to avoid an initialization
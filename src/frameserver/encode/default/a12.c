@@ -212,6 +212,15 @@ static void decode_args(struct arg_arr* arg, struct dispatch_data* dst)
 		else if (strcasecmp(method, "dpng") == 0){
 /* no-op, default */
 		}
+		else if (strcasecmp(method, "dtile") == 0){
+			dst->video_cfg.method = VFRAME_METHOD_DTILE;
+		}
+		else if (strcasecmp(method, "dlz") == 0){
+			dst->video_cfg.method = VFRAME_METHOD_DLZ;
+		}
+		else if (strcasecmp(method, "adaptive") == 0){
+			dst->video_cfg.method = VFRAME_METHOD_ADAPTIVE;
+		}
 		else
 			LOG("unknown vcodec: %s\n", method);
 	}
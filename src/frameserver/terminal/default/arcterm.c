@@ -25,8 +25,14 @@ static struct {
 	struct shl_pty* pty;
 	struct arg_arr* args;
 
-	pthread_mutex_t synch;
-	pthread_mutex_t hold;
+/* the screen is shared between the pty thread and the render thread, it is
+ * handed over in ticket order so that neither side can starve the other */
+	struct {
+		pthread_mutex_t lock;
+		pthread_cond_t step;
+		unsigned long ticket;
+		unsigned long serving;
+	} synch;
 
 	pid_t child;
 
@@ -42,10 +48,21 @@ static struct {
 
 } term = {
 	.die_on_term = true,
-	.synch = PTHREAD_MUTEX_INITIALIZER,
-	.hold = PTHREAD_MUTEX_INITIALIZER
+	.synch = {
+		.lock = PTHREAD_MUTEX_INITIALIZER,
+		.step = PTHREAD_COND_INITIALIZER
+	}
 };
 
+/* largest single read from the pty, and how much to drain in one go before
+ * checking the other descriptors */
+#define PTY_READ_SZ 65536
+#define PTY_DRAIN_SZ (16 * PTY_READ_SZ)
+
+/* how long the render thread steps away from the screen while it waits for
+ * the last frame to be consumed */
+#define FRAME_WAIT_MS 2
+
 static inline void trace(const char* msg, ...)
 {
 #ifdef TRACE_ENABLE
@@ -59,9 +76,38 @@ static inline void trace(const char* msg, ...)
 
 extern int arcan_tuiint_dirty(struct tui_context* tui);
 
-static ssize_t flush_buffer(int fd, char dst[static 4096])
+static void screen_lock()
+{
+	pthread_mutex_lock(&term.synch.lock);
+	unsigned long ticket = term.synch.ticket++;
+	while (ticket != term.synch.serving)
+		pthread_cond_wait(&term.synch.step, &term.synch.lock);
+	pthread_mutex_unlock(&term.synch.lock);
+}
+
+static bool screen_trylock()
 {
-	ssize_t nr = read(fd, dst, 4096);
+	bool rv = false;
+	pthread_mutex_lock(&term.synch.lock);
+	if (term.synch.ticket == term.synch.serving){
+		term.synch.ticket++;
+		rv = true;
+	}
+	pthread_mutex_unlock(&term.synch.lock);
+	return rv;
+}
+
+static void screen_unlock()
+{
+	pthread_mutex_lock(&term.synch.lock);
+	term.synch.serving++;
+	pthread_cond_broadcast(&term.synch.step);
+	pthread_mutex_unlock(&term.synch.lock);
+}
+
+static ssize_t flush_buffer(int fd, char* dst, size_t dst_sz)
+{
+	ssize_t nr = read(fd, dst, dst_sz);
 	if (-1 == nr){
 		if (errno == EAGAIN || errno == EINTR)
 			return -1;
@@ -74,42 +120,55 @@ static ssize_t flush_buffer(int fd, char dst[static 4096])
 	return nr;
 }
 
-static bool readout_pty(int fd)
+/* a read from the pty rarely returns more than a page, so gather whatever is
+ * pending into one batch before taking the screen */
+static ssize_t fill_buffer(int fd, char dst[static PTY_READ_SZ])
 {
-	char buf[4096];
-	bool got_hold = false;
-	ssize_t nr = flush_buffer(fd, buf);
-
-	if (nr < 0)
-		return false;
+	ssize_t nr = flush_buffer(fd, dst, PTY_READ_SZ);
+	if (nr <= 0)
+		return nr;
 
-	if (0 != pthread_mutex_trylock(&term.synch)){
-		pthread_mutex_lock(&term.hold);
-		write(term.dirtyfd, &(char){'1'}, 1);
-		pthread_mutex_lock(&term.synch);
-		got_hold = true;
+	size_t got = nr;
+	while (got < PTY_READ_SZ && 1 == poll(
+		(struct pollfd[]){ {.fd = fd, .events = POLLIN } }, 1, 0)){
+		nr = flush_buffer(fd, &dst[got], PTY_READ_SZ - got);
+		if (nr <= 0)
+			break;
+		got += nr;
 	}
 
-	tsm_vte_input(term.vte, buf, nr);
+	return got;
+}
 
-/* could possibly also match against parser state, or specific total
- * timeout before breaking out and releasing the terminal */
-	size_t w, h;
-	arcan_tui_dimensions(term.screen, &w, &h);
-	ssize_t cap = w * h * 4;
-	while (nr > 0 && cap > 0 && 1 == poll(
-		(struct pollfd[]){ {.fd = fd, .events = POLLIN } }, 1, 0)){
-		nr = flush_buffer(fd, buf);
-		if (nr > 0){
-			tsm_vte_input(term.vte, buf, nr);
-			cap -= nr;
+static bool readout_pty(int fd)
+{
+	static char buf[PTY_READ_SZ];
+	size_t left = PTY_DRAIN_SZ;
+
+/* keep parsing for as long as there is data, the screen is only held for one
+ * batch at a time so that the render thread can get in between */
+	do {
+		ssize_t nr = fill_buffer(fd, buf);
+		if (nr < 0)
+			return false;
+
+/* end of file never drains [left] and the hangup keeps polling ready */
+		if (nr == 0)
+			break;
+
+/* if the render thread holds the screen it is likely blocking on events,
+ * wake it up so that it lets go */
+		if (!screen_trylock()){
+			write(term.dirtyfd, &(char){'1'}, 1);
+			screen_lock();
 		}
-	}
 
-	if (got_hold){
-		pthread_mutex_unlock(&term.hold);
-	}
-	pthread_mutex_unlock(&term.synch);
+		tsm_vte_input(term.vte, buf, nr);
+		screen_unlock();
+
+		left = left > (size_t) nr ? left - nr : 0;
+	} while (left && 1 == poll(
+		(struct pollfd[]){ {.fd = fd, .events = POLLIN } }, 1, 0));
 
 	return true;
 }
@@ -725,7 +784,7 @@ int afsrv_terminal(struct arcan_shmif_cont* con, struct arg_arr* args)
 #endif
 
 	while(atomic_load(&term.alive) || !term.die_on_term){
-		pthread_mutex_lock(&term.synch);
+		screen_lock();
 		struct tui_process_res res =
 			arcan_tui_process(&term.screen, 1, &term.signalfd, 1, -1);
 
@@ -740,16 +799,31 @@ int afsrv_terminal(struct arcan_shmif_cont* con, struct arg_arr* args)
 			term.complete_signal = true;
 		}
 
-		arcan_tui_refresh(term.screen);
+/* only publish when the previous frame has been consumed, anything the
+ * parser adds until then is coalesced into the next one */
+		struct arcan_shmif_cont* acon = arcan_tui_acon(term.screen);
+		int jitter, errc;
+		int left = arcan_shmif_deadline(acon, 0, &jitter, &errc);
+		if (left >= 0)
+			arcan_tui_refresh(term.screen);
+
+		bool backlog = left < 0 && arcan_tuiint_dirty(term.screen);
+		int epipe = acon->epipe;
+		screen_unlock();
 
 	/* flush out the signal pipe, don't care about contents, assume
 	 * it is about unlocking for now */
-		pthread_mutex_unlock(&term.synch);
 		if (res.ok){
 			char buf[256];
 			read(term.signalfd, buf, 256);
-			pthread_mutex_lock(&term.hold);
-			pthread_mutex_unlock(&term.hold);
+		}
+
+/* processing won't block while there is something left to publish, so wait
+ * for the frame away from the screen rather than spin and hold up the parser,
+ * input still wakes us up */
+		if (backlog){
+			poll((struct pollfd[]){
+				{.fd = epipe, .events = POLLIN}}, 1, FRAME_WAIT_MS);
 		}
 	}
 
@@ -144,6 +144,7 @@ struct tsm_vte {
 	char *palette_name;
 
 	struct tsm_utf8_mach *mach;
+	int utf8_state; /* last result from feeding mach */
 	unsigned long parse_cnt;
 	tsm_symbol_t last_symbol;
 
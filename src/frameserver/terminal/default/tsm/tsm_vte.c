@@ -51,6 +51,12 @@
 #include <inttypes.h>
 #include "libtsm_int.h"
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
 /* Input parser states */
 enum parser_state {
 	STATE_NONE,		/* placeholder */
@@ -873,6 +879,7 @@ void tsm_vte_reset(struct tsm_vte *vte)
 	arcan_tui_set_flags(vte->con, TUI_AUTO_WRAP);
 
 	tsm_utf8_mach_reset(vte->mach);
+	vte->utf8_state = TSM_UTF8_START;
 	vte->state = STATE_GROUND;
 	vte->gl = &vte->g0;
 	vte->gr = &vte->g1;
@@ -2672,18 +2679,103 @@ static void parse_data(struct tsm_vte *vte, uint32_t raw)
 	DEBUG_LOG(vte, "unhandled input %u in state %d", raw, vte->state);
 }
 
+/*
+ * Length of the leading run of printable ASCII (0x20 - 0x7e) in [buf], the
+ * bulk of what 'cat' of a log or a compiler spews out.
+ */
+static size_t ascii_run(const uint8_t *buf, size_t len)
+{
+	size_t i = 0;
+
+#if defined(__SSE2__)
+/* the compares are signed so bytes >= 0x80 fail the lower bound */
+	const __m128i lo = _mm_set1_epi8(0x1f);
+	const __m128i hi = _mm_set1_epi8(0x7f);
+
+	for (; i + 16 <= len; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)&buf[i]);
+		__m128i ok = _mm_and_si128(
+			_mm_cmpgt_epi8(v, lo), _mm_cmplt_epi8(v, hi));
+		unsigned mask = _mm_movemask_epi8(ok);
+		if (mask != 0xffff)
+			return i + __builtin_ctz(~mask);
+	}
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+	const uint8x16_t lo = vdupq_n_u8(0x20);
+	const uint8x16_t hi = vdupq_n_u8(0x7f);
+
+	for (; i + 16 <= len; i += 16) {
+		uint8x16_t v = vld1q_u8(&buf[i]);
+		uint8x16_t ok = vandq_u8(vcgeq_u8(v, lo), vcltq_u8(v, hi));
+		if (vminvq_u8(ok) != 0xff)
+			break;
+	}
+#else
+/* eight at a time, a byte is out of range if it is below 0x20, has the
+ * high bit set or becomes so when 0x01 is added (0x7f) */
+	const uint64_t ones = 0x0101010101010101ull;
+	const uint64_t high = 0x8080808080808080ull;
+
+	for (; i + 8 <= len; i += 8) {
+		uint64_t v;
+		memcpy(&v, &buf[i], 8);
+		if (((v - ones * 0x20) | v | (v + ones)) & high)
+			break;
+	}
+#endif
+
+	while (i < len && buf[i] >= 0x20 && buf[i] < 0x7f)
+		i++;
+
+	return i;
+}
+
+/*
+ * In the ground state with the default GL set and no pending UTF-8 sequence,
+ * printable ASCII would go through parse_data as ACTION_PRINT one character
+ * at a time with vte_map as the identity. Forward such runs in one write.
+ */
+static size_t print_ascii(struct tsm_vte *vte, const uint8_t *buf, size_t len)
+{
+	if (vte->state != STATE_GROUND || vte->glt ||
+		*vte->gl != &tsm_vte_unicode_lower)
+		return 0;
+
+	if (!(vte->flags & (FLAG_7BIT_MODE | FLAG_8BIT_MODE)) &&
+		vte->utf8_state != TSM_UTF8_START &&
+		vte->utf8_state != TSM_UTF8_ACCEPT &&
+		vte->utf8_state != TSM_UTF8_REJECT)
+		return 0;
+
+	size_t run = ascii_run(buf, len);
+	if (!run)
+		return 0;
+
+	vte->last_symbol = buf[run - 1];
+	to_rgb(vte, false);
+	arcan_tui_writeu8(vte->con, buf, run, &vte->cattr);
+
+	return run;
+}
+
 SHL_EXPORT
 void tsm_vte_input(struct tsm_vte *vte, const char *u8, size_t len)
 {
 	int state;
 	uint32_t ucs4;
-	size_t i;
+	size_t i, run;
 
 	if (!vte || !vte->con)
 		return;
 
 	++vte->parse_cnt;
 	for (i = 0; i < len; ++i) {
+		run = print_ascii(vte, (const uint8_t *)&u8[i], len - i);
+		if (run) {
+			i += run - 1;
+			continue;
+		}
+
 		if (vte->flags & FLAG_7BIT_MODE) {
 			if (u8[i] & 0x80)
 				DEBUG_LOG(vte, "receiving 8bit character U+%d from pty while in 7bit mode",
@@ -2693,6 +2785,7 @@ void tsm_vte_input(struct tsm_vte *vte, const char *u8, size_t len)
 			parse_data(vte, u8[i]);
 		} else {
 			state = tsm_utf8_mach_feed(vte->mach, u8[i]);
+			vte->utf8_state = state;
 			if (state == TSM_UTF8_ACCEPT ||
 			    state == TSM_UTF8_REJECT) {
 				ucs4 = tsm_utf8_mach_get(vte->mach);
@@ -17,6 +17,10 @@ struct anet_options {
 	int mode;
 	const char* redirect_exit;
 	const char* devicehint_cp;
+	const char* cache_dir;
+	size_t cache_limit;
+	size_t max_sessions;
+	size_t session_limit;
 	ssize_t retry_count;
 	struct a12_context_options* opts;
 };
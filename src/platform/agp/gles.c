@@ -87,6 +87,44 @@ const char * defcvprg =
 " gl_Position = (projection * modelview) * vertex;\n"
 "}";
 
+/* cells from a TPACK buffer drawn as quads against a glyph atlas, the atlas
+ * carries the coverage per channel and the cell colors come as attributes,
+ * a negative foreground marks a color glyph that is used as is */
+static const char* deftvprg =
+"#version 100\n"
+"precision mediump float;\n"
+"uniform mat4 modelview;\n"
+"uniform mat4 projection;\n"
+"attribute vec4 vertex;\n"
+"attribute vec2 texcoord;\n"
+"attribute vec3 color;\n"
+"attribute vec3 normal;\n"
+"varying vec2 texco;\n"
+"varying vec3 fgc;\n"
+"varying vec3 bgc;\n"
+"void main(){\n"
+"	gl_Position = (projection * modelview) * vertex;\n"
+"	texco = texcoord;\n"
+"	fgc = color;\n"
+"	bgc = normal;\n"
+"}";
+
+static const char* deftfprg =
+"#version 100\n"
+"precision mediump float;\n"
+"uniform sampler2D map_diffuse;\n"
+"uniform float obj_opacity;\n"
+"varying vec2 texco;\n"
+"varying vec3 fgc;\n"
+"varying vec3 bgc;\n"
+"void main(){\n"
+"	vec4 cov = texture2D(map_diffuse, texco);\n"
+"	if (fgc.r < 0.0)\n"
+"		gl_FragColor = vec4(cov.rgb + bgc * (1.0 - cov.a), max(obj_opacity, cov.a));\n"
+"	else\n"
+"		gl_FragColor = vec4(mix(bgc, fgc, cov.rgb), max(obj_opacity, cov.a));\n"
+"}";
+
 agp_shader_id agp_default_shader(enum SHADER_TYPES type)
 {
 	static agp_shader_id shids[SHADER_TYPE_ENDM];
@@ -99,6 +137,8 @@ agp_shader_id agp_default_shader(enum SHADER_TYPES type)
 		shids[COLOR_2D] = agp_shader_build(
 			"DEFAULT_COLOR", NULL, defcvprg, defcfprg);
 		shids[BASIC_3D] = shids[BASIC_2D];
+		shids[TPACK_2D] = agp_shader_build(
+			"DEFAULT_TPACK", NULL, deftvprg, deftfprg);
 		defshdr_build = true;
 	}
 
@@ -142,6 +182,11 @@ void agp_shader_source(enum SHADER_TYPES type,
 		*frag = defcfprg;
 	break;
 
+	case TPACK_2D:
+		*vert = deftvprg;
+		*frag = deftfprg;
+	break;
+
 	default:
 		*vert = NULL;
 		*frag = NULL;
@@ -1720,6 +1720,21 @@ void agp_rendertarget_clearcolor(
 	tgt->clearcol[3] = a;
 }
 
+bool agp_rendertarget_readback(struct agp_rendertarget* tgt)
+{
+	if (!tgt || !tgt->fbo || !tgt->store || !tgt->store->vinf.text.raw)
+		return false;
+
+	struct agp_fenv* env = agp_env();
+	BIND_FRAMEBUFFER(tgt->fbo);
+	env->read_pixels(0, 0, tgt->store->w, tgt->store->h,
+		GL_PIXEL_FORMAT, GL_UNSIGNED_BYTE, tgt->store->vinf.text.raw);
+	BIND_FRAMEBUFFER(0);
+
+	tgt->store->update_ts = arcan_timemillis();
+	return true;
+}
+
 void agp_drop_mesh(struct agp_mesh_store* s)
 {
 	if (!s)
@@ -315,6 +315,11 @@ void agp_rendertarget_clearcolor(
 {
 }
 
+bool agp_rendertarget_readback(struct agp_rendertarget* tgt)
+{
+	return false;
+}
+
 bool agp_status_ok(const char** msg)
 {
 	return true;
@@ -43,11 +43,13 @@ typedef uint32_t agp_shader_id;
  * Retrieve the default shader for a specific purpose,
  * BASIC_2D => single textured, alpha in obj_opacity
  * COLOR_2D => not textured, color channel in uniforms
+ * TPACK_2D => glyph atlas coverage in texture, fg/bg in color/normal attribs
  */
 enum SHADER_TYPES {
 	BASIC_2D = 0,
 	COLOR_2D,
 	BASIC_3D,
+	TPACK_2D,
 	SHADER_TYPE_ENDM
 };
 agp_shader_id agp_default_shader(enum SHADER_TYPES);
@@ -436,6 +438,13 @@ void agp_rendertarget_clear();
 void agp_rendertarget_clearcolor(
 	struct agp_rendertarget*, float, float, float, float);
 
+/*
+ * Read the color attachment of the rendertarget back into the raw buffer of
+ * the store it is bound to. Unlike agp_readback_synchronous this goes through
+ * the framebuffer, so it also works where textures can't be read (GLES).
+ */
+bool agp_rendertarget_readback(struct agp_rendertarget*);
+
 enum agp_mesh_type {
 	AGP_MESH_TRISOUP,
 	AGP_MESH_POINTCLOUD
@@ -1136,7 +1136,8 @@ int arcan_shmif_tryenqueue(
 	pthread_mutex_lock(&ctx->synch.lock);
 #endif
 
-	if (((*ctx->front + 1) % ctx->eventbuf_sz) == *ctx->back){
+/* same full condition as _enqueue waits on */
+	if (((*ctx->back + 1) % ctx->eventbuf_sz) == *ctx->front){
 #ifdef ARCAN_SHMIF_THREADSAFE_QUEUE
 	pthread_mutex_unlock(&ctx->synch.lock);
 #endif
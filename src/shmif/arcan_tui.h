@@ -584,6 +584,11 @@ struct tui_subwnd_req {
 	enum tui_subwnd_hint hint;
 };
 
+enum tui_search_flags {
+	TUI_SEARCH_FORWARD = 1,
+	TUI_SEARCH_NOCASE = 2
+};
+
 #ifndef ARCAN_TUI_DYNAMIC
 
 /*
@@ -1127,6 +1132,17 @@ void arcan_tui_tab_left(struct tui_context*, size_t);
 void arcan_tui_scroll_up(struct tui_context*, size_t);
 void arcan_tui_scroll_down(struct tui_context*, size_t);
 
+/*
+ * search the scrollback for the UTF-8 string [str], starting at the line
+ * above the top of the window and moving towards older lines, or at the line
+ * below it towards newer ones with TUI_SEARCH_FORWARD. TUI_SEARCH_NOCASE
+ * ignores case for ASCII. On a match, the window is scrolled so that the line
+ * is on the top row and [col] is set to the column the match starts at.
+ * Returns false if there are no further matches or in alt-screen.
+ */
+bool arcan_tui_sb_search(
+	struct tui_context*, const char* str, int flags, size_t* col);
+
 /*
  * [DEPRECATE -> widget]
  * remove the tabstop at the current position
@@ -1206,6 +1222,7 @@ typedef void (* PTUITABRIGHT)(struct tui_context*, size_t);
 typedef void (* PTUITABLEFT)(struct tui_context*, size_t);
 typedef void (* PTUISCROLLUP)(struct tui_context*, size_t);
 typedef void (* PTUISCROLLDOWN)(struct tui_context*, size_t);
+typedef bool (* PTUISBSEARCH)(struct tui_context*, const char*, int, size_t*);
 typedef void (* PTUIRESETTABSTOP)(struct tui_context*);
 typedef void (* PTUIRESETALLTABSTOPS)(struct tui_context*);
 typedef void (* PTUISCROLLHINT)(struct tui_context*, size_t, struct tui_region*);
@@ -1291,6 +1308,7 @@ static PTUITABRIGHT arcan_tui_tab_right;
 static PTUITABLEFT arcan_tui_tab_left;
 static PTUISCROLLUP arcan_tui_scroll_up;
 static PTUISCROLLDOWN arcan_tui_scroll_down;
+static PTUISBSEARCH arcan_tui_sb_search;
 static PTUIRESETTABSTOP arcan_tui_reset_tabstop;
 static PTUIRESETALLTABSTOPS arcan_tui_reset_all_tabstops;
 static PTUISCROLLHINT arcan_tui_scrollhint;
@@ -1371,6 +1389,7 @@ M(PTUITABRIGHT,arcan_tui_tab_right);
 M(PTUITABLEFT,arcan_tui_tab_left);
 M(PTUISCROLLUP,arcan_tui_scroll_up);
 M(PTUISCROLLDOWN,arcan_tui_scroll_down);
+M(PTUISBSEARCH,arcan_tui_sb_search);
 M(PTUIRESETTABSTOP,arcan_tui_reset_tabstop);
 M(PTUIRESETALLTABSTOPS,arcan_tui_reset_all_tabstops);
 M(PTUISCROLLHINT,arcan_tui_scrollhint);
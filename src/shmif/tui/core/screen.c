@@ -31,6 +31,16 @@ static int tsm_draw_callback(struct tsm_screen* screen, uint32_t id,
 		tui->front[pos].attr = *attr;
 		tui->front[pos].fstamp = tui->fstamp;
 		tui->dirty |= DIRTY_PARTIAL;
+
+		struct tui_span* span = &tui->front_dirty[y];
+		if (!span->x2){
+			span->x1 = x;
+			span->x2 = x + 1;
+		}
+		else if (x < span->x1)
+			span->x1 = x;
+		else if (x >= span->x2)
+			span->x2 = x + 1;
 	}
 
 	return 0;
@@ -46,7 +56,8 @@ static void resize_cellbuffer(struct tui_context* tui)
 
 	tui->base = NULL;
 
-	size_t buffer_sz = 2 * tui->rows * tui->cols * sizeof(struct tui_cell);
+	size_t buffer_sz = 2 * tui->rows * tui->cols * sizeof(struct tui_cell) +
+		tui->rows * sizeof(struct tui_span);
 	size_t rbuf_sz =
 		sizeof(struct tui_raster_header) + /* always there */
 		((tui->rows * tui->cols + 2) * raster_cell_sz) + /* worst case, includes cursor */
@@ -75,19 +86,20 @@ static void resize_cellbuffer(struct tui_context* tui)
 
 	tui->front = tui->base;
 	tui->back = &tui->base[tui->rows * tui->cols];
+	tui->front_dirty = (struct tui_span*) &tui->base[2 * tui->rows * tui->cols];
 	tui->dirty |= DIRTY_FULL;
 }
 
 /* sweep a row from a start offset until the first deviation
- * between front and back offset */
+ * between front and back offset, or until [end] */
 static ssize_t find_row_ofs(
-	struct tui_context* tui, size_t row, size_t ofs)
+	struct tui_context* tui, size_t row, size_t ofs, size_t end)
 {
 	size_t pos = row * tui->cols;
 	struct tui_cell* front = &tui->front[pos];
 	struct tui_cell* back = &tui->back[pos];
 
-	for (pos = ofs; pos < tui->cols; pos++){
+	for (pos = ofs; pos < end; pos++){
 		if (!tui_attr_equal(front[pos].attr,
 			back[pos].attr) || front[pos].ch != back[pos].ch){
 			return pos;
@@ -213,13 +225,24 @@ int tui_screen_tpack(struct tui_context* tui,
 				front++;
 			}
 		}
+
+		if (opts.synch)
+			memset(tui->front_dirty, '\0', tui->rows * sizeof(struct tui_span));
 		rv = 2;
 	}
 
-/* delta update, find_row_ofs gives the next mismatch on the row */
+/* delta update, find_row_ofs gives the next mismatch on the row within the
+ * span that has been written to since the last synch */
 	else if (tui->dirty & DIRTY_PARTIAL){
 		for (size_t row = 0; row < tui->rows; row++){
-			ssize_t ofs = find_row_ofs(tui, row, 0);
+			struct tui_span span = tui->front_dirty[row];
+			if (!span.x2)
+				continue;
+
+			if (opts.synch)
+				tui->front_dirty[row] = (struct tui_span){0};
+
+			ssize_t ofs = find_row_ofs(tui, row, span.x1, span.x2);
 			if (-1 == ofs)
 				continue;
 
@@ -253,7 +276,7 @@ int tui_screen_tpack(struct tui_context* tui,
 				outsz += cell_to_rcell(attr, &out[outsz], 0);
 /* iterate forward */
 				ssize_t last_ofs = ofs;
-				ofs = find_row_ofs(tui, row, ofs+1);
+				ofs = find_row_ofs(tui, row, ofs+1, span.x2);
 				if (-1 == ofs)
 					break;
 
@@ -1,4 +1,6 @@
 #include <inttypes.h>
+#include <pthread.h>
+#include <unistd.h>
 #include "../../arcan_shmif.h"
 #include "../../arcan_tui.h"
 #define SHMIF_TTF
@@ -22,9 +24,82 @@ struct cell {
 	uint8_t attr;
 };
 
+/* Large frames are split into bands of lines that are rastered in parallel,
+ * each band renders with its own instance of the vector fonts as the glyph
+ * cache and the FreeType face can't be shared between threads. */
+#define RASTER_MAX_BANDS 4
+#define RASTER_PARALLEL_CELLS 4096
+
+/* Glyph atlas for tui_raster_tolist, slots are cell sized and keyed on the
+ * codepoint along with the attributes that change the shape of the glyph,
+ * colors are applied when the quads are drawn. */
+#define RASTER_ATLAS_DIM 1024
+#define RASTER_ATLAS_QUADS 2048
+#define ATLAS_ATTR_MASK ((1 << CATTR_BOLD) | (1 << CATTR_UNDERLINE) |\
+	(1 << CATTR_ITALIC) | (1 << CATTR_STRIKETHROUGH))
+
+struct raster_atlas {
+	shmif_pixel* buf;
+	size_t w, h, cols;
+
+/* slot 0 is kept blank and used for cells without a glyph */
+	size_t n_slots, used;
+
+/* open addressed, a zero key is free as the blank slot is never looked up */
+	uint64_t* keys;
+	uint32_t* slots;
+	size_t ht_mask;
+
+/* per slot, set if the glyph carries its own colors rather than coverage */
+	bool* color;
+
+/* glyphs are rastered here first as they may overdraw the cell */
+	shmif_pixel* scratch;
+
+/* region that has changed since the last flush */
+	size_t x1, y1, x2, y2;
+
+	struct tui_raster_quad quads[RASTER_ATLAS_QUADS];
+	size_t n_quads;
+
+	void (*flush)(struct tui_raster_batch*, void* tag);
+	void* tag;
+	uint8_t alpha;
+};
+
+struct raster_fonts {
+	TTF_Font* src[2];
+	TTF_Font* ttf[2];
+	size_t n;
+	int last_style;
+};
+
+/* one line from the packed buffer, along with the rows of background to fill
+ * in before it for full frames */
+struct raster_job {
+	struct tui_raster_line line;
+	uint8_t* cells;
+	size_t ncells;
+	size_t draw_y;
+	size_t fill_y;
+	size_t fill_h;
+};
+
+struct raster_band {
+	struct tui_raster_context* ctx;
+	struct raster_fonts* fonts;
+	struct raster_job* jobs;
+	size_t n_jobs;
+
+	shmif_pixel* vidp;
+	size_t pitch, max_w, max_h;
+	shmif_pixel bgc;
+	uint8_t alpha;
+	uint16_t x2;
+};
+
 struct tui_raster_context {
 	struct tui_font* fonts[4];
-	int last_style;
 	int cursor_state;
 
 	shmif_pixel cc;
@@ -34,14 +109,201 @@ struct tui_raster_context {
 
 	size_t min_x, min_y;
 	size_t max_x, max_y;
+
+/* [0] aliases the context fonts, the others are clones */
+	struct raster_fonts band_fonts[RASTER_MAX_BANDS];
+
+	struct raster_job* jobs;
+	size_t jobs_cap;
+
+	struct raster_atlas* atlas;
+};
+
+static struct {
+	pthread_mutex_t lock;
+	pthread_cond_t work;
+	pthread_cond_t done;
+	pthread_once_t init;
+	struct raster_band* bands;
+	size_t n_bands;
+	size_t next;
+	size_t pending;
+	size_t workers;
+	bool active;
+} pool = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.work = PTHREAD_COND_INITIALIZER,
+	.done = PTHREAD_COND_INITIALIZER,
+	.init = PTHREAD_ONCE_INIT
 };
 
+static void raster_band(struct raster_band* band);
+
+static void* pool_worker(void* tag)
+{
+	pthread_mutex_lock(&pool.lock);
+
+	for(;;){
+		if (pool.next >= pool.n_bands){
+			pthread_cond_wait(&pool.work, &pool.lock);
+			continue;
+		}
+
+		struct raster_band* band = &pool.bands[pool.next++];
+		pthread_mutex_unlock(&pool.lock);
+		raster_band(band);
+		pthread_mutex_lock(&pool.lock);
+
+		if (!--pool.pending)
+			pthread_cond_broadcast(&pool.done);
+	}
+
+	return NULL;
+}
+
+static void pool_setup()
+{
+	long nproc = sysconf(_SC_NPROCESSORS_ONLN);
+	size_t want = nproc > 1 ? nproc - 1 : 0;
+	if (want > RASTER_MAX_BANDS - 1)
+		want = RASTER_MAX_BANDS - 1;
+
+	pthread_attr_t attr;
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+	for (size_t i = 0; i < want; i++){
+		pthread_t pth;
+		if (0 != pthread_create(&pth, &attr, pool_worker, NULL))
+			break;
+		pool.workers++;
+	}
+
+	pthread_attr_destroy(&attr);
+}
+
+/* run all bands with the calling thread helping out, the pool is shared
+ * between contexts so only one set of bands is in flight at a time */
+static void pool_run(struct raster_band* bands, size_t n)
+{
+	pthread_mutex_lock(&pool.lock);
+	while (pool.active)
+		pthread_cond_wait(&pool.done, &pool.lock);
+
+	pool.active = true;
+	pool.bands = bands;
+	pool.n_bands = n;
+	pool.next = 0;
+	pool.pending = n;
+	pthread_cond_broadcast(&pool.work);
+
+	while (pool.next < pool.n_bands){
+		struct raster_band* band = &pool.bands[pool.next++];
+		pthread_mutex_unlock(&pool.lock);
+		raster_band(band);
+		pthread_mutex_lock(&pool.lock);
+		pool.pending--;
+	}
+
+	while (pool.pending)
+		pthread_cond_wait(&pool.done, &pool.lock);
+
+	pool.bands = NULL;
+	pool.n_bands = 0;
+	pool.active = false;
+	pthread_cond_broadcast(&pool.done);
+	pthread_mutex_unlock(&pool.lock);
+}
+
+static void drop_clones(struct tui_raster_context* ctx)
+{
+	for (size_t i = 1; i < RASTER_MAX_BANDS; i++){
+		struct raster_fonts* bf = &ctx->band_fonts[i];
+		for (size_t j = 0; j < 2; j++){
+			if (bf->ttf[j])
+				TTF_CloseFont(bf->ttf[j]);
+		}
+		*bf = (struct raster_fonts){.last_style = -1};
+	}
+}
+
+static void drop_atlas(struct tui_raster_context* ctx)
+{
+	struct raster_atlas* atlas = ctx->atlas;
+	if (!atlas)
+		return;
+
+	free(atlas->buf);
+	free(atlas->keys);
+	free(atlas->slots);
+	free(atlas->color);
+	free(atlas->scratch);
+	free(atlas);
+	ctx->atlas = NULL;
+}
+
+/* the vector fonts in use, kept in sync with what the fonts slots point to
+ * as those can be swapped or reloaded under us */
+static void synch_fonts(struct tui_raster_context* ctx, size_t n_bands)
+{
+	TTF_Font* src[2] = {NULL, NULL};
+	size_t n = 0;
+
+	if (ctx->fonts[0] && ctx->fonts[0]->vector){
+		src[0] = ctx->fonts[0]->truetype;
+		n = 1;
+		if (ctx->fonts[1] && ctx->fonts[1]->vector && ctx->fonts[1]->truetype){
+			src[1] = ctx->fonts[1]->truetype;
+			n = 2;
+		}
+	}
+
+	struct raster_fonts* main = &ctx->band_fonts[0];
+	if (main->src[0] != src[0] || main->src[1] != src[1]){
+		drop_clones(ctx);
+		main->last_style = -1;
+	}
+
+	main->src[0] = main->ttf[0] = src[0];
+	main->src[1] = main->ttf[1] = src[1];
+	main->n = n;
+
+	for (size_t i = 1; i < n_bands; i++){
+		struct raster_fonts* bf = &ctx->band_fonts[i];
+		if (bf->n == n)
+			continue;
+
+		for (size_t j = 0; j < n; j++){
+			if (!bf->ttf[j])
+				bf->ttf[j] = TTF_CloneFont(src[j]);
+			bf->src[j] = src[j];
+		}
+		bf->n = n;
+		bf->last_style = -1;
+	}
+}
+
+/* bands past those with a full set of cloned fonts fall back to serial */
+static size_t usable_bands(struct tui_raster_context* ctx, size_t n_bands)
+{
+	struct raster_fonts* main = &ctx->band_fonts[0];
+	for (size_t i = 1; i < n_bands; i++){
+		for (size_t j = 0; j < main->n; j++)
+			if (!ctx->band_fonts[i].ttf[j])
+				return i;
+	}
+	return n_bands;
+}
+
 void tui_raster_setfont(
 	struct tui_raster_context* ctx, struct tui_font** src, size_t n_fonts)
 {
 	for (size_t i = 0; i < 4; i++)
 		ctx->fonts[i] = i < n_fonts ? src[i] : NULL;
-	ctx->last_style = -1;
+
+	drop_clones(ctx);
+	drop_atlas(ctx);
+	ctx->band_fonts[0] = (struct raster_fonts){.last_style = -1};
 }
 
 struct tui_raster_context* tui_raster_setup(size_t cell_w, size_t cell_h)
@@ -53,10 +315,12 @@ struct tui_raster_context* tui_raster_setup(size_t cell_w, size_t cell_h)
 	*res = (struct tui_raster_context){
 		.cell_w = cell_w,
 		.cell_h = cell_h,
-		.cc = SHMIF_RGBA(0x00, 0xaa, 0x00, 0xff),
-		.last_style = -1
+		.cc = SHMIF_RGBA(0x00, 0xaa, 0x00, 0xff)
 	};
 
+	for (size_t i = 0; i < RASTER_MAX_BANDS; i++)
+		res->band_fonts[i].last_style = -1;
+
 	return res;
 }
 
@@ -64,6 +328,10 @@ void tui_raster_cell_size(struct tui_raster_context* ctx, size_t w, size_t h)
 {
 	ctx->cell_w = w;
 	ctx->cell_h = h;
+
+/* the font was likely reopened at a new size */
+	drop_clones(ctx);
+	drop_atlas(ctx);
 }
 
 void unpack_u32(uint32_t* dst, uint8_t* inbuf)
@@ -102,7 +370,8 @@ static void linehint(struct tui_raster_context* ctx, struct cell* cell,
 	}
 }
 
-static size_t drawglyph(struct tui_raster_context* ctx, struct cell* cell,
+static size_t drawglyph(struct tui_raster_context* ctx,
+	struct raster_fonts* rf, struct cell* cell,
 	shmif_pixel* vidp, size_t pitch, int x, int y, size_t maxx, size_t maxy)
 {
 /* draw glyph based on font state */
@@ -131,12 +400,8 @@ static size_t drawglyph(struct tui_raster_context* ctx, struct cell* cell,
 	}
 
 /* vector font drawing */
-	size_t nfonts = 1;
-	TTF_Font* fonts[2] = {ctx->fonts[0]->truetype, NULL};
-	if (ctx->fonts[1]->vector && ctx->fonts[1]->truetype){
-		nfonts = 2;
-		fonts[1] = ctx->fonts[1]->truetype;
-	}
+	size_t nfonts = rf->n;
+	TTF_Font** fonts = rf->ttf;
 
 /* Clear to bg-color as the glyph drawing with background won't pad,
  * except if it is the cursor color, then use that. We can't do the
@@ -161,10 +426,10 @@ static size_t drawglyph(struct tui_raster_context* ctx, struct cell* cell,
 /* seriously expensive so only perform if we actually need to as it can cause a
  * glyph cache flush (bold / italic / ...), other option would be to run
  * separate glyph caches on the different style options.. */
-	if (prem != ctx->last_style){
-		ctx->last_style = prem;
+	if (prem != rf->last_style){
+		rf->last_style = prem;
 		TTF_SetFontStyle(fonts[0], prem);
-		if (fonts[1])
+		if (nfonts > 1)
 			TTF_SetFontStyle(fonts[1], prem);
 	}
 
@@ -180,7 +445,7 @@ static size_t drawglyph(struct tui_raster_context* ctx, struct cell* cell,
 	unsigned ind = 0;
 	TTF_RenderUNICODEglyph(&vidp[y * pitch + x],
 		ctx->cell_w, ctx->cell_h, pitch, fonts, nfonts, cell->ucs4, &xs,
-		fg, bg, true, true, ctx->last_style, &adv, &ind
+		fg, bg, true, true, rf->last_style, &adv, &ind
 	);
 
 /* add line-marks, this actually does not belong here, it should be part
@@ -196,11 +461,63 @@ static size_t drawglyph(struct tui_raster_context* ctx, struct cell* cell,
 	return ctx->cell_w;
 }
 
-static int raster_tobuf(
-	struct tui_raster_context* ctx, shmif_pixel* vidp, size_t pitch,
-	size_t max_w, size_t max_h,
+static void raster_line(struct raster_band* band, struct raster_job* job)
+{
+	struct tui_raster_context* ctx = band->ctx;
+
+/* for full draw we fill in the skipped space with the background color */
+	if (job->fill_h){
+		draw_box_px(band->vidp, band->pitch, band->max_w, band->max_h,
+			0, job->fill_y, ctx->cell_w, job->fill_h, band->bgc);
+	}
+
+/* Shaping, BiDi, ... missing here now while we get the rest in place */
+	size_t draw_x = job->line.offset * ctx->cell_w;
+	size_t draw_y = job->draw_y;
+	uint8_t* buf = job->cells;
+
+	for (size_t i = 0; i < job->ncells; i++){
+
+/* extract each cell */
+		struct cell cell;
+		unpack_cell(buf, &cell, band->alpha);
+		buf += raster_cell_sz;
+
+/* skip bit is set, note that for a shaped line, this means that
+ * we need to have an offset- map to advance correctly */
+		if (cell.attr & (1 << CATTR_SKIP)){
+			draw_x += ctx->cell_w;
+			continue;
+		}
+
+/* blit or discard if OOB */
+		if (draw_x + ctx->cell_w <= band->max_w &&
+			draw_y + ctx->cell_h <= band->max_h){
+			draw_x += drawglyph(ctx, band->fonts, &cell, band->vidp,
+				band->pitch, draw_x, draw_y, band->max_w, band->max_h);
+		}
+		else
+			continue;
+
+		uint16_t next_x = draw_x + ctx->cell_w;
+		if (band->x2 < next_x && next_x <= band->max_w){
+			band->x2 = next_x;
+		}
+	}
+}
+
+static void raster_band(struct raster_band* band)
+{
+	for (size_t i = 0; i < band->n_jobs; i++)
+		raster_line(band, &band->jobs[i]);
+}
+
+/* split the packed buffer into per-line jobs and sort out the dirty region,
+ * returns the number of jobs or -1 if the buffer is malformed */
+static ssize_t parse_jobs(struct tui_raster_context* ctx,
+	struct tui_raster_header* out, size_t max_w, size_t max_h,
 	uint16_t* x1, uint16_t* y1, uint16_t* x2, uint16_t* y2,
-	uint8_t* buf, size_t buf_sz)
+	bool* ordered, uint8_t* buf, size_t buf_sz)
 {
 	struct tui_raster_header hdr;
 	if (!buf_sz || buf_sz < sizeof(struct tui_raster_header))
@@ -208,6 +525,7 @@ static int raster_tobuf(
 
 	bool update = false;
 	memcpy(&hdr, buf, sizeof(struct tui_raster_header));
+	*out = hdr;
 
 /* the caller might provide a larger input buffer than what the header sets,
  * and that will still clamp/drop-out etc. but mismatch between the header
@@ -219,9 +537,17 @@ static int raster_tobuf(
 		return -1;
 	}
 
+	if (hdr.lines > ctx->jobs_cap){
+		struct raster_job* jobs =
+			realloc(ctx->jobs, sizeof(struct raster_job) * hdr.lines);
+		if (!jobs)
+			return -1;
+		ctx->jobs = jobs;
+		ctx->jobs_cap = hdr.lines;
+	}
+
 	buf_sz -= sizeof(struct tui_raster_header);
 	buf += sizeof(struct tui_raster_header);
-	shmif_pixel bgc = SHMIF_RGBA(hdr.bgc[0], hdr.bgc[1], hdr.bgc[2], hdr.bgc[3]);
 
 	if (hdr.flags & RPACK_DFRAME){
 		*x1 = max_w;
@@ -240,40 +566,46 @@ static int raster_tobuf(
 	ssize_t cur_y = -1;
 	size_t last_line = 0;
 	size_t draw_y = 0;
+	size_t n_jobs = 0;
+	*ordered = true;
 
 	for (size_t i = 0; i < hdr.lines && buf_sz; i++){
 		if (buf_sz < sizeof(struct tui_raster_line))
 			return -1;
 
 /* read / unpack line metadata */
-		struct tui_raster_line line;
+		struct raster_job* job = &ctx->jobs[n_jobs++];
+		*job = (struct raster_job){0};
 
-		memcpy(&line, buf, sizeof(struct tui_raster_line));
-		buf += sizeof(line);
+		memcpy(&job->line, buf, sizeof(struct tui_raster_line));
+		buf += sizeof(struct tui_raster_line);
+		buf_sz -= sizeof(struct tui_raster_line);
 
 /* remember the lower line we were at, these are not always ordered */
-		if (line.start_line > last_line)
-			last_line = line.start_line;
+		if (job->line.start_line > last_line)
+			last_line = job->line.start_line;
 
 /* respecting scrolling will need another drawing routine, as we need clipping
  * etc. and multiple lines can be scrolled, and that's better fixed when we
  * have an atlas to work from */
 		if (update && cur_y == -1){
-			*y1 = line.start_line * ctx->cell_h;
+			*y1 = job->line.start_line * ctx->cell_h;
 		}
 
 /* skip omitted lines */
-		if (cur_y != line.start_line){
+		if (cur_y != job->line.start_line){
+			if (cur_y != -1 && job->line.start_line < cur_y)
+				*ordered = false;
+
 /* for full draw we fill in the skipped space with the background color */
 			if (!update && cur_y != -1){
-				draw_box_px(vidp, pitch, max_w, max_h,
-					0, cur_y * ctx->cell_h,
-					ctx->cell_w, ctx->cell_h * (line.start_line - cur_y), bgc
-				);
+				job->fill_y = cur_y * ctx->cell_h;
+				job->fill_h = ctx->cell_h * (job->line.start_line - cur_y);
 			}
-			cur_y = line.start_line;
+			cur_y = job->line.start_line;
 		}
 		draw_y = cur_y * ctx->cell_h;
+		job->draw_y = draw_y;
 
 /* the line- raster routine isn't right, we actually need to unpack each line
  * into a local buffer, make note of actual offsets and width, and then two-pass
@@ -283,50 +615,332 @@ static int raster_tobuf(
 			*y1 = draw_y;
 		}
 
-/* Shaping, BiDi, ... missing here now while we get the rest in place */
-		size_t draw_x = line.offset * ctx->cell_w;
-
+		size_t draw_x = job->line.offset * ctx->cell_w;
 		if (draw_x < *x1){
 			*x1 = draw_x;
 		}
 
-		for (size_t i = line.offset; line.ncells && buf_sz >= raster_cell_sz; i++){
-			line.ncells--;
+		job->cells = buf;
+		job->ncells = job->line.ncells;
+		if (job->ncells > buf_sz / raster_cell_sz)
+			job->ncells = buf_sz / raster_cell_sz;
 
-/* extract each cell */
+		buf += job->ncells * raster_cell_sz;
+		buf_sz -= job->ncells * raster_cell_sz;
+
+		cur_y++;
+	}
+
+	if (update){
+		*y2 = (last_line + 1) * ctx->cell_h;
+	}
+
+	return n_jobs;
+}
+
+static int raster_tobuf(
+	struct tui_raster_context* ctx, shmif_pixel* vidp, size_t pitch,
+	size_t max_w, size_t max_h,
+	uint16_t* x1, uint16_t* y1, uint16_t* x2, uint16_t* y2,
+	uint8_t* buf, size_t buf_sz)
+{
+	struct tui_raster_header hdr;
+	bool ordered;
+
+/* first pass splits the buffer into lines and sorts out the dirty region */
+	ssize_t n_jobs = parse_jobs(ctx,
+		&hdr, max_w, max_h, x1, y1, x2, y2, &ordered, buf, buf_sz);
+	if (-1 == n_jobs)
+		return -1;
+
+	shmif_pixel bgc = SHMIF_RGBA(hdr.bgc[0], hdr.bgc[1], hdr.bgc[2], hdr.bgc[3]);
+
+/* Lines are independent as long as they arrive in order, then each band of
+ * lines touches its own set of rows and can be rastered on its own. */
+	size_t n_bands = 1;
+	if (ordered && hdr.cells >= RASTER_PARALLEL_CELLS && n_jobs > 1){
+		pthread_once(&pool.init, pool_setup);
+		n_bands = pool.workers + 1;
+		if (n_bands > n_jobs)
+			n_bands = n_jobs;
+	}
+
+	synch_fonts(ctx, n_bands);
+	n_bands = usable_bands(ctx, n_bands);
+
+	struct raster_band bands[RASTER_MAX_BANDS];
+	size_t job = 0;
+
+/* split on cells rather than lines to even out partial updates */
+	size_t per_band = (hdr.cells + n_bands - 1) / n_bands;
+	for (size_t i = 0; i < n_bands; i++){
+		bands[i] = (struct raster_band){
+			.ctx = ctx,
+			.fonts = &ctx->band_fonts[i],
+			.jobs = &ctx->jobs[job],
+			.vidp = vidp,
+			.pitch = pitch,
+			.max_w = max_w,
+			.max_h = max_h,
+			.bgc = bgc,
+			.alpha = hdr.bgc[3],
+			.x2 = *x2
+		};
+
+		size_t cells = 0;
+		while (job < n_jobs && (cells < per_band || i == n_bands - 1)){
+			cells += ctx->jobs[job++].ncells;
+			bands[i].n_jobs++;
+		}
+	}
+
+	if (n_bands > 1)
+		pool_run(bands, n_bands);
+	else
+		raster_band(&bands[0]);
+
+	for (size_t i = 0; i < n_bands; i++)
+		if (bands[i].x2 > *x2)
+			*x2 = bands[i].x2;
+
+/* sweep through the context struct and blit the glyphs */
+	return 1;
+}
+
+static struct raster_atlas* get_atlas(struct tui_raster_context* ctx)
+{
+	if (ctx->atlas)
+		return ctx->atlas;
+
+	if (!ctx->cell_w || !ctx->cell_h)
+		return NULL;
+
+	size_t cols = RASTER_ATLAS_DIM / ctx->cell_w;
+	size_t rows = RASTER_ATLAS_DIM / ctx->cell_h;
+	if (cols < 2)
+		cols = 2;
+	if (rows < 1)
+		rows = 1;
+
+	struct raster_atlas* atlas = malloc(sizeof(struct raster_atlas));
+	if (!atlas)
+		return NULL;
+
+	size_t n_slots = cols * rows;
+	size_t ht_sz = 1;
+	while (ht_sz < n_slots * 2)
+		ht_sz <<= 1;
+
+	*atlas = (struct raster_atlas){
+		.w = cols * ctx->cell_w,
+		.h = rows * ctx->cell_h,
+		.cols = cols,
+		.n_slots = n_slots,
+		.used = 1,
+		.ht_mask = ht_sz - 1,
+		.x1 = cols * ctx->cell_w,
+		.y1 = rows * ctx->cell_h
+	};
+
+	atlas->buf = calloc(atlas->w * atlas->h, sizeof(shmif_pixel));
+	atlas->keys = calloc(ht_sz, sizeof(uint64_t));
+	atlas->slots = malloc(ht_sz * sizeof(uint32_t));
+	atlas->color = calloc(n_slots, sizeof(bool));
+	atlas->scratch = malloc((ctx->cell_h + 1) * ctx->cell_w * 2 * sizeof(shmif_pixel));
+	ctx->atlas = atlas;
+
+	if (!atlas->buf || !atlas->keys || !atlas->slots || !atlas->color || !atlas->scratch){
+		drop_atlas(ctx);
+		return NULL;
+	}
+
+	return atlas;
+}
+
+static void atlas_flush(struct raster_atlas* atlas)
+{
+	if (!atlas->n_quads && atlas->x2 <= atlas->x1)
+		return;
+
+	struct tui_raster_batch batch = {
+		.atlas = atlas->buf,
+		.atlas_w = atlas->w,
+		.atlas_h = atlas->h,
+		.x1 = atlas->x1,
+		.y1 = atlas->y1,
+		.x2 = atlas->x2,
+		.y2 = atlas->y2,
+		.quads = atlas->quads,
+		.n_quads = atlas->n_quads,
+		.alpha = atlas->alpha
+	};
+
+	atlas->flush(&batch, atlas->tag);
+
+	atlas->n_quads = 0;
+	atlas->x1 = atlas->w;
+	atlas->y1 = atlas->h;
+	atlas->x2 = atlas->y2 = 0;
+}
+
+/* resolve the slot of the glyph for [cell], rastering it if it is missing,
+ * returns false if the atlas is full. [color] is set for glyphs that should
+ * be sampled as is rather than tinted with the cell colors. */
+static bool atlas_slot(struct tui_raster_context* ctx,
+	struct raster_atlas* atlas, struct cell* cell, size_t* s, size_t* t, bool* color)
+{
+	uint8_t attr = cell->attr & ATLAS_ATTR_MASK;
+	uint64_t key = (uint64_t) cell->ucs4 | ((uint64_t) attr << 32);
+	size_t pos = (size_t)((key * 0x9e3779b97f4a7c15ull) >> 32) & atlas->ht_mask;
+	size_t slot;
+
+	while (atlas->keys[pos]){
+		if (atlas->keys[pos] == key){
+			slot = atlas->slots[pos];
+			goto out;
+		}
+		pos = (pos + 1) & atlas->ht_mask;
+	}
+
+	if (atlas->used == atlas->n_slots)
+		return false;
+
+	slot = atlas->used++;
+	atlas->keys[pos] = key;
+	atlas->slots[pos] = slot;
+
+/* white on transparent so that the color channels carry the coverage */
+	struct cell gc = {
+		.fc = SHMIF_RGBA(0xff, 0xff, 0xff, 0xff),
+		.bc = SHMIF_RGBA(0x00, 0x00, 0x00, 0x00),
+		.ucs4 = cell->ucs4,
+		.attr = attr
+	};
+
+	size_t pitch = ctx->cell_w * 2;
+	memset(atlas->scratch, '\0', (ctx->cell_h + 1) * pitch * sizeof(shmif_pixel));
+	drawglyph(ctx, &ctx->band_fonts[0],
+		&gc, atlas->scratch, pitch, 0, 0, pitch, ctx->cell_h);
+
+/* BGRA glyphs are written with their own premultiplied colors */
+	atlas->color[slot] = ctx->fonts[0]->vector && TTF_GlyphIsColor(
+		ctx->band_fonts[0].ttf, ctx->band_fonts[0].n, cell->ucs4);
+
+	size_t sx = (slot % atlas->cols) * ctx->cell_w;
+	size_t sy = (slot / atlas->cols) * ctx->cell_h;
+	for (size_t y = 0; y < ctx->cell_h; y++)
+		memcpy(&atlas->buf[(sy + y) * atlas->w + sx],
+			&atlas->scratch[y * pitch], ctx->cell_w * sizeof(shmif_pixel));
+
+	if (sx < atlas->x1)
+		atlas->x1 = sx;
+	if (sy < atlas->y1)
+		atlas->y1 = sy;
+	if (sx + ctx->cell_w > atlas->x2)
+		atlas->x2 = sx + ctx->cell_w;
+	if (sy + ctx->cell_h > atlas->y2)
+		atlas->y2 = sy + ctx->cell_h;
+
+out:
+	*s = (slot % atlas->cols) * ctx->cell_w;
+	*t = (slot / atlas->cols) * ctx->cell_h;
+	*color = atlas->color[slot];
+	return true;
+}
+
+static void atlas_quad(struct raster_atlas* atlas,
+	size_t x, size_t y, size_t w, size_t h,
+	size_t s, size_t t, size_t sw, size_t th,
+	shmif_pixel fc, shmif_pixel bc, bool color)
+{
+	if (atlas->n_quads == RASTER_ATLAS_QUADS)
+		atlas_flush(atlas);
+
+	atlas->quads[atlas->n_quads++] = (struct tui_raster_quad){
+		.x1 = x, .y1 = y, .x2 = x + w, .y2 = y + h,
+		.s1 = s, .t1 = t, .s2 = s + sw, .t2 = t + th,
+		.fc = fc, .bc = bc, .color = color
+	};
+}
+
+int tui_raster_tolist(struct tui_raster_context* ctx,
+	size_t max_w, size_t max_h, uint8_t* buf, size_t buf_sz,
+	void (*flush)(struct tui_raster_batch*, void* tag), void* tag)
+{
+	if (!ctx || !flush || !ctx->fonts[0])
+		return -1;
+
+	struct raster_atlas* atlas = get_atlas(ctx);
+	if (!atlas)
+		return -1;
+
+	struct tui_raster_header hdr;
+	uint16_t x1, y1, x2, y2;
+	bool ordered;
+	ssize_t n_jobs = parse_jobs(ctx,
+		&hdr, max_w, max_h, &x1, &y1, &x2, &y2, &ordered, buf, buf_sz);
+	if (-1 == n_jobs)
+		return -1;
+
+	synch_fonts(ctx, 1);
+	atlas->flush = flush;
+	atlas->tag = tag;
+	atlas->alpha = hdr.bgc[3];
+
+	size_t cw = ctx->cell_w;
+	size_t ch = ctx->cell_h;
+	shmif_pixel bgc = SHMIF_RGBA(hdr.bgc[0], hdr.bgc[1], hdr.bgc[2], hdr.bgc[3]);
+
+/* same walk as raster_line, but emit quads rather than draw */
+	for (size_t i = 0; i < n_jobs; i++){
+		struct raster_job* job = &ctx->jobs[i];
+
+		if (job->fill_h)
+			atlas_quad(atlas, 0, job->fill_y, cw, job->fill_h, 0, 0, 1, 1, bgc, bgc, false);
+
+		size_t draw_x = job->line.offset * cw;
+		uint8_t* cells = job->cells;
+
+		for (size_t j = 0; j < job->ncells; j++, cells += raster_cell_sz){
 			struct cell cell;
-			unpack_cell(buf, &cell, hdr.bgc[3]);
-			buf += raster_cell_sz;
-			buf_sz -= raster_cell_sz;
+			unpack_cell(cells, &cell, hdr.bgc[3]);
 
-/* skip bit is set, note that for a shaped line, this means that
- * we need to have an offset- map to advance correctly */
 			if (cell.attr & (1 << CATTR_SKIP)){
-				draw_x += ctx->cell_w;
+				draw_x += cw;
 				continue;
 			}
 
-/* blit or discard if OOB */
-			if (draw_x + ctx->cell_w <= max_w && draw_y + ctx->cell_h <= max_h){
-				draw_x += drawglyph(ctx, &cell, vidp, pitch, draw_x, draw_y, max_w, max_h);
-			}
-			else
+			if (draw_x + cw > max_w || job->draw_y + ch > max_h)
 				continue;
 
-			uint16_t next_x = draw_x + ctx->cell_w;
-			if (*x2 < next_x && next_x <= max_w){
-				*x2 = next_x;
+			shmif_pixel bc = cell.bc;
+			if ((cell.attr & (1 << CATTR_CURSOR)) && ctx->cursor_state == CURSOR_ACTIVE)
+				bc = ctx->cc;
+
+/* the blank slot is sampled from a single texel as it is also used to fill */
+			if (!cell.ucs4){
+				atlas_quad(atlas, draw_x, job->draw_y, cw, ch, 0, 0, 1, 1, cell.fc, bc, false);
+				draw_x += cw;
+				continue;
 			}
-		}
 
-		cur_y++;
-	}
+/* out of slots, draw what we have so far and then start over */
+			size_t s, t;
+			bool color;
+			if (!atlas_slot(ctx, atlas, &cell, &s, &t, &color)){
+				atlas_flush(atlas);
+				memset(atlas->keys, '\0', (atlas->ht_mask + 1) * sizeof(uint64_t));
+				atlas->used = 1;
+				atlas_slot(ctx, atlas, &cell, &s, &t, &color);
+			}
 
-	if (update){
-		*y2 = (last_line + 1) * ctx->cell_h;
+			atlas_quad(atlas,
+				draw_x, job->draw_y, cw, ch, s, t, cw, ch, cell.fc, bc, color);
+			draw_x += cw;
+		}
 	}
 
-/* sweep through the context struct and blit the glyphs */
+	atlas_flush(atlas);
 	return 1;
 }
 
@@ -403,5 +1017,8 @@ void tui_raster_free(struct tui_raster_context* ctx)
 	if (!ctx)
 		return;
 
+	drop_clones(ctx);
+	drop_atlas(ctx);
+	free(ctx->jobs);
 	free(ctx);
 }
@@ -172,6 +172,51 @@ void tui_raster_renderagp(struct tui_raster_context* ctx,
 	struct agp_vstore* dst, uint8_t* buf, size_t buf_sz);
 #endif
 
+/*
+ * Atlas based drawing, rather than rastering into a buffer the packed cells
+ * are translated into a list of quads that reference cell- sized glyph slots
+ * in an atlas kept by the context. Only glyphs missing from the atlas are
+ * rastered, and the region of the atlas that changed is returned along with
+ * the quads so that the consumer only needs to synch that part.
+ *
+ * Coordinates are in pixels, the destination in (x1, y1, x2, y2) and the atlas
+ * source in (s1, t1, s2, t2). Cells without a glyph reference the blank slot.
+ *
+ * The atlas normally holds coverage in white that should be tinted with [fc]
+ * over [bc]. If [color] is set the slot holds a glyph with its own colors in
+ * premultiplied alpha (e.g. emoji) that should be drawn over [bc] as is.
+ */
+struct tui_raster_quad {
+	uint16_t x1, y1, x2, y2;
+	uint16_t s1, t1, s2, t2;
+	shmif_pixel fc, bc;
+	bool color;
+};
+
+struct tui_raster_batch {
+	shmif_pixel* atlas;
+	size_t atlas_w, atlas_h;
+
+/* atlas region that has changed since the last batch, empty if x2 <= x1 */
+	size_t x1, y1, x2, y2;
+
+	struct tui_raster_quad* quads;
+	size_t n_quads;
+
+/* background alpha from the header, applies to all quads */
+	uint8_t alpha;
+};
+
+/*
+ * Process [buf] into batches of quads that are forwarded to [flush]. This is
+ * invoked when the quad list is full, before the atlas slots are recycled and
+ * when the buffer has been consumed, so the batch has to be drawn before the
+ * callback returns. Returns -1 on a malformed buffer or allocation failure.
+ */
+int tui_raster_tolist(struct tui_raster_context* ctx,
+	size_t max_w, size_t max_h, uint8_t* buf, size_t buf_sz,
+	void (*flush)(struct tui_raster_batch*, void* tag), void* tag);
+
 /*
  * Free any buffers and resources bound to the raster.
  */
@@ -31,6 +31,7 @@
 #include <stdarg.h>
 #include <stdbool.h>
 #include <stdlib.h>
+#include <sys/uio.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -161,7 +162,8 @@ typedef int (*tsm_screen_customline_cb) (struct tsm_screen *con,
 	void* data
 );
 
-/* blocks are individually allocated, including the save_buf */
+/* blocks are individually allocated, including the save_buf, unless it
+ * was set up through tsm_save_buf_map */
 struct tsm_save_buf {
 	size_t metadata_sz;
 	uint8_t* metadata;
@@ -192,6 +194,13 @@ int tsm_screen_sb_page_up(struct tsm_screen *con, unsigned int num);
 int tsm_screen_sb_page_down(struct tsm_screen *con, unsigned int num);
 void tsm_screen_sb_reset(struct tsm_screen *con);
 
+/* move the view to the next scrollback line above the top of the view (or
+ * below it if [forward]) that contains [needle], with ASCII case folding if
+ * [fold]. Returns 0 and sets [col] to the cell the match starts at, or
+ * -ENOENT if there are no more matches */
+int tsm_screen_sb_search(struct tsm_screen *con, const uint32_t *needle,
+	size_t n, bool forward, bool fold, unsigned int *col);
+
 struct tui_screen_attr tsm_screen_get_def_attr(struct tsm_screen* con);
 
 void tsm_screen_set_def_attr(struct tsm_screen *con,
@@ -210,6 +219,11 @@ void tsm_screen_reset_all_tabstops(struct tsm_screen *con);
 
 int tsm_screen_write(struct tsm_screen *con, tsm_symbol_t ch,
 		const struct tui_screen_attr *attr);
+
+/* write the leading run of printable ASCII (0x20..0x7e) in [buf], returns
+ * the number of bytes consumed */
+size_t tsm_screen_write_ascii(struct tsm_screen *con, const uint8_t *buf,
+		size_t len, const struct tui_screen_attr *attr);
 int tsm_screen_newline(struct tsm_screen *con);
 int tsm_screen_scroll_up(struct tsm_screen *con, unsigned int num);
 int tsm_screen_scroll_down(struct tsm_screen *con, unsigned int num);
@@ -275,6 +289,15 @@ bool tsm_screen_save(struct tsm_screen* src, bool sb, struct tsm_save_buf**);
 bool tsm_screen_save_sub(struct tsm_screen* src,
 	struct tsm_save_buf** out, size_t x, size_t y, size_t w, size_t h);
 
+/* fill [iov] with the blocks of [buf] in the order of a snapshot so that it
+ * can be stored with a single writev, returns the number of entries used */
+size_t tsm_save_buf_iov(struct tsm_save_buf* buf, struct iovec iov[static 3]);
+
+/* set up [out] to refer to a snapshot stored contiguously in [buf], e.g. a
+ * mapped file written through _iov. The blocks alias [buf] and should not
+ * be freed */
+bool tsm_save_buf_map(struct tsm_save_buf* out, uint8_t* buf, size_t buf_sz);
+
 /* rebuild [dst] from the contents in [buf, buf_sz]. If the [dst] screen
  * size does not fit, contents will be cropped rather than wrapped. This
  * is safe to run multiple times with the same [dst] screen as a way of
@@ -94,18 +94,57 @@ struct cell {
 };
 
 struct line {
-	struct line *next;
-	struct line *prev;
-
 	unsigned int size;
 	struct cell *cells;
-	uint64_t sb_id;
 	tsm_age_t age;
 };
 
+/* scrollback store, see tsm_scrollback.c */
+
+struct tsm_sb;
+
+struct tsm_sb *tsm_sb_new(void);
+void tsm_sb_free(struct tsm_sb *sb);
+void tsm_sb_clear(struct tsm_sb *sb);
+size_t tsm_sb_count(struct tsm_sb *sb);
+size_t tsm_sb_footprint(struct tsm_sb *sb);
+
+/* append a line as the newest entry */
+bool tsm_sb_push(struct tsm_sb *sb, const struct cell *cells, unsigned int n);
+
+/* drop the oldest entry */
+void tsm_sb_pop(struct tsm_sb *sb);
+
+/* decode the entry [index] lines from the oldest, the returned cells stay
+ * valid until the next call into the store */
+struct cell *tsm_sb_get(struct tsm_sb *sb, size_t index, unsigned int *n);
+
+/* find [needle] in the entries from [index] towards older ones, or newer
+ * ones if [forward], with ASCII case folding if [fold]. On a match [index]
+ * is set to the entry and [col] to the cell the match starts at */
+bool tsm_sb_search(struct tsm_sb *sb, const uint32_t *needle, size_t n,
+	bool forward, bool fold, size_t *index, unsigned int *col);
+
+/* copy the records of all entries, oldest first, into a new buffer */
+bool tsm_sb_export(struct tsm_sb *sb, uint8_t **out, size_t *out_sz);
+
+/* append the records from an _export buffer after skipping the first
+ * [skip], stops at the first malformed record. Lines wider than [max_cells]
+ * (unless 0) are cut to that width. Returns the number added */
+size_t tsm_sb_import(struct tsm_sb *sb,
+	const uint8_t *buf, size_t buf_sz, size_t skip, unsigned int max_cells);
+
+/* columns [x1, x2) of a row that changed since the last draw */
+struct tsm_span {
+	unsigned int x1;
+	unsigned int x2;
+};
+
+/* [sb_id] is the scrollback line the position refers to, or 0 if it is on
+ * the screen at row [y] */
 #define SELECTION_TOP -1
 struct selection_pos {
-	struct line *line;
+	uint64_t sb_id;
 	unsigned int x;
 	int y;
 };
@@ -122,6 +161,14 @@ struct tsm_screen {
 	tsm_age_t age_cnt;
 	unsigned int age_reset : 1;
 
+	/* damage since the last draw, one bit per row and the span of changed
+	 * cells on that row. Anything that bumps [age] damages the whole screen */
+	uint64_t *dirty_rows;
+	struct tsm_span *dirty_span;
+	unsigned int dirty_cap;
+	bool dirty_all;
+	tsm_age_t drawn_age;
+
 	/* current buffer */
 	unsigned int size_x;
 	unsigned int size_y;
@@ -133,13 +180,15 @@ struct tsm_screen {
 	struct line **alt_lines;
 	tsm_age_t age;
 
-	/* scroll-back buffer */
+	/* scroll-back buffer, lines are identified by an id that increases
+	 * by one for each line pushed, so the oldest one has the id
+	 * sb_last_id - sb_count + 1 */
+	struct tsm_sb *sb;
 	unsigned int sb_count;		/* number of lines in sb */
-	struct line *sb_first;		/* first line; was moved first */
-	struct line *sb_last;		/* last line; was moved last*/
 	unsigned int sb_max;		/* max-limit of lines in sb */
-	struct line *sb_pos;		/* current position in sb or NULL */
+	uint64_t sb_pos;		/* id of the top line in view or 0 */
 	uint64_t sb_last_id;		/* last id given to sb-line */
+	struct line sb_line;		/* last line fetched from sb */
 
 	/* cursor */
 	unsigned int cursor_x;
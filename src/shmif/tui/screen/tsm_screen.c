@@ -98,6 +98,55 @@ void tsm_screen_inc_age(struct tsm_screen *con)
 	}
 }
 
+/*
+ * Track which rows and cells have changed since the last tsm_screen_draw so
+ * that it (and in turn the tpack/raster stages) only has to visit those. The
+ * functions that move or clear whole lines age the lines themselves rather
+ * than the screen, so that output that scrolls a region or clears the rest of
+ * a line doesn't force the entire screen to be redrawn.
+ */
+static void screen_damage(struct tsm_screen *con,
+	unsigned int y, unsigned int x1, unsigned int x2)
+{
+	if (con->dirty_all)
+		return;
+
+	if (y >= con->dirty_cap){
+		con->dirty_all = true;
+		return;
+	}
+
+	if (x2 > con->size_x)
+		x2 = con->size_x;
+	if (x1 >= x2)
+		return;
+
+	uint64_t bit = (uint64_t)1 << (y % 64);
+	struct tsm_span *span = &con->dirty_span[y];
+
+	if (!(con->dirty_rows[y / 64] & bit)){
+		con->dirty_rows[y / 64] |= bit;
+		span->x1 = x1;
+		span->x2 = x2;
+		return;
+	}
+
+	if (x1 < span->x1)
+		span->x1 = x1;
+	if (x2 > span->x2)
+		span->x2 = x2;
+}
+
+/* age and damage the rows [y1, y2] in full */
+static void screen_damage_lines(struct tsm_screen *con,
+	unsigned int y1, unsigned int y2)
+{
+	for (; y1 <= y2 && y1 < con->size_y; y1++){
+		con->lines[y1]->age = con->age_cnt;
+		screen_damage(con, y1, 0, con->size_x);
+	}
+}
+
 static struct cell *get_cursor_cell(struct tsm_screen *con)
 {
 	unsigned int cur_x, cur_y;
@@ -157,8 +206,6 @@ static int line_new(struct tsm_screen *con, struct line **out,
 	line = malloc(sizeof(*line));
 	if (!line)
 		return -ENOMEM;
-	line->next = NULL;
-	line->prev = NULL;
 	line->size = width;
 	line->age = con->age_cnt;
 
@@ -205,92 +252,110 @@ static int line_resize(struct tsm_screen *con, struct line *line,
 	return 0;
 }
 
-/* This links the given line into the scrollback-buffer */
-static void link_to_scrollback(struct tsm_screen *con, struct line *line)
+static uint64_t sb_first_id(struct tsm_screen *con)
 {
-	struct line *tmp;
+	return con->sb_last_id - con->sb_count + 1;
+}
 
-	con->age = con->age_cnt;
+/* decode a scrollback line into the shared scratch line, the result is only
+ * valid until the next fetch or change to the scrollback */
+static struct line *sb_fetch(struct tsm_screen *con, uint64_t id)
+{
+	if (!id || id > con->sb_last_id || id < sb_first_id(con))
+		return NULL;
 
-	if (con->sb_max == 0) {
-		if (con->sel_active) {
-			if (con->sel_start.line == line) {
-				con->sel_start.line = NULL;
-				con->sel_start.y = SELECTION_TOP;
-			}
-			if (con->sel_end.line == line) {
-				con->sel_end.line = NULL;
-				con->sel_end.y = SELECTION_TOP;
-			}
-		}
-		line_free(line);
+	struct cell *cells = tsm_sb_get(con->sb, id - sb_first_id(con),
+		&con->sb_line.size);
+	if (!cells)
+		return NULL;
+
+	for (size_t i = 0; i < con->sb_line.size; i++)
+		cells[i].age = con->age_cnt;
+
+	con->sb_line.cells = cells;
+	con->sb_line.age = con->age_cnt;
+	return &con->sb_line;
+}
+
+static void sb_unselect(struct tsm_screen *con, uint64_t id)
+{
+	if (!con->sel_active)
 		return;
+
+	if (con->sel_start.sb_id == id) {
+		con->sel_start.sb_id = 0;
+		con->sel_start.y = SELECTION_TOP;
+	}
+	if (con->sel_end.sb_id == id) {
+		con->sel_end.sb_id = 0;
+		con->sel_end.y = SELECTION_TOP;
 	}
+}
 
-	/* Remove a line from the scrollback buffer if it reaches its maximum.
-	 * We must take care to correctly keep the current position as the new
-	 * line is linked in after we remove the top-most line here.
-	 * sb_max == 0 is tested earlier so we can assume sb_max > 0 here. In
-	 * other words, buf->sb_first is a valid line if sb_count >= sb_max. */
-	if (con->sb_count >= con->sb_max) {
-		tmp = con->sb_first;
-		con->sb_first = tmp->next;
-		if (tmp->next)
-			tmp->next->prev = NULL;
-		else
-			con->sb_last = NULL;
-		--con->sb_count;
-
-		/* (position == tmp && !next) means we have sb_max=1 so set
-		 * position to the new line. Otherwise, set to new first line.
-		 * If position!=tmp and we have a fixed-position then nothing
-		 * needs to be done because we can stay at the same line. If we
-		 * have no fixed-position, we need to set the position to the
-		 * next inserted line, which can be "line", too. */
-		if (con->sb_pos) {
-			if (con->sb_pos == tmp ||
-			    !(con->flags & TSM_SCREEN_FIXED_POS)) {
-				if (con->sb_pos->next)
-					con->sb_pos = con->sb_pos->next;
-				else
-					con->sb_pos = line;
-			}
-		}
+/* drop the oldest line in the scrollback buffer, a view positioned there
+ * (or anywhere if it isn't [fixed]) moves to the next line, or to [tail] if
+ * there is none */
+static void sb_drop_first(struct tsm_screen *con, bool fixed, uint64_t tail)
+{
+	uint64_t id = sb_first_id(con);
 
-		if (con->sel_active) {
-			if (con->sel_start.line == tmp) {
-				con->sel_start.line = NULL;
-				con->sel_start.y = SELECTION_TOP;
-			}
-			if (con->sel_end.line == tmp) {
-				con->sel_end.line = NULL;
-				con->sel_end.y = SELECTION_TOP;
-			}
-		}
-		line_free(tmp);
+	tsm_sb_pop(con->sb);
+	con->sb_count--;
+
+	if (con->sb_pos && (con->sb_pos == id || !fixed))
+		con->sb_pos = con->sb_pos < con->sb_last_id ? con->sb_pos + 1 : tail;
+
+	sb_unselect(con, id);
+}
+
+/* This encodes the given line into the scrollback-buffer, the line itself
+ * stays with the caller */
+static void link_to_scrollback(struct tsm_screen *con, struct line *line)
+{
+/* the visible rows are damaged by the scrolling itself, the scrollback only
+ * shows when the view is moved there */
+	if (con->sb_pos)
+		con->age = con->age_cnt;
+
+	if (con->sb_max == 0)
+		return;
+
+	/* Remove a line from the scrollback buffer if it reaches its maximum.
+	 * If we have a fixed-position, the view stays at the same line unless
+	 * that is the one removed. Otherwise it follows the new line. */
+	if (con->sb_count >= con->sb_max)
+		sb_drop_first(con,
+			con->flags & TSM_SCREEN_FIXED_POS, con->sb_last_id + 1);
+
+	if (!tsm_sb_push(con->sb, line->cells, line->size)) {
+		if (con->sb_pos > con->sb_last_id)
+			con->sb_pos = 0;
+		return;
 	}
 
-	line->sb_id = ++con->sb_last_id;
-	line->next = NULL;
-	line->prev = con->sb_last;
-	if (con->sb_last)
-		con->sb_last->next = line;
-	else
-		con->sb_first = line;
-	con->sb_last = line;
+	++con->sb_last_id;
 	++con->sb_count;
 }
 
+/* map a selection that scrolled off the top of the screen, [y] rows above
+ * it, onto the scrollback line it was moved to */
+static void sb_select_scrolled(struct tsm_screen *con, struct selection_pos *pos)
+{
+	uint64_t steps = -(pos->y + 1);
+
+	pos->sb_id = 0;
+	if (con->sb_count && steps < con->sb_count)
+		pos->sb_id = con->sb_last_id - steps;
+	pos->y = SELECTION_TOP;
+}
+
 static int screen_scroll_up(struct tsm_screen *con, unsigned int num)
 {
 	unsigned int i, j, max, pos;
-	int ret;
 
 	if (!num)
 		return 0;
 
-	con->age = con->age_cnt;
-
 	max = con->margin_bottom + 1 - con->margin_top;
 	if (num > max)
 		num = max;
@@ -307,20 +372,16 @@ static int screen_scroll_up(struct tsm_screen *con, unsigned int num)
 	}
 	struct line *cache[num];
 
+/* the contents go to the scrollback in encoded form so the line itself can
+ * be recycled as a blank one at the bottom */
 	for (i = 0; i < num; ++i) {
 		pos = con->margin_top + i;
 		if (!(con->flags & TSM_SCREEN_ALTERNATE))
-			ret = line_new(con, &cache[i], con->size_x);
-		else
-			ret = -EAGAIN;
-
-		if (!ret) {
 			link_to_scrollback(con, con->lines[pos]);
-		} else {
-			cache[i] = con->lines[pos];
-			for (j = 0; j < con->size_x; ++j)
-				cell_init(con, &cache[i]->cells[j]);
-		}
+
+		cache[i] = con->lines[pos];
+		for (j = 0; j < con->size_x; ++j)
+			cell_init(con, &cache[i]->cells[j]);
 	}
 
 	if (num < max) {
@@ -332,24 +393,18 @@ static int screen_scroll_up(struct tsm_screen *con, unsigned int num)
 	memcpy(&con->lines[con->margin_top + (max - num)],
 	       cache, num * sizeof(struct line*));
 
+	screen_damage_lines(con, con->margin_top, con->margin_bottom);
+
 	if (con->sel_active) {
-		if (!con->sel_start.line && con->sel_start.y >= 0) {
+		if (!con->sel_start.sb_id && con->sel_start.y >= 0) {
 			con->sel_start.y -= num;
-			if (con->sel_start.y < 0) {
-				con->sel_start.line = con->sb_last;
-				while (con->sel_start.line && ++con->sel_start.y < 0)
-					con->sel_start.line = con->sel_start.line->prev;
-				con->sel_start.y = SELECTION_TOP;
-			}
+			if (con->sel_start.y < 0)
+				sb_select_scrolled(con, &con->sel_start);
 		}
-		if (!con->sel_end.line && con->sel_end.y >= 0) {
+		if (!con->sel_end.sb_id && con->sel_end.y >= 0) {
 			con->sel_end.y -= num;
-			if (con->sel_end.y < 0) {
-				con->sel_end.line = con->sb_last;
-				while (con->sel_end.line && ++con->sel_end.y < 0)
-					con->sel_end.line = con->sel_end.line->prev;
-				con->sel_end.y = SELECTION_TOP;
-			}
+			if (con->sel_end.y < 0)
+				sb_select_scrolled(con, &con->sel_end);
 		}
 	}
 	return num;
@@ -362,8 +417,6 @@ static int screen_scroll_down(struct tsm_screen *con, unsigned int num)
 	if (!num)
 		return 0;
 
-	con->age = con->age_cnt;
-
 	max = con->margin_bottom + 1 - con->margin_top;
 	if (num > max)
 		num = max;
@@ -391,10 +444,12 @@ static int screen_scroll_down(struct tsm_screen *con, unsigned int num)
 	memcpy(&con->lines[con->margin_top],
 	       cache, num * sizeof(struct line*));
 
+	screen_damage_lines(con, con->margin_top, con->margin_bottom);
+
 	if (con->sel_active) {
-		if (!con->sel_start.line && con->sel_start.y >= 0)
+		if (!con->sel_start.sb_id && con->sel_start.y >= 0)
 			con->sel_start.y += num;
-		if (!con->sel_end.line && con->sel_end.y >= 0)
+		if (!con->sel_end.sb_id && con->sel_end.y >= 0)
 			con->sel_end.y += num;
 	}
 	return num;
@@ -421,6 +476,7 @@ static void screen_write(struct tsm_screen *con, unsigned int x,
 		line->age = con->age_cnt;
 		memmove(&line->cells[x + len], &line->cells[x],
 			sizeof(struct cell) * (con->size_x - len - x));
+		screen_damage(con, y, x, con->size_x);
 	}
 
 	line->cells[x].age = con->age_cnt;
@@ -432,6 +488,8 @@ static void screen_write(struct tsm_screen *con, unsigned int x,
 		line->cells[x + i].age = con->age_cnt;
 		line->cells[x + i].width = 0;
 	}
+
+	screen_damage(con, y, x, x + len);
 }
 
 void tsm_screen_erase_region(struct tsm_screen *con,
@@ -444,8 +502,8 @@ void tsm_screen_erase_region(struct tsm_screen *con,
 	unsigned int to;
 	struct line *line;
 
+/* only the cells that actually change are aged, see cell_init_chg */
 	inc_age(con);
-	con->age = con->age_cnt;
 
 	if (y_to >= con->size_y)
 		y_to = con->size_y - 1;
@@ -463,6 +521,8 @@ void tsm_screen_erase_region(struct tsm_screen *con,
 			to = x_to;
 		else
 			to = con->size_x - 1;
+
+		screen_damage(con, y_from, x_from, to + 1);
 		for ( ; x_from <= to; ++x_from) {
 			if (protect && TUI_HAS_ATTR(line->cells[x_from].attr, TUI_ATTR_PROTECT))
 				continue;
@@ -512,6 +572,12 @@ int tsm_screen_new(struct tsm_screen **out, tsm_log_t log, void *log_data)
 	if (ret)
 		goto err_free;
 
+	con->sb = tsm_sb_new();
+	if (!con->sb) {
+		ret = -ENOMEM;
+		goto err_free;
+	}
+
 	ret = tsm_screen_resize(con, 80, 24);
 	if (ret)
 		goto err_free;
@@ -528,6 +594,9 @@ err_free:
 	free(con->main_lines);
 	free(con->alt_lines);
 	free(con->tab_ruler);
+	free(con->dirty_rows);
+	free(con->dirty_span);
+	tsm_sb_free(con->sb);
 	tsm_symbol_table_unref(con->sym_table);
 	free(con);
 	return ret;
@@ -550,8 +619,6 @@ void tsm_screen_unref(struct tsm_screen *con)
 	if (!con || !con->ref || --con->ref)
 		return;
 
-	tsm_screen_clear_sb(con);
-
 	for (i = 0; i < con->line_num; ++i) {
 		line_free(con->main_lines[i]);
 		line_free(con->alt_lines[i]);
@@ -559,6 +626,9 @@ void tsm_screen_unref(struct tsm_screen *con)
 	free(con->main_lines);
 	free(con->alt_lines);
 	free(con->tab_ruler);
+	free(con->dirty_rows);
+	free(con->dirty_span);
+	tsm_sb_free(con->sb);
 	tsm_symbol_table_unref(con->sym_table);
 	free(con);
 }
@@ -598,6 +668,25 @@ int tsm_screen_resize(
 	if (con->size_x == x && con->size_y == y)
 		return 0;
 
+	if (y > con->dirty_cap){
+		uint64_t *rows =
+			realloc(con->dirty_rows, sizeof(uint64_t) * ((y + 63) / 64));
+		if (!rows)
+			return -ENOMEM;
+		con->dirty_rows = rows;
+
+		struct tsm_span *span =
+			realloc(con->dirty_span, sizeof(struct tsm_span) * y);
+		if (!span)
+			return -ENOMEM;
+		con->dirty_span = span;
+		con->dirty_cap = y;
+	}
+
+/* the consumer will have to reallocate and redraw its buffers as well */
+	con->dirty_all = true;
+	con->age = con->age_cnt;
+
 	/* First make sure the line buffer is big enough for our new screen.
 	 * That is, allocate all new lines and make sure each line has enough
 	 * cells to hold the new screen or the current screen. If we fail, we
@@ -777,46 +866,13 @@ int tsm_screen_get_word(struct tsm_screen *con,
 	if (!ascii_test(con, wl->cells[*sx].ch))
 		return -EINVAL;
 
-/* scan left */
-	for(;;){
-		int tx = *sx;
-/* wrap around back */
-		if (tx == 0){
-			wl = wl->prev;
-			if (!wl || !ascii_test(con, wl->cells[wl->size-1].ch))
-				break;
-
-			*sy--;
-			*sx = wl->size - 1;
-			continue;
-		}
-		else{
-			tx = tx - 1;
-			if (!ascii_test(con, wl->cells[tx].ch))
-				break;
-			*sx = tx;
-		}
-	}
+/* scan left, words do not wrap across rows */
+	while (*sx > 0 && ascii_test(con, wl->cells[*sx - 1].ch))
+		(*sx)--;
 
-	wl = cur;
 /* scan right */
-	for(;;){
-		int tx = *ex;
-		if (tx == wl->size-1){
-			wl = wl->next;
-			if (!wl || !ascii_test(con, wl->cells[0].ch))
-				break;
-
-			*ey++;
-			*ex = 0;
-		}
-		else{
-			tx = tx+1;
-			if (!ascii_test(con, wl->cells[tx].ch))
-				break;
-			*ex = tx;
-		}
-	}
+	while (*ex + 1 < wl->size && ascii_test(con, wl->cells[*ex + 1].ch))
+		(*ex)++;
 
 	return (*sx != *ex || *sy != *ey) ? 0 : -EINVAL;
 }
@@ -856,40 +912,16 @@ SHL_EXPORT
 void tsm_screen_set_max_sb(struct tsm_screen *con,
 			       unsigned int max)
 {
-	struct line *line;
-
 	if (!con)
 		return;
 
 	inc_age(con);
 	con->age = con->age_cnt;
 
-	while (con->sb_count > max) {
-		line = con->sb_first;
-		con->sb_first = line->next;
-		if (line->next)
-			line->next->prev = NULL;
-		else
-			con->sb_last = NULL;
-		con->sb_count--;
-
-		/* We treat fixed/unfixed position the same here because we
-		 * remove lines from the TOP of the scrollback buffer. */
-		if (con->sb_pos == line)
-			con->sb_pos = con->sb_first;
-
-		if (con->sel_active) {
-			if (con->sel_start.line == line) {
-				con->sel_start.line = NULL;
-				con->sel_start.y = SELECTION_TOP;
-			}
-			if (con->sel_end.line == line) {
-				con->sel_end.line = NULL;
-				con->sel_end.y = SELECTION_TOP;
-			}
-		}
-		line_free(line);
-	}
+	/* We treat fixed/unfixed position the same here because we
+	 * remove lines from the TOP of the scrollback buffer. */
+	while (con->sb_count > max)
+		sb_drop_first(con, true, 0);
 
 	con->sb_max = max;
 }
@@ -898,32 +930,23 @@ void tsm_screen_set_max_sb(struct tsm_screen *con,
 SHL_EXPORT
 void tsm_screen_clear_sb(struct tsm_screen *con)
 {
-	struct line *iter, *tmp;
-
 	if (!con)
 		return;
 
 	inc_age(con);
 	con->age = con->age_cnt;
 
-	for (iter = con->sb_first; iter; ) {
-		tmp = iter;
-		iter = iter->next;
-		line_free(tmp);
-	}
-
-	con->sb_first = NULL;
-	con->sb_last = NULL;
+	tsm_sb_clear(con->sb);
 	con->sb_count = 0;
-	con->sb_pos = NULL;
+	con->sb_pos = 0;
 
 	if (con->sel_active) {
-		if (con->sel_start.line) {
-			con->sel_start.line = NULL;
+		if (con->sel_start.sb_id) {
+			con->sel_start.sb_id = 0;
 			con->sel_start.y = SELECTION_TOP;
 		}
-		if (con->sel_end.line) {
-			con->sel_end.line = NULL;
+		if (con->sel_end.sb_id) {
+			con->sel_end.sb_id = 0;
 			con->sel_end.y = SELECTION_TOP;
 		}
 	}
@@ -941,14 +964,14 @@ int tsm_screen_sb_up(struct tsm_screen *con, unsigned int num)
 
 	while (num2--) {
 		if (con->sb_pos) {
-			if (!con->sb_pos->prev)
+			if (con->sb_pos == sb_first_id(con))
 				return 0;
 
-			con->sb_pos = con->sb_pos->prev;
-		} else if (!con->sb_last) {
+			con->sb_pos--;
+		} else if (!con->sb_count) {
 			return -(num - num2);
 		} else {
-			con->sb_pos = con->sb_last;
+			con->sb_pos = con->sb_last_id;
 		}
 	}
 	return -num;
@@ -966,7 +989,7 @@ int tsm_screen_sb_down(struct tsm_screen *con, unsigned int num)
 
 	while (num2--) {
 		if (con->sb_pos)
-			con->sb_pos = con->sb_pos->next;
+			con->sb_pos = con->sb_pos < con->sb_last_id ? con->sb_pos + 1 : 0;
 		else
 			return (num - num2);
 	}
@@ -993,6 +1016,42 @@ int tsm_screen_sb_page_down(struct tsm_screen *con, unsigned int num)
 	return tsm_screen_sb_down(con, num * con->size_y);
 }
 
+SHL_EXPORT
+int tsm_screen_sb_search(struct tsm_screen *con, const uint32_t *needle,
+	size_t n, bool forward, bool fold, unsigned int *col)
+{
+	if (!con || !needle || !n)
+		return -EINVAL;
+
+/* continue from the line at the top of the view, or from the newest line
+ * if the view is not in the scrollback */
+	size_t index;
+	if (forward) {
+		if (!con->sb_pos)
+			return -ENOENT;
+		index = con->sb_pos - sb_first_id(con) + 1;
+	}
+	else {
+		index = con->sb_pos ? con->sb_pos - sb_first_id(con) : con->sb_count;
+		if (!index)
+			return -ENOENT;
+		index--;
+	}
+
+	unsigned int x;
+	if (!tsm_sb_search(con->sb, needle, n, forward, fold, &index, &x))
+		return -ENOENT;
+
+	inc_age(con);
+	con->age = con->age_cnt;
+	con->sb_pos = sb_first_id(con) + index;
+
+	if (col)
+		*col = x;
+
+	return 0;
+}
+
 SHL_EXPORT
 void tsm_screen_sb_reset(struct tsm_screen *con)
 {
@@ -1002,7 +1061,7 @@ void tsm_screen_sb_reset(struct tsm_screen *con)
 	inc_age(con);
 	con->age = con->age_cnt;
 
-	con->sb_pos = NULL;
+	con->sb_pos = 0;
 }
 
 SHL_EXPORT
@@ -1190,19 +1249,89 @@ int tsm_screen_write(struct tsm_screen *con, tsm_symbol_t ch,
 	return rv;
 }
 
+/*
+ * Same as repeated tsm_screen_write calls, but the part of the run that fits
+ * on the current line is stored directly into the cells with a single age and
+ * damage update. Wrapping, scrolling and insert mode are left to the regular
+ * path one character at a time.
+ */
+SHL_EXPORT
+size_t tsm_screen_write_ascii(struct tsm_screen *con, const uint8_t *buf,
+			  size_t len, const struct tui_screen_attr *attr)
+{
+	size_t pos = 0;
+
+	if (!con || !buf)
+		return 0;
+
+	if (!attr)
+		attr = &con->def_attr;
+
+	while (pos < len && buf[pos] >= 0x20 && buf[pos] < 0x7f) {
+		if (con->cursor_x >= con->size_x ||
+		    con->cursor_y >= con->size_y ||
+		    (con->flags & TSM_SCREEN_INSERT_MODE)) {
+			tsm_screen_write(con, buf[pos++], attr);
+			continue;
+		}
+
+		inc_age(con);
+
+		struct line *line = con->lines[con->cursor_y];
+		unsigned int x = con->cursor_x;
+
+		for (; pos < len && x < con->size_x; pos++, x++) {
+			uint8_t ch = buf[pos];
+			if (ch < 0x20 || ch >= 0x7f)
+				break;
+
+			line->cells[x] = (struct cell){
+				.ch = ch,
+				.width = 1,
+				.attr = *attr,
+				.age = con->age_cnt
+			};
+		}
+
+		screen_damage(con, con->cursor_y, con->cursor_x, x);
+		move_cursor(con, x, con->cursor_y);
+	}
+
+	return pos;
+}
+
+/*
+ * Snapshot layout, the metadata block is followed by the screen block and
+ * then the scrollback block. Nothing refers to memory addresses so the three
+ * can be written out back to back with a single writev and used again from
+ * a mapping of that file, see tsm_save_buf_iov / tsm_save_buf_map.
+ *
+ * screen: rows * columns struct cell, the same layout as the live lines
+ * scrollback: the records as kept by the scrollback store, oldest first
+ */
+#define EXPORT_VERSION 1
+
 struct export_metadata {
 	uint8_t magic[4];
+	uint16_t version;
+	uint16_t cell_sz;
 	uint32_t sb_count;
 	uint16_t columns, rows;
 	uint16_t margin_top;
 	uint16_t margin_bottom;
+	uint16_t cursor_x, cursor_y;
 	uint32_t flags;
+	uint64_t screen_sz;
+	uint64_t scrollback_sz;
 };
 
-struct export_cell {
-	struct tui_screen_attr attr;
-	uint32_t ch;
-};
+static void drop_save_buf(struct tsm_save_buf *buf)
+{
+	free(buf->metadata);
+	free(buf->scrollback);
+	free(buf->screen);
+	free(buf);
+}
 
 SHL_EXPORT
 bool tsm_screen_save(struct tsm_screen* src, bool sb, struct tsm_save_buf** out)
@@ -1219,15 +1348,24 @@ bool tsm_screen_save(struct tsm_screen* src, bool sb, struct tsm_save_buf** out)
 /* take the buffer, complement with scrollback and more metadata */
 	md->margin_top = src->margin_top;
 	md->margin_bottom = src->margin_bottom;
+	md->cursor_x = src->cursor_x;
+	md->cursor_y = src->cursor_y;
 	md->flags = src->flags;
 
 /* missing:
  * tab-ruler, selection state (likely uninteresting)
  */
 
-	if (sb){
-/* sb_count, sb_first, sb_last, sb_max, sb_pos, sb_last_id */
-		fprintf(stderr, "scrollback save/restore missing\n");
+/* the store is already compact, so the records are taken as they are */
+	if (sb && src->sb_count){
+		if (!tsm_sb_export(src->sb, &(*out)->scrollback, &(*out)->scrollback_sz)){
+			drop_save_buf(*out);
+			*out = NULL;
+			return false;
+		}
+
+		md->sb_count = src->sb_count;
+		md->scrollback_sz = (*out)->scrollback_sz;
 	}
 
 	return true;
@@ -1237,6 +1375,9 @@ SHL_EXPORT
 bool tsm_screen_save_sub(struct tsm_screen* src,
 	struct tsm_save_buf** out, size_t x, size_t y, size_t w, size_t h)
 {
+	if (!src || !out)
+		return false;
+
 	if (x > src->size_x || x+w > src->size_x)
 		return false;
 
@@ -1244,53 +1385,122 @@ bool tsm_screen_save_sub(struct tsm_screen* src,
 		return false;
 
 	struct tsm_save_buf* buf = malloc(sizeof(struct tsm_save_buf));
+	if (!buf)
+		return false;
+
 	*buf = (struct tsm_save_buf){0};
 	buf->metadata_sz = sizeof(struct export_metadata);
+	buf->screen_sz = sizeof(struct cell) * w * h;
 
 	struct export_metadata* md = malloc(buf->metadata_sz);
 	buf->metadata = (uint8_t*) md;
+	buf->screen = malloc(buf->screen_sz ? buf->screen_sz : 1);
+
+	if (!md || !buf->screen){
+		drop_save_buf(buf);
+		return false;
+	}
+
 	*md = (struct export_metadata){
 		.magic = {'a', 't', 'u', 'i'},
+		.version = EXPORT_VERSION,
+		.cell_sz = sizeof(struct cell),
 		.columns = w,
-		.rows = h
+		.rows = h,
+		.screen_sz = buf->screen_sz
 	};
 
-	buf->screen_sz = sizeof(struct export_cell) * w * h;
-	buf->screen = malloc(buf->screen_sz);
-	size_t ofs = 0;
-
 /* the _resize call makes sure that lines actually fit the current size */
-	for (size_t row = y; row < h; row++)
-		for (size_t col = x; col < w; col++, ofs++){
-			struct export_cell cell = {
-				.attr = src->lines[row]->cells[col].attr,
-				.ch = src->lines[row]->cells[col].ch
-			};
-
-			memcpy(
-			&buf->screen[ofs * sizeof(struct export_cell)],
-				&cell,
-				sizeof(struct export_cell)
-			);
-		}
+	for (size_t row = 0; row < h; row++)
+		memcpy(&buf->screen[row * w * sizeof(struct cell)],
+			&src->lines[y + row]->cells[x], w * sizeof(struct cell));
 
 	*out = buf;
 	return true;
 }
 
+SHL_EXPORT
+size_t tsm_save_buf_iov(struct tsm_save_buf* buf, struct iovec iov[static 3])
+{
+	if (!buf)
+		return 0;
+
+	iov[0] = (struct iovec){
+		.iov_base = buf->metadata, .iov_len = buf->metadata_sz
+	};
+	iov[1] = (struct iovec){
+		.iov_base = buf->screen, .iov_len = buf->screen_sz
+	};
+	iov[2] = (struct iovec){
+		.iov_base = buf->scrollback, .iov_len = buf->scrollback_sz
+	};
+
+	return buf->scrollback_sz ? 3 : 2;
+}
+
+SHL_EXPORT
+bool tsm_save_buf_map(struct tsm_save_buf* out, uint8_t* buf, size_t buf_sz)
+{
+	struct export_metadata md;
+	if (!out || !buf || buf_sz < sizeof(struct export_metadata))
+		return false;
+
+	memcpy(&md, buf, sizeof(struct export_metadata));
+	size_t left = buf_sz - sizeof(struct export_metadata);
+
+	if (md.screen_sz > left || md.scrollback_sz > left - md.screen_sz)
+		return false;
+
+	*out = (struct tsm_save_buf){
+		.metadata = buf,
+		.metadata_sz = sizeof(struct export_metadata),
+		.screen = &buf[sizeof(struct export_metadata)],
+		.screen_sz = md.screen_sz,
+		.scrollback = md.scrollback_sz ?
+			&buf[sizeof(struct export_metadata) + md.screen_sz] : NULL,
+		.scrollback_sz = md.scrollback_sz
+	};
+
+	return true;
+}
+
+/* replace the scrollback with the records in [buf], keeping at most the
+ * newest sb_max of them, cut to the width of the screen */
+static void sb_load(struct tsm_screen *con,
+	const uint8_t *buf, size_t buf_sz, size_t count)
+{
+	tsm_screen_clear_sb(con);
+	if (!con->sb_max)
+		return;
+
+	size_t skip = count > con->sb_max ? count - con->sb_max : 0;
+	size_t n = tsm_sb_import(con->sb, buf, buf_sz, skip, con->size_x);
+
+	con->sb_count += n;
+	con->sb_last_id += n;
+}
+
 SHL_EXPORT
 bool tsm_screen_load(struct tsm_screen* dst,
 	struct tsm_save_buf* in, size_t start_x, size_t start_y, int mode)
 {
 	struct export_metadata md;
-	if (in->metadata_sz != sizeof(struct export_metadata))
+	if (!dst || !in || in->metadata_sz != sizeof(struct export_metadata))
 		return false;
 
 	memcpy(&md, in->metadata, sizeof(struct export_metadata));
 
 	if (!in->screen ||
 		md.magic[0] != 'a' || md.magic[1] != 't' ||
-		md.magic[2] != 'u' || md.magic[3] != 'i')
+		md.magic[2] != 'u' || md.magic[3] != 'i' ||
+		md.version != EXPORT_VERSION || md.cell_sz != sizeof(struct cell))
+		return false;
+
+	size_t csz = sizeof(struct cell);
+	if (in->screen_sz < (size_t) md.rows * md.columns * csz)
+		return false;
+
+	if (md.scrollback_sz && (!in->scrollback || in->scrollback_sz < md.scrollback_sz))
 		return false;
 
 	if (mode & TSM_LOAD_RESIZE){
@@ -1300,28 +1510,61 @@ bool tsm_screen_load(struct tsm_screen* dst,
 		tsm_screen_erase_screen(dst, false);
 	}
 
-	size_t csz = sizeof(struct export_cell);
 	if (mode & TSM_LOAD_APPEND){
 		tsm_screen_move_to(dst, start_x, start_y);
 		for (size_t pos = 0; pos < md.rows * md.columns * csz; pos += csz){
-			struct export_cell unp;
+			struct cell unp;
 			memcpy(&unp, &in->screen[pos], csz);
 			tsm_screen_write(dst, unp.ch, &unp.attr);
 		}
 		tsm_screen_move_to(dst, start_x, start_y+md.rows+1);
+		return true;
 	}
-	else{
-/* replace screen contents with as much as possible */
-		for (size_t y = start_y; y < dst->size_y && y - start_y < md.rows; y++)
-			for (size_t x = start_x; x < dst->size_x && x - start_x < md.columns;x++){
-				struct export_cell unp;
-				memcpy(&unp, &in->screen[ csz *
-					((y-start_y) * md.columns + (x-start_x))], csz);
-				tsm_screen_move_to(dst, x, y);
-				tsm_screen_write(dst, unp.ch, &unp.attr);
-		}
+
+/* replace screen contents with as much as possible, the cells have the live
+ * layout so each row is a single copy */
+	inc_age(dst);
+	size_t last_y = start_y;
+
+	for (size_t y = start_y; y < dst->size_y && y - start_y < md.rows; y++){
+		if (start_x >= dst->size_x)
+			break;
+
+		size_t n = dst->size_x - start_x;
+		if (n > md.columns)
+			n = md.columns;
+
+		struct cell *cells = &dst->lines[y]->cells[start_x];
+		memcpy(cells, &in->screen[csz * (y - start_y) * md.columns], n * csz);
+
+		for (size_t x = 0; x < n; x++)
+			cells[x].age = dst->age_cnt;
+		last_y = y;
+	}
+
+	if (md.rows)
+		screen_damage_lines(dst, start_y, last_y);
+
+/* a cursor saved past the last column is a pending wrap, that only holds if
+ * the restored right edge is the edge of the screen, otherwise clamp */
+	if (dst->size_x && dst->size_y){
+		size_t cx = start_x + md.cursor_x;
+		size_t cy = start_y + md.cursor_y;
+
+		if (md.cursor_x >= md.columns && cx >= dst->size_x)
+			cx = dst->size_x;
+		else if (cx >= dst->size_x)
+			cx = dst->size_x - 1;
+
+		if (cy >= dst->size_y)
+			cy = dst->size_y - 1;
+
+		move_cursor(dst, cx, cy);
 	}
 
+	if (md.scrollback_sz)
+		sb_load(dst, in->scrollback, md.scrollback_sz, md.sb_count);
+
 	return true;
 }
 
@@ -1583,7 +1826,6 @@ void tsm_screen_insert_lines(struct tsm_screen *con, unsigned int num)
 		return;
 
 	inc_age(con);
-	con->age = con->age_cnt;
 
 	max = con->margin_bottom - con->cursor_y + 1;
 	if (num > max)
@@ -1606,6 +1848,7 @@ void tsm_screen_insert_lines(struct tsm_screen *con, unsigned int num)
 		       cache, num * sizeof(struct line*));
 	}
 
+	screen_damage_lines(con, con->cursor_y, con->margin_bottom);
 	con->cursor_x = 0;
 }
 
@@ -1622,7 +1865,6 @@ void tsm_screen_delete_lines(struct tsm_screen *con, unsigned int num)
 		return;
 
 	inc_age(con);
-	con->age = con->age_cnt;
 
 	max = con->margin_bottom - con->cursor_y + 1;
 	if (num > max)
@@ -1645,6 +1887,7 @@ void tsm_screen_delete_lines(struct tsm_screen *con, unsigned int num)
 		       cache, num * sizeof(struct line*));
 	}
 
+	screen_damage_lines(con, con->cursor_y, con->margin_bottom);
 	con->cursor_x = 0;
 }
 
@@ -1658,7 +1901,6 @@ void tsm_screen_insert_chars(struct tsm_screen *con, unsigned int num)
 		return;
 
 	inc_age(con);
-	con->age = con->age_cnt;
 
 	if (con->cursor_x >= con->size_x)
 		con->cursor_x = con->size_x - 1;
@@ -1678,6 +1920,9 @@ void tsm_screen_insert_chars(struct tsm_screen *con, unsigned int num)
 
 	for (i = 0; i < num; ++i)
 		cell_init(con, &cells[con->cursor_x + i]);
+
+	con->lines[con->cursor_y]->age = con->age_cnt;
+	screen_damage(con, con->cursor_y, con->cursor_x, con->size_x);
 }
 
 SHL_EXPORT
@@ -1690,7 +1935,6 @@ void tsm_screen_delete_chars(struct tsm_screen *con, unsigned int num)
 		return;
 
 	inc_age(con);
-	con->age = con->age_cnt;
 
 	if (con->cursor_x >= con->size_x)
 		con->cursor_x = con->size_x - 1;
@@ -1710,6 +1954,9 @@ void tsm_screen_delete_chars(struct tsm_screen *con, unsigned int num)
 
 	for (i = 0; i < num; ++i)
 		cell_init(con, &cells[con->cursor_x + mv + i]);
+
+	con->lines[con->cursor_y]->age = con->age_cnt;
+	screen_damage(con, con->cursor_y, con->cursor_x, con->size_x);
 }
 
 SHL_EXPORT
@@ -1852,19 +2099,14 @@ void tsm_screen_erase_screen(struct tsm_screen *con, bool protect)
 static void selection_set(struct tsm_screen *con, struct selection_pos *sel,
 			  unsigned int x, unsigned int y)
 {
-	struct line *pos;
-
-	sel->line = NULL;
-	pos = con->sb_pos;
+	uint64_t pos = con->sb_pos;
 
 	while (y && pos) {
 		--y;
-		pos = pos->next;
+		pos = pos < con->sb_last_id ? pos + 1 : 0;
 	}
 
-	if (pos)
-		sel->line = pos;
-
+	sel->sb_id = pos;
 	sel->x = x;
 	sel->y = y;
 }
@@ -1949,6 +2191,7 @@ int tsm_screen_selection_copy(struct tsm_screen *con, char **out, bool conv)
 	unsigned int len, i;
 	struct selection_pos *start, *end;
 	struct line *iter;
+	uint64_t id;
 	char *str, *pos;
 
 	if (!con || !out)
@@ -1958,8 +2201,8 @@ int tsm_screen_selection_copy(struct tsm_screen *con, char **out, bool conv)
 		return -ENOENT;
 
 	/* check whether sel_start or sel_end comes first */
-	if (!con->sel_start.line && con->sel_start.y == SELECTION_TOP) {
-		if (!con->sel_end.line && con->sel_end.y == SELECTION_TOP) {
+	if (!con->sel_start.sb_id && con->sel_start.y == SELECTION_TOP) {
+		if (!con->sel_end.sb_id && con->sel_end.y == SELECTION_TOP) {
 			str = strdup("");
 			if (!str)
 				return -ENOMEM;
@@ -1968,14 +2211,14 @@ int tsm_screen_selection_copy(struct tsm_screen *con, char **out, bool conv)
 		}
 		start = &con->sel_start;
 		end = &con->sel_end;
-	} else if (!con->sel_end.line && con->sel_end.y == SELECTION_TOP) {
+	} else if (!con->sel_end.sb_id && con->sel_end.y == SELECTION_TOP) {
 		start = &con->sel_end;
 		end = &con->sel_start;
-	} else if (con->sel_start.line && con->sel_end.line) {
-		if (con->sel_start.line->sb_id < con->sel_end.line->sb_id) {
+	} else if (con->sel_start.sb_id && con->sel_end.sb_id) {
+		if (con->sel_start.sb_id < con->sel_end.sb_id) {
 			start = &con->sel_start;
 			end = &con->sel_end;
-		} else if (con->sel_start.line->sb_id > con->sel_end.line->sb_id) {
+		} else if (con->sel_start.sb_id > con->sel_end.sb_id) {
 			start = &con->sel_end;
 			end = &con->sel_start;
 		} else if (con->sel_start.x < con->sel_end.x) {
@@ -1985,10 +2228,10 @@ int tsm_screen_selection_copy(struct tsm_screen *con, char **out, bool conv)
 			start = &con->sel_end;
 			end = &con->sel_start;
 		}
-	} else if (con->sel_start.line) {
+	} else if (con->sel_start.sb_id) {
 		start = &con->sel_start;
 		end = &con->sel_end;
-	} else if (con->sel_end.line) {
+	} else if (con->sel_end.sb_id) {
 		start = &con->sel_end;
 		end = &con->sel_start;
 	} else if (con->sel_start.y < con->sel_end.y) {
@@ -2007,12 +2250,12 @@ int tsm_screen_selection_copy(struct tsm_screen *con, char **out, bool conv)
 
 	/* calculate size of buffer */
 	len = 0;
-	iter = start->line;
-	if (!iter && start->y == SELECTION_TOP)
-		iter = con->sb_first;
+	id = start->sb_id;
+	if (!id && start->y == SELECTION_TOP)
+		id = sb_first_id(con);
 
-	while (iter) {
-		if (iter == start->line && iter == end->line) {
+	for (; id && (iter = sb_fetch(con, id)); id++) {
+		if (id == start->sb_id && id == end->sb_id) {
 			if (iter->size > start->x) {
 				if (iter->size > end->x)
 					len += end->x - start->x + 1;
@@ -2020,10 +2263,10 @@ int tsm_screen_selection_copy(struct tsm_screen *con, char **out, bool conv)
 					len += iter->size - start->x;
 			}
 			break;
-		} else if (iter == start->line) {
+		} else if (id == start->sb_id) {
 			if (iter->size > start->x)
 				len += iter->size - start->x;
-		} else if (iter == end->line) {
+		} else if (id == end->sb_id) {
 			if (iter->size > end->x)
 				len += end->x + 1;
 			else
@@ -2034,16 +2277,15 @@ int tsm_screen_selection_copy(struct tsm_screen *con, char **out, bool conv)
 		}
 
 		++len;
-		iter = iter->next;
 	}
 
-	if (!end->line) {
-		if (start->line || start->y == SELECTION_TOP)
+	if (!end->sb_id) {
+		if (start->sb_id || start->y == SELECTION_TOP)
 			i = 0;
 		else
 			i = start->y;
 		for ( ; i < con->size_y; ++i) {
-			if (!start->line && start->y == i && end->y == i) {
+			if (!start->sb_id && start->y == i && end->y == i) {
 				if (con->size_x > start->x) {
 					if (con->size_x > end->x)
 						len += end->x - start->x + 1;
@@ -2051,7 +2293,7 @@ int tsm_screen_selection_copy(struct tsm_screen *con, char **out, bool conv)
 						len += con->size_x - start->x;
 				}
 				break;
-			} else if (!start->line && start->y == i) {
+			} else if (!start->sb_id && start->y == i) {
 				if (con->size_x > start->x)
 					len += con->size_x - start->x;
 			} else if (end->y == i) {
@@ -2077,12 +2319,12 @@ int tsm_screen_selection_copy(struct tsm_screen *con, char **out, bool conv)
 	pos = str;
 
 	/* copy data into buffer */
-	iter = start->line;
-	if (!iter && start->y == SELECTION_TOP)
-		iter = con->sb_first;
+	id = start->sb_id;
+	if (!id && start->y == SELECTION_TOP)
+		id = sb_first_id(con);
 
-	while (iter) {
-		if (iter == start->line && iter == end->line) {
+	for (; id && (iter = sb_fetch(con, id)); id++) {
+		if (id == start->sb_id && id == end->sb_id) {
 			if (iter->size > start->x) {
 				if (iter->size > end->x)
 					len = end->x - start->x + 1;
@@ -2091,11 +2333,11 @@ int tsm_screen_selection_copy(struct tsm_screen *con, char **out, bool conv)
 				pos += copy_line(iter, pos, start->x, len, conv);
 			}
 			break;
-		} else if (iter == start->line) {
+		} else if (id == start->sb_id) {
 			if (iter->size > start->x)
 				pos += copy_line(iter, pos, start->x,
 						 iter->size - start->x, conv);
-		} else if (iter == end->line) {
+		} else if (id == end->sb_id) {
 			if (iter->size > end->x)
 				len = end->x + 1;
 			else
@@ -2114,17 +2356,16 @@ int tsm_screen_selection_copy(struct tsm_screen *con, char **out, bool conv)
 			memcpy(pos, &ch, 4);
 			pos += 4;
 		}
-		iter = iter->next;
 	}
 
-	if (!end->line) {
-		if (start->line || start->y == SELECTION_TOP)
+	if (!end->sb_id) {
+		if (start->sb_id || start->y == SELECTION_TOP)
 			i = 0;
 		else
 			i = start->y;
 		for ( ; i < con->size_y; ++i) {
 			iter = con->lines[i];
-			if (!start->line && start->y == i && end->y == i) {
+			if (!start->sb_id && start->y == i && end->y == i) {
 				if (con->size_x > start->x) {
 					if (con->size_x > end->x)
 						len = end->x - start->x + 1;
@@ -2133,7 +2374,7 @@ int tsm_screen_selection_copy(struct tsm_screen *con, char **out, bool conv)
 					pos += copy_line(iter, pos, start->x, len, conv);
 				}
 				break;
-			} else if (!start->line && start->y == i) {
+			} else if (!start->sb_id && start->y == i) {
 				if (con->size_x > start->x)
 					pos += copy_line(iter, pos, start->x,
 							 con->size_x - start->x, conv);
@@ -2165,62 +2406,132 @@ int tsm_screen_selection_copy(struct tsm_screen *con, char **out, bool conv)
 	return pos - str;
 }
 
+static void draw_cell(struct tsm_screen *con, struct line *line,
+	struct cell *empty, unsigned int x, unsigned int y, bool sel,
+	tsm_screen_draw_cb draw_cb, void *data)
+{
+	struct cell *cell;
+	struct tui_screen_attr attr;
+	const uint32_t *ch;
+	size_t len;
+	tsm_age_t age;
+
+	if (x < line->size)
+		cell = &line->cells[x];
+	else
+		cell = empty;
+	memcpy(&attr, &cell->attr, sizeof(attr));
+
+/* actual inverse logic is handled in the renderer */
+	if (con->flags & TSM_SCREEN_INVERSE)
+		attr.aflags ^= TUI_ATTR_INVERSE;
+
+	if (sel)
+		attr.aflags ^= TUI_ATTR_INVERSE;
+
+	if (con->age_reset) {
+		age = 0;
+	} else {
+		age = cell->age;
+		if (line->age > age)
+			age = line->age;
+		if (con->age > age)
+			age = con->age;
+	}
+
+	ch = tsm_symbol_get(con->sym_table, &cell->ch, &len);
+	if (cell->ch == ' ' || cell->ch == 0 || cell->ch == 0xa0)
+		len = 0;
+
+	draw_cb(con, cell->ch, ch, len, cell->width, x, y, &attr, age, data);
+}
+
+/* Only the damaged spans need to be visited unless something has aged the
+ * entire screen, or the selection or scrollback is in view as the damage is
+ * tracked against the lines of the active screen. */
+static void draw_damaged(struct tsm_screen *con, struct cell *empty,
+	tsm_screen_draw_cb draw_cb, void *data)
+{
+	size_t words = (con->size_y + 63) / 64;
+
+	for (size_t w = 0; w < words; w++){
+		uint64_t bits = con->dirty_rows[w];
+
+		while (bits){
+			unsigned int y = w * 64 + __builtin_ctzll(bits);
+			bits &= bits - 1;
+			if (y >= con->size_y)
+				return;
+
+			struct tsm_span *span = &con->dirty_span[y];
+			for (unsigned int x = span->x1; x < span->x2 && x < con->size_x; x++)
+				draw_cell(con, con->lines[y], empty, x, y, false, draw_cb, data);
+		}
+	}
+}
+
 SHL_EXPORT
 tsm_age_t tsm_screen_draw(struct tsm_screen *con, tsm_screen_draw_cb draw_cb,
 			  void *data)
 {
 	unsigned int i, j, k;
-	struct line *iter, *line = NULL;
-	struct cell *cell, empty;
-	struct tui_screen_attr attr;
-	const uint32_t *ch;
-	size_t len;
+	struct line *line = NULL;
+	uint64_t iter, row_id;
+	struct cell empty;
 	bool in_sel = false, sel_start = false, sel_end = false;
 	bool was_sel = false;
-	tsm_age_t age;
 
 	if (!con || !draw_cb)
 		return 0;
 
 	cell_init(con, &empty);
 
+	if (con->dirty_rows && !con->dirty_all && !con->age_reset &&
+		!con->sel_active && !con->sb_pos && con->age == con->drawn_age) {
+		draw_damaged(con, &empty, draw_cb, data);
+		goto out;
+	}
+
 	/* push ech character into rendering pipeline */
 
 	iter = con->sb_pos;
 	k = 0;
 
 	if (con->sel_active) {
-		if (!con->sel_start.line && con->sel_start.y == SELECTION_TOP)
+		if (!con->sel_start.sb_id && con->sel_start.y == SELECTION_TOP)
 			in_sel = !in_sel;
-		if (!con->sel_end.line && con->sel_end.y == SELECTION_TOP)
+		if (!con->sel_end.sb_id && con->sel_end.y == SELECTION_TOP)
 			in_sel = !in_sel;
 
-		if (con->sel_start.line &&
-		    (!iter || con->sel_start.line->sb_id < iter->sb_id))
+		if (con->sel_start.sb_id &&
+		    (!iter || con->sel_start.sb_id < iter))
 			in_sel = !in_sel;
-		if (con->sel_end.line &&
-		    (!iter || con->sel_end.line->sb_id < iter->sb_id))
+		if (con->sel_end.sb_id &&
+		    (!iter || con->sel_end.sb_id < iter))
 			in_sel = !in_sel;
 	}
 
 	for (i = 0; i < con->size_y; ++i) {
-		if (iter) {
-			line = iter;
-			iter = iter->next;
+		line = iter ? sb_fetch(con, iter) : NULL;
+		if (line) {
+			row_id = iter;
+			iter = iter < con->sb_last_id ? iter + 1 : 0;
 		} else {
+			iter = 0;
+			row_id = 0;
 			line = con->lines[k];
 			k++;
 		}
 
 		if (con->sel_active) {
-			if (con->sel_start.line == line ||
-			    (!con->sel_start.line &&
+			if ((con->sel_start.sb_id && con->sel_start.sb_id == row_id) ||
+			    (!con->sel_start.sb_id &&
 			     con->sel_start.y == k - 1))
 				sel_start = true;
 			else
 				sel_start = false;
-			if (con->sel_end.line == line ||
-			    (!con->sel_end.line &&
+			if ((con->sel_end.sb_id && con->sel_end.sb_id == row_id) ||
+			    (!con->sel_end.sb_id &&
 			     con->sel_end.y == k - 1))
 				sel_end = true;
 			else
@@ -2230,12 +2541,6 @@ tsm_age_t tsm_screen_draw(struct tsm_screen *con, tsm_screen_draw_cb draw_cb,
 		}
 
 		for (j = 0; j < con->size_x; ++j) {
-			if (j < line->size)
-				cell = &line->cells[j];
-			else
-				cell = &empty;
-			memcpy(&attr, &cell->attr, sizeof(attr));
-
 			if (con->sel_active) {
 				if (sel_start &&
 				    j == con->sel_start.x) {
@@ -2249,34 +2554,18 @@ tsm_age_t tsm_screen_draw(struct tsm_screen *con, tsm_screen_draw_cb draw_cb,
 				}
 			}
 
-/* actual inverse logic is handled in the renderer */
-			if (con->flags & TSM_SCREEN_INVERSE)
-				attr.aflags ^= TUI_ATTR_INVERSE;
-
-			if (in_sel || was_sel) {
-				was_sel = false;
-				attr.aflags ^= TUI_ATTR_INVERSE;
-			}
-
-			if (con->age_reset) {
-				age = 0;
-			} else {
-				age = cell->age;
-				if (line->age > age)
-					age = line->age;
-				if (con->age > age)
-					age = con->age;
-			}
-
-			ch = tsm_symbol_get(con->sym_table, &cell->ch, &len);
-			if (cell->ch == ' ' || cell->ch == 0 || cell->ch == 0xa0)
-				len = 0;
-
-			draw_cb(con, cell->ch,
-				ch, len, cell->width, j, i, &attr, age, data);
+			draw_cell(con, line, &empty, j, i,
+				in_sel || was_sel, draw_cb, data);
+			was_sel = false;
 		}
 	}
 
+out:
+	if (con->dirty_rows)
+		memset(con->dirty_rows, 0, sizeof(uint64_t) * ((con->dirty_cap + 63) / 64));
+	con->dirty_all = false;
+	con->drawn_age = con->age;
+
 	if (con->age_reset) {
 		con->age_reset = 0;
 		return 0;
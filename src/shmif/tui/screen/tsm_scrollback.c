@@ -0,0 +1,867 @@
+/*
+ * Copyright: 2020, Bjorn Stahl
+ * License: 3-Clause BSD, see COPYING file in arcan source repository.
+ * Reference: http://arcan-fe.com
+ * Description: Compact scrollback storage for tsm_screen.
+ *
+ * Lines that scroll off the screen are encoded into records that are packed
+ * back to back in large segments, the segments form a FIFO that is trimmed
+ * from the oldest record. A line is only decoded again when it is drawn or
+ * copied while the view is moved into the scrollback.
+ *
+ * Record layout, all numbers are LEB128 varints:
+ *  record size (excluding itself)
+ *  number of cells, number of cells with glyphs, number of attribute runs
+ *  runs: [cells in run, fr, fg, fb, br, bg, bb, aflags(lo, hi), custom_id]
+ *  glyphs: [symbol << 2 | width]
+ *
+ * Cells past those with glyphs are empty (symbol 0, width 1), so the blank
+ * tail of a line costs nothing but its attribute run.
+ *
+ * Each segment also carries a bloom filter of the (ASCII lower-cased)
+ * trigrams of the lines that went into it, so searching can skip past the
+ * segments that cannot contain the string without decoding them.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../../arcan_shmif.h"
+#include "../../arcan_tui.h"
+#include "libtsm.h"
+
+typedef void* TTF_Font;
+#include "libtsm_int.h"
+
+#define SB_SEGMENT_SZ 65536
+#define SB_ATTR_SZ 9
+#define SB_BLOOM_BITS 16384
+
+struct sb_seg {
+	uint64_t first; /* sequence number of the first record still in use */
+	size_t n; /* records still in use */
+	size_t start; /* offset of the first record still in use */
+	size_t used;
+	size_t cap;
+	uint64_t bloom[SB_BLOOM_BITS / 64];
+	uint8_t data[];
+};
+
+struct tsm_sb {
+/* ring of segments, oldest at [head] */
+	struct sb_seg **segs;
+	size_t segs_cap;
+	size_t head;
+	size_t n_segs;
+	struct sb_seg *spare;
+
+	uint64_t first;
+	size_t count;
+
+/* position of the last lookup, lines tend to be read in sequence */
+	struct {
+		struct sb_seg *seg;
+		uint64_t seq;
+		size_t ofs;
+	} cursor;
+
+/* encoding and decoding scratch */
+	uint8_t *enc;
+	size_t enc_cap;
+	struct cell *dec;
+	size_t dec_cap;
+
+/* search scratch, the text of a line and the column of each codepoint */
+	uint32_t *txt;
+	unsigned int *txt_col;
+	size_t txt_cap;
+	size_t *ofs;
+	size_t ofs_cap;
+};
+
+static size_t put_varint(uint8_t *dst, uint64_t val)
+{
+	size_t pos = 0;
+	do {
+		uint8_t ch = val & 0x7f;
+		val >>= 7;
+		dst[pos++] = ch | (val ? 0x80 : 0);
+	} while (val);
+	return pos;
+}
+
+static uint64_t get_varint(const uint8_t *src, size_t *pos)
+{
+	uint64_t val = 0;
+	unsigned shift = 0;
+	uint8_t ch;
+	do {
+		ch = src[(*pos)++];
+		val |= (uint64_t)(ch & 0x7f) << shift;
+		shift += 7;
+	} while ((ch & 0x80) && shift < 64);
+	return val;
+}
+
+static struct sb_seg *seg_at(struct tsm_sb *sb, size_t i)
+{
+	return sb->segs[(sb->head + i) % sb->segs_cap];
+}
+
+struct tsm_sb *tsm_sb_new(void)
+{
+	struct tsm_sb *sb = malloc(sizeof(struct tsm_sb));
+	if (!sb)
+		return NULL;
+
+	*sb = (struct tsm_sb){0};
+	return sb;
+}
+
+void tsm_sb_clear(struct tsm_sb *sb)
+{
+	if (!sb)
+		return;
+
+	for (size_t i = 0; i < sb->n_segs; i++)
+		free(seg_at(sb, i));
+
+	sb->head = 0;
+	sb->n_segs = 0;
+	sb->first += sb->count;
+	sb->count = 0;
+	sb->cursor.seg = NULL;
+}
+
+void tsm_sb_free(struct tsm_sb *sb)
+{
+	if (!sb)
+		return;
+
+	tsm_sb_clear(sb);
+	free(sb->segs);
+	free(sb->spare);
+	free(sb->enc);
+	free(sb->dec);
+	free(sb->txt);
+	free(sb->txt_col);
+	free(sb->ofs);
+	free(sb);
+}
+
+size_t tsm_sb_count(struct tsm_sb *sb)
+{
+	return sb ? sb->count : 0;
+}
+
+static struct sb_seg *seg_append(struct tsm_sb *sb, size_t need)
+{
+	if (sb->n_segs == sb->segs_cap){
+		size_t cap = sb->segs_cap ? sb->segs_cap * 2 : 16;
+		struct sb_seg **segs = malloc(sizeof(struct sb_seg*) * cap);
+		if (!segs)
+			return NULL;
+
+		for (size_t i = 0; i < sb->n_segs; i++)
+			segs[i] = seg_at(sb, i);
+
+		free(sb->segs);
+		sb->segs = segs;
+		sb->segs_cap = cap;
+		sb->head = 0;
+	}
+
+	struct sb_seg *seg;
+	size_t cap = need > SB_SEGMENT_SZ ? need : SB_SEGMENT_SZ;
+
+	if (sb->spare && sb->spare->cap >= cap){
+		seg = sb->spare;
+		sb->spare = NULL;
+		cap = seg->cap;
+	}
+	else {
+		seg = malloc(sizeof(struct sb_seg) + cap);
+		if (!seg)
+			return NULL;
+	}
+
+	*seg = (struct sb_seg){
+		.first = sb->first + sb->count,
+		.cap = cap
+	};
+
+	sb->segs[(sb->head + sb->n_segs) % sb->segs_cap] = seg;
+	sb->n_segs++;
+	return seg;
+}
+
+static void put_attr(uint8_t *dst, const struct tui_screen_attr *attr)
+{
+	dst[0] = attr->fr;
+	dst[1] = attr->fg;
+	dst[2] = attr->fb;
+	dst[3] = attr->br;
+	dst[4] = attr->bg;
+	dst[5] = attr->bb;
+	dst[6] = attr->aflags & 0xff;
+	dst[7] = attr->aflags >> 8;
+	dst[8] = attr->custom_id;
+}
+
+static void get_attr(const uint8_t *src, struct tui_screen_attr *attr)
+{
+	*attr = (struct tui_screen_attr){
+		.fr = src[0], .fg = src[1], .fb = src[2],
+		.br = src[3], .bg = src[4], .bb = src[5],
+		.aflags = src[6] | (src[7] << 8),
+		.custom_id = src[8]
+	};
+}
+
+/* blanks search as spaces, and only ASCII is folded so that the filter is
+ * independent of the locale */
+static uint32_t sb_fold(uint32_t ch)
+{
+	if (!ch)
+		return ' ';
+	if (ch >= 'A' && ch <= 'Z')
+		return ch + ('a' - 'A');
+	return ch;
+}
+
+static uint32_t sb_trigram(uint32_t a, uint32_t b, uint32_t c)
+{
+	uint32_t h = a * 0x9e3779b1u ^ b * 0x85ebca77u ^ c * 0xc2b2ae3du;
+	h ^= h >> 16;
+	h *= 0x7feb352du;
+	h ^= h >> 15;
+	h *= 0x846ca68bu;
+	h ^= h >> 16;
+	return h;
+}
+
+static void bloom_set(struct sb_seg *seg, uint32_t h)
+{
+	uint32_t b1 = h % SB_BLOOM_BITS;
+	uint32_t b2 = (h >> 16) % SB_BLOOM_BITS;
+	seg->bloom[b1 / 64] |= (uint64_t)1 << (b1 % 64);
+	seg->bloom[b2 / 64] |= (uint64_t)1 << (b2 % 64);
+}
+
+static bool bloom_test(struct sb_seg *seg, uint32_t h)
+{
+	uint32_t b1 = h % SB_BLOOM_BITS;
+	uint32_t b2 = (h >> 16) % SB_BLOOM_BITS;
+	return (seg->bloom[b1 / 64] & ((uint64_t)1 << (b1 % 64))) &&
+		(seg->bloom[b2 / 64] & ((uint64_t)1 << (b2 % 64)));
+}
+
+struct trigram {
+	uint32_t a, b;
+	unsigned int got;
+};
+
+static void bloom_step(struct sb_seg *seg, struct trigram *tg, uint32_t ch)
+{
+	uint32_t c = sb_fold(ch);
+	if (++tg->got >= 3)
+		bloom_set(seg, sb_trigram(tg->a, tg->b, c));
+	tg->a = tg->b;
+	tg->b = c;
+}
+
+/* the continuation cells of wide glyphs have no text of their own */
+static void bloom_add(struct sb_seg *seg,
+	const struct cell *cells, unsigned int n)
+{
+	struct trigram tg = {0};
+
+	for (unsigned int i = 0; i < n; i++)
+		if (cells[i].width)
+			bloom_step(seg, &tg, cells[i].ch);
+}
+
+bool tsm_sb_push(struct tsm_sb *sb, const struct cell *cells, unsigned int n)
+{
+	if (!sb)
+		return false;
+
+/* worst case is a run and a full width glyph per cell */
+	size_t bound = 40 + (size_t)n * (10 + SB_ATTR_SZ + 10);
+	if (bound > sb->enc_cap){
+		uint8_t *enc = realloc(sb->enc, bound);
+		if (!enc)
+			return false;
+		sb->enc = enc;
+		sb->enc_cap = bound;
+	}
+
+	unsigned int glyphs = n;
+	while (glyphs && cells[glyphs - 1].ch == 0 && cells[glyphs - 1].width == 1)
+		glyphs--;
+
+	unsigned int runs = 0;
+	for (unsigned int i = 0; i < n; i++)
+		if (!i || !tui_attr_equal(cells[i].attr, cells[i - 1].attr))
+			runs++;
+
+/* leave room in front for the record size */
+	uint8_t *out = &sb->enc[10];
+	size_t pos = 0;
+	pos += put_varint(&out[pos], n);
+	pos += put_varint(&out[pos], glyphs);
+	pos += put_varint(&out[pos], runs);
+
+	for (unsigned int i = 0; i < n;){
+		unsigned int len = 1;
+		while (i + len < n && tui_attr_equal(cells[i + len].attr, cells[i].attr))
+			len++;
+
+		pos += put_varint(&out[pos], len);
+		put_attr(&out[pos], &cells[i].attr);
+		pos += SB_ATTR_SZ;
+		i += len;
+	}
+
+	for (unsigned int i = 0; i < glyphs; i++){
+		unsigned int width = cells[i].width > 3 ? 3 : cells[i].width;
+		pos += put_varint(&out[pos], ((uint64_t)cells[i].ch << 2) | width);
+	}
+
+	uint8_t hdr[10];
+	size_t hdr_sz = put_varint(hdr, pos);
+	size_t need = hdr_sz + pos;
+
+	struct sb_seg *seg = sb->n_segs ? seg_at(sb, sb->n_segs - 1) : NULL;
+	if (!seg || seg->cap - seg->used < need){
+		seg = seg_append(sb, need);
+		if (!seg)
+			return false;
+	}
+
+	memcpy(&seg->data[seg->used], hdr, hdr_sz);
+	memcpy(&seg->data[seg->used + hdr_sz], out, pos);
+	seg->used += need;
+	seg->n++;
+	sb->count++;
+	bloom_add(seg, cells, glyphs);
+
+	return true;
+}
+
+void tsm_sb_pop(struct tsm_sb *sb)
+{
+	if (!sb || !sb->count)
+		return;
+
+	struct sb_seg *seg = seg_at(sb, 0);
+	size_t pos = seg->start;
+	size_t len = get_varint(seg->data, &pos);
+
+	seg->start = pos + len;
+	seg->first++;
+	seg->n--;
+	sb->first++;
+	sb->count--;
+
+/* keep the emptied segment around for the next append rather than going
+ * through malloc/free for every segment worth of lines */
+	if (!seg->n){
+		if (sb->cursor.seg == seg)
+			sb->cursor.seg = NULL;
+
+		sb->head = (sb->head + 1) % sb->segs_cap;
+		sb->n_segs--;
+
+		if (!sb->spare || sb->spare->cap < seg->cap){
+			free(sb->spare);
+			sb->spare = seg;
+		}
+		else
+			free(seg);
+	}
+}
+
+static size_t seg_index(struct tsm_sb *sb, uint64_t seq)
+{
+	size_t lo = 0, hi = sb->n_segs;
+
+	while (hi - lo > 1){
+		size_t mid = lo + (hi - lo) / 2;
+		if (seg_at(sb, mid)->first <= seq)
+			lo = mid;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+static struct sb_seg *seg_find(struct tsm_sb *sb, uint64_t seq)
+{
+	return seg_at(sb, seg_index(sb, seq));
+}
+
+/* decode the record at [pos] (its size prefix) into the shared scratch */
+static struct cell *rec_decode(
+	struct tsm_sb *sb, const uint8_t *in, size_t pos, unsigned int *n)
+{
+	get_varint(in, &pos);
+	unsigned int cells = get_varint(in, &pos);
+	unsigned int glyphs = get_varint(in, &pos);
+	unsigned int runs = get_varint(in, &pos);
+
+	if (cells > sb->dec_cap){
+		struct cell *dec = realloc(sb->dec, sizeof(struct cell) * cells);
+		if (!dec)
+			return NULL;
+		sb->dec = dec;
+		sb->dec_cap = cells;
+	}
+
+	struct cell *out = sb->dec;
+	for (unsigned int i = 0, r = 0; r < runs; r++){
+		unsigned int len = get_varint(in, &pos);
+		struct tui_screen_attr attr;
+		get_attr(&in[pos], &attr);
+		pos += SB_ATTR_SZ;
+
+		for (; len && i < cells; len--, i++)
+			out[i] = (struct cell){
+				.width = 1,
+				.attr = attr
+			};
+	}
+
+	for (unsigned int i = 0; i < glyphs && i < cells; i++){
+		uint64_t val = get_varint(in, &pos);
+		out[i].ch = val >> 2;
+		out[i].width = val & 3;
+	}
+
+/* the screen keeps a wide glyph written to the last column, it can only
+ * show one cell of it */
+	if (glyphs && glyphs >= cells && out[cells - 1].width > 1)
+		out[cells - 1].width = 1;
+
+	*n = cells;
+	return out;
+}
+
+struct cell *tsm_sb_get(struct tsm_sb *sb, size_t index, unsigned int *n)
+{
+	if (!sb || index >= sb->count)
+		return NULL;
+
+	uint64_t seq = sb->first + index;
+	struct sb_seg *seg = seg_find(sb, seq);
+
+	uint64_t at = seg->first;
+	size_t pos = seg->start;
+	if (sb->cursor.seg == seg &&
+		sb->cursor.seq >= seg->first && sb->cursor.seq <= seq){
+		at = sb->cursor.seq;
+		pos = sb->cursor.ofs;
+	}
+
+	for (; at < seq; at++){
+		size_t len = get_varint(seg->data, &pos);
+		pos += len;
+	}
+
+	sb->cursor.seg = seg;
+	sb->cursor.seq = seq;
+	sb->cursor.ofs = pos;
+
+	return rec_decode(sb, seg->data, pos, n);
+}
+
+/* decode only the glyphs of the record at [pos] into the search scratch,
+ * returns the number of codepoints or -1 if the scratch could not grow */
+static ssize_t sb_text(struct tsm_sb *sb, const uint8_t *in, size_t pos)
+{
+	get_varint(in, &pos);
+	get_varint(in, &pos);
+	unsigned int glyphs = get_varint(in, &pos);
+	unsigned int runs = get_varint(in, &pos);
+
+	for (unsigned int r = 0; r < runs; r++){
+		get_varint(in, &pos);
+		pos += SB_ATTR_SZ;
+	}
+
+	if (glyphs > sb->txt_cap){
+		uint32_t *txt = realloc(sb->txt, sizeof(uint32_t) * glyphs);
+		if (!txt)
+			return -1;
+		sb->txt = txt;
+
+		unsigned int *txt_col = realloc(sb->txt_col, sizeof(unsigned int) * glyphs);
+		if (!txt_col)
+			return -1;
+		sb->txt_col = txt_col;
+		sb->txt_cap = glyphs;
+	}
+
+	size_t n = 0;
+	for (unsigned int i = 0; i < glyphs; i++){
+		uint64_t val = get_varint(in, &pos);
+		if (!(val & 3))
+			continue;
+
+		sb->txt[n] = val >> 2;
+		sb->txt_col[n++] = i;
+	}
+
+	return n;
+}
+
+static bool sb_match(const uint32_t *txt, size_t n,
+	const uint32_t *needle, size_t n_needle, bool fold, size_t *at)
+{
+	for (size_t i = 0; i + n_needle <= n; i++){
+		size_t j = 0;
+		if (fold)
+			while (j < n_needle && sb_fold(txt[i + j]) == sb_fold(needle[j]))
+				j++;
+		else
+			while (j < n_needle && (txt[i + j] ? txt[i + j] : ' ') == needle[j])
+				j++;
+
+		if (j == n_needle){
+			*at = i;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/* a segment can only hold a match if every trigram of the needle is in its
+ * filter, shorter needles have to be scanned */
+static bool seg_maybe(struct sb_seg *seg, const uint32_t *needle, size_t n)
+{
+	for (size_t i = 2; i < n; i++)
+		if (!bloom_test(seg, sb_trigram(
+			sb_fold(needle[i - 2]), sb_fold(needle[i - 1]), sb_fold(needle[i]))))
+			return false;
+
+	return true;
+}
+
+/* 1 if the record at [pos] contains [needle], sets [col], -1 on failure */
+static int rec_match(struct tsm_sb *sb, struct sb_seg *seg, size_t pos,
+	const uint32_t *needle, size_t n, bool fold, unsigned int *col)
+{
+	ssize_t nt = sb_text(sb, seg->data, pos);
+	if (-1 == nt)
+		return -1;
+
+	size_t ofs;
+	if (!sb_match(sb->txt, nt, needle, n, fold, &ofs))
+		return 0;
+
+	*col = sb->txt_col[ofs];
+	return 1;
+}
+
+bool tsm_sb_search(struct tsm_sb *sb, const uint32_t *needle, size_t n,
+	bool forward, bool fold, size_t *index, unsigned int *col)
+{
+	if (!sb || !needle || !n || *index >= sb->count)
+		return false;
+
+	uint64_t seq = sb->first + *index;
+	size_t si = seg_index(sb, seq);
+
+	for (;;){
+		struct sb_seg *seg = seg_at(sb, si);
+		uint64_t end = seg->first + seg->n;
+		size_t pos = seg->start;
+
+		bool maybe = seg_maybe(seg, needle, n);
+
+		if (maybe && forward){
+			for (uint64_t at = seg->first; at < end; at++){
+				size_t rec = pos;
+				size_t len = get_varint(seg->data, &pos);
+				pos += len;
+
+				if (at < seq)
+					continue;
+
+				int rv = rec_match(sb, seg, rec, needle, n, fold, col);
+				if (-1 == rv)
+					return false;
+
+				if (rv){
+					*index = at - sb->first;
+					return true;
+				}
+			}
+		}
+/* records only link forward, so collect the offsets up to [seq] and test
+ * them in reverse */
+		else if (maybe){
+			size_t cnt = (seq < end ? seq + 1 : end) - seg->first;
+			if (cnt > sb->ofs_cap){
+				size_t *ofs = realloc(sb->ofs, sizeof(size_t) * cnt);
+				if (!ofs)
+					return false;
+				sb->ofs = ofs;
+				sb->ofs_cap = cnt;
+			}
+
+			for (size_t i = 0; i < cnt; i++){
+				sb->ofs[i] = pos;
+				size_t len = get_varint(seg->data, &pos);
+				pos += len;
+			}
+
+			for (size_t i = cnt; i > 0; i--){
+				int rv = rec_match(sb, seg, sb->ofs[i - 1], needle, n, fold, col);
+				if (-1 == rv)
+					return false;
+
+				if (rv){
+					*index = seg->first + i - 1 - sb->first;
+					return true;
+				}
+			}
+		}
+
+		if (forward){
+			if (++si == sb->n_segs)
+				return false;
+		}
+		else if (si-- == 0)
+			return false;
+	}
+}
+
+bool tsm_sb_export(struct tsm_sb *sb, uint8_t **out, size_t *out_sz)
+{
+	if (!sb || !out || !out_sz)
+		return false;
+
+	size_t sz = 0;
+	for (size_t i = 0; i < sb->n_segs; i++){
+		struct sb_seg *seg = seg_at(sb, i);
+		sz += seg->used - seg->start;
+	}
+
+	uint8_t *buf = malloc(sz ? sz : 1);
+	if (!buf)
+		return false;
+
+	size_t pos = 0;
+	for (size_t i = 0; i < sb->n_segs; i++){
+		struct sb_seg *seg = seg_at(sb, i);
+		memcpy(&buf[pos], &seg->data[seg->start], seg->used - seg->start);
+		pos += seg->used - seg->start;
+	}
+
+	*out = buf;
+	*out_sz = sz;
+	return true;
+}
+
+static bool get_varint_s(
+	const uint8_t *src, size_t sz, size_t *pos, uint64_t *out)
+{
+	uint64_t val = 0;
+	unsigned shift = 0;
+	uint8_t ch;
+	do {
+		if (*pos >= sz || shift >= 64)
+			return false;
+		ch = src[(*pos)++];
+		val |= (uint64_t)(ch & 0x7f) << shift;
+		shift += 7;
+	} while (ch & 0x80);
+
+	*out = val;
+	return true;
+}
+
+/* the record body in [src, sz) comes from outside, so check that it decodes
+ * to exactly its size and that the runs cover every cell (the decoder leaves
+ * the rest as they were) before it is let into a segment, and build the
+ * filter entries for it while at it */
+static bool rec_verify(
+	const uint8_t *src, size_t sz, struct sb_seg *seg, uint64_t *cells)
+{
+	size_t pos = 0;
+	uint64_t glyphs, runs;
+	if (!get_varint_s(src, sz, &pos, cells) ||
+		!get_varint_s(src, sz, &pos, &glyphs) ||
+		!get_varint_s(src, sz, &pos, &runs) ||
+		*cells > UINT16_MAX || glyphs > *cells || runs > *cells)
+		return false;
+
+	uint64_t sum = 0;
+	for (uint64_t r = 0; r < runs; r++){
+		uint64_t len;
+		if (!get_varint_s(src, sz, &pos, &len) ||
+			len > *cells - sum || sz - pos < SB_ATTR_SZ)
+			return false;
+		sum += len;
+		pos += SB_ATTR_SZ;
+	}
+
+	if (sum != *cells)
+		return false;
+
+/* a glyph is at most two cells wide, one in the last cell may be two wide
+ * as on the live screen and gets clamped by the decoder */
+	struct trigram tg = {0};
+	for (uint64_t i = 0; i < glyphs; i++){
+		uint64_t val;
+		if (!get_varint_s(src, sz, &pos, &val) || (val & 3) > 2)
+			return false;
+		if (val & 3)
+			bloom_step(seg, &tg, val >> 2);
+	}
+
+	return pos == sz;
+}
+
+/* a segment appended for records that all got left behind would sit empty
+ * in the ring, hand it back */
+static void import_drop_empty(struct tsm_sb *sb)
+{
+	struct sb_seg *seg = sb->n_segs ? seg_at(sb, sb->n_segs - 1) : NULL;
+	if (!seg || seg->n)
+		return;
+
+	if (sb->cursor.seg == seg)
+		sb->cursor.seg = NULL;
+
+	sb->n_segs--;
+	if (!sb->spare || sb->spare->cap < seg->cap){
+		free(sb->spare);
+		sb->spare = seg;
+	}
+	else
+		free(seg);
+}
+
+static size_t import_commit(struct tsm_sb *sb,
+	struct sb_seg *seg, const uint8_t *src, size_t sz, size_t n)
+{
+	memcpy(&seg->data[seg->used], src, sz);
+	seg->used += sz;
+	seg->n += n;
+	sb->count += n;
+	return n;
+}
+
+size_t tsm_sb_import(struct tsm_sb *sb,
+	const uint8_t *buf, size_t buf_sz, size_t skip, unsigned int max_cells)
+{
+	if (!sb || !buf)
+		return 0;
+
+	size_t pos = 0;
+	uint64_t len;
+
+	for (; skip && pos < buf_sz; skip--){
+		if (!get_varint_s(buf, buf_sz, &pos, &len) || buf_sz - pos < len)
+			return 0;
+		pos += len;
+	}
+
+/* records are verified in place and copied into the segment they fit in as
+ * one run, rather than one at a time */
+	struct sb_seg *seg = sb->n_segs ? seg_at(sb, sb->n_segs - 1) : NULL;
+	size_t run = pos, end = pos, run_n = 0, added = 0;
+
+	while (pos < buf_sz){
+		size_t rec = pos;
+		if (!get_varint_s(buf, buf_sz, &pos, &len) || buf_sz - pos < len)
+			break;
+
+		size_t need = pos - rec + len;
+		if (!seg || seg->cap - seg->used - (rec - run) < need){
+			if (seg && run_n)
+				added += import_commit(sb, seg, &buf[run], rec - run, run_n);
+			run = rec;
+			run_n = 0;
+
+			import_drop_empty(sb);
+			seg = seg_append(sb, need);
+			if (!seg)
+				return added;
+		}
+
+/* a record that doesn't check out is left behind, its size prefix is still
+ * good so the ones after it can be taken */
+		uint64_t cells;
+		if (!rec_verify(&buf[pos], len, seg, &cells)){
+			if (run_n)
+				added += import_commit(sb, seg, &buf[run], rec - run, run_n);
+			pos += len;
+			run = end = pos;
+			run_n = 0;
+			continue;
+		}
+
+		pos += len;
+
+/* lines wider than the screen are cut to fit, that takes a new record so the
+ * ones collected so far go in first, a wide glyph split by the cut is kept
+ * one cell wide as the screen would show it */
+		if (max_cells && cells > max_cells){
+			if (run_n)
+				added += import_commit(sb, seg, &buf[run], rec - run, run_n);
+
+			unsigned int n;
+			struct cell *dec = rec_decode(sb, buf, rec, &n);
+			if (!dec)
+				return added;
+
+			if (dec[max_cells - 1].width > 1)
+				dec[max_cells - 1].width = 1;
+
+			if (!tsm_sb_push(sb, dec, max_cells))
+				return added;
+
+			added++;
+			seg = seg_at(sb, sb->n_segs - 1);
+			run = end = pos;
+			run_n = 0;
+			continue;
+		}
+
+		end = pos;
+		run_n++;
+	}
+
+	if (seg && run_n)
+		added += import_commit(sb, seg, &buf[run], end - run, run_n);
+
+	import_drop_empty(sb);
+	return added;
+}
+
+size_t tsm_sb_footprint(struct tsm_sb *sb)
+{
+	if (!sb)
+		return 0;
+
+	size_t sum = sizeof(struct tsm_sb) +
+		sb->segs_cap * sizeof(struct sb_seg*) +
+		sb->enc_cap + sb->dec_cap * sizeof(struct cell) +
+		sb->txt_cap * (sizeof(uint32_t) + sizeof(unsigned int)) +
+		sb->ofs_cap * sizeof(size_t);
+
+	for (size_t i = 0; i < sb->n_segs; i++)
+		sum += sizeof(struct sb_seg) + seg_at(sb, i)->cap;
+
+	if (sb->spare)
+		sum += sizeof(struct sb_seg) + sb->spare->cap;
+
+	return sum;
+}
@@ -780,6 +780,15 @@ bool arcan_tui_writeu8(struct tui_context* c,
 
 	size_t pos = 0;
 	while (pos < len){
+/* printable ASCII goes to the screen in runs */
+		size_t run =
+			tsm_screen_write_ascii(c->screen, &u8[pos], len - pos, attr);
+		if (run){
+			pos += run;
+			flag_cursor(c);
+			continue;
+		}
+
 		uint32_t ucs4 = 0;
 		ssize_t step = arcan_tui_utf8ucs4((char*) &u8[pos], &ucs4);
 /* invalid character, write empty and advance */
@@ -1033,6 +1042,48 @@ void arcan_tui_scroll_down(struct tui_context* c, size_t n)
 	flag_cursor(c);
 }
 
+bool arcan_tui_sb_search(
+	struct tui_context* c, const char* str, int flags, size_t* col)
+{
+	if (!c || !str || (c->flags & TUI_ALTERNATE))
+		return false;
+
+	size_t len = strlen(str);
+	uint32_t* needle = malloc(sizeof(uint32_t) * (len + 1));
+	if (!needle)
+		return false;
+
+/* the decoder reads a full sequence worth, so pad the tail */
+	size_t n = 0;
+	for (size_t pos = 0; pos < len;){
+		char u8[4] = {0};
+		memcpy(u8, &str[pos], len - pos < 4 ? len - pos : 4);
+
+		ssize_t step = arcan_tui_utf8ucs4(u8, &needle[n]);
+		if (step <= 0){
+			pos++;
+			continue;
+		}
+
+		pos += step;
+		n++;
+	}
+
+	unsigned int x;
+	int rv = tsm_screen_sb_search(c->screen, needle, n,
+		flags & TUI_SEARCH_FORWARD, flags & TUI_SEARCH_NOCASE, &x);
+	free(needle);
+
+	if (rv)
+		return false;
+
+	if (col)
+		*col = x;
+
+	flag_cursor(c);
+	return true;
+}
+
 void arcan_tui_reset_tabstop(struct tui_context* c)
 {
 	if (c)
@@ -19,6 +19,11 @@ struct color {
 	bool bgset;
 };
 
+/* columns [x1, x2) of a row where front might differ from back */
+struct tui_span {
+	unsigned x1, x2;
+};
+
 struct tui_font;
 struct tui_raster_context;
 struct tui_context;
@@ -39,6 +44,10 @@ struct tui_context {
 	struct tui_cell* back;
 	uint8_t fstamp;
 
+/* per row span of front that has been written to since the last synch,
+ * x2 is 0 for untouched rows. This is also an alias into base. */
+	struct tui_span* front_dirty;
+
 	float progress[5];
 
 /* rbuf is used to package / convert the representation in base(front|back)
@@ -0,0 +1,600 @@
+/*
+ * Drive synthetic content through an in-process a12 client/server pair with
+ * each of the video methods and measure the full path: encode (including the
+ * packetization in flush), decode (unpack into the destination buffer) and
+ * the bytes that would go over the wire.
+ *
+ * Latency is from the frame being handed to a12_channel_vframe until the last
+ * of it has been unpacked, plus the time to transfer it at -b Mbit if set.
+ * CPU is process time, so it includes the worker threads the encoders and
+ * decoders may split a frame over.
+ *
+ * Output is one line per profile and method in the format:
+ * profile:method:w:h:frames:enc_ms:dec_ms:bytes:p50_ms:p95_ms:p99_ms:cpu_ms
+ *
+ * With the times being averages per frame, except for the percentiles.
+ */
+#include <arcan_shmif.h>
+#include <arcan_shmif_server.h>
+#include <arcan/a12.h>
+
+#include <sys/uio.h>
+#include <unistd.h>
+#include <time.h>
+
+extern void arcan_random(uint8_t*, size_t);
+
+static uint8_t clpriv[32];
+static uint8_t srvpriv[32];
+
+static struct pk_response key_auth_cl(uint8_t pk[static 32])
+{
+	struct pk_response auth = {.authentic = true};
+	memcpy(auth.key, clpriv, 32);
+	return auth;
+}
+
+static struct pk_response key_auth_srv(uint8_t pk[static 32])
+{
+	struct pk_response auth = {.authentic = true};
+	memcpy(auth.key, srvpriv, 32);
+	return auth;
+}
+
+static double timestamp(clockid_t clk)
+{
+	struct timespec ts;
+	clock_gettime(clk, &ts);
+	return (double) ts.tv_sec * 1000.0 + (double) ts.tv_nsec / 1000000.0;
+}
+
+enum profile {
+	PROFILE_DESKTOP = 0,
+	PROFILE_SCROLL,
+	PROFILE_VIDEO,
+	PROFILE_TPACK,
+	PROFILE_COUNT
+};
+
+static const char* profile_names[] = {
+	"desktop",
+	"scroll",
+	"video",
+	"tpack"
+};
+
+static const struct {
+	const char* name;
+	enum a12_vframe_method method;
+} methods[] = {
+	{"normal", VFRAME_METHOD_NORMAL},
+	{"rgb", VFRAME_METHOD_RAW_NOALPHA},
+	{"rgb565", VFRAME_METHOD_RAW_RGB565},
+	{"dpng", VFRAME_METHOD_DPNG},
+	{"dlz", VFRAME_METHOD_DLZ},
+	{"dtile", VFRAME_METHOD_DTILE},
+	{"adaptive", VFRAME_METHOD_ADAPTIVE},
+#ifdef WANT_H264_ENC
+	{"h264", VFRAME_METHOD_H264},
+#endif
+	{"tpack", VFRAME_METHOD_TPACK}
+};
+
+struct content {
+	size_t w, h;
+	shmif_pixel* px;
+
+/* tpack grid and the packed buffer that gets sent */
+	size_t rows, cols;
+	uint8_t* cells;
+	uint8_t* tpack;
+	bool* dirty;
+
+/* damaged region of the last frame */
+	size_t x1, y1, x2, y2;
+	uint32_t seed;
+};
+
+static uint32_t xorshift(uint32_t* state)
+{
+	uint32_t x = *state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	*state = x;
+	return x;
+}
+
+/* 8x16 cell that looks enough like a glyph for the compressors */
+static void draw_glyph(struct content* c, size_t x, size_t y, uint32_t code)
+{
+	for (size_t row = 0; row < 16 && y + row < c->h; row++){
+		uint8_t bits = (code * (row + 1) * 2654435761u) >> 24;
+		if (row < 3 || row > 12)
+			bits = 0;
+
+		shmif_pixel* dst = &c->px[(y + row) * c->w + x];
+		for (size_t col = 0; col < 8 && x + col < c->w; col++)
+			dst[col] = (bits & (1 << col)) ?
+				SHMIF_RGBA(0xe0, 0xe0, 0xe0, 0xff) : SHMIF_RGBA(0x20, 0x20, 0x28, 0xff);
+	}
+}
+
+static void text_line(struct content* c, size_t y, uint32_t* seed)
+{
+	size_t len = xorshift(seed) % (c->w / 8);
+	for (size_t x = 0; x + 8 <= c->w; x += 8)
+		draw_glyph(c, x, y, x / 8 < len ? 'a' + xorshift(seed) % 64 : 0);
+}
+
+static void desktop_setup(struct content* c)
+{
+	for (size_t y = 0; y < c->h; y++)
+		for (size_t x = 0; x < c->w; x++)
+			c->px[y * c->w + x] = SHMIF_RGBA(0x30, 0x40 + y * 0x40 / c->h, 0x60, 0xff);
+
+/* a few windows with text in them */
+	uint32_t seed = 0x1234;
+	for (size_t i = 0; i < 4; i++){
+		size_t wx = (i * c->w) / 5 + 16;
+		size_t wy = (i * c->h) / 6 + 16;
+		size_t ww = c->w / 2;
+		size_t wh = c->h / 2;
+		for (size_t y = wy; y < wy + wh && y < c->h; y++)
+			for (size_t x = wx; x < wx + ww && x < c->w; x++)
+				c->px[y * c->w + x] = SHMIF_RGBA(0x20, 0x20, 0x28, 0xff);
+		for (size_t y = wy + 4; y + 16 < wy + wh && y + 16 < c->h; y += 16)
+			for (size_t x = wx + 4; x + 8 < wx + ww / 2 && x + 8 < c->w; x += 8)
+				draw_glyph(c, x, y, xorshift(&seed));
+	}
+}
+
+/* a blinking cursor and a clock that updates */
+static void desktop_frame(struct content* c, size_t i)
+{
+	size_t cx = 64 + (i * 8) % (c->w / 2);
+	size_t cy = c->h / 3;
+
+	draw_glyph(c, cx - 8, cy, 'a' + i % 26);
+	for (size_t y = cy; y < cy + 16; y++)
+		for (size_t x = cx; x < cx + 8; x++)
+			c->px[y * c->w + x] = (i & 1) ?
+				SHMIF_RGBA(0xff, 0xff, 0xff, 0xff) : SHMIF_RGBA(0x20, 0x20, 0x28, 0xff);
+
+	uint32_t seed = i + 1;
+	for (size_t x = c->w - 64; x < c->w; x += 8)
+		draw_glyph(c, x, 0, '0' + xorshift(&seed) % 10);
+
+/* damage covers both, which is what a compositor would report */
+	c->x1 = 0;
+	c->y1 = 0;
+	c->x2 = c->w;
+	c->y2 = cy + 16;
+}
+
+/* one line of text scrolls in at the bottom every frame */
+static void scroll_frame(struct content* c, size_t i)
+{
+	size_t line = 16 * c->w;
+	memmove(c->px, &c->px[line], (c->h - 16) * c->w * sizeof(shmif_pixel));
+	text_line(c, c->h - 16, &c->seed);
+
+	c->x1 = c->y1 = 0;
+	c->x2 = c->w;
+	c->y2 = c->h;
+}
+
+/* moving gradients with some noise, nothing stays the same between frames */
+static void video_frame(struct content* c, size_t i)
+{
+	for (size_t y = 0; y < c->h; y++){
+		shmif_pixel* dst = &c->px[y * c->w];
+		for (size_t x = 0; x < c->w; x++){
+			uint32_t n = xorshift(&c->seed);
+			uint8_t r = (x + i * 3) ^ (y >> 1);
+			uint8_t g = (y + i * 2) + (n & 0x0f);
+			uint8_t b = ((x + y) >> 1) + i + ((n >> 8) & 0x07);
+			dst[x] = SHMIF_RGBA(r, g, b, 0xff);
+		}
+	}
+
+	c->x1 = c->y1 = 0;
+	c->x2 = c->w;
+	c->y2 = c->h;
+}
+
+/* see shmif/tui/raster for the layout */
+static size_t tpack_pack(struct content* c, bool full)
+{
+	size_t pos = 16;
+	uint16_t n_lines = 0;
+	uint16_t n_cells = 0;
+
+	for (size_t row = 0; row < c->rows; row++){
+		if (!full && !c->dirty[row])
+			continue;
+
+		uint8_t line[9] = {row & 0xff, row >> 8, c->cols & 0xff, c->cols >> 8};
+		memcpy(&c->tpack[pos], line, 9);
+		pos += 9;
+		memcpy(&c->tpack[pos], &c->cells[row * c->cols * 12], c->cols * 12);
+		pos += c->cols * 12;
+		n_lines++;
+		n_cells += c->cols;
+	}
+
+	uint8_t hdr[16] = {
+		pos & 0xff, (pos >> 8) & 0xff, (pos >> 16) & 0xff, pos >> 24,
+		n_lines & 0xff, n_lines >> 8, n_cells & 0xff, n_cells >> 8,
+		0, full ? 1 : 2, 0, 0x10, 0x10, 0x10, 0xff, 0
+	};
+	memcpy(c->tpack, hdr, 16);
+
+	return pos;
+}
+
+/* typing on the last line, a full scroll every tenth frame */
+static size_t tpack_frame(struct content* c, size_t i)
+{
+	memset(c->dirty, '\0', c->rows);
+
+	if (i % 10 == 9){
+		memmove(c->cells, &c->cells[c->cols * 12], (c->rows - 1) * c->cols * 12);
+		memset(c->dirty, 1, c->rows);
+	}
+
+	size_t row = c->rows - 1;
+	size_t col = i % c->cols;
+	uint8_t* cell = &c->cells[(row * c->cols + col) * 12];
+	uint8_t fg = xorshift(&c->seed) & 0x07 ? 0xe0 : 0xff;
+	uint8_t attr[12] = {fg, fg, fg, 0x20, 0x20, 0x28, 0, 0, 'a' + i % 26, 0, 0, 0};
+	memcpy(cell, attr, 12);
+	c->dirty[row] = true;
+
+	return tpack_pack(c, i == 0);
+}
+
+static bool content_setup(struct content* c, enum profile p, size_t w, size_t h)
+{
+	*c = (struct content){
+		.w = w,
+		.h = h,
+		.seed = 0xfeedface
+	};
+
+	if (p == PROFILE_TPACK){
+		c->cols = w / 8;
+		c->rows = h / 16;
+		c->cells = malloc(c->rows * c->cols * 12);
+		c->tpack = malloc(16 + c->rows * (9 + c->cols * 12));
+		c->dirty = malloc(c->rows);
+		if (!c->cells || !c->tpack || !c->dirty)
+			return false;
+
+		for (size_t i = 0; i < c->rows * c->cols; i++){
+			uint8_t cell[12] =
+				{0xe0, 0xe0, 0xe0, 0x20, 0x20, 0x28, 0, 0, 'a' + i % 26, 0, 0, 0};
+			memcpy(&c->cells[i * 12], cell, 12);
+		}
+		return true;
+	}
+
+	c->px = malloc(w * h * sizeof(shmif_pixel));
+	if (!c->px)
+		return false;
+
+	if (p == PROFILE_DESKTOP)
+		desktop_setup(c);
+	else {
+		for (size_t y = 0; y + 16 <= h; y += 16)
+			text_line(c, y, &c->seed);
+	}
+
+	return true;
+}
+
+static void content_free(struct content* c)
+{
+	free(c->px);
+	free(c->cells);
+	free(c->tpack);
+	free(c->dirty);
+}
+
+struct sink {
+	uint8_t* buf;
+	size_t frames;
+};
+
+static shmif_pixel* sink_alloc(
+	size_t w, size_t h, size_t* stride, int fl, void* tag)
+{
+	struct sink* s = tag;
+	free(s->buf);
+	*stride = w * sizeof(shmif_pixel);
+	s->buf = malloc(*stride * h);
+	return (shmif_pixel*) s->buf;
+}
+
+static void sink_signal(size_t x1, size_t y1, size_t x2, size_t y2, void* tag)
+{
+	struct sink* s = tag;
+	s->frames++;
+}
+
+/* move everything queued on [src] over to [dst], returns the bytes moved */
+static size_t pump(struct a12_state* src, struct a12_state* dst,
+	double* t_flush, double* t_unpack)
+{
+	size_t total = 0;
+
+	for(;;){
+		struct iovec iov[16];
+		size_t n_iov = 16;
+
+		double start = timestamp(CLOCK_MONOTONIC);
+		size_t out = a12_flush_iov(src, iov, &n_iov, 0);
+		double mid = timestamp(CLOCK_MONOTONIC);
+		if (!out)
+			break;
+
+		for (size_t i = 0; i < n_iov; i++)
+			a12_unpack(dst, iov[i].iov_base, iov[i].iov_len, NULL, NULL);
+		double end = timestamp(CLOCK_MONOTONIC);
+
+		if (t_flush)
+			*t_flush += mid - start;
+		if (t_unpack)
+			*t_unpack += end - mid;
+		total += out;
+	}
+
+	return total;
+}
+
+static bool authenticate(struct a12_state* cl, struct a12_state* srv)
+{
+	int s1, s2;
+	do {
+		pump(cl, srv, NULL, NULL);
+		pump(srv, cl, NULL, NULL);
+		s1 = a12_poll(cl);
+		s2 = a12_poll(srv);
+		if (s1 == -1 || s2 == -1)
+			return false;
+	} while (s1 > 0 || s2 > 0 || !a12_auth_state(cl) || !a12_auth_state(srv));
+
+	return true;
+}
+
+static int dcmp(const void* a, const void* b)
+{
+	double da = *(const double*) a;
+	double db = *(const double*) b;
+	return da < db ? -1 : da > db;
+}
+
+static double percentile(double* sorted, size_t n, double p)
+{
+	size_t i = (size_t)(p * (double)(n - 1) + 0.5);
+	return sorted[i < n ? i : n - 1];
+}
+
+static bool run(struct a12_state* cl, struct a12_state* srv,
+	enum profile p, size_t mi, size_t w, size_t h, size_t n_frames, float mbit)
+{
+	struct content c = {0};
+	struct sink sink = {0};
+	double* latency = malloc(n_frames * sizeof(double));
+
+	if (!latency || !content_setup(&c, p, w, h)){
+		free(latency);
+		content_free(&c);
+		return false;
+	}
+
+	a12_set_destination_raw(srv, 0,
+		(struct a12_unpack_cfg){
+			.tag = &sink,
+			.request_raw_buffer = sink_alloc,
+			.signal_video = sink_signal
+		}, sizeof(struct a12_unpack_cfg)
+	);
+
+	double enc = 0, dec = 0;
+	size_t bytes = 0;
+	double cpu = timestamp(CLOCK_PROCESS_CPUTIME_ID);
+	size_t i = 0;
+
+	for (; i < n_frames; i++){
+		struct shmifsrv_vbuffer vb = {
+			.w = w,
+			.h = h,
+			.pitch = w,
+			.stride = w * sizeof(shmif_pixel)
+		};
+
+		if (p == PROFILE_TPACK){
+			tpack_frame(&c, i);
+			vb.buffer_bytes = c.tpack;
+		}
+		else {
+			if (p == PROFILE_DESKTOP)
+				desktop_frame(&c, i);
+			else if (p == PROFILE_SCROLL)
+				scroll_frame(&c, i);
+			else
+				video_frame(&c, i);
+
+			vb.buffer = c.px;
+			if (i && (c.x1 || c.y1 || c.x2 != w || c.y2 != h)){
+				vb.flags.subregion = true;
+				vb.region = (struct arcan_shmif_region){
+					.x1 = c.x1, .y1 = c.y1, .x2 = c.x2, .y2 = c.y2
+				};
+			}
+		}
+
+		double start = timestamp(CLOCK_MONOTONIC);
+		a12_channel_vframe(cl, &vb, (struct a12_vframe_opts){
+			.method = methods[mi].method,
+			.bias = VFRAME_BIAS_LATENCY,
+			.bitrate = mbit
+		});
+		double t_enc = timestamp(CLOCK_MONOTONIC) - start;
+		double t_dec = 0;
+
+		size_t nb = pump(cl, srv, &t_enc, &t_dec);
+
+/* acknowledgements and pings going back are not part of the frame */
+		pump(srv, cl, NULL, NULL);
+		if (a12_poll(cl) == -1 || a12_poll(srv) == -1)
+			break;
+
+		enc += t_enc;
+		dec += t_dec;
+		bytes += nb;
+		latency[i] = t_enc + t_dec;
+		if (mbit > 0)
+			latency[i] += (double) nb * 8.0 / (mbit * 1000.0);
+	}
+
+	cpu = timestamp(CLOCK_PROCESS_CPUTIME_ID) - cpu;
+
+	if (i){
+		qsort(latency, i, sizeof(double), dcmp);
+		printf("%s:%s:%zu:%zu:%zu:%.3f:%.3f:%zu:%.3f:%.3f:%.3f:%.3f\n",
+			profile_names[p], methods[mi].name, w, h, i,
+			enc / i, dec / i, bytes / i,
+			percentile(latency, i, 0.5),
+			percentile(latency, i, 0.95),
+			percentile(latency, i, 0.99),
+			cpu / i
+		);
+		fflush(stdout);
+	}
+
+	a12_set_destination_raw(srv, 0,
+		(struct a12_unpack_cfg){}, sizeof(struct a12_unpack_cfg));
+
+	free(sink.buf);
+	free(latency);
+	content_free(&c);
+
+	return i == n_frames;
+}
+
+static void usage()
+{
+	fprintf(stderr,
+		"use: a12codec [options]\n"
+		"-n frames   frames per test (default 200)\n"
+		"-s WxH      surface size (default 1280x720)\n"
+		"-p profile  only run this profile (desktop, scroll, video, tpack)\n"
+		"-m method   only run this method (normal, rgb, rgb565, dpng, dlz,\n"
+		"            dtile, adaptive, "
+#ifdef WANT_H264_ENC
+		"h264, "
+#endif
+		"tpack), tpack only goes\n"
+		"            with the tpack profile and the other way around\n"
+		"-b mbit     link bandwidth, added to the latency and given to\n"
+		"            the adaptive method as its link estimate\n"
+		"-c          enable the cipher\n"
+	);
+}
+
+int main(int argc, char** argv)
+{
+	size_t n_frames = 200;
+	size_t w = 1280, h = 720;
+	const char* only_profile = NULL;
+	const char* only_method = NULL;
+	float mbit = 0;
+	bool cipher = false;
+	int ch;
+
+	while ((ch = getopt(argc, argv, "n:s:p:m:b:ch")) != -1){
+		switch (ch){
+		case 'n':
+			n_frames = strtoul(optarg, NULL, 10);
+		break;
+		case 's':
+			if (2 != sscanf(optarg, "%zux%zu", &w, &h))
+				w = 0;
+		break;
+		case 'p':
+			only_profile = optarg;
+		break;
+		case 'm':
+			only_method = optarg;
+		break;
+		case 'b':
+			mbit = strtof(optarg, NULL);
+		break;
+		case 'c':
+			cipher = true;
+		break;
+		default:
+			usage();
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (!n_frames || w < 64 || h < 64 || w > 8192 || h > 8192){
+		usage();
+		return EXIT_FAILURE;
+	}
+
+/* h264 is only in the table when built with it, say so rather than run nothing */
+	if (only_method){
+		size_t mi = 0;
+		for (; mi < sizeof(methods) / sizeof(methods[0]); mi++)
+			if (strcmp(only_method, methods[mi].name) == 0)
+				break;
+
+		if (mi == sizeof(methods) / sizeof(methods[0])){
+			fprintf(stderr, "unknown or unsupported method: %s\n", only_method);
+			return EXIT_FAILURE;
+		}
+	}
+
+	arcan_random(clpriv, 32);
+	arcan_random(srvpriv, 32);
+
+	struct a12_context_options cl_opts = {
+		.pk_lookup = key_auth_cl,
+		.disable_cipher = !cipher
+	};
+	struct a12_context_options srv_opts = cl_opts;
+	memcpy(cl_opts.priv_key, clpriv, 32);
+	srv_opts.pk_lookup = key_auth_srv;
+
+	struct a12_state* srv = a12_server(&srv_opts);
+	struct a12_state* cl = a12_client(&cl_opts);
+	if (!srv || !cl || !authenticate(cl, srv)){
+		fprintf(stderr, "couldn't setup the a12 pair\n");
+		return EXIT_FAILURE;
+	}
+
+	for (size_t p = 0; p < PROFILE_COUNT; p++){
+		if (only_profile && strcmp(only_profile, profile_names[p]) != 0)
+			continue;
+
+		for (size_t mi = 0; mi < sizeof(methods) / sizeof(methods[0]); mi++){
+			if (only_method && strcmp(only_method, methods[mi].name) != 0)
+				continue;
+
+/* tpack content can only go as tpack and the other way around */
+			if ((p == PROFILE_TPACK) != (methods[mi].method == VFRAME_METHOD_TPACK))
+				continue;
+
+			if (!run(cl, srv, p, mi, w, h, n_frames, mbit)){
+				fprintf(stderr, "%s:%s failed\n", profile_names[p], methods[mi].name);
+				return EXIT_FAILURE;
+			}
+		}
+	}
+
+	return EXIT_SUCCESS;
+}
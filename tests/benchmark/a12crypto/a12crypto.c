@@ -0,0 +1,149 @@
+/*
+ * Throughput of the a12 crypto path on its own: the chacha stream cipher
+ * (in-place and fused with the copy into the output buffer) and the blake3
+ * MAC, at a few packet sizes that match what the a12 encoders produce.
+ *
+ * Output is one line per test in the format:
+ * test:simd:packet_size:MB/s
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "chacha.c"
+#include "blake3.h"
+
+static const char* simd_names[] = {
+	"unknown",
+	"none",
+	"sse2",
+	"avx2",
+	"neon"
+};
+
+static double timestamp()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double) ts.tv_sec + (double) ts.tv_nsec / 1000000000.0;
+}
+
+static void setup_cipher(struct chacha_ctx* ctx)
+{
+	uint8_t key[32];
+	uint8_t nonce[8];
+	for (size_t i = 0; i < 32; i++)
+		key[i] = i * 7;
+	for (size_t i = 0; i < 8; i++)
+		nonce[i] = i * 13;
+
+	chacha_setup(ctx, key, 32, 0, 8);
+	chacha_set_nonce(ctx, nonce);
+}
+
+enum test_kind {
+	TEST_CIPHER = 0,
+	TEST_CIPHER_COPY,
+	TEST_MAC,
+	TEST_PACKET
+};
+
+static const char* test_names[] = {
+	"chacha",
+	"chacha_copy",
+	"blake3",
+	"packet"
+};
+
+/* packet mirrors serialize_packet, cipher on copy then MAC and sample it */
+static double run_test(enum test_kind kind,
+	uint8_t* src, uint8_t* dst, size_t total, size_t packet_sz)
+{
+	struct chacha_ctx ctx;
+	blake3_hasher mac;
+	uint8_t tag[16];
+
+	setup_cipher(&ctx);
+	blake3_hasher_init(&mac);
+
+	double start = timestamp();
+
+	for (size_t ofs = 0; ofs + packet_sz <= total; ofs += packet_sz){
+		switch (kind){
+		case TEST_CIPHER:
+			chacha_apply(&ctx, &src[ofs], packet_sz);
+		break;
+		case TEST_CIPHER_COPY:
+			chacha_apply_copy(&ctx, &src[ofs], &dst[ofs], packet_sz);
+		break;
+		case TEST_MAC:
+			blake3_hasher_update(&mac, &src[ofs], packet_sz);
+			blake3_hasher_finalize(&mac, tag, sizeof(tag));
+		break;
+		case TEST_PACKET:
+			chacha_apply_copy(&ctx, &src[ofs], &dst[ofs], packet_sz);
+			blake3_hasher_update(&mac, &dst[ofs], packet_sz);
+			blake3_hasher_finalize(&mac, tag, sizeof(tag));
+		break;
+		}
+	}
+
+	double elapsed = timestamp() - start;
+	return elapsed > 0 ? (double) total / elapsed / 1000000.0 : 0;
+}
+
+int main(int argc, char** argv)
+{
+	size_t total = 256;
+	if (argc > 1)
+		total = strtoul(argv[1], NULL, 10);
+
+	if (!total){
+		fprintf(stderr, "use: a12crypto [megabytes per test (default 256)]\n");
+		return EXIT_FAILURE;
+	}
+	total *= 1024 * 1024;
+
+	uint8_t* src = malloc(total);
+	uint8_t* dst = malloc(total);
+	if (!src || !dst){
+		fprintf(stderr, "couldn't allocate test buffers\n");
+		return EXIT_FAILURE;
+	}
+
+	for (size_t i = 0; i < total; i++)
+		src[i] = i * 31;
+	memset(dst, 0, total);
+
+	size_t sizes[] = {128, 1500, 16384, 65536};
+	enum chacha_simd best = chacha_simd();
+
+	for (size_t k = TEST_CIPHER; k <= TEST_PACKET; k++){
+
+/* blake3 picks its own implementation, there is no need to step through the
+ * cipher levels for it */
+		enum chacha_simd first = k == TEST_MAC ? best : CHACHA_SIMD_NONE;
+
+		for (enum chacha_simd level = first; level <= best; level++){
+
+/* the x86 levels sit between none and neon but aren't built on arm */
+			if (best == CHACHA_SIMD_NEON &&
+				level != CHACHA_SIMD_NONE && level != best)
+				continue;
+
+			chacha_simd_level = level;
+
+			for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++){
+				double rate = run_test(k, src, dst, total, sizes[i]);
+				printf("%s:%s:%zu:%.1f\n", test_names[k],
+					k == TEST_MAC ? "auto" : simd_names[level], sizes[i], rate);
+			}
+		}
+	}
+
+	free(src);
+	free(dst);
+	return EXIT_SUCCESS;
+}
@@ -7,12 +7,14 @@
 
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <fcntl.h>
 
 #include <errno.h>
 #include <unistd.h>
 #include <poll.h>
 #include <assert.h>
+#include <math.h>
 
 extern void arcan_random(uint8_t*, size_t);
 #define clsrv_okstate() (a12_poll(cl) != -1 && a12_poll(srv) != -1)
@@ -39,29 +41,6 @@ static struct pk_response key_auth_srv(uint8_t pk[static 32])
 
 extern void arcan_random(uint8_t* buf, size_t buf_sz);
 
-static void data_round_corrupt(
-	struct a12_state* cl, struct a12_state* srv, bool cl_round)
-{
-	uint8_t* buf;
-	struct a12_state* src, (* dst);
-
-	if (cl_round){
-		src = cl;
-		dst = srv;
-	}
-	else {
-		src = srv;
-		dst = cl;
-	}
-
-	size_t out = a12_flush(src, &buf, 0);
-
-	if (out){
-		arcan_random(buf, 8);
-		a12_unpack(dst, buf, out, NULL, NULL);
-	}
-}
-
 static size_t data_round(
 	struct a12_state* cl, struct a12_state* srv, bool cl_round)
 {
@@ -70,15 +49,22 @@ static size_t data_round(
 	if (!clsrv_okstate())
 		return 0;
 
+/* the client (video source) goes through the scatter/gather flush so that
+ * the detached payload path is covered as well as the contiguous one */
 	if (cl_round){
-		src = cl;
-		dst = srv;
-	}
-	else {
-		src = srv;
-		dst = cl;
+		struct iovec iov[16];
+		size_t n_iov = 16;
+		size_t out = a12_flush_iov(cl, iov, &n_iov, 0);
+
+		for (size_t i = 0; i < n_iov; i++)
+			a12_unpack(srv, iov[i].iov_base, iov[i].iov_len, NULL, NULL);
+
+		return out;
 	}
 
+	src = srv;
+	dst = cl;
+
 	size_t out = a12_flush(src, &buf, 0);
 
 	if (out)
@@ -136,6 +122,7 @@ struct video_tag {
 	size_t buf_n_px;
 	size_t w;
 	bool match;
+	bool drop;
 	shmif_pixel* srv_buf;
 };
 
@@ -225,44 +212,410 @@ static bool video_test_raw(struct a12_state* cl, struct a12_state* srv)
 	return tag.match && clsrv_okstate();
 }
 
+/* delta methods need the sink to retain the previous contents */
+static shmif_pixel* video_signal_keep(
+	size_t w, size_t h, size_t* stride, int fl, void* tag)
+{
+	struct video_tag* data = tag;
+	assert(w == data->w);
+	*stride = sizeof(shmif_pixel) * w;
+
+/* no buffer means that the frame gets dropped on the sink side */
+	if (data->drop){
+		data->drop = false;
+		return NULL;
+	}
+
+	if (!data->srv_buf)
+		data->srv_buf = malloc(*stride * h);
+
+	return data->srv_buf;
+}
+
+/* the delta methods share encoder state, so the sink buffer has to survive
+ * between those passes, just like a shmif segment would */
+static shmif_pixel* delta_sink;
+
+static bool video_test_delta(
+	struct a12_state* cl, struct a12_state* srv, int method)
+{
+/* deliberately not a multiple of the tile size */
+	size_t w = 513;
+	size_t h = 257;
+	size_t buf_sz = w * h * sizeof(shmif_pixel);
+	struct video_tag tag =
+	{
+		.buffer = malloc(buf_sz),
+		.buf_n_px = w * h,
+		.w = w,
+		.match = true,
+		.srv_buf = delta_sink
+	};
+	shmif_pixel* first = malloc(buf_sz);
+
+	a12_set_destination_raw(srv, 0,
+		(struct a12_unpack_cfg){
+		.tag = &tag,
+		.signal_video = video_signal_raw,
+		.request_raw_buffer = video_signal_keep,
+		}, sizeof(struct a12_unpack_cfg)
+	);
+
+	arcan_random((uint8_t*)tag.buffer, buf_sz);
+	memcpy(first, tag.buffer, buf_sz);
+
+	for (size_t i = 0; i < 10 && clsrv_okstate(); i++){
+/* change a block that straddles tiles, every third frame go back to the
+ * first one so that the tile cache gets used (dtile) */
+		if (i % 3 == 2)
+			memcpy(tag.buffer, first, buf_sz);
+		else {
+			size_t x = (i * 37) % (w - 100);
+			size_t y = (i * 53) % (h - 100);
+			for (size_t cy = y; cy < y + 100; cy++)
+				arcan_random((uint8_t*)&tag.buffer[cy * w + x], 100 * sizeof(shmif_pixel));
+		}
+
+/* the sink always sets alpha to opaque */
+		for (size_t j = 0; j < w * h; j++)
+			tag.buffer[j] |= SHMIF_RGBA(0, 0, 0, 0xff);
+
+		a12_channel_vframe(cl,
+		&(struct shmifsrv_vbuffer){
+			.buffer = tag.buffer,
+			.w = w,
+			.h = h,
+			.pitch = w,
+			.stride = w * sizeof(shmif_pixel),
+		},
+		(struct a12_vframe_opts){
+			.method = method
+		});
+
+		tag.match = false;
+		FLUSH(cl, srv);
+
+		if (!tag.match)
+			break;
+	}
+
+	free(first);
+	free(tag.buffer);
+	delta_sink = tag.srv_buf;
+	a12_set_destination_raw(srv, 0,
+		(struct a12_unpack_cfg){}, sizeof(struct a12_unpack_cfg));
+
+	return tag.match && clsrv_okstate();
+}
+
+static bool video_test_dtile(struct a12_state* cl, struct a12_state* srv)
+{
+	return video_test_delta(cl, srv, VFRAME_METHOD_DTILE);
+}
+
+static void dtile_region(struct a12_state* cl,
+	struct video_tag* tag, size_t h, size_t x, size_t y, size_t sz)
+{
+	for (size_t cy = y; cy < y + sz; cy++)
+		for (size_t cx = x; cx < x + sz; cx++)
+			tag->buffer[cy * tag->w + cx] ^= SHMIF_RGBA(0xff, 0x7f, 0x3f, 0x00);
+
+	struct shmifsrv_vbuffer vb = {
+		.buffer = tag->buffer,
+		.w = tag->w,
+		.h = h,
+		.pitch = tag->w,
+		.stride = tag->w * sizeof(shmif_pixel),
+		.flags.subregion = true,
+		.region = {
+			.x1 = x, .y1 = y, .x2 = x + sz, .y2 = y + sz
+		}
+	};
+
+	a12_channel_vframe(cl, &vb,
+		(struct a12_vframe_opts){.method = VFRAME_METHOD_DTILE});
+}
+
+/* drop one tile frame on the sink side, the next one only covers a different
+ * part of the surface so the sink only catches up if a refresh was forced */
+static bool video_test_dtile_drop(struct a12_state* cl, struct a12_state* srv)
+{
+	size_t w = 513;
+	size_t h = 257;
+	size_t buf_sz = w * h * sizeof(shmif_pixel);
+	struct video_tag tag =
+	{
+		.buffer = malloc(buf_sz),
+		.buf_n_px = w * h,
+		.w = w,
+		.match = true,
+		.srv_buf = delta_sink
+	};
+
+	a12_set_destination_raw(srv, 0,
+		(struct a12_unpack_cfg){
+		.tag = &tag,
+		.signal_video = video_signal_raw,
+		.request_raw_buffer = video_signal_keep,
+		}, sizeof(struct a12_unpack_cfg)
+	);
+
+	arcan_random((uint8_t*)tag.buffer, buf_sz);
+	for (size_t j = 0; j < w * h; j++)
+		tag.buffer[j] |= SHMIF_RGBA(0, 0, 0, 0xff);
+
+	dtile_region(cl, &tag, h, 0, 0, h);
+	FLUSH(cl, srv);
+
+	tag.drop = true;
+	dtile_region(cl, &tag, h, 10, 10, 40);
+	FLUSH(cl, srv);
+
+	dtile_region(cl, &tag, h, 300, 150, 40);
+	FLUSH(cl, srv);
+
+	bool ok = tag.match && !tag.drop && tag.srv_buf &&
+		memcmp(tag.buffer, tag.srv_buf, buf_sz) == 0;
+
+	free(tag.buffer);
+	delta_sink = tag.srv_buf;
+	a12_set_destination_raw(srv, 0,
+		(struct a12_unpack_cfg){}, sizeof(struct a12_unpack_cfg));
+
+	return ok && clsrv_okstate();
+}
+
+static bool video_test_dpng(struct a12_state* cl, struct a12_state* srv)
+{
+	return video_test_delta(cl, srv, VFRAME_METHOD_DPNG);
+}
+
+static bool video_test_dlz(struct a12_state* cl, struct a12_state* srv)
+{
+	return video_test_delta(cl, srv, VFRAME_METHOD_DLZ);
+}
+
+static bool video_test_adaptive(struct a12_state* cl, struct a12_state* srv)
+{
+	return video_test_delta(cl, srv, VFRAME_METHOD_ADAPTIVE);
+}
+
+struct tpack_tag {
+	uint8_t* buffer;
+	size_t buf_sz;
+	uint8_t* srv_buf;
+	size_t srv_sz;
+	bool match;
+};
+
+static shmif_pixel* tpack_signal_alloc(
+	size_t w, size_t h, size_t* stride, int fl, void* tag)
+{
+	struct tpack_tag* data = tag;
+	*stride = sizeof(shmif_pixel) * w;
+
+	if (!data->srv_buf){
+		data->srv_sz = *stride * h;
+		data->srv_buf = malloc(data->srv_sz);
+	}
+
+	return (shmif_pixel*) data->srv_buf;
+}
+
+static void tpack_signal(size_t x1, size_t y1, size_t x2, size_t y2, void* tag)
+{
+	struct tpack_tag* data = tag;
+	data->match = data->buf_sz <= data->srv_sz &&
+		memcmp(data->buffer, data->srv_buf, data->buf_sz) == 0;
+}
+
+/*
+ * Build a tpack buffer from a grid of 12 byte cells, either all lines or just
+ * the ones marked as dirty - the layout is described in shmif/tui/raster.
+ */
+static size_t tpack_build(uint8_t* out,
+	uint8_t* cells, size_t rows, size_t cols, bool* dirty)
+{
+	size_t pos = 16;
+	uint16_t n_lines = 0;
+	uint16_t n_cells = 0;
+
+	for (size_t row = 0; row < rows; row++){
+		if (dirty && !dirty[row])
+			continue;
+
+		uint8_t line[9] = {row & 0xff, row >> 8, cols & 0xff, cols >> 8};
+		memcpy(&out[pos], line, 9);
+		pos += 9;
+		memcpy(&out[pos], &cells[row * cols * 12], cols * 12);
+		pos += cols * 12;
+		n_lines++;
+		n_cells += cols;
+	}
+
+	uint8_t hdr[16] = {
+		pos & 0xff, (pos >> 8) & 0xff, (pos >> 16) & 0xff, pos >> 24,
+		n_lines & 0xff, n_lines >> 8, n_cells & 0xff, n_cells >> 8,
+		0, dirty ? 2 : 1, 0, 0x10, 0x10, 0x10, 0xff, 0
+	};
+	memcpy(out, hdr, 16);
+
+	return pos;
+}
+
+/* full frame followed by deltas, with a few frames where the styles and
+ * glyphs go outside of what the palette and single byte glyphs cover */
+static bool video_test_tpack(struct a12_state* cl, struct a12_state* srv)
+{
+	size_t rows = 24;
+	size_t cols = 80;
+	uint8_t* cells = malloc(rows * cols * 12);
+	uint8_t* buf = malloc(16 + rows * (9 + cols * 12));
+	bool dirty[24];
+
+	struct tpack_tag tag = {
+		.buffer = buf,
+		.match = true
+	};
+
+	a12_set_destination_raw(srv, 0,
+		(struct a12_unpack_cfg){
+		.tag = &tag,
+		.signal_video = tpack_signal,
+		.request_raw_buffer = tpack_signal_alloc,
+		}, sizeof(struct a12_unpack_cfg)
+	);
+
+	for (size_t i = 0; i < rows * cols; i++){
+		uint8_t cell[12] = {0xff, 0xff, 0xff, 0, 0, 0, 0, 0, 'a' + i % 26, 0, 0, 0};
+		memcpy(&cells[i * 12], cell, 12);
+	}
+
+	for (size_t i = 0; i < 20 && clsrv_okstate(); i++){
+		memset(dirty, '\0', sizeof(dirty));
+
+		if (i){
+			size_t row = (i * 7) % rows;
+			dirty[row] = true;
+			dirty[(row + 1) % rows] = true;
+
+			for (size_t col = 0; col < cols; col++){
+				uint8_t* cell = &cells[(row * cols + col) * 12];
+				cell[8] = 'A' + (i + col) % 26;
+/* every fifth frame gets random colors and code points */
+				if (i % 5 == 0){
+					arcan_random(cell, 6);
+					arcan_random(&cell[8], 3);
+				}
+			}
+		}
+
+		tag.buf_sz = tpack_build(buf, cells, rows, cols, i ? dirty : NULL);
+
+		a12_channel_vframe(cl,
+		&(struct shmifsrv_vbuffer){
+			.buffer_bytes = buf,
+			.w = 640,
+			.h = 384,
+			.pitch = 640,
+			.stride = 640 * sizeof(shmif_pixel)
+		},
+		(struct a12_vframe_opts){
+			.method = VFRAME_METHOD_TPACK
+		});
+
+		tag.match = false;
+		FLUSH(cl, srv);
+
+		if (!tag.match)
+			break;
+	}
+
+	free(cells);
+	free(buf);
+	free(tag.srv_buf);
+	a12_set_destination_raw(srv, 0,
+		(struct a12_unpack_cfg){}, sizeof(struct a12_unpack_cfg));
+
+	return tag.match && clsrv_okstate();
+}
+
 struct audio_tag {
 	shmif_asample* buffer;
 	size_t buf_sz;
 	size_t n_ch;
 	size_t srate;
+
+	int16_t* ref;
+	size_t ref_pos;
+	size_t ref_n;
+	unsigned max_err;
 	bool match;
 };
 
 static void audio_signal_raw(size_t bytes, void* tag)
 {
-//	struct audio_tag* buf = tag;
+	struct audio_tag* at = tag;
+	size_t n = bytes / sizeof(shmif_asample);
+
+	if (at->n_ch != 2 || at->srate != 48000 ||
+		bytes > at->buf_sz || at->ref_pos + n > at->ref_n){
+		at->match = false;
+		return;
+	}
+
+/* compare against what was sent, lossy methods get some slack */
+	for (size_t i = 0; i < n; i++){
+		int diff = abs((int)at->buffer[i] - (int)at->ref[at->ref_pos + i]);
+		if (diff > at->max_err){
+			printf("audio mismatch @%zu: %d <-> %d\n",
+				at->ref_pos + i, (int)at->buffer[i], (int)at->ref[at->ref_pos + i]);
+			at->match = false;
+			return;
+		}
+	}
 
-/* use first n- bytes from the buffer - check that they follow our 'signal' */
+	at->ref_pos += n;
 }
 
 static shmif_asample* audio_buffer_alloc(
 	size_t n_ch, size_t samplerate, size_t bytes, void* tag)
 {
 	struct audio_tag* at = tag;
-	if (!at->buffer)
-		at->buffer = NULL;
+	free(at->buffer);
 
 	at->n_ch = n_ch;
 	at->srate = samplerate;
+	at->buf_sz = bytes;
 	at->buffer = malloc(bytes);
 
 	return at->buffer;
 }
 
-static bool audio_test_raw(struct a12_state* cl, struct a12_state* srv)
+static bool audio_test(struct a12_state* cl,
+	struct a12_state* srv, enum a12_aframe_method method, unsigned max_err)
 {
-/* deliberately !%2 */
+/* deliberately not a multiple of the ADPCM byte packing */
+	size_t n_frames = 1023;
+	size_t rounds = 10;
+	int16_t* ref = malloc(n_frames * 2 * rounds * sizeof(int16_t));
+	if (!ref)
+		return false;
+
 	struct audio_tag tag =
 	{
-		.buffer = NULL,
+		.ref = ref,
+		.ref_n = n_frames * 2 * rounds,
+		.max_err = max_err,
 		.match = true
 	};
 
+/* two tones, one per channel, continuous over the frames */
+	for (size_t i = 0; i < n_frames * rounds; i++){
+		ref[i * 2 + 0] = (int16_t)(8000.0 * sin((double)i * 0.0575));
+		ref[i * 2 + 1] = (int16_t)(12000.0 * sin((double)i * 0.0131));
+	}
+
 	a12_set_destination_raw(srv, 0,
 		(struct a12_unpack_cfg){
 		.tag = &tag,
@@ -271,18 +624,35 @@ static bool audio_test_raw(struct a12_state* cl, struct a12_state* srv)
 		}, sizeof(struct a12_unpack_cfg)
 	);
 
-	for (size_t i = 0; i < 10 &&
-		a12_poll(srv) != -1 && a12_poll(cl) != -1 && tag.match; i++){
-
-	/* send abuffer */
+	for (size_t i = 0; i < rounds && clsrv_okstate() && tag.match; i++){
+		a12_channel_aframe(cl, &ref[i * n_frames * 2], n_frames * 2,
+			(struct a12_aframe_cfg){
+				.channels = 2,
+				.samplerate = 48000
+			},
+			(struct a12_aframe_opts){
+				.method = method
+			}
+		);
 		FLUSH(cl, srv);
 	}
 
 	free(tag.buffer);
+	free(ref);
 	a12_set_destination_raw(srv, 0,
 		(struct a12_unpack_cfg){}, sizeof(struct a12_unpack_cfg));
 
-	return tag.match && (a12_poll(cl) != -1 && a12_poll(srv) != -1);
+	return tag.match && tag.ref_pos == tag.ref_n && clsrv_okstate();
+}
+
+static bool audio_test_raw(struct a12_state* cl, struct a12_state* srv)
+{
+	return audio_test(cl, srv, AFRAME_METHOD_RAW, 0);
+}
+
+static bool audio_test_adpcm(struct a12_state* cl, struct a12_state* srv)
+{
+	return audio_test(cl, srv, AFRAME_METHOD_ADPCM, 1024);
 }
 
 struct test_pass {
@@ -293,9 +663,14 @@ struct test_pass {
 
 /* normally possible with multiples, but not for this test */
 struct blob_md {
-	int got_job;
+	int completed;
+	int cached;
+	int fd;
+	uint8_t checksum[16];
 };
 
+/* first transfer goes to a temporary file that is kept as the 'cache', any
+ * later one with the same checksum should be cancelled and served from it */
 static struct a12_bhandler_res bhandler(
 	struct a12_state* S, struct a12_bhandler_meta md, void* tag)
 {
@@ -307,7 +682,20 @@ static struct a12_bhandler_res bhandler(
 	};
 
 /* status update? */
-	if (bmd->got_job){
+	if (md.state != A12_BHANDLER_INITIALIZE){
+		if (md.state == A12_BHANDLER_COMPLETED)
+			bmd->completed++;
+
+		if (md.fd == -1)
+			return res;
+
+		if (md.state == A12_BHANDLER_COMPLETED && bmd->fd == -1){
+			bmd->fd = md.fd;
+			memcpy(bmd->checksum, md.checksum, 16);
+		}
+		else
+			close(md.fd);
+
 		return res;
 	}
 
@@ -317,17 +705,42 @@ static struct a12_bhandler_res bhandler(
 	if (md.streaming)
 		return res;
 
+	if (bmd->fd != -1 && memcmp(bmd->checksum, md.checksum, 16) == 0){
+		bmd->cached++;
+		res.flag = A12_BHANDLER_CACHED;
+		res.fd = dup(bmd->fd);
+		return res;
+	}
+
+	FILE* tmp = tmpfile();
+	if (!tmp)
+		return res;
+
+	res.fd = dup(fileno(tmp));
+	res.flag = A12_BHANDLER_NEWFD;
+	fclose(tmp);
+
 	a12int_trace(A12_TRACE_BTRANSFER, "new_transfer");
 	return res;
 }
 
+static size_t blob_round(struct a12_state* cl, struct a12_state* srv)
+{
+	uint8_t* buf;
+	size_t out = a12_flush(cl, &buf, A12_FLUSH_ALL);
+	if (out)
+		a12_unpack(srv, buf, out, NULL, NULL);
+	return out;
+}
+
 static bool test_bxfer(struct a12_state* cl, struct a12_state* srv)
 {
-	struct blob_md blob;
+	struct blob_md blob = {.fd = -1};
 
-/* increment each time the test is run up to a cap */
-	static size_t base_sz = 1024;
-	if (base_sz < 10 * 1024)
+/* increment each time the test is run up to a cap, big enough to have the
+ * data held back until the cancellation has had time to arrive */
+	static size_t base_sz = 16 * 1024;
+	if (base_sz < 256 * 1024)
 		base_sz *= 2;
 
 	FILE* fpek = fopen("bxfer.temp", "w+");
@@ -337,22 +750,48 @@ static bool test_bxfer(struct a12_state* cl, struct a12_state* srv)
 	unlink("bxfer.temp");
 
 	char* buf = malloc(base_sz);
-	memset(buf, 'a', base_sz);
+	for (size_t i = 0; i < base_sz; i++)
+		buf[i] = 'a' + (i % 23);
 	fwrite(buf, base_sz, 1, fpek);
+	fflush(fpek);
 
 	int myfd = fileno(fpek);
 
+	a12_set_destination_raw(srv, 0,
+		(struct a12_unpack_cfg){}, sizeof(struct a12_unpack_cfg));
 	a12_set_bhandler(srv, bhandler, &blob);
 
 /* send same file twice, the second time we should be able to just reject */
-	for (size_t i = 0; i < 2 && a12_poll(cl) != -1 && a12_poll(srv) != -1; i++){
+	for (size_t i = 0; i < 2 && clsrv_okstate(); i++){
 		a12_enqueue_bstream(cl, myfd, A12_BTYPE_BLOB, false, base_sz);
-		FLUSH(cl, srv);
+
+		for (size_t tries = 0; tries < 1000 && blob.completed <= i &&
+			clsrv_okstate(); tries++){
+			FLUSH(cl, srv);
+			if (!blob_round(cl, srv))
+				usleep(1000);
+		}
+	}
+
+/* and the contents that was kept should match what was sent */
+	bool ok = blob.completed == 2 && blob.cached == 1 && blob.fd != -1;
+	if (ok){
+		char* cmp = malloc(base_sz);
+		ok = pread(blob.fd, cmp, base_sz, 0) == (ssize_t) base_sz &&
+			memcmp(cmp, buf, base_sz) == 0;
+		free(cmp);
 	}
 
+	if (blob.fd != -1)
+		close(blob.fd);
+
 	fclose(fpek);
+	free(buf);
 	a12_set_bhandler(srv, NULL, NULL);
-	return true;
+	a12_set_destination_raw(srv, 0,
+		(struct a12_unpack_cfg){}, sizeof(struct a12_unpack_cfg));
+
+	return ok && clsrv_okstate();
 }
 
 static bool buffer_sink(uint8_t* buf, size_t nb, void* tag)
@@ -378,6 +817,9 @@ int main(int argc, char** argv)
 	memcpy(cl_opts.priv_key, clpriv, 32);
 	srv_opts.pk_lookup = key_auth_srv;
 
+/* the binary transfer test caches on the server side */
+	srv_opts.blob_cache = true;
+
 /* parse arguments from cmdline, ... */
 	a12_set_trace_level(
 		A12_TRACE_CRYPTO |
@@ -418,21 +860,43 @@ int main(int argc, char** argv)
 		.pass = video_test_raw,
 		.name = "Video(Raw)",
 	},
+	{
+		.pass = video_test_dtile,
+		.name = "Video(DTile)",
+	},
+	{
+		.pass = video_test_dtile_drop,
+		.name = "Video(DTile drop)",
+	},
+	{
+		.pass = video_test_dpng,
+		.name = "Video(DPNG)",
+	},
+	{
+		.pass = video_test_dlz,
+		.name = "Video(DLZ)",
+	},
+	{
+		.pass = video_test_adaptive,
+		.name = "Video(Adaptive)",
+	},
+	{
+		.pass = video_test_tpack,
+		.name = "Video(TPACK)",
+	},
 	{
 		.pass = audio_test_raw,
 		.name = "Audio(Raw)",
-		.ignore = true
+	},
+	{
+		.pass = audio_test_adpcm,
+		.name = "Audio(ADPCM)",
 	},
 	{
 		.pass = test_bxfer,
 		.name = "Binary",
-		.ignore = true
 	}
 /* checklist:
- * - working audio
- * - working bchunk
- *   - bchunk-handler stream-cancel (caching)
- *
  * - working 1-round x25519
  * - working 2-round x25519
  *
@@ -0,0 +1,284 @@
+/*
+ * Runs two sessions through the single-threaded multiplexer (a12_helper_mux)
+ * against an in-process shmif server. The consumer of the first session
+ * never releases its video buffer and stops reading events while its client
+ * sends more than the event queue holds, the second session should still get
+ * all of its frames through as the mux thread isn't allowed to wait on any
+ * one consumer.
+ */
+#include <arcan_shmif.h>
+#include <arcan_shmif_server.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+
+#include "a12.h"
+#include "a12_helper.h"
+
+#define N_FRAMES 8
+
+/* more than both the shmif event queue and what the mux holds back before it
+ * stops reading the socket */
+#define N_EVENTS 400
+
+extern void arcan_random(uint8_t* dst, size_t ntc);
+
+static uint8_t clpriv[32];
+static uint8_t srvpriv[32];
+
+static struct pk_response key_auth_cl(uint8_t pk[static 32])
+{
+	struct pk_response auth = {
+		.authentic = true
+	};
+	memcpy(auth.key, clpriv, 32);
+	return auth;
+}
+
+static struct pk_response key_auth_srv(uint8_t pk[static 32])
+{
+	struct pk_response auth = {
+		.authentic = true
+	};
+	memcpy(auth.key, srvpriv, 32);
+	return auth;
+}
+
+struct session {
+	struct a12_state* S;
+	int fd;
+	struct shmifsrv_client* cl;
+
+/* never step the video buffer */
+	bool stall;
+	bool held;
+	size_t frames;
+	size_t sent;
+
+/* never dequeue events */
+	bool stall_events;
+	bool reordered;
+	size_t events;
+};
+
+static void session_flood(struct session* s, size_t n)
+{
+	a12_set_channel(s->S, 0);
+	for (size_t i = 0; i < n; i++){
+		struct arcan_event ev = {
+			.category = EVENT_EXTERNAL,
+			.ext.kind = EVENT_EXTERNAL_MESSAGE
+		};
+		snprintf((char*)ev.ext.message.data,
+			sizeof(ev.ext.message.data), "%zu", i);
+		a12_channel_enqueue(s->S, &ev);
+	}
+}
+
+/* one round of moving data between the client state, the mux socket and the
+ * consumer side of the segment, with a new frame whenever there are fewer
+ * than two in flight */
+static bool session_step(struct session* s)
+{
+	static shmif_pixel buf[64 * 64];
+
+	if (a12_auth_state(s->S) > 0 && s->sent - s->frames < 2){
+		memset(buf, s->sent & 0xff, sizeof(buf));
+		a12_set_channel(s->S, 0);
+		a12_channel_vframe(s->S,
+		&(struct shmifsrv_vbuffer){
+			.buffer = buf,
+			.w = 64,
+			.h = 64,
+			.pitch = 64,
+			.stride = 64 * sizeof(shmif_pixel),
+		},
+		(struct a12_vframe_opts){
+		});
+		s->sent++;
+	}
+
+	uint8_t* out;
+	size_t n;
+	while ((n = a12_flush(s->S, &out, A12_FLUSH_ALL))){
+		while (n){
+			ssize_t nw = write(s->fd, out, n);
+			if (-1 == nw && errno != EINTR && errno != EAGAIN)
+				return false;
+			if (nw > 0){
+				out += nw;
+				n -= nw;
+			}
+		}
+	}
+
+	uint8_t inbuf[9000];
+	ssize_t nr;
+	while ((nr = recv(s->fd, inbuf, sizeof(inbuf), MSG_DONTWAIT)) > 0)
+		a12_unpack(s->S, inbuf, nr, NULL, NULL);
+
+	if (!s->cl)
+		return a12_poll(s->S) != -1;
+
+/* a stalled buffer stays ready, only count it once */
+	int sv = shmifsrv_poll(s->cl);
+	if (sv == CLIENT_DEAD)
+		return false;
+
+	if ((sv & CLIENT_VBUFFER_READY) && !s->held){
+		s->frames++;
+		if (s->stall)
+			s->held = true;
+		else
+			shmifsrv_video_step(s->cl);
+	}
+
+	struct arcan_event ev;
+	while (!s->stall_events && 1 == shmifsrv_dequeue_events(s->cl, &ev, 1)){
+		if (ev.category == EVENT_EXTERNAL && ev.ext.kind == EVENT_EXTERNAL_MESSAGE){
+			if (strtoul((char*)ev.ext.message.data, NULL, 10) != s->events)
+				s->reordered = true;
+			s->events++;
+		}
+	}
+
+	return a12_poll(s->S) != -1;
+}
+
+/* keep sending until the consumer has seen [frames] of them, stepping the
+ * [other] session along with it */
+static bool session_run(struct session* s, size_t frames, struct session* other)
+{
+	s->cl = shmifsrv_allocate_connpoint("a12mux", NULL, S_IRWXU, -1);
+	if (!s->cl){
+		fprintf(stderr, "couldn't allocate connection point\n");
+		return false;
+	}
+
+	for (size_t i = 0; i < 1000 && s->frames < frames; i++){
+		if (!session_step(s) || (other && !session_step(other)))
+			return false;
+
+		struct pollfd pfd = {
+			.fd = s->fd,
+			.events = POLLIN
+		};
+		poll(&pfd, 1, 10);
+	}
+
+	return s->frames >= frames;
+}
+
+static bool session_open(struct a12helper_mux* mux,
+	struct session* s, struct a12_context_options* cl_opts,
+	struct a12_context_options* srv_opts)
+{
+	int sv[2];
+	if (-1 == socketpair(AF_UNIX, SOCK_STREAM, 0, sv))
+		return false;
+
+	*s = (struct session){
+		.S = a12_client(cl_opts),
+		.fd = sv[1]
+	};
+
+	struct arcan_shmif_cont fake = {};
+	a12_set_destination(s->S, &fake, 0);
+
+	return a12helper_mux_add(mux, a12_server(srv_opts), sv[0]);
+}
+
+int main(int argc, char** argv)
+{
+	char tmpl[] = "/tmp/a12mux_XXXXXX";
+	if (!mkdtemp(tmpl)){
+		fprintf(stderr, "couldn't create runtime directory\n");
+		return EXIT_FAILURE;
+	}
+	setenv("XDG_RUNTIME_DIR", tmpl, 1);
+
+	arcan_random(clpriv, 32);
+	arcan_random(srvpriv, 32);
+
+	struct a12_context_options cl_opts = {
+		.pk_lookup = key_auth_cl,
+		.disable_cipher = true
+	};
+	struct a12_context_options srv_opts = cl_opts;
+	memcpy(cl_opts.priv_key, clpriv, 32);
+	srv_opts.pk_lookup = key_auth_srv;
+
+	a12_set_trace_level(A12_TRACE_SYSTEM, stderr);
+
+	struct a12helper_mux* mux =
+		a12helper_mux_create("a12mux", (struct a12helper_mux_opts){});
+	if (!mux){
+		fprintf(stderr, "couldn't create mux\n");
+		return EXIT_FAILURE;
+	}
+
+	struct session slow, fast;
+	if (!session_open(mux, &slow, &cl_opts, &srv_opts)){
+		fprintf(stderr, "couldn't add session\n");
+		return EXIT_FAILURE;
+	}
+	slow.stall = true;
+
+	printf("stalled consumer: ");
+	if (!session_run(&slow, 1, NULL)){
+		printf(" fail\n");
+		return EXIT_FAILURE;
+	}
+	printf(" ok\n");
+
+/* and its event queue fills up, that shouldn't hold up the mux either */
+	slow.stall_events = true;
+	session_flood(&slow, N_EVENTS);
+
+/* the slow session has frames in flight while the fast one runs */
+	if (!session_open(mux, &fast, &cl_opts, &srv_opts)){
+		fprintf(stderr, "couldn't add session\n");
+		return EXIT_FAILURE;
+	}
+
+	printf("second session: ");
+	if (!session_run(&fast, N_FRAMES, &slow)){
+		printf(" fail (%zu of %d frames)\n", fast.frames, N_FRAMES);
+		return EXIT_FAILURE;
+	}
+	printf(" ok\n");
+
+/* and once the consumer catches up, the held back frame should arrive */
+	printf("deferred frame: ");
+	slow.stall = slow.held = false;
+	shmifsrv_video_step(slow.cl);
+	for (size_t i = 0; i < 100 && slow.frames < 2; i++){
+		session_step(&slow);
+		usleep(10000);
+	}
+
+	if (slow.frames < 2){
+		printf(" fail\n");
+		return EXIT_FAILURE;
+	}
+	printf(" ok\n");
+
+/* as should all the events that were held back, in order */
+	printf("deferred events: ");
+	slow.stall_events = false;
+	for (size_t i = 0; i < 500 && slow.events < N_EVENTS; i++){
+		session_step(&slow);
+		usleep(10000);
+	}
+
+	if (slow.events != N_EVENTS || slow.reordered){
+		printf(" fail (%zu of %d events%s)\n",
+			slow.events, N_EVENTS, slow.reordered ? ", out of order" : "");
+		return EXIT_FAILURE;
+	}
+	printf(" ok\n");
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,187 @@
+/*
+ * Save / load round-trips of tsm screens, including the scrollback
+ */
+#include <arcan_shmif.h>
+#include <arcan_tui.h>
+#include "libtsm.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#define COLS 80
+#define ROWS 8
+#define LINES 60
+
+/* U+4E00, two cells wide */
+#define WIDE 0x4e00
+
+static struct tsm_screen* screen_new(unsigned w, unsigned h)
+{
+	struct tsm_screen* con;
+	if (0 != tsm_screen_new(&con, NULL, NULL))
+		return NULL;
+
+	tsm_screen_set_max_sb(con, 1000);
+	tsm_screen_resize(con, w, h);
+	return con;
+}
+
+/* every line gets a tag to search for, a wide glyph in the middle and in the
+ * last column, and one where a half-width screen ends */
+static void fill(struct tsm_screen* con)
+{
+	for (size_t i = 0; i < LINES; i++){
+		char line[16];
+		snprintf(line, sizeof(line), "<%zu>", i);
+		tsm_screen_write_ascii(con, (uint8_t*) line, strlen(line), NULL);
+
+		unsigned cols[] = {COLS / 4, COLS / 2 - 1, COLS - 1};
+		for (size_t j = 0; j < sizeof(cols) / sizeof(cols[0]); j++){
+			tsm_screen_move_to(con, cols[j], tsm_screen_get_cursor_y(con));
+			tsm_screen_write(con, WIDE, NULL);
+		}
+		tsm_screen_newline(con);
+	}
+}
+
+static bool find_line(struct tsm_screen* con, size_t i)
+{
+	char line[16];
+	uint32_t needle[16];
+	size_t n = snprintf(line, sizeof(line), "<%zu>", i);
+	for (size_t j = 0; j < n; j++)
+		needle[j] = line[j];
+
+	tsm_screen_sb_reset(con);
+	if (0 != tsm_screen_sb_search(con, needle, n, false, false, NULL)){
+		printf("line %zu not in the scrollback\n", i);
+		return false;
+	}
+
+	return true;
+}
+
+static bool same_block(uint8_t* a, size_t a_sz, uint8_t* b, size_t b_sz)
+{
+	return a_sz == b_sz && (!a_sz || memcmp(a, b, a_sz) == 0);
+}
+
+static bool test_wide_sb(void)
+{
+	struct tsm_screen* src = screen_new(COLS, ROWS);
+	struct tsm_screen* dst = screen_new(COLS, ROWS);
+	struct tsm_save_buf* out, (* again);
+	if (!src || !dst)
+		return false;
+
+	fill(src);
+	if (!tsm_screen_save(src, true, &out))
+		return false;
+
+	if (!tsm_screen_load(dst, out, 0, 0, 0))
+		return false;
+
+	if (!tsm_screen_save(dst, true, &again))
+		return false;
+
+/* the records are taken as they are, so saving the restored screen should
+ * give the same scrollback back (the screen cells get new ages) */
+	bool rv = same_block(out->scrollback,
+		out->scrollback_sz, again->scrollback, again->scrollback_sz);
+
+	if (!rv)
+		printf("scrollback %zu -> %zu bytes\n",
+			out->scrollback_sz, again->scrollback_sz);
+
+	tsm_screen_unref(src);
+	tsm_screen_unref(dst);
+	return rv;
+}
+
+/* restoring into a screen half as wide cuts every line through a wide glyph,
+ * none of the lines should be lost for it */
+static bool test_wide_sb_cut(void)
+{
+	struct tsm_screen* src = screen_new(COLS, ROWS);
+	struct tsm_screen* dst = screen_new(COLS / 2, ROWS);
+	struct tsm_save_buf* out;
+	if (!src || !dst)
+		return false;
+
+	fill(src);
+	if (!tsm_screen_save(src, true, &out) ||
+		!tsm_screen_load(dst, out, 0, 0, 0))
+		return false;
+
+	bool rv = find_line(dst, LINES - ROWS) && find_line(dst, 0);
+
+	tsm_screen_unref(src);
+	tsm_screen_unref(dst);
+	return rv;
+}
+
+static bool test_wrap_cursor(void)
+{
+	struct tsm_screen* src = screen_new(COLS, ROWS);
+	struct tsm_screen* dst = screen_new(COLS, ROWS);
+	struct tsm_save_buf* out;
+	if (!src || !dst)
+		return false;
+
+	tsm_screen_set_flags(src, TSM_SCREEN_AUTO_WRAP);
+	tsm_screen_set_flags(dst, TSM_SCREEN_AUTO_WRAP);
+
+	for (size_t i = 0; i < COLS; i++)
+		tsm_screen_write(src, 'a', NULL);
+
+	if (!tsm_screen_save(src, false, &out) ||
+		!tsm_screen_load(dst, out, 0, 0, 0))
+		return false;
+
+/* the next write should go to the start of the next row in both */
+	tsm_screen_write(src, 'b', NULL);
+	tsm_screen_write(dst, 'b', NULL);
+
+	bool rv =
+		tsm_screen_get_cursor_x(src) == tsm_screen_get_cursor_x(dst) &&
+		tsm_screen_get_cursor_y(src) == tsm_screen_get_cursor_y(dst);
+
+	if (!rv)
+		printf("cursor %u,%u -> %u,%u\n",
+			tsm_screen_get_cursor_x(src), tsm_screen_get_cursor_y(src),
+			tsm_screen_get_cursor_x(dst), tsm_screen_get_cursor_y(dst));
+
+	tsm_screen_unref(src);
+	tsm_screen_unref(dst);
+	return rv;
+}
+
+int main(int argc, char** argv)
+{
+	struct {
+		bool (*pass)(void);
+		const char* name;
+	} passes[] = {
+		{
+			.pass = test_wide_sb,
+			.name = "Scrollback(wide)"
+		},
+		{
+			.pass = test_wide_sb_cut,
+			.name = "Scrollback(wide, cut)"
+		},
+		{
+			.pass = test_wrap_cursor,
+			.name = "Cursor(wrap)"
+		}
+	};
+
+	for (size_t i = 0; i < sizeof(passes) / sizeof(passes[0]); i++){
+		bool pass = passes[i].pass();
+		printf("[%zu] %s - %s\n", i, passes[i].name, pass ? "ok" : "fail");
+		if (!pass)
+			return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}